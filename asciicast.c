@@ -0,0 +1,351 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asciicast.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static size_t escape_byte(uint8_t c, char *out)
+{
+	switch (c) {
+	case '"':
+	case '\\':
+		out[0] = '\\';
+		out[1] = (char)c;
+		return 2;
+	case '\n':
+		memcpy(out, "\\n", 2);
+		return 2;
+	case '\r':
+		memcpy(out, "\\r", 2);
+		return 2;
+	case '\t':
+		memcpy(out, "\\t", 2);
+		return 2;
+	default:
+		break;
+	}
+
+	memcpy(out, "\\u00", 4);
+	out[4] = hex_digits[c >> 4];
+	out[5] = hex_digits[c & 0xf];
+	return 6;
+}
+
+static bool is_plain(uint8_t c)
+{
+	return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+}
+
+/* Length of the UTF-8 sequence at buf if it's valid, 0 if the end of buf
+ * cuts it short, or -1 */
+static int utf8_seq_len(const uint8_t *buf, size_t len)
+{
+	uint8_t lo = 0x80;
+	uint8_t hi = 0xbf;
+	uint8_t c = buf[0];
+	size_t n;
+
+	if (c >= 0xc2 && c <= 0xdf) {
+		n = 2;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		n = 3;
+		/* no overlong forms, no surrogates */
+		lo = c == 0xe0 ? 0xa0 : lo;
+		hi = c == 0xed ? 0x9f : hi;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		n = 4;
+		/* no overlong forms, nothing past U+10FFFF */
+		lo = c == 0xf0 ? 0x90 : lo;
+		hi = c == 0xf4 ? 0x8f : hi;
+	} else {
+		return -1;
+	}
+
+	for (size_t i = 1; i < n; i++) {
+		if (i >= len) {
+			return 0;
+		}
+		if (buf[i] < lo || buf[i] > hi) {
+			return -1;
+		}
+		lo = 0x80;
+		hi = 0xbf;
+	}
+
+	return (int)n;
+}
+
+size_t asciicast_escape(struct asciicast_enc *enc, const uint8_t *buf,
+			size_t len, char *out)
+{
+	size_t o = 0;
+	size_t i = 0;
+	int n;
+
+	/* Finish off a sequence started by the last call */
+	while (enc->partial_len && i < len) {
+		enc->partial[enc->partial_len++] = buf[i++];
+		n = utf8_seq_len(enc->partial, enc->partial_len);
+		if (n > 0) {
+			memcpy(out + o, enc->partial, (size_t)n);
+			o += (size_t)n;
+			enc->partial_len = 0;
+		} else if (n < 0) {
+			/* What was held is raw, and the byte that broke the
+			 * sequence is looked at afresh */
+			for (size_t j = 0; j < enc->partial_len - 1; j++) {
+				o += escape_byte(enc->partial[j], out + o);
+			}
+			enc->partial_len = 0;
+			i--;
+		}
+	}
+
+	while (i < len) {
+		uint8_t c = buf[i];
+
+		if (is_plain(c)) {
+			size_t start = i;
+
+			while (i < len && is_plain(buf[i])) {
+				i++;
+			}
+			memcpy(out + o, buf + start, i - start);
+			o += i - start;
+			continue;
+		}
+
+		if (c < 0x80) {
+			o += escape_byte(c, out + o);
+			i++;
+			continue;
+		}
+
+		n = utf8_seq_len(buf + i, len - i);
+		if (n > 0) {
+			memcpy(out + o, buf + i, (size_t)n);
+			o += (size_t)n;
+			i += (size_t)n;
+		} else if (n == 0) {
+			enc->partial_len = len - i;
+			memcpy(enc->partial, buf + i, enc->partial_len);
+			i = len;
+		} else {
+			o += escape_byte(c, out + o);
+			i++;
+		}
+	}
+
+	return o;
+}
+
+size_t asciicast_escape_flush(struct asciicast_enc *enc, char *out)
+{
+	size_t o = 0;
+
+	for (size_t i = 0; i < enc->partial_len; i++) {
+		o += escape_byte(enc->partial[i], out + o);
+	}
+	enc->partial_len = 0;
+
+	return o;
+}
+
+static const char *skip_space(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+		p++;
+	}
+	return p;
+}
+
+static int parse_hex4(const char *p, uint32_t *val)
+{
+	*val = 0;
+	for (int i = 0; i < 4; i++) {
+		const char *d = strchr(hex_digits, p[i] | 0x20);
+
+		if (!p[i] || !d) {
+			return -1;
+		}
+		*val = *val << 4 | (uint32_t)(d - hex_digits);
+	}
+	return 0;
+}
+
+static size_t utf8_encode(uint32_t cp, uint8_t *out)
+{
+	if (cp < 0x80) {
+		out[0] = (uint8_t)cp;
+		return 1;
+	}
+	if (cp < 0x800) {
+		out[0] = (uint8_t)(0xc0 | cp >> 6);
+		out[1] = (uint8_t)(0x80 | (cp & 0x3f));
+		return 2;
+	}
+	if (cp < 0x10000) {
+		out[0] = (uint8_t)(0xe0 | cp >> 12);
+		out[1] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+		out[2] = (uint8_t)(0x80 | (cp & 0x3f));
+		return 3;
+	}
+	out[0] = (uint8_t)(0xf0 | cp >> 18);
+	out[1] = (uint8_t)(0x80 | ((cp >> 12) & 0x3f));
+	out[2] = (uint8_t)(0x80 | ((cp >> 6) & 0x3f));
+	out[3] = (uint8_t)(0x80 | (cp & 0x3f));
+	return 4;
+}
+
+/* Decode the JSON string starting after its opening quote */
+static const char *parse_string(const char *p, uint8_t *out, size_t *out_len)
+{
+	size_t o = 0;
+	uint32_t cp;
+	uint32_t lo;
+
+	while (*p != '"') {
+		if (!*p) {
+			return NULL;
+		}
+
+		if (*p != '\\') {
+			out[o++] = (uint8_t)*p++;
+			continue;
+		}
+
+		p++;
+		switch (*p++) {
+		case '"':
+			out[o++] = '"';
+			continue;
+		case '\\':
+			out[o++] = '\\';
+			continue;
+		case '/':
+			out[o++] = '/';
+			continue;
+		case 'b':
+			out[o++] = '\b';
+			continue;
+		case 'f':
+			out[o++] = '\f';
+			continue;
+		case 'n':
+			out[o++] = '\n';
+			continue;
+		case 'r':
+			out[o++] = '\r';
+			continue;
+		case 't':
+			out[o++] = '\t';
+			continue;
+		case 'u':
+			break;
+		default:
+			return NULL;
+		}
+
+		if (parse_hex4(p, &cp)) {
+			return NULL;
+		}
+		p += 4;
+
+		if (cp >= 0xd800 && cp <= 0xdbff && p[0] == '\\' &&
+		    p[1] == 'u' && !parse_hex4(p + 2, &lo) && lo >= 0xdc00 &&
+		    lo <= 0xdfff) {
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+			p += 6;
+		}
+
+		/* A byte that wasn't UTF-8 when it was recorded */
+		if (cp >= 0x80 && cp <= 0xff) {
+			out[o++] = (uint8_t)cp;
+			continue;
+		}
+
+		o += utf8_encode(cp, out + o);
+	}
+
+	*out_len = o;
+	return p + 1;
+}
+
+int asciicast_parse_event(const char *line, double *time, uint8_t *out,
+			  size_t *out_len)
+{
+	const char *p = skip_space(line);
+	char *end;
+	size_t len;
+
+	/* The header, and blank lines */
+	if (*p == '{' || !*p) {
+		return 1;
+	}
+
+	if (*p != '[') {
+		return -1;
+	}
+
+	*time = strtod(p + 1, &end);
+	if (end == p + 1 || *time < 0) {
+		return -1;
+	}
+
+	p = skip_space(end);
+	if (*p++ != ',') {
+		return -1;
+	}
+
+	p = skip_space(p);
+	if (*p++ != '"') {
+		return -1;
+	}
+
+	/* Input, resize and marker events aren't replayed */
+	if (p[0] != 'o' || p[1] != '"') {
+		return strchr(p, '"') ? 1 : -1;
+	}
+
+	p = skip_space(p + 2);
+	if (*p++ != ',') {
+		return -1;
+	}
+
+	p = skip_space(p);
+	if (*p++ != '"') {
+		return -1;
+	}
+
+	p = parse_string(p, out, &len);
+	if (!p) {
+		return -1;
+	}
+
+	p = skip_space(p);
+	if (*p != ']') {
+		return -1;
+	}
+
+	*out_len = len;
+	return 0;
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * asciicast v2 (https://docs.asciinema.org/manual/asciicast/v2/): a JSON
+ * header line, then one JSON array per line for each output event,
+ * [seconds, "o", "data"].
+ *
+ * JSON strings hold text, and console output needn't be UTF-8. Bytes that
+ * aren't part of a valid UTF-8 sequence are written as \u0080 to \u00ff,
+ * which a valid sequence never is, so asciicast_parse_event() can restore
+ * them. Other players show them as Latin-1.
+ */
+
+/* A UTF-8 sequence split between calls is held back for the next one */
+struct asciicast_enc {
+	uint8_t partial[4];
+	size_t partial_len;
+};
+
+/* Room needed in out to escape len bytes */
+#define ASCIICAST_ESCAPED_MAX(len) (((len) + 4) * 6)
+
+size_t asciicast_escape(struct asciicast_enc *enc, const uint8_t *buf,
+			size_t len, char *out);
+/* Escape what's held back, when no more data follows */
+size_t asciicast_escape_flush(struct asciicast_enc *enc, char *out);
+
+/* Returns 0 for an output event, decoded into out (which needs as much room
+ * as line is long), 1 for a line to skip, such as the header, or -1 if the
+ * line isn't valid */
+int asciicast_parse_event(const char *line, double *time, uint8_t *out,
+			  size_t *out_len);
@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -130,6 +131,20 @@ const char *config_get_section_value(struct config *config, const char *secname,
 	return iniparser_getstring(config->dict, buf, NULL);
 }
 
+/* Look up a key in the console's section, falling back to the global value */
+const char *config_get_console_value(struct config *config,
+				     const char *console_id, const char *name)
+{
+	const char *value;
+
+	value = config_get_section_value(config, console_id, name);
+	if (value) {
+		return value;
+	}
+
+	return config_get_value(config, name);
+}
+
 void config_fini(struct config *config)
 {
 	if (!config) {
@@ -286,6 +301,65 @@ int config_parse_bytesize(const char *size_str, size_t *size)
 	return 0;
 }
 
+int config_parse_ulong(const char *str, unsigned long *val)
+{
+	unsigned long parsed;
+	char *endp;
+
+	if (!str) {
+		return -1;
+	}
+
+	errno = 0;
+	parsed = strtoul(str, &endp, 0);
+	if (endp == str || errno == ERANGE) {
+		return -1;
+	}
+
+	/* Reject negative values, which strtoul() silently wraps */
+	while (isspace(*str)) {
+		str++;
+	}
+	if (*str == '-') {
+		return -1;
+	}
+
+	while (*endp && isspace(*endp)) {
+		endp++;
+	}
+
+	if (*endp) {
+		return -1;
+	}
+
+	*val = parsed;
+	return 0;
+}
+
+int config_parse_bool(const char *str, bool *val)
+{
+	static const char *const truthy[] = { "1", "true", "yes", "on" };
+	static const char *const falsy[] = { "0", "false", "no", "off" };
+
+	if (!str) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(truthy); i++) {
+		if (!strcasecmp(str, truthy[i])) {
+			*val = true;
+			return 0;
+		}
+
+		if (!strcasecmp(str, falsy[i])) {
+			*val = false;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
 /* Default console id if not specified on command line or in config */
 #define DEFAULT_CONSOLE_ID "default"
 
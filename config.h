@@ -17,6 +17,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <termios.h>
@@ -26,6 +27,8 @@ struct config;
 const char *config_get_section_value(struct config *config, const char *secname,
 				     const char *name);
 const char *config_get_value(struct config *config, const char *name);
+const char *config_get_console_value(struct config *config,
+				     const char *console_id, const char *name);
 struct config *config_init(const char *filename);
 const char *config_resolve_console_id(struct config *config,
 				      const char *id_arg);
@@ -35,6 +38,8 @@ int config_parse_baud(speed_t *speed, const char *baud_string);
 uint32_t parse_baud_to_int(speed_t speed);
 speed_t parse_int_to_baud(uint32_t baud);
 int config_parse_bytesize(const char *size_str, size_t *size);
+int config_parse_ulong(const char *str, unsigned long *val);
+int config_parse_bool(const char *str, bool *val);
 
 int config_count_sections(struct config *config);
 const char *config_get_section_name(struct config *config, int i);
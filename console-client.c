@@ -16,42 +16,87 @@
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/un.h>
 
 #include "console-server.h"
+#include "asciicast.h"
 #include "config.h"
+#include "escape.h"
 
-#define EXIT_ESCAPE 2
+#define EXIT_ESCAPE	 2
+#define EXIT_TIMEOUT 3
 
 enum process_rc {
 	PROCESS_OK = 0,
 	PROCESS_ERR,
 	PROCESS_EXIT,
 	PROCESS_ESC,
+	/* batch mode saw what it was waiting for, or ran out of time */
+	PROCESS_MATCH,
+	PROCESS_TIMEOUT,
 };
 
 enum esc_type {
 	ESC_TYPE_SSH,
 	ESC_TYPE_STR,
+	/* input isn't from a terminal, and no escape was asked for */
+	ESC_TYPE_NONE,
 };
 
-struct ssh_esc_state {
-	uint8_t state;
+/*
+ * Relays data from one fd to another with splice(), so that it never
+ * crosses into user space. splice() needs a pipe at one end, so the data
+ * goes through one in the middle.
+ */
+struct client_relay {
+	int pipe[2];
+	bool enabled;
+};
+
+enum relay_rc {
+	RELAY_OK,
+	RELAY_EOF,
+	RELAY_ERR,
+	/* nothing was moved, and the source can't be spliced from */
+	RELAY_UNSUPPORTED,
 };
 
-struct str_esc_state {
-	const uint8_t *str;
-	size_t pos;
+#define CLIENT_RELAY_CHUNK (64 * 1024)
+
+/*
+ * Batch mode captures console output without a terminal: nothing is read
+ * from stdin, and the terminal is left as it is.
+ */
+struct client_batch {
+	bool enabled;
+	/* read the server's buffered output, rather than live output */
+	bool dump;
+	const char *out_path;
+	/* stop once this appears in the output */
+	bool wait;
+	struct str_esc_state pattern;
+	/* stop after this long, or -1 */
+	int timeout_ms;
+	struct timespec deadline;
+	/* play a recording rather than connect, at speed times real time,
+	 * from skip seconds in */
+	const char *replay_path;
+	double speed;
+	double skip;
 };
 
 struct console_client {
@@ -59,81 +104,163 @@ struct console_client {
 	int fd_in;
 	int fd_out;
 	bool is_tty;
+	struct client_relay relay_in;
+	struct client_relay relay_out;
 	struct termios orig_termios;
 	enum esc_type esc_type;
 	union {
 		struct ssh_esc_state ssh;
 		struct str_esc_state str;
 	} esc_state;
+	struct client_batch batch;
 };
 
+/* Write out what's left of a read, as one write */
+static enum process_rc write_tty_data(struct console_client *client,
+				      const uint8_t *buf, size_t len)
+{
+	if (!len) {
+		return PROCESS_OK;
+	}
+
+	return write_buf_to_fd(client->console_sd, buf, len) < 0 ? PROCESS_ERR :
+								    PROCESS_OK;
+}
+
+/* The ssh-style escape is "\r~.", see ssh_esc_scan() */
 static enum process_rc process_ssh_tty(struct console_client *client,
-				       const uint8_t *buf, size_t len)
+				       uint8_t *buf, size_t len)
 {
-	struct ssh_esc_state *esc_state = &client->esc_state.ssh;
-	const uint8_t *out_buf = buf;
-	int rc;
+	bool escaped;
 
-	for (size_t i = 0; i < len; ++i) {
-		switch (buf[i]) {
-		case '.':
-			if (esc_state->state != '~') {
-				esc_state->state = '\0';
-				break;
-			}
-			return PROCESS_ESC;
-		case '~':
-			if (esc_state->state != '\r') {
-				esc_state->state = '\0';
-				break;
-			}
-			esc_state->state = '~';
-			/* We need to print everything to skip the tilde */
-			rc = write_buf_to_fd(client->console_sd, out_buf,
-					     i - (out_buf - buf));
-			if (rc < 0) {
-				return PROCESS_ERR;
-			}
-			out_buf = &buf[i + 1];
-			break;
-		case '\r':
-			esc_state->state = '\r';
-			break;
-		default:
-			esc_state->state = '\0';
-		}
+	escaped = ssh_esc_scan(&client->esc_state.ssh, buf, &len);
+	if (escaped) {
+		return write_tty_data(client, buf, len) == PROCESS_OK ?
+			       PROCESS_ESC :
+			       PROCESS_ERR;
 	}
 
-	rc = write_buf_to_fd(client->console_sd, out_buf,
-			     len - (out_buf - buf));
-	return rc < 0 ? PROCESS_ERR : PROCESS_OK;
+	return write_tty_data(client, buf, len);
 }
 
+/* Everything up to and including the escape string is sent */
 static enum process_rc process_str_tty(struct console_client *client,
-				       const uint8_t *buf, size_t len)
+				       uint8_t *buf, size_t len)
 {
-	struct str_esc_state *esc_state = &client->esc_state.str;
-	enum process_rc prc = PROCESS_OK;
-	size_t i;
+	size_t end;
 
-	for (i = 0; i < len; ++i) {
-		if (buf[i] == esc_state->str[esc_state->pos]) {
-			esc_state->pos++;
-		} else {
-			esc_state->pos = 0;
+	end = str_esc_scan(&client->esc_state.str, buf, len);
+	if (end) {
+		return write_tty_data(client, buf, end) == PROCESS_OK ?
+			       PROCESS_ESC :
+			       PROCESS_ERR;
+	}
+
+	return write_tty_data(client, buf, len);
+}
+
+/* Pipes, sockets and files can be spliced, terminals can't. Nor can files
+ * opened for appending, such as a shell's >> redirection */
+static bool fd_can_splice(int fd)
+{
+	struct stat st;
+	int flags;
+
+	if (fstat(fd, &st)) {
+		return false;
+	}
+
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || (flags & O_APPEND)) {
+		return false;
+	}
+
+	return S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode) ||
+	       S_ISREG(st.st_mode);
+}
+
+static void client_relay_init(struct client_relay *relay, int from, int to)
+{
+	relay->enabled = false;
+
+	if (!fd_can_splice(from) || !fd_can_splice(to)) {
+		return;
+	}
+
+	relay->enabled = !pipe2(relay->pipe, O_CLOEXEC);
+}
+
+static void client_relay_fini(struct client_relay *relay)
+{
+	if (!relay->enabled) {
+		return;
+	}
+
+	close(relay->pipe[0]);
+	close(relay->pipe[1]);
+	relay->enabled = false;
+}
+
+/* to turned out not to take splices: copy what is in the pipe out, and leave
+ * the rest to the copy loop */
+static enum relay_rc client_relay_drain(struct client_relay *relay, int to,
+					size_t len)
+{
+	uint8_t buf[4096];
+	ssize_t rc;
+
+	while (len) {
+		rc = read(relay->pipe[0], buf,
+			  len < sizeof(buf) ? len : sizeof(buf));
+		if (rc <= 0) {
+			warn("Relay pipe read error");
+			return RELAY_ERR;
+		}
+		if (write_buf_to_fd(to, buf, (size_t)rc) < 0) {
+			return RELAY_ERR;
 		}
+		len -= (size_t)rc;
+	}
 
-		if (esc_state->str[esc_state->pos] == '\0') {
-			prc = PROCESS_ESC;
-			++i;
-			break;
+	client_relay_fini(relay);
+
+	return RELAY_OK;
+}
+
+/* Move what's available on from to to. Like write_buf_to_fd(), this blocks
+ * until to has taken it all */
+static enum relay_rc client_relay(struct client_relay *relay, int from,
+				  int to)
+{
+	ssize_t len;
+	ssize_t rc;
+
+	len = splice(from, NULL, relay->pipe[1], NULL, CLIENT_RELAY_CHUNK,
+		     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (len < 0) {
+		if (errno == EAGAIN) {
+			return RELAY_OK;
 		}
+		return errno == EINVAL ? RELAY_UNSUPPORTED : RELAY_ERR;
+	}
+	if (len == 0) {
+		return RELAY_EOF;
 	}
 
-	if (write_buf_to_fd(client->console_sd, buf, i) < 0) {
-		return PROCESS_ERR;
+	while (len) {
+		rc = splice(relay->pipe[0], NULL, to, NULL, (size_t)len,
+			    SPLICE_F_MOVE);
+		if (rc < 0 && errno == EINVAL) {
+			return client_relay_drain(relay, to, (size_t)len);
+		}
+		if (rc <= 0) {
+			warn("Splice error");
+			return RELAY_ERR;
+		}
+		len -= rc;
 	}
-	return prc;
+
+	return RELAY_OK;
 }
 
 static enum process_rc process_tty(struct console_client *client)
@@ -141,6 +268,21 @@ static enum process_rc process_tty(struct console_client *client)
 	uint8_t buf[4096];
 	ssize_t len;
 
+	if (client->relay_in.enabled) {
+		switch (client_relay(&client->relay_in, client->fd_in,
+				     client->console_sd)) {
+		case RELAY_OK:
+			return PROCESS_OK;
+		case RELAY_EOF:
+			return PROCESS_EXIT;
+		case RELAY_ERR:
+			return PROCESS_ERR;
+		case RELAY_UNSUPPORTED:
+			client_relay_fini(&client->relay_in);
+			break;
+		}
+	}
+
 	len = read(client->fd_in, buf, sizeof(buf));
 	if (len < 0) {
 		return PROCESS_ERR;
@@ -154,6 +296,8 @@ static enum process_rc process_tty(struct console_client *client)
 		return process_ssh_tty(client, buf, len);
 	case ESC_TYPE_STR:
 		return process_str_tty(client, buf, len);
+	case ESC_TYPE_NONE:
+		return write_tty_data(client, buf, len);
 	default:
 		return PROCESS_ERR;
 	}
@@ -161,20 +305,52 @@ static enum process_rc process_tty(struct console_client *client)
 
 static int process_console(struct console_client *client)
 {
+	bool quiet = client->batch.enabled;
 	uint8_t buf[4096];
+	size_t end;
 	ssize_t len;
 	int rc;
 
+	if (client->relay_out.enabled) {
+		switch (client_relay(&client->relay_out, client->console_sd,
+				     client->fd_out)) {
+		case RELAY_OK:
+			return PROCESS_OK;
+		case RELAY_EOF:
+			if (!quiet) {
+				fprintf(stderr, "Connection closed\n");
+			}
+			return PROCESS_EXIT;
+		case RELAY_ERR:
+			warn("Can't relay from server");
+			return PROCESS_ERR;
+		case RELAY_UNSUPPORTED:
+			client_relay_fini(&client->relay_out);
+			break;
+		}
+	}
+
 	len = read(client->console_sd, buf, sizeof(buf));
 	if (len < 0) {
 		warn("Can't read from server");
 		return PROCESS_ERR;
 	}
 	if (len == 0) {
-		fprintf(stderr, "Connection closed\n");
+		if (!quiet) {
+			fprintf(stderr, "Connection closed\n");
+		}
 		return PROCESS_EXIT;
 	}
 
+	/* Output stops at the end of what batch mode waits for */
+	if (client->batch.wait) {
+		end = str_esc_scan(&client->batch.pattern, buf, len);
+		if (end) {
+			rc = write_buf_to_fd(client->fd_out, buf, end);
+			return rc ? PROCESS_ERR : PROCESS_MATCH;
+		}
+	}
+
 	rc = write_buf_to_fd(client->fd_out, buf, len);
 	return rc ? PROCESS_ERR : PROCESS_OK;
 }
@@ -192,7 +368,19 @@ static int client_tty_init(struct console_client *client)
 	client->fd_out = STDOUT_FILENO;
 	client->is_tty = isatty(client->fd_in);
 
+	/* Console output needs no processing, so is relayed wherever stdout
+	 * allows. Input is too, if it needn't be scanned for an escape */
+	client_relay_init(&client->relay_out, client->console_sd,
+			  client->fd_out);
+
 	if (!client->is_tty) {
+		if (client->esc_type == ESC_TYPE_SSH) {
+			client->esc_type = ESC_TYPE_NONE;
+		}
+		if (client->esc_type == ESC_TYPE_NONE) {
+			client_relay_init(&client->relay_in, client->fd_in,
+					  client->console_sd);
+		}
 		return 0;
 	}
 
@@ -213,6 +401,198 @@ static int client_tty_init(struct console_client *client)
 	return 0;
 }
 
+/* In batch mode, output goes to stdout or the file asked for, and the
+ * terminal is left alone */
+static int client_batch_open_output(struct console_client *client)
+{
+	struct client_batch *batch = &client->batch;
+
+	client->fd_in = -1;
+	client->fd_out = STDOUT_FILENO;
+	client->is_tty = false;
+
+	if (batch->out_path) {
+		client->fd_out = open(batch->out_path,
+				      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				      0644);
+		if (client->fd_out < 0) {
+			warn("Can't open %s", batch->out_path);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int client_batch_init(struct console_client *client)
+{
+	struct client_batch *batch = &client->batch;
+	long ns;
+
+	if (client_batch_open_output(client)) {
+		return -1;
+	}
+
+	/* The output can only be relayed if it needn't be scanned */
+	if (!batch->wait) {
+		client_relay_init(&client->relay_out, client->console_sd,
+				  client->fd_out);
+	}
+
+	if (batch->timeout_ms >= 0) {
+		clock_gettime(CLOCK_MONOTONIC, &batch->deadline);
+		ns = batch->deadline.tv_nsec +
+		     (long)(batch->timeout_ms % 1000) * 1000000;
+		batch->deadline.tv_sec += batch->timeout_ms / 1000 +
+					  ns / 1000000000;
+		batch->deadline.tv_nsec = ns % 1000000000;
+	}
+
+	return 0;
+}
+
+/* The poll() timeout to reach the batch deadline, rounded up, or -1 */
+static int client_batch_timeout(struct console_client *client)
+{
+	struct client_batch *batch = &client->batch;
+	struct timespec now;
+	int64_t ms;
+
+	if (!batch->enabled || batch->timeout_ms < 0) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (int64_t)(batch->deadline.tv_sec - now.tv_sec) * 1000 +
+	     (batch->deadline.tv_nsec - now.tv_nsec + 999999) / 1000000;
+
+	return ms > 0 ? (int)ms : 0;
+}
+
+/* Wait until secs seconds after start */
+static void sleep_until(const struct timespec *start, double secs)
+{
+	struct timespec ts = *start;
+	long ns;
+
+	ts.tv_sec += (time_t)secs;
+	ns = ts.tv_nsec + (long)((secs - (double)(time_t)secs) * 1e9);
+	ts.tv_sec += ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR) {
+	}
+}
+
+/*
+ * Play an asciicast recording, as written by the record handler, with its
+ * timing. Output from before the skip offset is written straight away, so
+ * that the terminal is in the state it was at that point.
+ */
+static int client_replay(struct console_client *client)
+{
+	struct client_batch *batch = &client->batch;
+	struct timespec start;
+	size_t line_size = 0;
+	uint8_t *data = NULL;
+	size_t data_size = 0;
+	char *line = NULL;
+	size_t lineno = 0;
+	ssize_t line_len;
+	double time;
+	size_t len;
+	FILE *file;
+	int rc = 0;
+
+	file = fopen(batch->replay_path, "re");
+	if (!file) {
+		warn("Can't open recording %s", batch->replay_path);
+		return -1;
+	}
+
+	if (client_batch_open_output(client)) {
+		fclose(file);
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while ((line_len = getline(&line, &line_size, file)) >= 0) {
+		lineno++;
+
+		if ((size_t)line_len > data_size) {
+			free(data);
+			data_size = (size_t)line_len;
+			data = malloc(data_size);
+			if (!data) {
+				rc = -1;
+				break;
+			}
+		}
+
+		/* A recording cut short may end mid-event */
+		rc = asciicast_parse_event(line, &time, data, &len);
+		if (rc < 0) {
+			warnx("Skipping invalid event on line %zu of %s",
+			      lineno, batch->replay_path);
+		}
+		if (rc) {
+			rc = 0;
+			continue;
+		}
+
+		if (time > batch->skip) {
+			sleep_until(&start, (time - batch->skip) / batch->speed);
+		}
+
+		rc = write_buf_to_fd(client->fd_out, data, len);
+		if (rc) {
+			break;
+		}
+	}
+
+	free(data);
+	free(line);
+	fclose(file);
+	if (batch->out_path) {
+		close(client->fd_out);
+	}
+
+	return rc;
+}
+
+/* Parse a number greater than zero, maybe fractional */
+static int parse_positive(const char *val, double *result)
+{
+	char *end;
+
+	errno = 0;
+	*result = strtod(val, &end);
+	if (errno || end == val || *end != '\0' || !(*result > 0)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Parse a number of seconds into milliseconds */
+static int parse_timeout(const char *val, int *timeout_ms)
+{
+	double secs;
+
+	if (parse_positive(val, &secs) || secs > (double)(INT_MAX / 1000)) {
+		return -1;
+	}
+
+	*timeout_ms = (int)(secs * 1000);
+	if (!*timeout_ms) {
+		*timeout_ms = 1;
+	}
+
+	return 0;
+}
+
 static int client_init(struct console_client *client, struct config *config,
 		       const char *console_id)
 {
@@ -233,7 +613,11 @@ static int client_init(struct console_client *client, struct config *config,
 
 	memset(&addr, 0, sizeof(addr));
 	addr.sun_family = AF_UNIX;
-	len = console_socket_path(addr.sun_path, resolved_id);
+	if (client->batch.dump) {
+		len = console_dump_socket_path(addr.sun_path, resolved_id);
+	} else {
+		len = console_socket_path(addr.sun_path, resolved_id);
+	}
 	if (len < 0) {
 		if (errno) {
 			warn("Failed to configure socket: %s", strerror(errno));
@@ -258,9 +642,15 @@ cleanup:
 
 static void client_fini(struct console_client *client)
 {
+	client_relay_fini(&client->relay_in);
+	client_relay_fini(&client->relay_out);
+
 	if (client->is_tty) {
 		tcsetattr(client->fd_in, TCSANOW, &client->orig_termios);
 	}
+	if (client->batch.out_path && client->fd_out >= 0) {
+		close(client->fd_out);
+	}
 	close(client->console_sd);
 }
 
@@ -274,14 +664,17 @@ int main(int argc, char *argv[])
 	struct config *config = NULL;
 	const char *console_id = NULL;
 	const uint8_t *esc = NULL;
+	int timeout;
 	int rc;
 
 	client = &_client;
 	memset(client, 0, sizeof(*client));
 	client->esc_type = ESC_TYPE_SSH;
+	client->batch.timeout_ms = -1;
+	client->batch.speed = 1;
 
 	for (;;) {
-		rc = getopt(argc, argv, "c:e:i:");
+		rc = getopt(argc, argv, "c:de:i:j:o:r:s:t:w:");
 		if (rc == -1) {
 			break;
 		}
@@ -309,17 +702,77 @@ int main(int argc, char *argv[])
 			}
 			console_id = optarg;
 			break;
+		case 'd':
+			client->batch.enabled = true;
+			client->batch.dump = true;
+			break;
+		case 'o':
+			if (optarg[0] == '\0') {
+				fprintf(stderr, "Output file cannot be empty\n");
+				return EXIT_FAILURE;
+			}
+			client->batch.enabled = true;
+			client->batch.out_path = optarg;
+			break;
+		case 't':
+			if (parse_timeout(optarg, &client->batch.timeout_ms)) {
+				fprintf(stderr, "Invalid timeout '%s'\n",
+					optarg);
+				return EXIT_FAILURE;
+			}
+			client->batch.enabled = true;
+			break;
+		case 'r':
+			if (optarg[0] == '\0') {
+				fprintf(stderr,
+					"Recording file cannot be empty\n");
+				return EXIT_FAILURE;
+			}
+			client->batch.enabled = true;
+			client->batch.replay_path = optarg;
+			break;
+		case 's':
+			if (parse_positive(optarg, &client->batch.speed)) {
+				fprintf(stderr, "Invalid speed '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'j':
+			if (parse_positive(optarg, &client->batch.skip)) {
+				fprintf(stderr, "Invalid offset '%s'\n", optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+		case 'w':
+			if (optarg[0] == '\0') {
+				fprintf(stderr, "Wait str cannot be empty\n");
+				return EXIT_FAILURE;
+			}
+			client->batch.enabled = true;
+			client->batch.wait = true;
+			client->batch.pattern.str = (const uint8_t *)optarg;
+			break;
 		default:
 			fprintf(stderr,
 				"Usage: %s "
 				"[-e <escape sequence>]"
 				"[-i <console ID>]"
-				"[-c <config>]\n",
-				argv[0]);
+				"[-c <config>]\n"
+				"       %s [-i <console ID>] [-c <config>] "
+				"[-d] [-w <str>] [-t <seconds>] [-o <file>]\n"
+				"       %s -r <recording> [-s <speed>] "
+				"[-j <seconds>] [-o <file>]\n",
+				argv[0], argv[0], argv[0]);
 			return EXIT_FAILURE;
 		}
 	}
 
+	if (client->batch.wait &&
+	    str_esc_init(&client->batch.pattern, client->batch.pattern.str)) {
+		warnx("Can't set up the wait str");
+		return EXIT_FAILURE;
+	}
+
 	if (config_path) {
 		config = config_init(config_path);
 		if (!config) {
@@ -335,7 +788,16 @@ int main(int argc, char *argv[])
 
 	if (esc) {
 		client->esc_type = ESC_TYPE_STR;
-		client->esc_state.str.str = esc;
+		if (str_esc_init(&client->esc_state.str, esc)) {
+			warnx("Can't set up the escape sequence");
+			rc = -1;
+			goto out_config_fini;
+		}
+	}
+
+	if (client->batch.replay_path) {
+		rc = client_replay(client);
+		goto out_config_fini;
 	}
 
 	rc = client_init(client, config, console_id);
@@ -343,22 +805,38 @@ int main(int argc, char *argv[])
 		goto out_config_fini;
 	}
 
-	rc = client_tty_init(client);
+	if (client->batch.enabled) {
+		rc = client_batch_init(client);
+	} else {
+		rc = client_tty_init(client);
+	}
 	if (rc) {
 		goto out_client_fini;
 	}
 
 	for (;;) {
+		/* Checked up front, as a busy console keeps poll() returning */
+		timeout = client_batch_timeout(client);
+		if (timeout == 0) {
+			prc = PROCESS_TIMEOUT;
+			rc = 0;
+			break;
+		}
+
+		/* poll() skips fd_in when it's -1, as in batch mode */
 		pollfds[0].fd = client->fd_in;
 		pollfds[0].events = POLLIN;
 		pollfds[1].fd = client->console_sd;
 		pollfds[1].events = POLLIN;
 
-		rc = poll(pollfds, 2, -1);
+		rc = poll(pollfds, 2, timeout);
 		if (rc < 0) {
 			warn("Poll failure");
 			break;
 		}
+		if (rc == 0) {
+			continue;
+		}
 
 		if (pollfds[0].revents) {
 			prc = process_tty(client);
@@ -378,6 +856,14 @@ out_client_fini:
 	client_fini(client);
 
 out_config_fini:
+	if (client->esc_type == ESC_TYPE_STR) {
+		str_esc_fini(&client->esc_state.str);
+	}
+
+	if (client->batch.wait) {
+		str_esc_fini(&client->batch.pattern);
+	}
+
 	if (config_path) {
 		config_fini(config);
 	}
@@ -385,5 +871,16 @@ out_config_fini:
 	if (prc == PROCESS_ESC) {
 		return EXIT_ESCAPE;
 	}
+
+	/* Waiting for output that never came is a failure, a capture that ran
+	 * its course isn't */
+	if (client->batch.wait) {
+		if (prc == PROCESS_TIMEOUT) {
+			return EXIT_TIMEOUT;
+		}
+		if (prc == PROCESS_EXIT) {
+			return EXIT_FAILURE;
+		}
+	}
 	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
 }
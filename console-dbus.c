@@ -17,12 +17,17 @@
 #include <assert.h>
 #include <errno.h>
 #include <err.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/socket.h>
 
 #include "config.h"
 #include "console-mux.h"
 #include "console-server.h"
+#include "history.h"
+#include "latency.h"
+#include "screen.h"
 
 /* size of the dbus object path length */
 const size_t dbus_obj_path_len = 1024;
@@ -32,13 +37,17 @@ const size_t dbus_obj_path_len = 1024;
 #define OBJ_NAME    "/xyz/openbmc_project/console/%s"
 #define UART_INTF   "xyz.openbmc_project.Console.UART"
 #define ACCESS_INTF "xyz.openbmc_project.Console.Access"
+#define STATS_INTF  "xyz.openbmc_project.Console.Statistics"
+#define MUX_INTF    "xyz.openbmc_project.Console.Mux"
+#define TRIGGER_INTF "xyz.openbmc_project.Console.Trigger"
+#define SCREEN_INTF  "xyz.openbmc_project.Console.Screen"
 
 static void tty_change_baudrate(struct console *console)
 {
 	int i;
 	int rc;
 
-	tty_init_termios(console->server);
+	tty_init_termios(console->tty);
 
 	for (i = 0; i < console->n_handlers; i++) {
 		const struct handler_type *type;
@@ -50,7 +59,7 @@ static void tty_change_baudrate(struct console *console)
 			continue;
 		}
 
-		rc = type->baudrate(handler, console->server->tty.uart.baud);
+		rc = type->baudrate(handler, console->tty->uart.baud);
 		if (rc) {
 			warnx("Can't set terminal baudrate for handler %s",
 			      type->name);
@@ -83,8 +92,8 @@ static int set_baud_handler(sd_bus *bus, const char *path,
 		return -EINVAL;
 	}
 
-	assert(console->server->tty.type == TTY_DEVICE_UART);
-	console->server->tty.uart.baud = speed;
+	assert(console->tty->type == TTY_DEVICE_UART);
+	console->tty->uart.baud = speed;
 	tty_change_baudrate(console);
 
 	sd_bus_emit_properties_changed(bus, path, interface, property, NULL);
@@ -100,14 +109,14 @@ static int get_baud_handler(sd_bus *bus __attribute__((unused)),
 			    sd_bus_error *error __attribute__((unused)))
 {
 	struct console *console = userdata;
-	struct console_server *server = console->server;
+	struct upstream_tty *tty = console->tty;
 	uint64_t baudrate;
 	int r;
 
-	assert(server->tty.type == TTY_DEVICE_UART);
-	baudrate = parse_baud_to_int(server->tty.uart.baud);
+	assert(tty->type == TTY_DEVICE_UART);
+	baudrate = parse_baud_to_int(tty->uart.baud);
 	if (!baudrate) {
-		warnx("Invalid baud rate: '%d'", server->tty.uart.baud);
+		warnx("Invalid baud rate: '%d'", tty->uart.baud);
 	}
 
 	r = sd_bus_message_append(reply, "t", baudrate);
@@ -148,6 +157,54 @@ static int method_connect(sd_bus_message *msg, void *userdata,
 	return rc;
 }
 
+static int get_tty_stat(sd_bus *bus __attribute__((unused)),
+			const char *path __attribute__((unused)),
+			const char *interface __attribute__((unused)),
+			const char *property, sd_bus_message *reply,
+			void *userdata,
+			sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	struct upstream_tty *tty = console->tty;
+	const struct tty_stats *stats = &tty->stats;
+
+	if (!strcmp(property, "TTYWakeups")) {
+		return sd_bus_message_append(reply, "t", stats->wakeups);
+	}
+
+	if (!strcmp(property, "TTYReads")) {
+		return sd_bus_message_append(reply, "t", stats->reads);
+	}
+
+	if (!strcmp(property, "TTYBytes")) {
+		return sd_bus_message_append(reply, "t", stats->bytes);
+	}
+
+	if (!strcmp(property, "TTYWakeupsPerSecond")) {
+		return sd_bus_message_append(reply, "d",
+					     tty_stats_wakeups_per_sec(tty));
+	}
+
+	if (!strcmp(property, "TTYBytesPerRead")) {
+		double per_read = stats->reads ? (double)stats->bytes /
+							 (double)stats->reads :
+						 0.0;
+		return sd_bus_message_append(reply, "d", per_read);
+	}
+
+	if (!strcmp(property, "TTYVMIN")) {
+		return sd_bus_message_append(reply, "y",
+					     (uint8_t)tty->read_policy.vmin);
+	}
+
+	if (!strcmp(property, "TTYLatencyBudgetMs")) {
+		return sd_bus_message_append(
+			reply, "t", (uint64_t)tty->read_policy.latency_ms);
+	}
+
+	return -ENOENT;
+}
+
 static const sd_bus_vtable console_uart_vtable[] = {
 	SD_BUS_VTABLE_START(0),
 	SD_BUS_WRITABLE_PROPERTY("Baud", "t", get_baud_handler,
@@ -164,6 +221,497 @@ static const sd_bus_vtable console_access_vtable[] = {
 	SD_BUS_VTABLE_END,
 };
 
+static int get_history_stat(sd_bus *bus __attribute__((unused)),
+			    const char *path __attribute__((unused)),
+			    const char *interface __attribute__((unused)),
+			    const char *property, sd_bus_message *reply,
+			    void *userdata,
+			    sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	struct history_stats stats = { 0 };
+
+	if (console->history) {
+		history_get_stats(console->history, &stats);
+	}
+
+	if (!strcmp(property, "HistoryBytes")) {
+		return sd_bus_message_append(reply, "t", stats.raw_bytes);
+	}
+
+	if (!strcmp(property, "HistoryCompressedBytes")) {
+		return sd_bus_message_append(reply, "t", stats.stored_bytes);
+	}
+
+	return -ENOENT;
+}
+
+static int get_ringbuffer_size(sd_bus *bus __attribute__((unused)),
+			       const char *path __attribute__((unused)),
+			       const char *interface __attribute__((unused)),
+			       const char *property __attribute__((unused)),
+			       sd_bus_message *reply, void *userdata,
+			       sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+
+	return sd_bus_message_append(reply, "t", (uint64_t)console->rb->size);
+}
+
+/* Background mux scanning: how often and how long this console was watched */
+static int get_scan_stat(sd_bus *bus __attribute__((unused)),
+			 const char *path __attribute__((unused)),
+			 const char *interface __attribute__((unused)),
+			 const char *property, sd_bus_message *reply,
+			 void *userdata,
+			 sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	const struct console_scan_stats *scan = &console->scan;
+	struct console_server *server = console->server;
+	uint64_t total_ms = 0;
+
+	if (!strcmp(property, "ScanSlices")) {
+		return sd_bus_message_append(reply, "t", scan->slices);
+	}
+
+	if (!strcmp(property, "ScanBytes")) {
+		return sd_bus_message_append(reply, "t", scan->bytes);
+	}
+
+	if (!strcmp(property, "ScanHeldMs")) {
+		return sd_bus_message_append(reply, "t", scan->held_ms);
+	}
+
+	if (!strcmp(property, "ScanMaxGapMs")) {
+		return sd_bus_message_append(reply, "t", scan->max_gap_ms);
+	}
+
+	if (!strcmp(property, "ScanShare")) {
+		for (size_t i = 0; i < server->n_consoles; i++) {
+			if (server->consoles[i]->tty == console->tty) {
+				total_ms += server->consoles[i]->scan.held_ms;
+			}
+		}
+		return sd_bus_message_append(
+			reply, "d",
+			total_ms ? (double)scan->held_ms / (double)total_ms :
+				   0.0);
+	}
+
+	return -ENOENT;
+}
+
+/* Mux switching cost, shared by the consoles on a tty */
+static int get_mux_stat(sd_bus *bus __attribute__((unused)),
+			const char *path __attribute__((unused)),
+			const char *interface __attribute__((unused)),
+			const char *property, sd_bus_message *reply,
+			void *userdata,
+			sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	struct console_mux_stats stats = { 0 };
+
+	console_mux_get_stats(console->tty, &stats);
+
+	if (!strcmp(property, "MuxSwitches")) {
+		return sd_bus_message_append(reply, "t", stats.switches);
+	}
+
+	if (!strcmp(property, "MuxSwitchLastUs")) {
+		return sd_bus_message_append(reply, "t",
+					     stats.last_switch_ns / 1000);
+	}
+
+	if (!strcmp(property, "MuxSwitchMaxUs")) {
+		return sd_bus_message_append(reply, "t",
+					     stats.max_switch_ns / 1000);
+	}
+
+	if (!strcmp(property, "MuxSwitchMeanUs")) {
+		return sd_bus_message_append(
+			reply, "d",
+			stats.switches ? (double)stats.total_switch_ns /
+						 (double)stats.switches / 1e3 :
+					 0.0);
+	}
+
+	if (!strcmp(property, "MuxFirstByteLastUs")) {
+		return sd_bus_message_append(reply, "t",
+					     stats.last_first_byte_ns / 1000);
+	}
+
+	if (!strcmp(property, "MuxFirstByteMaxUs")) {
+		return sd_bus_message_append(reply, "t",
+					     stats.max_first_byte_ns / 1000);
+	}
+
+	return -ENOENT;
+}
+
+/* Append one handler's delivery latency, as (count, sum, max, buckets) */
+static int append_latency(sd_bus_message *reply, const char *name,
+			  const struct latency_hist *hist)
+{
+	int r;
+
+	r = sd_bus_message_open_container(reply, 'e', "s(tttat)");
+	if (r < 0) {
+		return r;
+	}
+
+	r = sd_bus_message_append(reply, "s", name);
+	if (r < 0) {
+		return r;
+	}
+
+	r = sd_bus_message_open_container(reply, 'r', "tttat");
+	if (r < 0) {
+		return r;
+	}
+
+	r = sd_bus_message_append(reply, "ttt", hist->count, hist->sum_us,
+				  hist->max_us);
+	if (r < 0) {
+		return r;
+	}
+
+	r = sd_bus_message_append_array(reply, 't', hist->buckets,
+					sizeof(hist->buckets));
+	if (r < 0) {
+		return r;
+	}
+
+	r = sd_bus_message_close_container(reply);
+	if (r < 0) {
+		return r;
+	}
+
+	return sd_bus_message_close_container(reply);
+}
+
+/* Time from queueing tty data to the handlers delivering it */
+static int get_latency_stat(sd_bus *bus __attribute__((unused)),
+			    const char *path __attribute__((unused)),
+			    const char *interface __attribute__((unused)),
+			    const char *property, sd_bus_message *reply,
+			    void *userdata,
+			    sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	uint64_t bounds[LATENCY_BUCKETS];
+	int r;
+
+	if (!strcmp(property, "LatencyTracing")) {
+		return sd_bus_message_append(reply, "b",
+					     console->rb->stamps != NULL);
+	}
+
+	if (!strcmp(property, "LatencyBucketsUs")) {
+		for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+			bounds[i] = latency_bucket_max(i);
+		}
+		return sd_bus_message_append_array(reply, 't', bounds,
+						   sizeof(bounds));
+	}
+
+	if (!strcmp(property, "DeliveryLatency")) {
+		r = sd_bus_message_open_container(reply, 'a', "{s(tttat)}");
+		if (r < 0) {
+			return r;
+		}
+
+		for (long i = 0; i < console->n_handlers; i++) {
+			struct handler *handler = console->handlers[i];
+			const struct latency_hist *hist;
+
+			if (!handler->type->latency) {
+				continue;
+			}
+
+			hist = handler->type->latency(handler);
+			r = append_latency(reply, handler->type->name, hist);
+			if (r < 0) {
+				return r;
+			}
+		}
+
+		return sd_bus_message_close_container(reply);
+	}
+
+	return -ENOENT;
+}
+
+static const sd_bus_vtable console_stats_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("TTYWakeups", "t", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("TTYReads", "t", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("TTYBytes", "t", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("TTYWakeupsPerSecond", "d", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("TTYBytesPerRead", "d", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("TTYVMIN", "y", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("TTYLatencyBudgetMs", "t", get_tty_stat, 0, 0),
+	SD_BUS_PROPERTY("HistoryBytes", "t", get_history_stat, 0, 0),
+	SD_BUS_PROPERTY("HistoryCompressedBytes", "t", get_history_stat, 0, 0),
+	SD_BUS_PROPERTY("RingbufferSize", "t", get_ringbuffer_size, 0, 0),
+	SD_BUS_PROPERTY("ScanSlices", "t", get_scan_stat, 0, 0),
+	SD_BUS_PROPERTY("ScanBytes", "t", get_scan_stat, 0, 0),
+	SD_BUS_PROPERTY("ScanHeldMs", "t", get_scan_stat, 0, 0),
+	SD_BUS_PROPERTY("ScanMaxGapMs", "t", get_scan_stat, 0, 0),
+	SD_BUS_PROPERTY("ScanShare", "d", get_scan_stat, 0, 0),
+	SD_BUS_PROPERTY("MuxSwitches", "t", get_mux_stat, 0, 0),
+	SD_BUS_PROPERTY("MuxSwitchLastUs", "t", get_mux_stat, 0, 0),
+	SD_BUS_PROPERTY("MuxSwitchMaxUs", "t", get_mux_stat, 0, 0),
+	SD_BUS_PROPERTY("MuxSwitchMeanUs", "d", get_mux_stat, 0, 0),
+	SD_BUS_PROPERTY("MuxFirstByteLastUs", "t", get_mux_stat, 0, 0),
+	SD_BUS_PROPERTY("MuxFirstByteMaxUs", "t", get_mux_stat, 0, 0),
+	SD_BUS_PROPERTY("LatencyTracing", "b", get_latency_stat, 0, 0),
+	SD_BUS_PROPERTY("LatencyBucketsUs", "at", get_latency_stat, 0,
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("DeliveryLatency", "a{s(tttat)}", get_latency_stat, 0,
+			0),
+	SD_BUS_VTABLE_END,
+};
+
+/* Mux arbitration: the policy for the console's tty, and who holds it */
+static int get_mux_policy(sd_bus *bus __attribute__((unused)),
+			  const char *path __attribute__((unused)),
+			  const char *interface __attribute__((unused)),
+			  const char *property, sd_bus_message *reply,
+			  void *userdata,
+			  sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	struct console_mux_policy policy = { 0 };
+
+	console_mux_get_policy(console->tty, &policy);
+
+	if (!strcmp(property, "MinDwellMs")) {
+		return sd_bus_message_append(reply, "t",
+					     (uint64_t)policy.min_dwell_ms);
+	}
+
+	if (!strcmp(property, "Lease")) {
+		return sd_bus_message_append(reply, "b", policy.lease);
+	}
+
+	if (!strcmp(property, "ScanSliceMs")) {
+		return sd_bus_message_append(reply, "t",
+					     (uint64_t)policy.scan_slice_ms);
+	}
+
+	return -ENOENT;
+}
+
+static int get_mux_state(sd_bus *bus __attribute__((unused)),
+			 const char *path __attribute__((unused)),
+			 const char *interface __attribute__((unused)),
+			 const char *property, sd_bus_message *reply,
+			 void *userdata,
+			 sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	struct console *const *pending;
+	struct console *owner;
+	size_t n_pending;
+	int r;
+
+	if (!strcmp(property, "Active")) {
+		return sd_bus_message_append(
+			reply, "s",
+			console->tty->active ? console->tty->active->console_id :
+					       "");
+	}
+
+	if (!strcmp(property, "Owner")) {
+		owner = console_mux_owner(console->tty);
+		return sd_bus_message_append(reply, "s",
+					     owner ? owner->console_id : "");
+	}
+
+	if (!strcmp(property, "Pending")) {
+		pending = console_mux_pending(console->tty, &n_pending);
+
+		r = sd_bus_message_open_container(reply, 'a', "s");
+		if (r < 0) {
+			return r;
+		}
+
+		for (size_t i = 0; i < n_pending; i++) {
+			r = sd_bus_message_append(reply, "s",
+						  pending[i]->console_id);
+			if (r < 0) {
+				return r;
+			}
+		}
+
+		return sd_bus_message_close_container(reply);
+	}
+
+	return -ENOENT;
+}
+
+static const sd_bus_vtable console_mux_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("MinDwellMs", "t", get_mux_policy, 0,
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("Lease", "b", get_mux_policy, 0,
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("ScanSliceMs", "t", get_mux_policy, 0,
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("Active", "s", get_mux_state, 0, 0),
+	SD_BUS_PROPERTY("Owner", "s", get_mux_state, 0, 0),
+	SD_BUS_PROPERTY("Pending", "as", get_mux_state, 0, 0),
+	SD_BUS_VTABLE_END,
+};
+
+static int method_redraw(sd_bus_message *msg, void *userdata,
+			 sd_bus_error *err)
+{
+	struct console *console = userdata;
+	sd_bus_message *reply = NULL;
+	uint8_t *buf;
+	size_t len;
+	int rc;
+
+	if (!console->screen) {
+		sd_bus_error_set_const(err, DBUS_ERR, "No screen model");
+		return sd_bus_reply_method_error(msg, err);
+	}
+
+	buf = screen_redraw(console->screen, &len);
+	if (!buf) {
+		return -ENOMEM;
+	}
+
+	rc = sd_bus_message_new_method_return(msg, &reply);
+	if (rc >= 0) {
+		rc = sd_bus_message_append_array(reply, 'y', buf, len);
+	}
+	if (rc >= 0) {
+		rc = sd_bus_send(sd_bus_message_get_bus(msg), reply, NULL);
+	}
+
+	sd_bus_message_unref(reply);
+	free(buf);
+
+	return rc;
+}
+
+static int method_text(sd_bus_message *msg, void *userdata, sd_bus_error *err)
+{
+	struct console *console = userdata;
+	sd_bus_message *reply = NULL;
+	unsigned int cols;
+	unsigned int rows;
+	char *line;
+	int rc;
+
+	if (!console->screen) {
+		sd_bus_error_set_const(err, DBUS_ERR, "No screen model");
+		return sd_bus_reply_method_error(msg, err);
+	}
+
+	screen_get_size(console->screen, &cols, &rows);
+
+	/* Up to four bytes of UTF-8 for each cell */
+	line = malloc((size_t)cols * 4 + 1);
+	if (!line) {
+		return -ENOMEM;
+	}
+
+	rc = sd_bus_message_new_method_return(msg, &reply);
+	if (rc >= 0) {
+		rc = sd_bus_message_open_container(reply, 'a', "s");
+	}
+	for (unsigned int row = 0; rc >= 0 && row < rows; row++) {
+		screen_row_text(console->screen, row, line, (size_t)cols * 4 + 1);
+		rc = sd_bus_message_append(reply, "s", line);
+	}
+	if (rc >= 0) {
+		rc = sd_bus_message_close_container(reply);
+	}
+	if (rc >= 0) {
+		rc = sd_bus_send(sd_bus_message_get_bus(msg), reply, NULL);
+	}
+
+	sd_bus_message_unref(reply);
+	free(line);
+
+	return rc;
+}
+
+static int get_screen_size(sd_bus *bus __attribute__((unused)),
+			   const char *path __attribute__((unused)),
+			   const char *interface __attribute__((unused)),
+			   const char *property, sd_bus_message *reply,
+			   void *userdata,
+			   sd_bus_error *error __attribute__((unused)))
+{
+	struct console *console = userdata;
+	unsigned int cols = 0;
+	unsigned int rows = 0;
+
+	if (console->screen) {
+		screen_get_size(console->screen, &cols, &rows);
+	}
+
+	if (!strcmp(property, "Columns")) {
+		return sd_bus_message_append(reply, "u", cols);
+	}
+
+	if (!strcmp(property, "Rows")) {
+		return sd_bus_message_append(reply, "u", rows);
+	}
+
+	return -ENOENT;
+}
+
+static const sd_bus_vtable console_screen_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("Columns", "u", get_screen_size, 0,
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_PROPERTY("Rows", "u", get_screen_size, 0,
+			SD_BUS_VTABLE_PROPERTY_CONST),
+	SD_BUS_METHOD("Redraw", SD_BUS_NO_ARGS, "ay", method_redraw,
+		      SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("Text", SD_BUS_NO_ARGS, "as", method_text,
+		      SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_VTABLE_END,
+};
+
+static const sd_bus_vtable console_trigger_vtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_SIGNAL("PatternMatched", "sstt", 0),
+	SD_BUS_VTABLE_END,
+};
+
+int dbus_emit_trigger(struct console *console, const char *pattern,
+		      uint64_t offset, uint64_t suppressed)
+{
+	char obj_name[dbus_obj_path_len];
+	size_t bytes;
+	int r;
+
+	bytes = snprintf(obj_name, dbus_obj_path_len, OBJ_NAME,
+			 console->console_id);
+	if (bytes >= dbus_obj_path_len) {
+		return -1;
+	}
+
+	r = sd_bus_emit_signal(console->server->bus, obj_name, TRIGGER_INTF,
+			       "PatternMatched", "sstt", console->console_id,
+			       pattern, offset, suppressed);
+	if (r < 0) {
+		warnx("Failed to emit PatternMatched signal: %s",
+		      strerror(-r));
+		return -1;
+	}
+
+	return 0;
+}
+
 int dbus_server_init(struct console_server *server)
 {
 	int r;
@@ -203,11 +751,81 @@ void dbus_server_fini(struct console_server *server)
 	sd_bus_unref(server->bus);
 }
 
+/* Milliseconds until the bus wants servicing without a wakeup, or -1 */
+long dbus_server_timeout(struct console_server *server)
+{
+	struct pollfd *pollfd = &server->pollfds[server->dbus_pollfd_index];
+	struct timespec now;
+	uint64_t until;
+	uint64_t usec;
+	int events;
+
+	/* Queued requests go out as the socket becomes writable */
+	events = sd_bus_get_events(server->bus);
+	pollfd->events = events > 0 ? (short)events : POLLIN;
+
+	if (sd_bus_get_timeout(server->bus, &until) < 0 || until == UINT64_MAX) {
+		return -1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	usec = (uint64_t)now.tv_sec * 1000000u + (uint64_t)now.tv_nsec / 1000u;
+	if (until <= usec) {
+		return 0;
+	}
+
+	return (long)((until - usec + 999) / 1000);
+}
+
+void dbus_server_process(struct console_server *server)
+{
+	struct pollfd *pollfd = &server->pollfds[server->dbus_pollfd_index];
+
+	if (!pollfd->revents && dbus_server_timeout(server) != 0) {
+		return;
+	}
+
+	/* Drain everything queued, including replies to our name requests */
+	while (sd_bus_process(server->bus, NULL) > 0) {
+		;
+	}
+}
+
+/* The broker's RequestName reply: 1 is primary owner, 4 already owner */
+static int dbus_request_name_done(sd_bus_message *m, void *userdata,
+				  sd_bus_error *ret_error
+				  __attribute__((unused)))
+{
+	struct console *console = userdata;
+	const sd_bus_error *e;
+	uint32_t reply;
+	int r;
+
+	console->dbus_name_slot = sd_bus_slot_unref(console->dbus_name_slot);
+
+	if (sd_bus_message_is_method_error(m, NULL)) {
+		e = sd_bus_message_get_error(m);
+		warnx("Failed to acquire service name for console '%s': %s",
+		      console->console_id, e ? e->message : "unknown error");
+		return 0;
+	}
+
+	r = sd_bus_message_read(m, "u", &reply);
+	if (r < 0 || (reply != 1 && reply != 4)) {
+		warnx("Failed to acquire service name for console '%s': %s",
+		      console->console_id,
+		      r < 0 ? strerror(-r) : "name is taken");
+	}
+
+	return 0;
+}
+
 int dbus_init(struct console *console,
 	      struct config *config __attribute__((unused)))
 {
 	char obj_name[dbus_obj_path_len];
 	char dbus_name[dbus_obj_path_len];
+	sd_bus_slot **slot;
 	int r;
 	size_t bytes;
 
@@ -216,6 +834,8 @@ int dbus_init(struct console *console,
 		return -1;
 	}
 
+	slot = console->dbus_slots;
+
 	/* Register support console interface */
 	bytes = snprintf(obj_name, dbus_obj_path_len, OBJ_NAME,
 			 console->console_id);
@@ -225,9 +845,9 @@ int dbus_init(struct console *console,
 		return -1;
 	}
 
-	if (console->server->tty.type == TTY_DEVICE_UART) {
+	if (console->tty->type == TTY_DEVICE_UART) {
 		/* Register UART interface */
-		r = sd_bus_add_object_vtable(console->server->bus, NULL,
+		r = sd_bus_add_object_vtable(console->server->bus, slot++,
 					     obj_name, UART_INTF,
 					     console_uart_vtable, console);
 		if (r < 0) {
@@ -238,7 +858,7 @@ int dbus_init(struct console *console,
 	}
 
 	/* Register access interface */
-	r = sd_bus_add_object_vtable(console->server->bus, NULL, obj_name,
+	r = sd_bus_add_object_vtable(console->server->bus, slot++, obj_name,
 				     ACCESS_INTF, console_access_vtable,
 				     console);
 	if (r < 0) {
@@ -246,6 +866,42 @@ int dbus_init(struct console *console,
 		return -1;
 	}
 
+	/* Register statistics interface */
+	r = sd_bus_add_object_vtable(console->server->bus, slot++, obj_name,
+				     STATS_INTF, console_stats_vtable, console);
+	if (r < 0) {
+		warnx("Failed to register statistics interface: %s",
+		      strerror(-r));
+		return -1;
+	}
+
+	/* Register mux interface */
+	r = sd_bus_add_object_vtable(console->server->bus, slot++, obj_name,
+				     MUX_INTF, console_mux_vtable, console);
+	if (r < 0) {
+		warnx("Failed to register mux interface: %s", strerror(-r));
+		return -1;
+	}
+
+	/* Register screen interface */
+	r = sd_bus_add_object_vtable(console->server->bus, slot++, obj_name,
+				     SCREEN_INTF, console_screen_vtable,
+				     console);
+	if (r < 0) {
+		warnx("Failed to register screen interface: %s", strerror(-r));
+		return -1;
+	}
+
+	/* Register trigger interface, for the pattern matching signals */
+	r = sd_bus_add_object_vtable(console->server->bus, slot++, obj_name,
+				     TRIGGER_INTF, console_trigger_vtable,
+				     console);
+	if (r < 0) {
+		warnx("Failed to register trigger interface: %s",
+		      strerror(-r));
+		return -1;
+	}
+
 	bytes = snprintf(dbus_name, dbus_obj_path_len, DBUS_NAME,
 			 console->console_id);
 	if (bytes >= dbus_obj_path_len) {
@@ -254,10 +910,17 @@ int dbus_init(struct console *console,
 		return -1;
 	}
 
-	/* Finally register the bus name */
-	r = sd_bus_request_name(console->server->bus, dbus_name,
-				SD_BUS_NAME_ALLOW_REPLACEMENT |
-					SD_BUS_NAME_REPLACE_EXISTING);
+	/*
+	 * Finally ask for the bus name. The objects above are local to the
+	 * connection, but the name is a round trip to the broker: queue the
+	 * request and get on with serving the tty, the reply arrives through
+	 * dbus_server_process().
+	 */
+	r = sd_bus_request_name_async(console->server->bus,
+				      &console->dbus_name_slot, dbus_name,
+				      SD_BUS_NAME_ALLOW_REPLACEMENT |
+					      SD_BUS_NAME_REPLACE_EXISTING,
+				      dbus_request_name_done, console);
 	if (r < 0) {
 		warnx("Failed to acquire service name: %s", strerror(-r));
 		return -1;
@@ -265,3 +928,25 @@ int dbus_init(struct console *console,
 
 	return 0;
 }
+
+/* Withdraw the console's objects and name from the bus */
+void dbus_fini(struct console *console)
+{
+	char dbus_name[dbus_obj_path_len];
+	size_t bytes;
+
+	for (size_t i = 0; i < CONSOLE_DBUS_INTERFACES; i++) {
+		console->dbus_slots[i] =
+			sd_bus_slot_unref(console->dbus_slots[i]);
+	}
+
+	/* Drops the callback if the broker hasn't replied yet */
+	console->dbus_name_slot = sd_bus_slot_unref(console->dbus_name_slot);
+
+	bytes = snprintf(dbus_name, dbus_obj_path_len, DBUS_NAME,
+			 console->console_id);
+	if (bytes < dbus_obj_path_len) {
+		sd_bus_release_name_async(console->server->bus, NULL,
+					  dbus_name, NULL, NULL);
+	}
+}
@@ -4,23 +4,56 @@
 #include <gpiod.h>
 #include <limits.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "console-server.h"
 #include "console-mux.h"
 #include "config.h"
+#include "trace.h"
 
 struct console_gpio {
 	char *name;
 	struct gpiod_line *line;
+	size_t chip;
+};
+
+/* The lines of one chip are requested and set together, so a mux wired to a
+ * single chip never passes through an intermediate selection. A bulk request
+ * cannot span chips: lines on several chips are set one chip at a time. */
+struct console_mux_chip {
+	struct gpiod_chip *chip;
+	struct gpiod_line_bulk bulk;
+	bool requested;
 };
 
 struct console_mux {
 	struct console_gpio *mux_gpios;
 	size_t n_mux_gpios;
+
+	struct console_mux_chip *chips;
+	size_t n_chips;
+
+	struct console_mux_stats stats;
+	struct timespec switched_at;
+	bool first_byte_pending;
+
+	struct console_mux_policy policy;
+
+	/* Rotate through the consoles while no session is attached */
+	bool scanning;
+	bool scan_tagged;
+	struct timespec slice_start;
+
+	/* Switch requests held back by the dwell time or a lease, oldest
+	 * first */
+	struct console **pending;
+	size_t n_pending;
+	struct timespec last_switch;
 };
 
-static const char *key_mux_gpios = "mux-gpios";
 static const char *key_mux_index = "mux-index";
 
 __attribute__((nonnull)) static size_t strtokcnt(const char *str,
@@ -72,8 +105,48 @@ extract_mux_gpio_name(const char **config_gpio_names)
 	return word;
 }
 
+/* Each gpiod_line_find() opens the line's chip anew, and libgpiod only
+ * requests lines in bulk from a single chip handle: look each line up on the
+ * handle already open for its chip, if there is one. */
+__attribute__((nonnull)) static int
+console_mux_add_gpio_chip(struct console_mux *mux, struct console_gpio *gpio)
+{
+	struct gpiod_line *line;
+	const char *chip_name;
+	size_t i;
+
+	chip_name = gpiod_chip_name(gpiod_line_get_chip(gpio->line));
+
+	for (i = 0; i < mux->n_chips; i++) {
+		if (!strcmp(gpiod_chip_name(mux->chips[i].chip), chip_name)) {
+			break;
+		}
+	}
+
+	if (i == mux->n_chips) {
+		mux->chips[i].chip = gpiod_line_get_chip(gpio->line);
+		gpiod_line_bulk_init(&mux->chips[i].bulk);
+		mux->n_chips++;
+	} else {
+		line = gpiod_chip_find_line(mux->chips[i].chip, gpio->name);
+		gpiod_line_close_chip(gpio->line);
+		gpio->line = line;
+		if (!line) {
+			warnx("libgpiod: could not find line %s on %s",
+			      gpio->name, chip_name);
+			return -1;
+		}
+	}
+
+	gpio->chip = i;
+	gpiod_line_bulk_add(&mux->chips[i].bulk, gpio->line);
+
+	return 0;
+}
+
 __attribute__((nonnull)) static struct console_gpio *
-console_mux_find_gpio_by_index(struct console_gpio *gpio,
+console_mux_find_gpio_by_index(struct console_mux *mux,
+			       struct console_gpio *gpio,
 			       const char **config_gpio_names)
 {
 	assert(*config_gpio_names);
@@ -89,6 +162,13 @@ console_mux_find_gpio_by_index(struct console_gpio *gpio,
 	if (gpio->line == NULL) {
 		warnx("libgpiod: could not find line %s", gpio->name);
 		free(gpio->name);
+		gpio->name = NULL;
+		return NULL;
+	}
+
+	if (console_mux_add_gpio_chip(mux, gpio)) {
+		free(gpio->name);
+		gpio->name = NULL;
 		return NULL;
 	}
 
@@ -96,102 +176,140 @@ console_mux_find_gpio_by_index(struct console_gpio *gpio,
 }
 
 __attribute__((nonnull)) static void
-console_mux_release_gpio_lines(struct console_server *server)
+console_mux_release_gpio_lines(struct upstream_tty *tty)
 {
-	for (unsigned long i = 0; i < server->mux->n_mux_gpios; i++) {
-		struct console_gpio *gpio = &server->mux->mux_gpios[i];
-		gpiod_line_release(gpio->line);
-		gpiod_line_close_chip(gpio->line);
+	struct console_mux *mux = tty->mux;
+
+	for (size_t i = 0; i < mux->n_chips; i++) {
+		struct console_mux_chip *chip = &mux->chips[i];
+
+		if (chip->requested) {
+			gpiod_line_release_bulk(&chip->bulk);
+			chip->requested = false;
+		}
+		gpiod_chip_close(chip->chip);
+		chip->chip = NULL;
+	}
+	mux->n_chips = 0;
 
+	for (size_t i = 0; i < mux->n_mux_gpios; i++) {
+		struct console_gpio *gpio = &mux->mux_gpios[i];
+
+		gpio->line = NULL;
 		free(gpio->name);
 		gpio->name = NULL;
 	}
 }
 
 __attribute__((nonnull)) static int
-console_mux_request_gpio_lines(struct console_server *server,
+console_mux_request_gpio_lines(struct upstream_tty *tty,
 			       const char *config_gpio_names)
 {
+	int values[GPIOD_LINE_BULK_MAX_LINES] = { 0 };
 	const char *current = config_gpio_names;
+	struct console_mux *mux = tty->mux;
 	struct console_gpio *gpio;
 	int status = 0;
 
-	for (server->mux->n_mux_gpios = 0; *current;
-	     server->mux->n_mux_gpios++) {
-		size_t i = server->mux->n_mux_gpios;
-		gpio = console_mux_find_gpio_by_index(
-			&server->mux->mux_gpios[i], &current);
+	for (mux->n_mux_gpios = 0; *current; mux->n_mux_gpios++) {
+		size_t i = mux->n_mux_gpios;
+		gpio = console_mux_find_gpio_by_index(mux, &mux->mux_gpios[i],
+						      &current);
 		if (gpio == NULL) {
-			console_mux_release_gpio_lines(server);
+			console_mux_release_gpio_lines(tty);
 			return -1;
 		}
+	}
+
+	/* All lines start low, selecting mux-index 0 */
+	for (size_t i = 0; i < mux->n_chips; i++) {
+		struct console_mux_chip *chip = &mux->chips[i];
 
-		status = gpiod_line_request_output(
-			gpio->line, program_invocation_short_name, 0);
+		status = gpiod_line_request_bulk_output(
+			&chip->bulk, program_invocation_short_name, values);
 		if (status != 0) {
-			warnx("could not set line %s as output", gpio->name);
-			warnx("releasing all lines already requested");
-			console_mux_release_gpio_lines(server);
+			warn("could not set mux lines on %s as outputs",
+			     gpiod_chip_name(chip->chip));
+			console_mux_release_gpio_lines(tty);
 			return -1;
 		}
+		chip->requested = true;
 	}
 
 	return 0;
 }
 
-int console_server_mux_init(struct console_server *server)
+int console_tty_mux_init(struct upstream_tty *tty,
+			 const char *config_gpio_names)
 {
-	const char *config_gpio_names;
 	size_t max_ngpios;
 	size_t ngpios;
 
-	config_gpio_names = config_get_value(server->config, key_mux_gpios);
 	if (!config_gpio_names) {
 		return 0;
 	}
 
 	ngpios = count_mux_gpios(config_gpio_names);
 	max_ngpios = sizeof(((struct console *)0)->mux_index) * CHAR_BIT;
-	if (ngpios > max_ngpios) {
+	if (ngpios > max_ngpios || ngpios > GPIOD_LINE_BULK_MAX_LINES) {
 		return -1;
 	}
 
-	server->mux = calloc(1, sizeof(struct console_mux));
-	if (!server->mux) {
+	tty->mux = calloc(1, sizeof(struct console_mux));
+	if (!tty->mux) {
 		return -1;
 	}
 
-	server->mux->n_mux_gpios = 0;
-	server->mux->mux_gpios = calloc(ngpios, sizeof(struct console_gpio));
-	if (!server->mux->mux_gpios) {
+	tty->mux->n_mux_gpios = 0;
+	tty->mux->mux_gpios = calloc(ngpios, sizeof(struct console_gpio));
+	if (!tty->mux->mux_gpios) {
 		return -1;
 	}
 
-	return console_mux_request_gpio_lines(server, config_gpio_names);
+	tty->mux->chips = calloc(ngpios, sizeof(struct console_mux_chip));
+	if (!tty->mux->chips) {
+		return -1;
+	}
+
+	return console_mux_request_gpio_lines(tty, config_gpio_names);
 }
 
-void console_server_mux_fini(struct console_server *server)
+void console_tty_mux_fini(struct upstream_tty *tty)
 {
-	if (!server->mux) {
+	if (!tty->mux) {
 		return;
 	}
 
-	console_mux_release_gpio_lines(server);
+	console_mux_release_gpio_lines(tty);
+
+	free(tty->mux->mux_gpios);
+	tty->mux->mux_gpios = NULL;
 
-	free(server->mux->mux_gpios);
-	server->mux->mux_gpios = NULL;
+	free(tty->mux->chips);
+	tty->mux->chips = NULL;
 
-	free(server->mux);
-	server->mux = NULL;
+	free(tty->mux->pending);
+
+	free(tty->mux);
+	tty->mux = NULL;
 }
 
 int console_mux_init(struct console *console, struct config *config)
 {
-	if (!console->server->mux) {
+	const char *notices;
+
+	console->mux_notices = true;
+	notices = config_get_section_value(config, console->console_id,
+					   "mux-notices");
+	if (notices && config_parse_bool(notices, &console->mux_notices)) {
+		warnx("Invalid mux-notices '%s'", notices);
+	}
+
+	if (!console->tty->mux) {
 		return 0;
 	}
 
-	if (console->server->mux->n_mux_gpios == 0) {
+	if (console->tty->mux->n_mux_gpios == 0) {
 		return 0;
 	}
 
@@ -213,76 +331,538 @@ int console_mux_init(struct console *console, struct config *config)
 	return 0;
 }
 
+#define TIMESTAMP_MAX_SIZE 32
+
 static int console_timestamp(char *buffer, size_t size)
 {
 	size_t status;
 	time_t rawtime;
-	struct tm *timeinfo;
+	struct tm timeinfo;
 
 	time(&rawtime);
-	timeinfo = gmtime(&rawtime);
+	gmtime_r(&rawtime, &timeinfo);
 
-	status = strftime(buffer, size, "%Y-%m-%d %H:%M:%S UTC", timeinfo);
+	status = strftime(buffer, size, "%Y-%m-%d %H:%M:%S UTC", &timeinfo);
 	return !status;
 }
 
-static int console_print_timestamped(struct console *console,
-				     const char *message)
+static void console_print_timestamped(struct console *console,
+				      const char *timestamp,
+				      const char *message)
 {
-#define TIMESTAMP_MAX_SIZE 32
-	char buf_timestamp[TIMESTAMP_MAX_SIZE];
-	int status;
-	char *buf;
+	char buf[TIMESTAMP_MAX_SIZE + 64];
+	int len;
 
-	status = console_timestamp(buf_timestamp, sizeof(buf_timestamp));
-	if (status != 0) {
-		warnx("Error: unable to print timestamp");
-		return status;
+	if (!console->mux_notices) {
+		return;
 	}
 
-	status = asprintf(&buf, "[obmc-console] %s %s\n", buf_timestamp,
-			  message);
-	if (status == -1) {
-		return -1;
+	len = snprintf(buf, sizeof(buf), "[obmc-console] %s %s\n", timestamp,
+		       message);
+	if (len < 0 || (size_t)len >= sizeof(buf)) {
+		return;
 	}
 
-	ringbuffer_queue(console->rb, (uint8_t *)buf, strlen(buf));
-
-	free(buf);
+	ringbuffer_queue(console->rb, (uint8_t *)buf, len);
+}
 
-	return 0;
+static int64_t timespec_ns_since(const struct timespec *then,
+				 const struct timespec *now)
+{
+	return ((int64_t)now->tv_sec - then->tv_sec) * 1000000000ll +
+	       (now->tv_nsec - then->tv_nsec);
 }
 
 static int console_mux_set_lines(struct console *console)
 {
-	int status = 0;
+	struct console_mux *mux = console->tty->mux;
+	struct console_mux_stats *stats = &mux->stats;
+	int values[GPIOD_LINE_BULK_MAX_LINES];
+	struct timespec start;
+	uint64_t ns;
+	int status;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	for (size_t i = 0; i < console->server->mux->n_mux_gpios; i++) {
-		struct console_gpio *gpio = &console->server->mux->mux_gpios[i];
-		const uint8_t value = (console->mux_index >> i) & 0x1;
+	for (size_t c = 0; c < mux->n_chips; c++) {
+		size_t n = 0;
+
+		/* Bulk order is config order, within each chip */
+		for (size_t i = 0; i < mux->n_mux_gpios; i++) {
+			if (mux->mux_gpios[i].chip == c) {
+				values[n++] =
+					(int)((console->mux_index >> i) & 0x1);
+			}
+		}
 
-		status = gpiod_line_set_value(gpio->line, value);
+		status = gpiod_line_set_value_bulk(&mux->chips[c].bulk,
+						   values);
 		if (status != 0) {
-			warnx("could not set line %s", gpio->name);
+			warnx("could not set mux lines");
 			return -1;
 		}
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &mux->switched_at);
+	mux->first_byte_pending = true;
+
+	ns = (uint64_t)timespec_ns_since(&start, &mux->switched_at);
+	stats->switches++;
+	stats->last_switch_ns = ns;
+	stats->total_switch_ns += ns;
+	if (ns > stats->max_switch_ns) {
+		stats->max_switch_ns = ns;
+	}
+
+	return 0;
+}
+
+void console_mux_get_stats(struct upstream_tty *tty,
+			   struct console_mux_stats *stats)
+{
+	if (tty->mux) {
+		*stats = tty->mux->stats;
+	}
+}
+
+static int64_t timespec_ms_since(const struct timespec *then,
+				 const struct timespec *now)
+{
+	return timespec_ns_since(then, now) / 1000000ll;
+}
+
+static void console_mux_scan_enter(struct console *console,
+				   const struct timespec *now)
+{
+	struct console_mux *mux = console->tty->mux;
+	struct console_scan_stats *scan = &console->scan;
+	uint64_t gap;
+
+	if (scan->left.tv_sec || scan->left.tv_nsec) {
+		gap = (uint64_t)timespec_ms_since(&scan->left, now);
+		if (gap > scan->max_gap_ms) {
+			scan->max_gap_ms = gap;
+		}
+	}
+
+	scan->slices++;
+	mux->slice_start = *now;
+	mux->scan_tagged = false;
+}
+
+static void console_mux_scan_leave(struct console *console,
+				   const struct timespec *now)
+{
+	struct console_mux *mux = console->tty->mux;
+	struct console_scan_stats *scan = &console->scan;
+
+	scan->held_ms += (uint64_t)timespec_ms_since(&mux->slice_start, now);
+	scan->left = *now;
+}
+
+/* Stop rotating, leaving the mux where an interactive session wants it */
+static void console_mux_scan_stop(struct upstream_tty *tty)
+{
+	struct timespec now;
+
+	if (!tty->mux || !tty->mux->scanning) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	console_mux_scan_leave(tty->active, &now);
+	tty->mux->scanning = false;
+}
+
+static bool console_mux_has_sessions(struct upstream_tty *tty)
+{
+	struct console_server *server = tty->server;
+
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		struct console *console = server->consoles[i];
+
+		if (console->tty == tty && console->n_sessions) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void console_mux_set_policy(struct upstream_tty *tty,
+			    const struct console_mux_policy *policy)
+{
+	if (tty->mux) {
+		tty->mux->policy = *policy;
+	}
+}
+
+void console_mux_get_policy(struct upstream_tty *tty,
+			    struct console_mux_policy *policy)
+{
+	if (tty->mux) {
+		*policy = tty->mux->policy;
+	}
+}
+
+/*
+ * Whether the current slice is over. Scanning (re)starts on the active console
+ * once the last session on the tty has gone.
+ */
+bool console_mux_scan_due(struct upstream_tty *tty)
+{
+	struct console_mux *mux = tty->mux;
+	struct timespec now;
+
+	if (!mux || !mux->policy.scan_slice_ms || !tty->active) {
+		return false;
+	}
+
+	if (console_mux_has_sessions(tty)) {
+		console_mux_scan_stop(tty);
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (!mux->scanning) {
+		mux->scanning = true;
+		console_mux_scan_enter(tty->active, &now);
+		return false;
+	}
+
+	return timespec_ms_since(&mux->slice_start, &now) >=
+	       mux->policy.scan_slice_ms;
+}
+
+/* Milliseconds until the current slice ends, or -1 if not scanning */
+static long console_mux_scan_timeout(struct upstream_tty *tty)
+{
+	struct console_mux *mux = tty->mux;
+	struct timespec now;
+	int64_t remaining;
+
+	if (!mux || !mux->policy.scan_slice_ms) {
+		return -1;
+	}
+
+	/* Not started yet: have the next iteration start it */
+	if (!mux->scanning) {
+		return console_mux_has_sessions(tty) ? -1 : 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	remaining = mux->policy.scan_slice_ms -
+		    timespec_ms_since(&mux->slice_start, &now);
+
+	return remaining > 0 ? (long)remaining : 0;
+}
+
+/* Switch the mux to the next console on the tty, for one slice */
+void console_mux_scan_next(struct upstream_tty *tty)
+{
+	struct console_server *server = tty->server;
+	struct console *next = NULL;
+	struct timespec now;
+	size_t cur = 0;
+
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		if (server->consoles[i] == tty->active) {
+			cur = i;
+			break;
+		}
+	}
+
+	for (size_t i = 1; i <= server->n_consoles; i++) {
+		struct console *c =
+			server->consoles[(cur + i) % server->n_consoles];
+
+		if (c->tty == tty) {
+			next = c;
+			break;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (next == tty->active) {
+		/* Nothing else to look at, so just extend the slice */
+		tty->mux->slice_start = now;
+		return;
+	}
+
+	if (console_mux_set_lines(next)) {
+		warnx("Error: unable to set mux gpios, retrying next slice");
+		tty->mux->slice_start = now;
+		return;
+	}
+
+	console_mux_scan_leave(tty->active, &now);
+	tty->active = next;
+	console_mux_scan_enter(next, &now);
+}
+
+/*
+ * Account for data read from the tty on behalf of console: how long the first
+ * byte took to arrive after a switch, and what was captured while scanning.
+ * The first data in each scan slice is marked so that readers of the log can
+ * tell the capture is discontinuous.
+ */
+void console_mux_data(struct console *console, size_t len)
+{
+	struct console_mux *mux = console->tty->mux;
+	char timestamp[TIMESTAMP_MAX_SIZE];
+	struct timespec now;
+	uint64_t ns;
+
+	if (!mux || !len) {
+		return;
+	}
+
+	if (mux->first_byte_pending) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ns = (uint64_t)timespec_ns_since(&mux->switched_at, &now);
+		mux->stats.last_first_byte_ns = ns;
+		if (ns > mux->stats.max_first_byte_ns) {
+			mux->stats.max_first_byte_ns = ns;
+		}
+		mux->first_byte_pending = false;
+	}
+
+	if (!mux->scanning) {
+		return;
+	}
+
+	if (!mux->scan_tagged && !console_timestamp(timestamp,
+						    sizeof(timestamp))) {
+		console_print_timestamped(console, timestamp, "SCAN");
+	}
+	mux->scan_tagged = true;
+
+	console->scan.bytes += len;
+}
+
+/* The console holding the mux, if the policy grants leases */
+struct console *console_mux_owner(struct upstream_tty *tty)
+{
+	if (!tty->mux || !tty->mux->policy.lease || !tty->active) {
+		return NULL;
+	}
+
+	return tty->active->n_sessions ? tty->active : NULL;
+}
+
+struct console *const *console_mux_pending(struct upstream_tty *tty,
+					   size_t *n_pending)
+{
+	if (!tty->mux) {
+		*n_pending = 0;
+		return NULL;
+	}
+
+	*n_pending = tty->mux->n_pending;
+	return tty->mux->pending;
+}
+
+/* Milliseconds until the minimum dwell time has passed, or 0 */
+static int64_t console_mux_dwell_left(struct upstream_tty *tty)
+{
+	struct console_mux *mux = tty->mux;
+	struct timespec now;
+	int64_t left;
+
+	if (!mux->policy.min_dwell_ms) {
+		return 0;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	left = mux->policy.min_dwell_ms -
+	       timespec_ms_since(&mux->last_switch, &now);
+
+	return left > 0 ? left : 0;
+}
+
+static bool console_mux_blocked(struct upstream_tty *tty)
+{
+	if (!tty->mux) {
+		return false;
+	}
+
+	return console_mux_owner(tty) || console_mux_dwell_left(tty);
+}
+
+static bool console_mux_is_pending(struct console_mux *mux,
+				   struct console *console)
+{
+	for (size_t i = 0; i < mux->n_pending; i++) {
+		if (mux->pending[i] == console) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static int console_mux_enqueue(struct console *console)
+{
+	struct console_mux *mux = console->tty->mux;
+	struct console **pending;
+
+	if (console_mux_is_pending(mux, console)) {
+		return 0;
+	}
+
+	pending = reallocarray(mux->pending, mux->n_pending + 1,
+			       sizeof(*mux->pending));
+	if (!pending) {
+		return -1;
+	}
+
+	mux->pending = pending;
+	mux->pending[mux->n_pending++] = console;
+
 	return 0;
 }
 
+static void console_mux_dequeue(struct console_mux *mux, size_t idx)
+{
+	mux->n_pending--;
+	memmove(&mux->pending[idx], &mux->pending[idx + 1],
+		(mux->n_pending - idx) * sizeof(*mux->pending));
+}
+
+static int console_mux_switch(struct console *console);
+
+/*
+ * Grant the oldest switch request still wanted by a session, once the lease
+ * and dwell time allow.
+ */
+void console_mux_service(struct upstream_tty *tty)
+{
+	struct console_mux *mux = tty->mux;
+	struct console *next;
+
+	if (!mux || !mux->n_pending) {
+		return;
+	}
+
+	/* Forget requests from consoles whose sessions have all gone */
+	for (size_t i = 0; i < mux->n_pending;) {
+		if (!mux->pending[i]->n_sessions ||
+		    mux->pending[i] == tty->active) {
+			console_mux_dequeue(mux, i);
+		} else {
+			i++;
+		}
+	}
+
+	if (!mux->n_pending || console_mux_blocked(tty)) {
+		return;
+	}
+
+	next = mux->pending[0];
+	console_mux_dequeue(mux, 0);
+	console_mux_switch(next);
+}
+
+/* Milliseconds until the mux needs attention, or -1 */
+long console_mux_timeout(struct upstream_tty *tty)
+{
+	long timeout = console_mux_scan_timeout(tty);
+	long dwell;
+
+	if (!tty->mux || !tty->mux->n_pending || console_mux_owner(tty)) {
+		return timeout;
+	}
+
+	dwell = (long)console_mux_dwell_left(tty);
+	if (timeout < 0 || dwell < timeout) {
+		return dwell;
+	}
+
+	return timeout;
+}
+
+/*
+ * Ask for the mux to be switched to console. Returns 1 if the request is
+ * queued behind another console's lease or the minimum dwell time.
+ */
 int console_mux_activate(struct console *console)
 {
-	struct console_server *server = console->server;
-	const bool first_activation = server->active == NULL;
-	const bool is_active = server->active == console;
-	int status = 0;
+	struct upstream_tty *tty = console->tty;
+	const bool first_activation = tty->active == NULL;
+
+	console_mux_scan_stop(tty);
+
+	if (tty->active == console) {
+		return 0;
+	}
+
+	if (!first_activation && console_mux_blocked(tty)) {
+		if (console_mux_enqueue(console)) {
+			warnx("Error: unable to queue mux switch");
+			return -1;
+		}
+		return 1;
+	}
+
+	return console_mux_switch(console);
+}
+
+/*
+ * Forget a console that is going away: drop its queued switch request, and if
+ * it holds the mux, leave the tty for another console to be activated.
+ */
+void console_mux_remove(struct console *console)
+{
+	struct upstream_tty *tty = console->tty;
+	struct console_mux *mux = tty->mux;
+
+	for (size_t i = 0; mux && i < mux->n_pending;) {
+		if (mux->pending[i] == console) {
+			console_mux_dequeue(mux, i);
+		} else {
+			i++;
+		}
+	}
 
-	if (is_active) {
+	if (tty->active == console) {
+		console_mux_scan_stop(tty);
+		tty->active = NULL;
+	}
+}
+
+/* Set the lines again for the active console, as its mux-index may change */
+int console_mux_refresh(struct upstream_tty *tty)
+{
+	if (!tty->mux || !tty->mux->n_mux_gpios || !tty->active) {
 		return 0;
 	}
 
-	if (server->mux) {
+	return console_mux_set_lines(tty->active);
+}
+
+/* Let any sessions paused by an earlier switch carry on */
+static void console_mux_select(struct console *console)
+{
+	for (long j = 0; j < console->n_handlers; j++) {
+		struct handler *h = console->handlers[j];
+
+		if (h->type->select) {
+			h->type->select(h);
+		}
+	}
+}
+
+static int console_mux_switch(struct console *console)
+{
+	struct console_server *server = console->server;
+	struct upstream_tty *tty = console->tty;
+	const bool first_activation = tty->active == NULL;
+	char timestamp[TIMESTAMP_MAX_SIZE];
+	int status = 0;
+
+	if (tty->mux) {
 		status = console_mux_set_lines(console);
 	}
 
@@ -291,19 +871,41 @@ int console_mux_activate(struct console *console)
 		return status;
 	}
 
-	server->active = console;
+	/* The initial selection doesn't start the dwell time */
+	if (tty->mux && !first_activation) {
+		clock_gettime(CLOCK_MONOTONIC, &tty->mux->last_switch);
+	}
 
-	/* Don't print disconnect/connect events on startup */
+	TRACE2(mux_switch, first_activation ? "" : tty->active->console_id,
+	       console->console_id);
+	tty->active = console;
+
+	/* Don't print disconnect/connect events on startup, or when the
+	 * console that held the tty was removed by a reload */
 	if (first_activation) {
+		console_mux_select(console);
 		return 0;
 	}
 
+	if (console_timestamp(timestamp, sizeof(timestamp))) {
+		warnx("Error: unable to print timestamp");
+		timestamp[0] = '\0';
+	}
+
 	for (size_t i = 0; i < server->n_consoles; i++) {
 		struct console *other = server->consoles[i];
-		if (other == console) {
+		/* Consoles on other ttys are not affected by this mux */
+		if (other == console || other->tty != tty) {
+			continue;
+		}
+		console_print_timestamped(other, timestamp, "DISCONNECTED");
+
+		/* Only sessions need to be told to let go, and those still
+		 * waiting their turn keep it */
+		if (!other->n_sessions ||
+		    (tty->mux && console_mux_is_pending(tty->mux, other))) {
 			continue;
 		}
-		console_print_timestamped(other, "DISCONNECTED");
 
 		for (long j = 0; j < other->n_handlers; j++) {
 			struct handler *h = other->handlers[j];
@@ -314,7 +916,9 @@ int console_mux_activate(struct console *console)
 		}
 	}
 
-	console_print_timestamped(console, "CONNECTED");
+	console_print_timestamped(console, timestamp, "CONNECTED");
+
+	console_mux_select(console);
 
 	return 0;
 }
@@ -16,11 +16,55 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Cost of switching the mux, and how long the newly selected host took to
+ * produce its first byte */
+struct console_mux_stats {
+	uint64_t switches;
+	uint64_t last_switch_ns;
+	uint64_t max_switch_ns;
+	uint64_t total_switch_ns;
+	uint64_t last_first_byte_ns;
+	uint64_t max_first_byte_ns;
+};
+
+/* How the mux is shared between the consoles on a tty */
+struct console_mux_policy {
+	/* rotate through the consoles while nobody is connected, if set */
+	long scan_slice_ms;
+	/* the least time the mux stays on a console before switching again */
+	long min_dwell_ms;
+	/* a console with sessions holds the mux until they have all gone */
+	bool lease;
+};
+
 struct config;
 struct console;
-struct console_server;
+struct upstream_tty;
 
-int console_server_mux_init(struct console_server *server);
-void console_server_mux_fini(struct console_server *server);
+int console_tty_mux_init(struct upstream_tty *tty,
+			 const char *config_gpio_names);
+void console_tty_mux_fini(struct upstream_tty *tty);
 int console_mux_init(struct console *console, struct config *config);
 int console_mux_activate(struct console *console);
+void console_mux_remove(struct console *console);
+int console_mux_refresh(struct upstream_tty *tty);
+void console_mux_get_stats(struct upstream_tty *tty,
+			   struct console_mux_stats *stats);
+
+void console_mux_set_policy(struct upstream_tty *tty,
+			    const struct console_mux_policy *policy);
+void console_mux_get_policy(struct upstream_tty *tty,
+			    struct console_mux_policy *policy);
+struct console *console_mux_owner(struct upstream_tty *tty);
+struct console *const *console_mux_pending(struct upstream_tty *tty,
+					   size_t *n_pending);
+void console_mux_service(struct upstream_tty *tty);
+long console_mux_timeout(struct upstream_tty *tty);
+
+bool console_mux_scan_due(struct upstream_tty *tty);
+void console_mux_scan_next(struct upstream_tty *tty);
+void console_mux_data(struct console *console, size_t len);
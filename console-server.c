@@ -33,28 +33,49 @@
 #include <time.h>
 #include <termios.h>
 
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <linux/serial.h>
 #include <poll.h>
+#include <systemd/sd-daemon.h>
 
 #include "console-mux.h"
 
 #include "console-server.h"
 #include "config.h"
+#include "history.h"
+#include "trace.h"
 
 #define DEV_PTS_PATH "/dev/pts"
 
 /* default size of the shared backlog ringbuffer */
 const size_t default_buffer_size = 128ul * 1024ul;
 
+/*
+ * On each tty wakeup we read in chunks until the device would block, or until
+ * we hit a byte or time budget. The whole batch is then queued to the
+ * ringbuffer at once, so consumers are notified once per batch rather than
+ * once per chunk.
+ */
+#define TTY_READ_CHUNK	   4096ul
+#define TTY_READ_BATCH_MAX (32ul * 1024ul)
+#define TTY_READ_BATCH_NS  (1000ll * 1000ll)
+
+/* Backoff between attempts to reopen a failed upstream tty */
+#define TTY_RECONNECT_MIN_MS 100l
+#define TTY_RECONNECT_MAX_MS 5000l
+
 /* state shared with the signal handler */
 static volatile sig_atomic_t sigint;
+static volatile sig_atomic_t sighup;
 
 static void usage(const char *progname)
 {
 	fprintf(stderr,
-		"usage: %s [options] <DEVICE>\n"
+		"usage: %s [options] [DEVICE]\n"
 		"\n"
 		"Options:\n"
 		"  --config <FILE>\tUse FILE for configuration\n"
@@ -133,8 +154,8 @@ int console_server_release_pollfd(struct console_server *server,
 	return 0;
 }
 
-/* populates server->tty.dev and server->tty.sysfs_devnode, using the tty kernel name */
-static int tty_find_device(struct console_server *server)
+/* populates tty->dev and tty->sysfs_devnode, using the tty kernel name */
+static int tty_find_device(struct upstream_tty *tty)
 {
 	char *tty_class_device_link = NULL;
 	char *tty_path_input_real = NULL;
@@ -146,23 +167,23 @@ static int tty_find_device(struct console_server *server)
 	char *tty_path_input = NULL;
 	int rc;
 
-	server->tty.type = TTY_DEVICE_UNDEFINED;
+	tty->type = TTY_DEVICE_UNDEFINED;
 
-	assert(server->tty.kname);
-	if (!strlen(server->tty.kname)) {
+	assert(tty->kname);
+	if (!strlen(tty->kname)) {
 		warnx("TTY kname must not be empty");
 		rc = -1;
 		goto out_free;
 	}
 
-	if (server->tty.kname[0] == '/') {
-		tty_path_input = strdup(server->tty.kname);
+	if (tty->kname[0] == '/') {
+		tty_path_input = strdup(tty->kname);
 		if (!tty_path_input) {
 			rc = -1;
 			goto out_free;
 		}
 	} else {
-		rc = asprintf(&tty_path_input, "/dev/%s", server->tty.kname);
+		rc = asprintf(&tty_path_input, "/dev/%s", tty->kname);
 		if (rc < 0) {
 			goto out_free;
 		}
@@ -182,15 +203,15 @@ static int tty_find_device(struct console_server *server)
 	 * https://amboar.github.io/notes/2023/05/02/testing-obmc-console-with-socat.html
 	 */
 	if (!strncmp(DEV_PTS_PATH, tty_path_input_real, strlen(DEV_PTS_PATH))) {
-		server->tty.type = TTY_DEVICE_PTY;
-		server->tty.dev = strdup(server->tty.kname);
-		rc = server->tty.dev ? 0 : -1;
+		tty->type = TTY_DEVICE_PTY;
+		tty->dev = strdup(tty->kname);
+		rc = tty->dev ? 0 : -1;
 		goto out_free;
 	}
 
 	tty_kname_real = basename(tty_path_input_real);
 	if (!tty_kname_real) {
-		warn("Can't find real name for %s", server->tty.kname);
+		warn("Can't find real name for %s", tty->kname);
 		rc = -1;
 		goto out_free;
 	}
@@ -208,13 +229,13 @@ static int tty_find_device(struct console_server *server)
 		goto out_free;
 	}
 
-	rc = asprintf(&server->tty.dev, "/dev/%s", tty_kname_real);
+	rc = asprintf(&tty->dev, "/dev/%s", tty_kname_real);
 	if (rc < 0) {
 		goto out_free;
 	}
 
 	// Default to non-VUART
-	server->tty.type = TTY_DEVICE_UART;
+	tty->type = TTY_DEVICE_UART;
 
 	/* Prior to 6.8, we have the tty device directly under the platform
 	 * device:
@@ -267,8 +288,8 @@ static int tty_find_device(struct console_server *server)
 
 		rc = access(tty_vuart_lpc_addr, F_OK);
 		if (!rc) {
-			server->tty.type = TTY_DEVICE_VUART;
-			server->tty.vuart.sysfs_devnode =
+			tty->type = TTY_DEVICE_VUART;
+			tty->vuart.sysfs_devnode =
 				strdup(tty_sysfs_devnode);
 			break;
 		}
@@ -287,20 +308,20 @@ out_free:
 	return rc;
 }
 
-static int tty_set_sysfs_attr(struct console_server *server, const char *name,
+static int tty_set_sysfs_attr(struct upstream_tty *tty, const char *name,
 			      int value)
 {
 	char *path;
 	FILE *fp;
 	int rc;
 
-	assert(server->tty.type == TTY_DEVICE_VUART);
+	assert(tty->type == TTY_DEVICE_VUART);
 
-	if (!server->tty.vuart.sysfs_devnode) {
+	if (!tty->vuart.sysfs_devnode) {
 		return -1;
 	}
 
-	rc = asprintf(&path, "%s/%s", server->tty.vuart.sysfs_devnode, name);
+	rc = asprintf(&path, "%s/%s", tty->vuart.sysfs_devnode, name);
 	if (rc < 0) {
 		return -1;
 	}
@@ -308,7 +329,7 @@ static int tty_set_sysfs_attr(struct console_server *server, const char *name,
 	fp = fopen(path, "w");
 	if (!fp) {
 		warn("Can't access attribute %s on device %s", name,
-		     server->tty.kname);
+		     tty->kname);
 		rc = -1;
 		goto out_free;
 	}
@@ -317,7 +338,7 @@ static int tty_set_sysfs_attr(struct console_server *server, const char *name,
 	rc = fprintf(fp, "0x%x", value);
 	if (rc < 0) {
 		warn("Error writing to %s attribute of device %s", name,
-		     server->tty.kname);
+		     tty->kname);
 	}
 	fclose(fp);
 
@@ -326,23 +347,77 @@ out_free:
 	return rc;
 }
 
+/* default bound on how long data may wait in the tty when batching reads */
+static const unsigned long default_tty_latency_ms = 10;
+
+/* Pick VMIN so that a full batch takes about the latency budget to arrive */
+static cc_t tty_auto_vmin(struct upstream_tty *tty,
+			  const struct termios *termios)
+{
+	uint32_t baud = 0;
+	unsigned long vmin;
+
+	/* PTYs and VUARTs have no meaningful line rate, assume the usual one */
+	if (tty->type == TTY_DEVICE_UART) {
+		baud = parse_baud_to_int(cfgetispeed(termios));
+	}
+	if (!baud) {
+		baud = 115200;
+	}
+
+	/* 10 bits per character on the wire with 8N1 framing */
+	vmin = (baud / 10) * tty->read_policy.latency_ms / 1000;
+	if (vmin < 1) {
+		vmin = 1;
+	}
+	if (vmin > UINT8_MAX) {
+		vmin = UINT8_MAX;
+	}
+
+	return (cc_t)vmin;
+}
+
+static void tty_set_low_latency(struct upstream_tty *tty, bool enable)
+{
+	struct serial_struct serial;
+	int rc;
+
+	rc = ioctl(tty->fd, TIOCGSERIAL, &serial);
+	if (rc) {
+		warn("Can't read serial settings for %s", tty->kname);
+		return;
+	}
+
+	if (enable) {
+		serial.flags |= ASYNC_LOW_LATENCY;
+	} else {
+		serial.flags &= ~ASYNC_LOW_LATENCY;
+	}
+
+	rc = ioctl(tty->fd, TIOCSSERIAL, &serial);
+	if (rc) {
+		warn("Can't set low latency mode on %s", tty->kname);
+	}
+}
+
 /**
  * Set termios attributes on the console tty.
  */
-void tty_init_termios(struct console_server *server)
+void tty_init_termios(struct upstream_tty *tty)
 {
+	struct tty_read_policy *policy = &tty->read_policy;
 	struct termios termios;
 	int rc;
 
-	rc = tcgetattr(server->tty.fd, &termios);
+	rc = tcgetattr(tty->fd, &termios);
 	if (rc) {
 		warn("Can't read tty termios");
 		return;
 	}
 
-	if (server->tty.type == TTY_DEVICE_UART && server->tty.uart.baud) {
-		if (cfsetspeed(&termios, server->tty.uart.baud) < 0) {
-			warn("Couldn't set speeds for %s", server->tty.kname);
+	if (tty->type == TTY_DEVICE_UART && tty->uart.baud) {
+		if (cfsetspeed(&termios, tty->uart.baud) < 0) {
+			warn("Couldn't set speeds for %s", tty->kname);
 		}
 	}
 
@@ -351,65 +426,123 @@ void tty_init_termios(struct console_server *server)
 	 */
 	cfmakeraw(&termios);
 
-	rc = tcsetattr(server->tty.fd, TCSANOW, &termios);
+	/* The tty is non-blocking and serviced from poll(), where VMIN only
+	 * takes effect with VTIME unset */
+	if (policy->vmin_auto) {
+		termios.c_cc[VMIN] = tty_auto_vmin(tty, &termios);
+	} else if (policy->vmin) {
+		termios.c_cc[VMIN] = policy->vmin;
+	}
+	termios.c_cc[VTIME] = 0;
+	policy->vmin = termios.c_cc[VMIN];
+	tty->read_idle = false;
+
+	rc = tcsetattr(tty->fd, TCSANOW, &termios);
 	if (rc) {
-		warn("Can't set terminal options for %s", server->tty.kname);
+		warn("Can't set terminal options for %s", tty->kname);
+	}
+
+	if (policy->low_latency >= 0 && tty->type != TTY_DEVICE_PTY) {
+		tty_set_low_latency(tty, policy->low_latency);
 	}
 }
 
+double tty_stats_wakeups_per_sec(struct upstream_tty *tty)
+{
+	struct tty_stats *stats = &tty->stats;
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (double)(now.tv_sec - stats->window_start.tv_sec) +
+		  (double)(now.tv_nsec - stats->window_start.tv_nsec) / 1e9;
+
+	/* Account for the current window too, so an idle tty decays to 0 */
+	if (elapsed >= 1.0) {
+		return (double)(stats->wakeups - stats->window_wakeups) /
+		       elapsed;
+	}
+
+	return stats->wakeups_per_sec;
+}
+
 /**
  * Open and initialise the serial device
  */
-static void tty_init_vuart_io(struct console_server *server)
+static void tty_init_vuart_io(struct upstream_tty *tty)
 {
-	assert(server->tty.type == TTY_DEVICE_VUART);
+	assert(tty->type == TTY_DEVICE_VUART);
 
-	if (server->tty.vuart.sirq) {
-		tty_set_sysfs_attr(server, "sirq", server->tty.vuart.sirq);
+	if (tty->vuart.sirq) {
+		tty_set_sysfs_attr(tty, "sirq", tty->vuart.sirq);
 	}
 
-	if (server->tty.vuart.lpc_addr) {
-		tty_set_sysfs_attr(server, "lpc_address",
-				   server->tty.vuart.lpc_addr);
+	if (tty->vuart.lpc_addr) {
+		tty_set_sysfs_attr(tty, "lpc_address",
+				   tty->vuart.lpc_addr);
 	}
 }
 
-static int tty_init_io(struct console_server *server)
+static int tty_open(struct upstream_tty *tty)
 {
-	server->tty.fd = open(server->tty.dev, O_RDWR);
-	if (server->tty.fd <= 0) {
-		warn("Can't open tty %s", server->tty.dev);
+	tty->fd = open(tty->dev, O_RDWR);
+	if (tty->fd <= 0) {
+		warn("Can't open tty %s", tty->dev);
+		tty->fd = -1;
 		return -1;
 	}
 
 	/* Disable character delay. We may want to later enable this when
 	 * we detect larger amounts of data
 	 */
-	fcntl(server->tty.fd, F_SETFL, FNDELAY);
+	fcntl(tty->fd, F_SETFL, FNDELAY);
+
+	tty_init_termios(tty);
 
-	tty_init_termios(server);
+	clock_gettime(CLOCK_MONOTONIC, &tty->stats.window_start);
+	tty->stats.last_service = tty->stats.window_start;
+
+	return 0;
+}
+
+static int tty_init_io(struct upstream_tty *tty)
+{
+	if (tty_open(tty)) {
+		return -1;
+	}
 
 	ssize_t index =
-		console_server_request_pollfd(server, server->tty.fd, POLLIN);
+		console_server_request_pollfd(tty->server, tty->fd, POLLIN);
 
 	if (index < 0) {
 		return -1;
 	}
 
-	server->tty_pollfd_index = (size_t)index;
+	tty->pollfd_index = (size_t)index;
 
 	return 0;
 }
 
-static int tty_init_vuart(struct console_server *server, struct config *config)
+/* Settings for a tty come from the console section that named it, if any */
+static const char *tty_config_value(struct upstream_tty *tty,
+				    struct config *config, const char *name)
+{
+	if (tty->section) {
+		return config_get_console_value(config, tty->section, name);
+	}
+
+	return config_get_value(config, name);
+}
+
+static int tty_init_vuart(struct upstream_tty *tty, struct config *config)
 {
 	unsigned long parsed;
 	const char *val;
 	char *endp;
 
-	assert(server->tty.type == TTY_DEVICE_VUART);
+	assert(tty->type == TTY_DEVICE_VUART);
 
-	val = config_get_value(config, "lpc-address");
+	val = tty_config_value(tty, config, "lpc-address");
 	if (val) {
 		errno = 0;
 		parsed = strtoul(val, &endp, 0);
@@ -424,14 +557,14 @@ static int tty_init_vuart(struct console_server *server, struct config *config)
 			return -1;
 		}
 
-		server->tty.vuart.lpc_addr = (uint16_t)parsed;
+		tty->vuart.lpc_addr = (uint16_t)parsed;
 		if (endp == optarg) {
 			warn("Invalid LPC address: '%s'", val);
 			return -1;
 		}
 	}
 
-	val = config_get_value(config, "sirq");
+	val = tty_config_value(tty, config, "sirq");
 	if (val) {
 		errno = 0;
 		parsed = strtoul(val, &endp, 0);
@@ -444,7 +577,7 @@ static int tty_init_vuart(struct console_server *server, struct config *config)
 			warn("Invalid LPC SERIRQ: '%s'", val);
 		}
 
-		server->tty.vuart.sirq = (int)parsed;
+		tty->vuart.sirq = (int)parsed;
 		if (endp == optarg) {
 			warn("Invalid sirq: '%s'", val);
 		}
@@ -453,39 +586,158 @@ static int tty_init_vuart(struct console_server *server, struct config *config)
 	return 0;
 }
 
-static int tty_init(struct console_server *server, struct config *config,
-		    const char *tty_arg)
+static void tty_init_read_policy(struct upstream_tty *tty,
+				 struct config *config)
+{
+	struct tty_read_policy *policy = &tty->read_policy;
+	unsigned long parsed;
+	const char *val;
+	bool enable;
+
+	policy->vmin_auto = false;
+	policy->vmin = 0;
+	policy->latency_ms = default_tty_latency_ms;
+	policy->low_latency = -1;
+
+	val = tty_config_value(tty, config, "upstream-tty-latency-ms");
+	if (val) {
+		if (config_parse_ulong(val, &parsed) || !parsed) {
+			warnx("Invalid upstream-tty-latency-ms '%s'", val);
+		} else {
+			policy->latency_ms = parsed;
+		}
+	}
+
+	val = tty_config_value(tty, config, "upstream-tty-vmin");
+	if (val) {
+		if (!strcmp(val, "auto")) {
+			policy->vmin_auto = true;
+		} else if (config_parse_ulong(val, &parsed) || !parsed ||
+			   parsed > UINT8_MAX) {
+			warnx("Invalid upstream-tty-vmin '%s'", val);
+		} else {
+			policy->vmin = (cc_t)parsed;
+		}
+	}
+
+	val = tty_config_value(tty, config, "upstream-tty-low-latency");
+	if (val) {
+		if (config_parse_bool(val, &enable)) {
+			warnx("Invalid upstream-tty-low-latency '%s'", val);
+		} else {
+			policy->low_latency = enable;
+		}
+	}
+}
+
+static void tty_fini(struct upstream_tty *tty)
+{
+	struct console_server *server = tty->server;
+
+	console_tty_mux_fini(tty);
+
+	if (tty->pollfd_index < server->capacity_pollfds) {
+		console_server_release_pollfd(server, tty->pollfd_index);
+		tty->pollfd_index = SIZE_MAX;
+	}
+
+	if (tty->fd >= 0) {
+		close(tty->fd);
+	}
+
+	if (tty->type == TTY_DEVICE_VUART) {
+		free(tty->vuart.sysfs_devnode);
+	}
+
+	free(tty->dev);
+	free(tty->section);
+	free(tty->kname);
+	free(tty);
+}
+
+static long tty_config_ms(struct upstream_tty *tty, struct config *config,
+			  const char *name)
+{
+	const char *val;
+	char *endp;
+	long ms;
+
+	val = tty_config_value(tty, config, name);
+	if (!val) {
+		return 0;
+	}
+
+	errno = 0;
+	ms = strtol(val, &endp, 0);
+	if (errno || *endp || ms < 0) {
+		warnx("Invalid %s '%s'", name, val);
+		return 0;
+	}
+
+	return ms;
+}
+
+static void tty_init_mux_policy(struct upstream_tty *tty,
+				struct config *config)
+{
+	struct console_mux_policy policy = { 0 };
+	const char *val;
+
+	policy.scan_slice_ms = tty_config_ms(tty, config, "mux-scan-slice-ms");
+	policy.min_dwell_ms = tty_config_ms(tty, config, "mux-min-dwell-ms");
+
+	val = tty_config_value(tty, config, "mux-lease");
+	if (val && config_parse_bool(val, &policy.lease)) {
+		warnx("Invalid mux-lease '%s'", val);
+	}
+
+	console_mux_set_policy(tty, &policy);
+}
+
+static struct upstream_tty *tty_init(struct console_server *server,
+				     struct config *config, const char *kname,
+				     const char *section)
 {
+	struct upstream_tty *tty;
 	const char *val;
 	int rc;
 
-	if (tty_arg) {
-		server->tty.kname = tty_arg;
-	} else if ((val = config_get_value(config, "upstream-tty"))) {
-		server->tty.kname = val;
-	} else {
-		warnx("Error: No TTY device specified");
-		return -1;
+	tty = calloc(1, sizeof(*tty));
+	if (!tty) {
+		return NULL;
 	}
 
-	rc = tty_find_device(server);
+	tty->server = server;
+	tty->fd = -1;
+	tty->pollfd_index = SIZE_MAX;
+
+	/* Both outlive the config they came from, across a reload */
+	tty->kname = strdup(kname);
+	tty->section = section ? strdup(section) : NULL;
+	if (!tty->kname || (section && !tty->section)) {
+		goto err_fini;
+	}
+
+	rc = tty_find_device(tty);
 	if (rc) {
-		return rc;
+		goto err_fini;
 	}
 
-	switch (server->tty.type) {
+	tty_init_read_policy(tty, config);
+
+	switch (tty->type) {
 	case TTY_DEVICE_VUART:
-		rc = tty_init_vuart(server, config);
+		rc = tty_init_vuart(tty, config);
 		if (rc) {
-			return rc;
+			goto err_fini;
 		}
 
-		tty_init_vuart_io(server);
+		tty_init_vuart_io(tty);
 		break;
 	case TTY_DEVICE_UART:
-		val = config_get_value(config, "baud");
+		val = tty_config_value(tty, config, "baud");
 		if (val) {
-			if (config_parse_baud(&server->tty.uart.baud, val)) {
+			if (config_parse_baud(&tty->uart.baud, val)) {
 				warnx("Invalid baud rate: '%s'", val);
 			}
 		}
@@ -495,24 +747,60 @@ static int tty_init(struct console_server *server, struct config *config,
 	case TTY_DEVICE_UNDEFINED:
 	default:
 		warnx("Cannot configure unrecognised TTY device");
-		return -1;
+		goto err_fini;
+	}
+
+	rc = console_tty_mux_init(tty, tty_config_value(tty, config,
+							"mux-gpios"));
+	if (rc) {
+		goto err_fini;
+	}
+
+	tty_init_mux_policy(tty, config);
+
+	rc = tty_init_io(tty);
+	if (rc) {
+		goto err_fini;
 	}
 
-	return tty_init_io(server);
+	return tty;
+
+err_fini:
+	tty_fini(tty);
+	return NULL;
 }
 
-static void tty_fini(struct console_server *server)
+/* Find the tty named by kname, initialising it on first use */
+static struct upstream_tty *
+console_server_get_tty(struct console_server *server, const char *kname,
+		       const char *section)
 {
-	if (server->tty_pollfd_index < server->capacity_pollfds) {
-		console_server_release_pollfd(server, server->tty_pollfd_index);
-		server->tty_pollfd_index = SIZE_MAX;
+	struct upstream_tty **ttys;
+	struct upstream_tty *tty;
+
+	for (size_t i = 0; i < server->n_ttys; i++) {
+		if (!strcmp(server->ttys[i]->kname, kname)) {
+			return server->ttys[i];
+		}
+	}
+
+	ttys = reallocarray(server->ttys, server->n_ttys + 1,
+			    sizeof(*server->ttys));
+	if (!ttys) {
+		warnx("could not realloc server->ttys");
+		return NULL;
 	}
+	server->ttys = ttys;
 
-	if (server->tty.type == TTY_DEVICE_VUART) {
-		free(server->tty.vuart.sysfs_devnode);
+	tty = tty_init(server, server->config, kname, section);
+	if (!tty) {
+		warnx("error during tty_init for %s", kname);
+		return NULL;
 	}
 
-	free(server->tty.dev);
+	server->ttys[server->n_ttys++] = tty;
+
+	return tty;
 }
 
 static int write_to_path(const char *path, const char *data)
@@ -623,18 +911,19 @@ out_free_glob:
 
 int console_data_out(struct console *console, const uint8_t *data, size_t len)
 {
-	return write_buf_to_fd(console->server->tty.fd, data, len);
+	/* Drop input while the upstream tty is being reopened */
+	if (console->tty->fd < 0) {
+		return 0;
+	}
+
+	return write_buf_to_fd(console->tty->fd, data, len);
 }
 
 /* Prepare a socket name */
-static int set_socket_info(struct console *console, struct config *config,
-			   const char *console_id)
+static int set_socket_info(struct console *console)
 {
 	ssize_t len;
 
-	/* Get console id */
-	console->console_id = config_resolve_console_id(config, console_id);
-
 	/* Get the socket name/path */
 	len = console_socket_path(console->socket_name, console->console_id);
 	if (len < 0) {
@@ -648,12 +937,39 @@ static int set_socket_info(struct console *console, struct config *config,
 	return 0;
 }
 
+/* NOLINTBEGIN(bugprone-reserved-identifier,cert-dcl37-c,cert-dcl51-cpp) */
+extern const struct handler_type *const __start_handlers[];
+extern const struct handler_type *const __stop_handlers[];
+/* NOLINTEND(bugprone-reserved-identifier,cert-dcl37-c,cert-dcl51-cpp) */
+
+static struct handler *handler_init(const struct handler_type *type,
+				    struct console *console,
+				    struct config *config)
+{
+	struct handler *handler;
+
+	/* Should be picked up at build time by
+	 * console_handler_register, but check anyway
+	 */
+	if (!type->init || !type->fini) {
+		errx(EXIT_FAILURE, "invalid handler type %s: no init() / fini()",
+		     type->name);
+	}
+
+	handler = type->init(type, console, config);
+
+	printf("  console '%s': handler %s [%sactive]\n", console->console_id,
+	       type->name, handler ? "" : "in");
+
+	if (handler) {
+		handler->type = type;
+	}
+
+	return handler;
+}
+
 static void handlers_init(struct console *console, struct config *config)
 {
-	/* NOLINTBEGIN(bugprone-reserved-identifier,cert-dcl37-c,cert-dcl51-cpp) */
-	extern const struct handler_type *const __start_handlers[];
-	extern const struct handler_type *const __stop_handlers[];
-	/* NOLINTEND(bugprone-reserved-identifier,cert-dcl37-c,cert-dcl51-cpp) */
 	size_t n_types;
 	int j = 0;
 	size_t i;
@@ -667,29 +983,64 @@ static void handlers_init(struct console *console, struct config *config)
 	printf("%zu handler type%s\n", n_types, n_types == 1 ? "" : "s");
 
 	for (i = 0; i < n_types; i++) {
-		const struct handler_type *type = __start_handlers[i];
 		struct handler *handler;
 
-		/* Should be picked up at build time by
-		 * console_handler_register, but check anyway
-		 */
-		if (!type->init || !type->fini) {
-			errx(EXIT_FAILURE,
-			     "invalid handler type %s: no init() / fini()",
-			     type->name);
+		handler = handler_init(__start_handlers[i], console, config);
+		if (handler) {
+			console->handlers[j++] = handler;
+		}
+	}
+
+	console->n_handlers = j;
+}
+
+/*
+ * Apply config to the console's handlers. Those that can't take it in place
+ * are restarted, and handlers may come and go as their settings do.
+ */
+static void handlers_reload(struct console *console, struct config *config)
+{
+	struct handler **handlers;
+	size_t n_types;
+	int j = 0;
+
+	n_types = __stop_handlers - __start_handlers;
+	handlers = calloc(n_types, sizeof(struct handler *));
+	if (!handlers) {
+		err(EXIT_FAILURE, "malloc(handlers)");
+	}
+
+	for (size_t i = 0; i < n_types; i++) {
+		const struct handler_type *type = __start_handlers[i];
+		struct handler *handler = NULL;
+
+		/* Clear the old slot, as the handler may be freed below */
+		for (long k = 0; k < console->n_handlers; k++) {
+			if (console->handlers[k] &&
+			    console->handlers[k]->type == type) {
+				handler = console->handlers[k];
+				console->handlers[k] = NULL;
+				break;
+			}
 		}
 
-		handler = type->init(type, console, config);
+		if (handler && type->reload && !type->reload(handler, config)) {
+			handlers[j++] = handler;
+			continue;
+		}
 
-		printf("  console '%s': handler %s [%sactive]\n",
-		       console->console_id, type->name, handler ? "" : "in");
+		if (handler) {
+			type->fini(handler);
+		}
 
+		handler = handler_init(type, console, config);
 		if (handler) {
-			handler->type = type;
-			console->handlers[j++] = handler;
+			handlers[j++] = handler;
 		}
 	}
 
+	free(console->handlers);
+	console->handlers = handlers;
 	console->n_handlers = j;
 }
 
@@ -736,6 +1087,14 @@ console_ringbuffer_consumer_register(struct console *console,
 	return ringbuffer_consumer_register(console->rb, poll_fn, data);
 }
 
+struct ringbuffer_consumer *
+console_ringbuffer_consumer_register_backlog(struct console *console,
+					     ringbuffer_poll_fn_t poll_fn,
+					     void *data)
+{
+	return ringbuffer_consumer_register_backlog(console->rb, poll_fn, data);
+}
+
 struct poller *console_poller_register(struct console *console,
 				       struct handler *handler,
 				       poller_event_fn_t poller_fn,
@@ -901,8 +1260,12 @@ static int call_pollers(struct console *console, struct timeval *cur_time)
 
 		/* process pending events... */
 		if (pollfd->revents) {
+			TRACE3(poller_dispatch, poller->handler->type->name,
+			       pollfd->fd, pollfd->revents);
 			prc = poller->event_fn(poller->handler, pollfd->revents,
 					       poller->data);
+			TRACE2(poller_dispatch_done,
+			       poller->handler->type->name, prc);
 			if (prc == POLLER_EXIT) {
 				rc = -1;
 			} else if (prc == POLLER_REMOVE) {
@@ -918,7 +1281,11 @@ static int call_pollers(struct console *console, struct timeval *cur_time)
 			desired has expired.  Process the buffered data for
 			transmission. */
 			timerclear(&poller->timeout);
+			TRACE3(poller_dispatch, poller->handler->type->name,
+			       pollfd->fd, 0);
 			prc = poller->timeout_fn(poller->handler, poller->data);
+			TRACE2(poller_dispatch_done,
+			       poller->handler->type->name, prc);
 			if (prc == POLLER_EXIT) {
 				rc = -1;
 			} else if (prc == POLLER_REMOVE) {
@@ -952,9 +1319,13 @@ static int call_pollers(struct console *console, struct timeval *cur_time)
 
 static void sighandler(int signal)
 {
-	if (signal == SIGINT) {
+	if (signal == SIGINT || signal == SIGTERM) {
 		sigint = 1;
 	}
+
+	if (signal == SIGHUP) {
+		sighup = 1;
+	}
 }
 
 static int run_console_per_console(struct console *console, size_t buf_size,
@@ -982,146 +1353,667 @@ static int run_console_per_console(struct console *console, size_t buf_size,
 	return 0;
 }
 
-static int run_console_iteration(struct console_server *server)
+static int64_t timespec_diff_ns(const struct timespec *a,
+				const struct timespec *b)
 {
-	struct timeval tv;
-	uint8_t buf[4096];
-	long timeout;
+	return ((int64_t)a->tv_sec - b->tv_sec) * 1000000000ll +
+	       (a->tv_nsec - b->tv_nsec);
+}
+
+/* Returns the number of bytes read, or -1 if the tty has failed */
+static ssize_t tty_read_batch(struct upstream_tty *tty, uint8_t *buf,
+			      size_t budget)
+{
+	struct tty_stats *stats = &tty->stats;
+	struct timespec start;
+	struct timespec now;
+	size_t len = 0;
 	ssize_t rc;
 
-	rc = get_current_time(&tv);
-	if (rc) {
-		warn("Failed to read current time");
-		return -1;
-	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	timeout = get_poll_timeout(server->active, &tv);
+	stats->wakeups++;
+	stats->last_service = start;
+	if (timespec_diff_ns(&start, &stats->window_start) >= 1000000000ll) {
+		stats->wakeups_per_sec =
+			(double)(stats->wakeups - stats->window_wakeups) * 1e9 /
+			(double)timespec_diff_ns(&start, &stats->window_start);
+		stats->window_start = start;
+		stats->window_wakeups = stats->wakeups;
+	}
 
-	rc = poll(server->pollfds, server->capacity_pollfds, (int)timeout);
+	while (len < budget) {
+		size_t chunk = budget - len;
 
-	if (sigint) {
-		warnx("Received interrupt, exiting\n");
-		return -1;
-	}
+		if (chunk > TTY_READ_CHUNK) {
+			chunk = TTY_READ_CHUNK;
+		}
 
-	if (rc < 0) {
-		if (errno == EINTR) {
-			return 0;
+		rc = read(tty->fd, buf + len, chunk);
+		if (rc < 0 && errno == EINTR) {
+			continue;
 		}
-		warn("poll error");
-		return -1;
-	}
 
-	/* process internal fd first */
-	if (server->pollfds[server->tty_pollfd_index].revents) {
-		rc = read(server->tty.fd, buf, sizeof(buf));
 		if (rc <= 0) {
-			warn("Error reading from tty device");
-			return -1;
+			/* Drained, or failed: queue what we have, if anything,
+			 * and let the next poll() report any error */
+			if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				break;
+			}
+			if (rc == 0) {
+				/* The other end hung up */
+				errno = EIO;
+			}
+			return len ? (ssize_t)len : -1;
 		}
 
-		rc = ringbuffer_queue(server->active->rb, buf, rc);
-		if (rc) {
-			return -1;
+		len += rc;
+		stats->reads++;
+		stats->bytes += rc;
+		TRACE2(tty_read, tty->kname, rc);
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (timespec_diff_ns(&now, &start) >= TTY_READ_BATCH_NS) {
+			break;
 		}
 	}
 
-	// process dbus
-	struct pollfd *dbus_pollfd =
-		&(server->pollfds[server->dbus_pollfd_index]);
-	if (dbus_pollfd->revents) {
-		sd_bus_process(server->bus, NULL);
+	return (ssize_t)len;
+}
+
+static size_t tty_read_budget(struct console *console)
+{
+	size_t budget = console->rb->size / 4;
+
+	/* Keep batches small relative to the ringbuffer, so a slow consumer
+	 * is only rarely forced to drain */
+	if (budget > TTY_READ_BATCH_MAX) {
+		budget = TTY_READ_BATCH_MAX;
 	}
 
-	for (size_t i = 0; i < server->n_consoles; i++) {
-		struct console *console = server->consoles[i];
+	if (budget < TTY_READ_CHUNK) {
+		budget = TTY_READ_CHUNK;
+	}
 
-		rc = run_console_per_console(console, sizeof(buf), &tv);
-		if (rc != 0) {
-			return -1;
-		}
+	/* ringbuffer_queue() rejects anything that doesn't fit */
+	if (budget >= console->rb->size) {
+		budget = console->rb->size - 1;
 	}
 
-	return 0;
+	return budget;
 }
 
-int run_server(struct console_server *server)
+/* Combine poll() timeouts, where a negative value means no timeout */
+static long poll_timeout_min(long a, long b)
 {
-	sighandler_t sighandler_save;
-	ssize_t rc = 0;
-
-	if (server->n_consoles == 0) {
-		warnx("no console configured for this server");
-		return -1;
+	if (a < 0) {
+		return b;
 	}
 
-	sighandler_save = signal(SIGINT, sighandler);
-	for (;;) {
-		rc = run_console_iteration(server);
-		if (rc) {
-			break;
-		}
+	if (b < 0) {
+		return a;
 	}
-	signal(SIGINT, sighandler_save);
 
-	return rc ? -1 : 0;
+	return a < b ? a : b;
 }
 
-static const struct option options[] = {
-	{ "config", required_argument, 0, 'c' },
-	{ "console-id", required_argument, 0, 'i' },
-	{ 0, 0, 0, 0 },
-};
-
-static struct console *console_init(struct console_server *server,
-				    struct config *config,
-				    const char *console_id)
+/* With VMIN batching, wake up in time to collect a partial batch */
+static long tty_poll_timeout(struct upstream_tty *tty, long timeout)
 {
-	size_t buffer_size = default_buffer_size;
-	const char *buffer_size_str = NULL;
-	int rc;
+	long budget = (long)tty->read_policy.latency_ms;
+	struct timespec now;
+	int64_t remaining;
 
-	struct console *console = calloc(1, sizeof(struct console));
-	if (console == NULL) {
-		return NULL;
+	if (tty->fd < 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		remaining = timespec_diff_ns(&tty->reconnect.at, &now);
+		remaining = remaining > 0 ? (remaining + 999999ll) / 1000000ll :
+					    0;
+		return poll_timeout_min(timeout, (long)remaining);
 	}
 
-	console->server = server;
-	console->console_id = console_id;
+	if (tty->read_policy.vmin <= 1 || tty->read_idle) {
+		return timeout;
+	}
 
-	buffer_size_str =
-		config_get_section_value(config, console_id, "ringbuffer-size");
+	if (timeout < 0 || timeout > budget) {
+		return budget;
+	}
+
+	return timeout;
+}
+
+static bool tty_latency_expired(struct upstream_tty *tty)
+{
+	const struct tty_read_policy *policy = &tty->read_policy;
+	struct timespec now;
 
-	if (!buffer_size_str) {
-		buffer_size_str = config_get_value(config, "ringbuffer-size");
+	if (policy->vmin <= 1 || tty->read_idle) {
+		return false;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return timespec_diff_ns(&now, &tty->stats.last_service) >=
+	       (int64_t)policy->latency_ms * 1000000ll;
+}
+
+static bool tty_read_pending(struct upstream_tty *tty)
+{
+	int pending;
+
+	if (ioctl(tty->fd, FIONREAD, &pending)) {
+		return true;
+	}
+
+	return pending > 0;
+}
+
+/*
+ * A partial batch doesn't make the tty poll readable, so with vmin > 1 the
+ * latency deadline is what collects it. Once a deadline finds nothing
+ * buffered, the tty is idle: drop VMIN to 1 and block in poll() until the
+ * next byte, then go back to batching.
+ */
+static void tty_set_read_idle(struct upstream_tty *tty, bool idle)
+{
+	struct termios termios;
+
+	if (tty->read_idle == idle) {
+		return;
+	}
+
+	if (tcgetattr(tty->fd, &termios)) {
+		warn("Can't read tty termios");
+		return;
+	}
+
+	termios.c_cc[VMIN] = idle ? 1 : tty->read_policy.vmin;
+	if (tcsetattr(tty->fd, TCSANOW, &termios)) {
+		warn("Can't set terminal options for %s", tty->kname);
+		return;
+	}
+
+	tty->read_idle = idle;
+}
+
+static void tty_backoff(struct upstream_tty *tty)
+{
+	tty->reconnect.backoff_ms *= 2;
+	if (tty->reconnect.backoff_ms > TTY_RECONNECT_MAX_MS) {
+		tty->reconnect.backoff_ms = TTY_RECONNECT_MAX_MS;
+	}
+}
+
+static void tty_schedule_reconnect(struct upstream_tty *tty)
+{
+	int64_t at;
+
+	clock_gettime(CLOCK_MONOTONIC, &tty->reconnect.at);
+	at = (int64_t)tty->reconnect.at.tv_nsec +
+	     (int64_t)tty->reconnect.backoff_ms * 1000000ll;
+	tty->reconnect.at.tv_sec += (time_t)(at / 1000000000ll);
+	tty->reconnect.at.tv_nsec = (long)(at % 1000000000ll);
+}
+
+/*
+ * Close a failed tty, keeping its consoles, their clients and ringbuffers.
+ * The device is reopened from tty_service() once the backoff expires.
+ */
+static void tty_disconnect(struct upstream_tty *tty)
+{
+	struct pollfd *pfd = &tty->server->pollfds[tty->pollfd_index];
+
+	warnx("Lost upstream tty %s, reconnecting", tty->kname);
+
+	close(tty->fd);
+	tty->fd = -1;
+
+	/* poll() ignores negative fds, so the slot stays reserved */
+	pfd->fd = -1;
+	pfd->events = 0;
+	pfd->revents = 0;
+
+	/* A tty that fails again before it has read anything, such as one
+	 * that reopens but errors on its first read, keeps backing off */
+	tty->reconnect.attempts = 0;
+	if (tty->reconnect.backoff_ms) {
+		tty_backoff(tty);
+	} else {
+		tty->reconnect.backoff_ms = TTY_RECONNECT_MIN_MS;
+	}
+	tty_schedule_reconnect(tty);
+}
+
+static bool tty_reconnect_due(struct upstream_tty *tty)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return timespec_diff_ns(&now, &tty->reconnect.at) >= 0;
+}
+
+/*
+ * Look the device up again, as it may have been renamed or rebound, then
+ * reapply the VUART and termios settings.
+ */
+static void tty_reconnect(struct upstream_tty *tty)
+{
+	struct upstream_tty probe = { .kname = tty->kname };
+	struct pollfd *pfd;
+	int rc;
+
+	tty->reconnect.attempts++;
+
+	rc = tty_find_device(&probe);
+	if (!rc && probe.type != tty->type) {
+		warnx("Upstream tty %s changed type, not reconnecting",
+		      tty->kname);
+		rc = -1;
+	}
+
+	if (rc) {
+		free(probe.dev);
+		if (probe.type == TTY_DEVICE_VUART) {
+			free(probe.vuart.sysfs_devnode);
+		}
+		goto backoff;
+	}
+
+	free(tty->dev);
+	tty->dev = probe.dev;
+
+	if (tty->type == TTY_DEVICE_VUART) {
+		free(tty->vuart.sysfs_devnode);
+		tty->vuart.sysfs_devnode = probe.vuart.sysfs_devnode;
+		tty_init_vuart_io(tty);
+	}
+
+	rc = tty_open(tty);
+	if (rc) {
+		goto backoff;
+	}
+
+	pfd = &tty->server->pollfds[tty->pollfd_index];
+	pfd->fd = tty->fd;
+	pfd->events = POLLIN;
+	pfd->revents = 0;
+
+	warnx("Reconnected upstream tty %s after %u attempt(s)", tty->kname,
+	      tty->reconnect.attempts);
+
+	return;
+
+backoff:
+	tty_backoff(tty);
+	tty_schedule_reconnect(tty);
+}
+
+static int tty_service(struct upstream_tty *tty, uint8_t *buf)
+{
+	struct console_server *server = tty->server;
+	bool scan_due;
+	ssize_t rc;
+
+	console_mux_service(tty);
+
+	if (tty->fd < 0) {
+		if (tty_reconnect_due(tty)) {
+			tty_reconnect(tty);
+		}
+		return 0;
+	}
+
+	scan_due = console_mux_scan_due(tty);
+
+	if (!server->pollfds[tty->pollfd_index].revents) {
+		if (!tty_latency_expired(tty) && !scan_due) {
+			return 0;
+		}
+		if (!scan_due && !tty_read_pending(tty)) {
+			tty_set_read_idle(tty, true);
+			return 0;
+		}
+	}
+
+	/* Reading arms the latency deadline again */
+	tty_set_read_idle(tty, false);
+
+	/* Read what is ready. At the end of a scan slice, that collects what is
+	 * left for the console being switched away from */
+	rc = tty_read_batch(tty, buf, tty_read_budget(tty->active));
+	if (rc < 0) {
+		warn("Error reading from tty device %s", tty->kname);
+		tty_disconnect(tty);
+		return 0;
+	}
+
+	/* The tty works again, so a later failure starts a fresh backoff */
+	if (rc) {
+		tty->reconnect.backoff_ms = 0;
+	}
+
+	console_mux_data(tty->active, rc);
+	if (ringbuffer_queue(tty->active->rb, buf, rc)) {
+		return -1;
+	}
+
+	if (scan_due) {
+		console_mux_scan_next(tty);
+	}
+
+	return 0;
+}
+
+static int console_server_reload(struct console_server *server);
+
+static int run_console_iteration(struct console_server *server)
+{
+	uint8_t buf[TTY_READ_BATCH_MAX];
+	struct timeval tv;
+	long timeout;
+	ssize_t rc;
+
+	rc = get_current_time(&tv);
+	if (rc) {
+		warn("Failed to read current time");
+		return -1;
+	}
+
+	/* Consoles the mux has switched away from may still have clients
+	 * with data buffered, so consider every console's pollers */
+	timeout = -1;
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		timeout = poll_timeout_min(
+			timeout, get_poll_timeout(server->consoles[i], &tv));
+	}
+
+	for (size_t i = 0; i < server->n_ttys; i++) {
+		struct upstream_tty *tty = server->ttys[i];
+
+		timeout = tty_poll_timeout(tty, timeout);
+		timeout = poll_timeout_min(timeout, console_mux_timeout(tty));
+	}
+
+	timeout = poll_timeout_min(timeout, dbus_server_timeout(server));
+
+	rc = poll(server->pollfds, server->capacity_pollfds, (int)timeout);
+
+	if (sigint) {
+		warnx("Received interrupt, exiting\n");
+		return -1;
+	}
+
+	/* The pollfds may move, so leave their events to the next poll */
+	if (sighup) {
+		sighup = 0;
+		warnx("Received hangup, reloading configuration");
+		console_server_reload(server);
+		return 0;
+	}
+
+	if (rc < 0) {
+		if (errno == EINTR) {
+			return 0;
+		}
+		warn("poll error");
+		return -1;
+	}
+
+	/* process internal fds first */
+	for (size_t i = 0; i < server->n_ttys; i++) {
+		rc = tty_service(server->ttys[i], buf);
+		if (rc) {
+			return -1;
+		}
+	}
+
+	// process dbus
+	dbus_server_process(server);
+
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		struct console *console = server->consoles[i];
+
+		rc = run_console_per_console(console, TTY_READ_CHUNK, &tv);
+		if (rc != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int run_server(struct console_server *server)
+{
+	sighandler_t sigterm_save;
+	sighandler_t sigint_save;
+	sighandler_t sighup_save;
+	ssize_t rc = 0;
+
+	if (server->n_consoles == 0) {
+		warnx("no console configured for this server");
+		return -1;
+	}
+
+	/* Exit through console_server_fini() on SIGTERM too, so that handlers
+	 * holding data back (such as a staged log) get to flush it */
+	sigint_save = signal(SIGINT, sighandler);
+	sigterm_save = signal(SIGTERM, sighandler);
+	sighup_save = signal(SIGHUP, sighandler);
+	for (;;) {
+		rc = run_console_iteration(server);
+		if (rc) {
+			break;
+		}
+	}
+	signal(SIGHUP, sighup_save);
+	signal(SIGTERM, sigterm_save);
+	signal(SIGINT, sigint_save);
+
+	/* Being asked to stop isn't a failure */
+	return (rc && !sigint) ? -1 : 0;
+}
+
+static const struct option options[] = {
+	{ "config", required_argument, 0, 'c' },
+	{ "console-id", required_argument, 0, 'i' },
+	{ 0, 0, 0, 0 },
+};
+
+/*
+ * With a ringbuffer arena, the console's 'ringbuffer-size' is the most of the
+ * arena it may take, and 'ringbuffer-min-size' what it keeps when other
+ * consoles need the space.
+ */
+static struct ringbuffer *
+console_ringbuffer_init_arena(struct ringbuffer_arena *arena,
+			      struct config *config, const char *console_id,
+			      size_t size)
+{
+	size_t min_size = ringbuffer_arena_chunk_size(arena);
+	const char *val;
+
+	val = config_get_console_value(config, console_id,
+				       "ringbuffer-min-size");
+	if (val && config_parse_bytesize(val, &min_size)) {
+		warnx("Invalid ringbuffer-min-size '%s'", val);
+		min_size = ringbuffer_arena_chunk_size(arena);
+	}
+
+	return ringbuffer_init_arena(arena, min_size, size);
+}
+
+/*
+ * With 'ringbuffer-dir' set, the ringbuffer is backed by a file there, so its
+ * history survives a restart of the server.
+ */
+static struct ringbuffer *console_ringbuffer_init(struct console_server *server,
+						  struct config *config,
+						  const char *console_id,
+						  size_t size)
+{
+	struct ringbuffer *rb;
+	const char *dir;
+	char *path;
+	int rc;
+
+	dir = config_get_console_value(config, console_id, "ringbuffer-dir");
+	if (!dir && server->rb_arena) {
+		return console_ringbuffer_init_arena(server->rb_arena, config,
+						     console_id, size);
+	}
+
+	if (!dir) {
+		return ringbuffer_init(size);
+	}
+
+	rc = mkdir(dir, 0700);
+	if (rc && errno != EEXIST) {
+		warn("Can't create ringbuffer directory %s", dir);
+	}
+
+	rc = asprintf(&path, "%s/%s.ringbuffer", dir, console_id);
+	if (rc < 0) {
+		return NULL;
+	}
+
+	rb = ringbuffer_init_file(path, size);
+	free(path);
+
+	if (!rb) {
+		warnx("Using an in-memory ringbuffer for console %s",
+		      console_id);
+		return ringbuffer_init(size);
+	}
+
+	return rb;
+}
+
+static void console_history_evict(void *data, const uint8_t *buf, size_t len)
+{
+	struct console *console = data;
+
+	history_append(console->history, buf, len);
+}
+
+/* 'history-size' enables a compressed tier behind the ringbuffer */
+static int console_history_init(struct console *console,
+				struct config *config)
+{
+	size_t size;
+	const char *val;
+
+	val = config_get_console_value(config, console->console_id,
+				       "history-size");
+	if (!val) {
+		return 0;
+	}
+
+	if (config_parse_bytesize(val, &size)) {
+		warnx("Invalid history-size '%s'", val);
+		return 0;
+	}
+
+	console->history = history_init(size);
+	if (!console->history) {
+		return -1;
+	}
+
+	ringbuffer_set_evict(console->rb, console_history_evict, console);
+
+	return 0;
+}
+
+static size_t console_ringbuffer_size(struct config *config,
+				      const char *console_id)
+{
+	size_t buffer_size = default_buffer_size;
+	const char *buffer_size_str = NULL;
+	int rc;
+
+	buffer_size_str =
+		config_get_console_value(config, console_id, "ringbuffer-size");
+
 	if (buffer_size_str) {
 		rc = config_parse_bytesize(buffer_size_str, &buffer_size);
 		if (rc) {
+			buffer_size = default_buffer_size;
 			warn("Invalid ringbuffer-size. Default to %zukB",
 			     buffer_size >> 10);
 		}
 	}
 
-	console->rb = ringbuffer_init(buffer_size);
+	return buffer_size;
+}
+
+/* 'latency-tracing' times each batch from the tty to the handlers' delivery */
+static void console_tracing_init(struct console *console, struct config *config)
+{
+	bool enable = false;
+	const char *val;
+
+	val = config_get_console_value(config, console->console_id,
+				       "latency-tracing");
+	if (val && config_parse_bool(val, &enable)) {
+		warnx("Invalid latency-tracing '%s'", val);
+	}
+
+	if (ringbuffer_set_tracing(console->rb, enable)) {
+		warnx("Can't trace latency for console '%s'",
+		      console->console_id);
+	}
+}
+
+static struct console *console_init(struct console_server *server,
+				    struct upstream_tty *tty,
+				    struct config *config,
+				    const char *console_id)
+{
+	int rc;
+
+	struct console *console = calloc(1, sizeof(struct console));
+	if (console == NULL) {
+		return NULL;
+	}
+
+	console->server = server;
+	console->tty = tty;
+
+	/* The id may point into config, which a reload replaces */
+	console->console_id = strdup(console_id);
+	if (!console->console_id) {
+		goto cleanup_console;
+	}
+
+	console->rb = console_ringbuffer_init(
+		server, config, console_id,
+		console_ringbuffer_size(config, console_id));
 	if (!console->rb) {
 		goto cleanup_console;
 	}
 
+	console_tracing_init(console, config);
+
+	rc = console_history_init(console, config);
+	if (rc) {
+		goto cleanup_rb;
+	}
+
 	rc = console_mux_init(console, config);
 	if (rc) {
 		warnx("could not set mux gpios from config, exiting");
 		goto cleanup_rb;
 	}
 
-	if (set_socket_info(console, config, console_id)) {
+	if (set_socket_info(console)) {
 		warnx("set_socket_info failed");
 		goto cleanup_rb;
 	}
 
 	rc = dbus_init(console, config);
 	if (rc != 0) {
+		dbus_fini(console);
 		goto cleanup_rb;
 	}
 
@@ -1130,8 +2022,12 @@ static struct console *console_init(struct console_server *server,
 	return console;
 
 cleanup_rb:
-	free(console->rb);
+	if (console->history) {
+		history_fini(console->history);
+	}
+	ringbuffer_fini(console->rb);
 cleanup_console:
+	free(console->console_id);
 	free(console);
 
 	return NULL;
@@ -1139,22 +2035,138 @@ cleanup_console:
 
 static void console_fini(struct console *console)
 {
+	console_mux_remove(console);
+	dbus_fini(console);
 	handlers_fini(console);
 	ringbuffer_fini(console->rb);
+	if (console->history) {
+		history_fini(console->history);
+	}
 	free(console->pollers);
+	free(console->console_id);
 	free(console);
 }
 
+/*
+ * Apply config to a console that carries on through a reload. The ringbuffer
+ * is resized with its data in place, and the handlers reloaded, so clients stay
+ * connected and the history is kept.
+ */
+static void console_reload(struct console *console, struct config *config)
+{
+	const unsigned long mux_index = console->mux_index;
+	struct ringbuffer *rb = console->rb;
+	size_t size;
+
+	size = console_ringbuffer_size(config, console->console_id);
+	if (size != rb->size && !rb->hdr && !rb->arena &&
+	    (size < TTY_READ_CHUNK || ringbuffer_resize(rb, size))) {
+		warnx("Can't resize the ringbuffer of console '%s' to %zukB",
+		      console->console_id, size >> 10);
+	}
+
+	console_tracing_init(console, config);
+
+	if (console_mux_init(console, config)) {
+		warnx("Keeping mux-index %lu for console '%s'", mux_index,
+		      console->console_id);
+		console->mux_index = mux_index;
+	}
+
+	if (console->mux_index != mux_index && console->tty->active == console &&
+	    console_mux_refresh(console->tty)) {
+		warnx("Error: unable to set mux gpios");
+	}
+
+	handlers_reload(console, config);
+}
+
+/*
+ * A console section may name its own upstream tty. Otherwise, fall back to the
+ * device provided on the command line, then to the global 'upstream-tty'.
+ */
+static const char *
+console_server_console_tty_name(struct console_server *server,
+				const char *console_id,
+				const char *arg_tty_kname, const char **section)
+{
+	const char *kname;
+
+	*section = NULL;
+
+	if (console_id) {
+		kname = config_get_section_value(server->config, console_id,
+						 "upstream-tty");
+		if (kname) {
+			*section = console_id;
+			return kname;
+		}
+	}
+
+	kname = arg_tty_kname;
+	if (!kname) {
+		kname = config_get_value(server->config, "upstream-tty");
+	}
+
+	if (!kname) {
+		warnx("no upstream tty for console '%s'",
+		      console_id ? console_id : "(default)");
+	}
+
+	return kname;
+}
+
+static struct upstream_tty *
+console_server_console_tty(struct console_server *server,
+			   const char *console_id, const char *arg_tty_kname)
+{
+	const char *section;
+	const char *kname;
+
+	kname = console_server_console_tty_name(server, console_id,
+						arg_tty_kname, &section);
+	if (!kname) {
+		return NULL;
+	}
+
+	return console_server_get_tty(server, kname, section);
+}
+
+static struct console *console_server_find(struct console_server *server,
+					   const char *console_id)
+{
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		if (!strcmp(server->consoles[i]->console_id, console_id)) {
+			return server->consoles[i];
+		}
+	}
+
+	return NULL;
+}
+
 // 'opt_console_id' may be NULL
 static int console_server_add_console(struct console_server *server,
 				      struct config *config,
-				      const char *opt_console_id)
+				      const char *opt_console_id,
+				      const char *arg_tty_kname)
 {
+	struct upstream_tty *tty;
 	const char *console_id;
 	struct console *console;
 
 	console_id = config_resolve_console_id(config, opt_console_id);
 
+	/* Already running, when the config is reloaded */
+	if (console_server_find(server, console_id)) {
+		return 0;
+	}
+
+	tty = console_server_console_tty(server, opt_console_id,
+					 arg_tty_kname);
+	if (tty == NULL) {
+		return -1;
+	}
+
 	struct console **tmp = reallocarray(server->consoles,
 					    server->n_consoles + 1,
 					    sizeof(struct console *));
@@ -1164,7 +2176,7 @@ static int console_server_add_console(struct console_server *server,
 	}
 	server->consoles = tmp;
 
-	console = console_init(server, config, console_id);
+	console = console_init(server, tty, config, console_id);
 	if (console == NULL) {
 		warnx("console_init failed");
 		return -1;
@@ -1175,25 +2187,24 @@ static int console_server_add_console(struct console_server *server,
 	return 0;
 }
 
-// returns NULL on error
-static struct console *
-console_server_add_consoles(struct console_server *server,
-			    const char *arg_console_id)
+static int console_server_add_consoles(struct console_server *server,
+				       const char *arg_console_id,
+				       const char *arg_tty_kname)
 {
 	int rc;
 
 	const int nsections = config_count_sections(server->config);
 	if (nsections < 0) {
-		return NULL;
+		return -1;
 	}
 
 	if (nsections == 0) {
 		const char *console_id = arg_console_id;
 
 		rc = console_server_add_console(server, server->config,
-						console_id);
+						console_id, arg_tty_kname);
 		if (rc != 0) {
-			return NULL;
+			return -1;
 		}
 	}
 
@@ -1203,37 +2214,336 @@ console_server_add_consoles(struct console_server *server,
 
 		if (console_id == NULL) {
 			warnx("no console id provided\n");
-			return NULL;
+			return -1;
 		}
 
 		rc = console_server_add_console(server, server->config,
-						console_id);
+						console_id, arg_tty_kname);
 		if (rc != 0) {
-			return NULL;
+			return -1;
 		}
 	}
 
-	const char *initially_active =
-		config_get_value(server->config, "active-console");
-	if (!initially_active) {
-		return server->consoles[0];
+	return 0;
+}
+
+/*
+ * Each tty starts out connected to its first console, unless 'active-console'
+ * names another console on the same tty.
+ */
+static int console_server_activate_consoles(struct console_server *server)
+{
+	const char *initially_active;
+	bool found = false;
+	int rc;
+
+	initially_active = config_get_value(server->config, "active-console");
+	if (initially_active) {
+		printf("setting console-id '%s' as the initially active console\n",
+		       initially_active);
 	}
 
-	printf("setting console-id '%s' as the initially active console\n",
-	       initially_active);
+	for (size_t i = 0; initially_active && i < server->n_consoles; i++) {
+		struct console *console = server->consoles[i];
+
+		if (strcmp(console->console_id, initially_active) == 0) {
+			rc = console_mux_activate(console);
+			if (rc != 0) {
+				return -1;
+			}
+			found = true;
+			break;
+		}
+	}
+
+	if (initially_active && !found) {
+		warnx("'active-console' '%s' not found among console ids\n",
+		      initially_active);
+		return -1;
+	}
 
 	for (size_t i = 0; i < server->n_consoles; i++) {
 		struct console *console = server->consoles[i];
 
-		if (strcmp(console->console_id, initially_active) == 0) {
-			return console;
+		if (console->tty->active) {
+			continue;
+		}
+
+		rc = console_mux_activate(console);
+		if (rc != 0) {
+			return -1;
 		}
 	}
 
-	warnx("'active-console' '%s' not found among console ids\n",
-	      initially_active);
+	return 0;
+}
 
-	return NULL;
+/* Whether the reloaded config still has console, on the same tty */
+static bool console_server_keeps(struct console_server *server,
+				 struct console *console)
+{
+	const int nsections = config_count_sections(server->config);
+	const char *section;
+	const char *kname;
+	bool found = false;
+
+	if (nsections <= 0) {
+		found = !strcmp(config_resolve_console_id(server->config,
+							  server->arg_console_id),
+				console->console_id);
+	}
+
+	for (int i = 0; !found && i < nsections; i++) {
+		const char *console_id =
+			config_get_section_name(server->config, i);
+
+		found = console_id && !strcmp(console_id, console->console_id);
+	}
+
+	if (!found) {
+		return false;
+	}
+
+	kname = console_server_console_tty_name(
+		server, nsections > 0 ? console->console_id : NULL,
+		server->arg_tty_kname, &section);
+
+	return kname && !strcmp(kname, console->tty->kname);
+}
+
+static void console_server_remove_console(struct console_server *server,
+					  size_t idx)
+{
+	struct console *console = server->consoles[idx];
+
+	printf("removing console '%s'\n", console->console_id);
+
+	server->n_consoles--;
+	memmove(&server->consoles[idx], &server->consoles[idx + 1],
+		(server->n_consoles - idx) * sizeof(*server->consoles));
+
+	console_fini(console);
+}
+
+/* Close the ttys that no console uses any more */
+static void console_server_prune_ttys(struct console_server *server)
+{
+	for (size_t i = server->n_ttys; i-- > 0;) {
+		struct upstream_tty *tty = server->ttys[i];
+		bool used = false;
+
+		for (size_t j = 0; !used && j < server->n_consoles; j++) {
+			used = server->consoles[j]->tty == tty;
+		}
+
+		if (used) {
+			continue;
+		}
+
+		server->n_ttys--;
+		memmove(&server->ttys[i], &server->ttys[i + 1],
+			(server->n_ttys - i) * sizeof(*server->ttys));
+		tty_fini(tty);
+	}
+}
+
+/*
+ * Reread the config, on SIGHUP. Consoles that have gone are shut down and new
+ * ones started. The rest are reconfigured in place, keeping their clients and
+ * history. Settings fixed when a tty or ringbuffer is set up, such as the tty's
+ * baud rate, 'ringbuffer-dir' and 'ringbuffer-arena-size', need a restart.
+ */
+static int console_server_reload(struct console_server *server)
+{
+	struct config *config;
+	struct config *old;
+	int rc;
+
+	config = config_init(server->config_filename);
+	if (!config) {
+		warnx("Keeping the running configuration");
+		return -1;
+	}
+
+	old = server->config;
+	server->config = config;
+
+	/* A console moving to another tty is restarted there */
+	for (size_t i = server->n_consoles; i-- > 0;) {
+		if (!console_server_keeps(server, server->consoles[i])) {
+			console_server_remove_console(server, i);
+		}
+	}
+
+	console_server_prune_ttys(server);
+
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		console_reload(server->consoles[i], config);
+	}
+
+	rc = console_server_add_consoles(server, server->arg_console_id,
+					 server->arg_tty_kname);
+	if (rc) {
+		warnx("Failed to start all consoles");
+	}
+
+	/* Connect ttys that are new, or whose console went */
+	for (size_t i = 0; i < server->n_consoles; i++) {
+		struct console *console = server->consoles[i];
+
+		if (!console->tty->active && console_mux_activate(console)) {
+			rc = -1;
+		}
+	}
+
+	config_fini(old);
+
+	return rc;
+}
+
+/*
+ * Collect the listening sockets systemd passed in, so each console's socket
+ * handler can claim its own however many consoles the server runs
+ */
+static int console_server_listen_fds_init(struct console_server *server)
+{
+	char **names = NULL;
+	int n;
+
+	n = sd_listen_fds_with_names(1, &names);
+	if (n < 0) {
+		warnx("Failed to read inherited sockets: %s", strerror(-n));
+		return 0;
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	server->listen_fds = calloc((size_t)n, sizeof(*server->listen_fds));
+	if (!server->listen_fds) {
+		warn("Failed to allocate inherited sockets");
+		for (int i = 0; names && names[i]; i++) {
+			free(names[i]);
+		}
+		free(names);
+		return -1;
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct listen_fd *lfd = &server->listen_fds[i];
+
+		lfd->fd = SD_LISTEN_FDS_START + i;
+		lfd->name = names ? names[i] : NULL;
+	}
+	server->n_listen_fds = (size_t)n;
+	free(names);
+
+	return 0;
+}
+
+/* Point out sockets that no console took, they are likely misconfigured */
+static void console_server_listen_fds_check(struct console_server *server)
+{
+	for (size_t i = 0; i < server->n_listen_fds; i++) {
+		struct listen_fd *lfd = &server->listen_fds[i];
+
+		if (!lfd->taken) {
+			warnx("Inherited socket '%s' (fd %d) matches no console",
+			      lfd->name ? lfd->name : "unknown", lfd->fd);
+		}
+	}
+}
+
+static void console_server_listen_fds_fini(struct console_server *server)
+{
+	for (size_t i = 0; i < server->n_listen_fds; i++) {
+		close(server->listen_fds[i].fd);
+		free(server->listen_fds[i].name);
+	}
+
+	free(server->listen_fds);
+	server->listen_fds = NULL;
+	server->n_listen_fds = 0;
+}
+
+/*
+ * A socket is matched by its FileDescriptorName=, which should be the socket
+ * name as shown by console_socket_path_readable(). Sockets left with systemd's
+ * default name are matched by the address they listen on.
+ */
+int console_server_take_listen_fd(struct console_server *server,
+				  const struct sockaddr_un *addr,
+				  size_t addrlen)
+{
+	size_t len = addrlen - offsetof(struct sockaddr_un, sun_path);
+	socket_path_t name;
+
+	console_socket_path_readable(addr, addrlen, name);
+
+	for (int by_name = 1; by_name >= 0; by_name--) {
+		for (size_t i = 0; i < server->n_listen_fds; i++) {
+			struct listen_fd *lfd = &server->listen_fds[i];
+
+			if (lfd->taken) {
+				continue;
+			}
+
+			if (by_name && (!lfd->name || strcmp(lfd->name, name))) {
+				continue;
+			}
+
+			if (sd_is_socket_unix(lfd->fd, SOCK_STREAM, 1,
+					      addr->sun_path, len) <= 0) {
+				if (by_name) {
+					warnx("Inherited socket '%s' doesn't listen on its address",
+					      name);
+				}
+				continue;
+			}
+
+			lfd->taken = true;
+			return lfd->fd;
+		}
+	}
+
+	return -1;
+}
+
+bool console_server_put_listen_fd(struct console_server *server, int fd)
+{
+	for (size_t i = 0; i < server->n_listen_fds; i++) {
+		if (server->listen_fds[i].fd == fd) {
+			server->listen_fds[i].taken = false;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* 'ringbuffer-arena-size' sets one pool shared by all consoles' ringbuffers */
+static int console_server_arena_init(struct console_server *server)
+{
+	const char *val;
+	size_t size;
+
+	val = config_get_value(server->config, "ringbuffer-arena-size");
+	if (!val) {
+		return 0;
+	}
+
+	if (config_parse_bytesize(val, &size)) {
+		warnx("Invalid ringbuffer-arena-size '%s'", val);
+		return -1;
+	}
+
+	server->rb_arena = ringbuffer_arena_init(size);
+	if (!server->rb_arena) {
+		return -1;
+	}
+
+	return 0;
 }
 
 int console_server_init(struct console_server *server,
@@ -1243,23 +2553,19 @@ int console_server_init(struct console_server *server,
 	int rc;
 	memset(server, 0, sizeof(struct console_server));
 
-	server->tty_pollfd_index = -1;
+	server->config_filename = config_filename;
+	server->arg_console_id = console_id;
+	server->arg_tty_kname = config_tty_kname;
 
 	server->config = config_init(config_filename);
 	if (server->config == NULL) {
 		return -1;
 	}
 
-	rc = console_server_mux_init(server);
-	if (rc != 0) {
-		return -1;
-	}
-
 	uart_routing_init(server->config);
 
-	rc = tty_init(server, server->config, config_tty_kname);
+	rc = console_server_arena_init(server);
 	if (rc != 0) {
-		warnx("error during tty_init, exiting.\n");
 		return -1;
 	}
 
@@ -1269,18 +2575,19 @@ int console_server_init(struct console_server *server,
 		return -1;
 	}
 
-	struct console *initial_active =
-		console_server_add_consoles(server, console_id);
-	if (initial_active == NULL) {
+	rc = console_server_listen_fds_init(server);
+	if (rc != 0) {
 		return -1;
 	}
 
-	rc = console_mux_activate(initial_active);
+	rc = console_server_add_consoles(server, console_id, config_tty_kname);
 	if (rc != 0) {
 		return -1;
 	}
 
-	return 0;
+	console_server_listen_fds_check(server);
+
+	return console_server_activate_consoles(server);
 }
 
 void console_server_fini(struct console_server *server)
@@ -1290,10 +2597,19 @@ void console_server_fini(struct console_server *server)
 	}
 
 	free(server->consoles);
+	console_server_listen_fds_fini(server);
 	dbus_server_fini(server);
-	tty_fini(server);
+
+	if (server->rb_arena) {
+		ringbuffer_arena_fini(server->rb_arena);
+	}
+
+	for (size_t i = 0; i < server->n_ttys; i++) {
+		tty_fini(server->ttys[i]);
+	}
+
+	free(server->ttys);
 	free(server->pollfds);
-	console_server_mux_fini(server);
 	config_fini(server->config);
 }
 
@@ -1328,10 +2644,9 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/* Without a device, each console names its tty in the config */
 	if (optind < argc) {
 		config_tty_kname = argv[optind];
-	} else {
-		errx(EXIT_FAILURE, "no tty device path has been provided\n");
 	}
 
 	rc = console_server_init(&server, config_filename, config_tty_kname,
@@ -35,7 +35,8 @@ struct config;
  *
  * Handlers are registered at link time using the console_handler_register()
  * macro. We call each handler's ->init() function at startup, and ->fini() at
- * exit.
+ * exit. When the configuration is reloaded, a handler's ->reload() applies it
+ * in place; handlers without one, or for which it fails, are restarted.
  *
  * Handlers will almost always want to register a ringbuffer consumer, which
  * provides data coming from the tty. Use cosole_register_ringbuffer_consumer()
@@ -45,6 +46,7 @@ struct config;
  * poller API, through console_poller_register().
  */
 struct handler;
+struct latency_hist;
 
 struct handler_type {
 	const char *name;
@@ -52,7 +54,12 @@ struct handler_type {
 				struct console *console, struct config *config);
 	void (*fini)(struct handler *handler);
 	int (*baudrate)(struct handler *handler, speed_t baudrate);
+	/* the mux has switched to, or away from, the handler's console */
+	void (*select)(struct handler *handler);
 	void (*deselect)(struct handler *handler);
+	int (*reload)(struct handler *handler, struct config *config);
+	/* how long the handler took to deliver data, see 'latency-tracing' */
+	const struct latency_hist *(*latency)(struct handler *handler);
 };
 
 struct handler {
@@ -98,23 +105,92 @@ enum tty_device {
 	TTY_DEVICE_PTY,
 };
 
-struct console_server {
+/*
+ * How reads from the upstream tty are batched. With vmin > 1 the tty only
+ * polls readable once vmin bytes are buffered, so while data is arriving we
+ * also service it after latency_ms to pick up any remainder.
+ */
+struct tty_read_policy {
+	bool vmin_auto;
+	cc_t vmin;
+	unsigned long latency_ms;
+	/* -1 leaves the driver's ASYNC_LOW_LATENCY setting alone */
+	int low_latency;
+};
+
+struct tty_stats {
+	uint64_t wakeups;
+	uint64_t reads;
+	uint64_t bytes;
+	struct timespec last_service;
+
+	/* wakeup rate over the most recent window of at least a second */
+	struct timespec window_start;
+	uint64_t window_wakeups;
+	double wakeups_per_sec;
+};
+
+/* How a console fared while the mux was scanned in the background */
+struct console_scan_stats {
+	uint64_t slices;
+	uint64_t bytes;
+	uint64_t held_ms;
+	/* longest time the console went unmonitored between slices */
+	uint64_t max_gap_ms;
+	struct timespec left;
+};
+
+/* An upstream tty device, and the consoles it carries */
+struct upstream_tty {
+	// point back to the console server
+	// which we are a member of
+	struct console_server *server;
+
+	char *kname;
+	char *dev;
+	int fd;
+	enum tty_device type;
+	union {
+		struct {
+			char *sysfs_devnode;
+			int sirq;
+			uint16_t lpc_addr;
+		} vuart;
+		struct {
+			speed_t baud;
+		} uart;
+	};
+	struct tty_read_policy read_policy;
+	struct tty_stats stats;
+
+	// with vmin > 1, VMIN is dropped to 1 while nothing is buffered, so
+	// poll() wakes on the first byte rather than after every latency_ms
+	bool read_idle;
+
+	// config section holding this tty's settings, NULL for the global one
+	char *section;
+
+	// index into (struct console_server)->pollfds
+	size_t pollfd_index;
+
+	// set while fd is closed, after the tty failed. backoff_ms is kept
+	// until the tty reads data again
 	struct {
-		const char *kname;
-		char *dev;
-		int fd;
-		enum tty_device type;
-		union {
-			struct {
-				char *sysfs_devnode;
-				int sirq;
-				uint16_t lpc_addr;
-			} vuart;
-			struct {
-				speed_t baud;
-			} uart;
-		};
-	} tty;
+		unsigned int attempts;
+		long backoff_ms;
+		struct timespec at;
+	} reconnect;
+
+	// the console currently receiving data from this tty
+	struct console *active;
+
+	// may be NULL in case there is no mux
+	struct console_mux *mux;
+};
+
+struct console_server {
+	struct upstream_tty **ttys;
+	size_t n_ttys;
 
 	// All the pollfds are stored here,
 	// so 'poll' can operate on them.
@@ -122,13 +198,16 @@ struct console_server {
 	struct pollfd *pollfds;
 	size_t capacity_pollfds;
 
-	// index into pollfds
-	size_t tty_pollfd_index;
-
 	struct config *config;
 
-	// the currently active console
-	struct console *active;
+	// where config was loaded from, and the command line arguments, for
+	// reloading it
+	const char *config_filename;
+	const char *arg_console_id;
+	const char *arg_tty_kname;
+
+	// shared ringbuffer storage, NULL unless 'ringbuffer-arena-size' is set
+	struct ringbuffer_arena *rb_arena;
 
 	struct console **consoles;
 	size_t n_consoles;
@@ -138,16 +217,31 @@ struct console_server {
 
 	struct sd_bus *bus;
 
-	// may be NULL in case there is no mux
-	struct console_mux *mux;
+	// listening sockets passed in by systemd, claimed by the socket
+	// handlers
+	struct listen_fd *listen_fds;
+	size_t n_listen_fds;
 };
 
+struct listen_fd {
+	int fd;
+	// FileDescriptorName= of the socket, may be NULL
+	char *name;
+	bool taken;
+};
+
+/* UART, Access, Statistics, Mux, Screen and Trigger */
+#define CONSOLE_DBUS_INTERFACES 6
+
 struct console {
 	// point back to the console server
 	// which we are a member of
 	struct console_server *server;
 
-	const char *console_id;
+	// the upstream tty this console's data comes from
+	struct upstream_tty *tty;
+
+	char *console_id;
 
 	/* Socket name starts with null character hence we need length */
 	socket_path_t socket_name;
@@ -155,6 +249,12 @@ struct console {
 
 	struct ringbuffer *rb;
 
+	// compressed data evicted from rb, may be NULL
+	struct history *history;
+
+	// model of the terminal screen, kept by the screen handler, may be NULL
+	struct screen *screen;
+
 	struct handler **handlers;
 	long n_handlers;
 
@@ -163,6 +263,18 @@ struct console {
 
 	// values to configure the mux
 	unsigned long mux_index;
+	// mark mux switches in the console's data
+	bool mux_notices;
+
+	// interactive clients attached through the socket or D-Bus
+	int n_sessions;
+
+	// the console's D-Bus objects, and its pending name request, released
+	// by dbus_fini()
+	sd_bus_slot *dbus_slots[CONSOLE_DBUS_INTERFACES];
+	sd_bus_slot *dbus_name_slot;
+
+	struct console_scan_stats scan;
 };
 
 /* poller API */
@@ -202,14 +314,40 @@ enum ringbuffer_poll_ret {
 typedef enum ringbuffer_poll_ret (*ringbuffer_poll_fn_t)(void *data,
 							 size_t force_len);
 
+/* called with history as it is overwritten */
+typedef void (*ringbuffer_evict_fn_t)(void *data, const uint8_t *buf,
+				      size_t len);
+
+struct history;
+struct screen;
+struct ringbuffer_arena;
+struct ringbuffer_stamps;
 struct ringbuffer_consumer;
+struct ringbuffer_file_header;
 
 struct ringbuffer {
 	uint8_t *buf;
 	size_t size;
 	size_t tail;
+	/* bytes of history behind tail, at most size - 1 */
+	size_t len;
 	struct ringbuffer_consumer **consumers;
 	int n_consumers;
+	ringbuffer_evict_fn_t evict_fn;
+	void *evict_data;
+	/* set when the buffer is backed by a file mapping */
+	struct ringbuffer_file_header *hdr;
+	size_t map_len;
+	uint64_t seq;
+	/* set when the buffer is built from chunks of a shared arena */
+	struct ringbuffer_arena *arena;
+	size_t *chunks;
+	size_t min_size;
+	size_t max_size;
+	/* bytes queued over the buffer's life, the stream offset of tail */
+	uint64_t written;
+	/* queue times of recent batches, NULL unless tracing latency */
+	struct ringbuffer_stamps *stamps;
 };
 
 struct ringbuffer_consumer {
@@ -217,17 +355,40 @@ struct ringbuffer_consumer {
 	ringbuffer_poll_fn_t poll_fn;
 	void *poll_data;
 	size_t pos;
+	/* where delivery latency is recorded, and the next batch to time */
+	struct latency_hist *latency;
+	uint64_t stamp;
 };
 
 struct ringbuffer *ringbuffer_init(size_t size);
+struct ringbuffer *ringbuffer_init_file(const char *path, size_t size);
+
+struct ringbuffer_arena *ringbuffer_arena_init(size_t size);
+void ringbuffer_arena_fini(struct ringbuffer_arena *arena);
+size_t ringbuffer_arena_chunk_size(struct ringbuffer_arena *arena);
+struct ringbuffer *ringbuffer_init_arena(struct ringbuffer_arena *arena,
+					 size_t min_size, size_t max_size);
 void ringbuffer_fini(struct ringbuffer *rb);
+int ringbuffer_resize(struct ringbuffer *rb, size_t size);
+void ringbuffer_set_evict(struct ringbuffer *rb, ringbuffer_evict_fn_t fn,
+			  void *data);
+int ringbuffer_set_tracing(struct ringbuffer *rb, bool enable);
 
 struct ringbuffer_consumer *
 ringbuffer_consumer_register(struct ringbuffer *rb,
 			     ringbuffer_poll_fn_t poll_fn, void *data);
 
+/* as above, but the consumer starts at the oldest byte of history */
+struct ringbuffer_consumer *
+ringbuffer_consumer_register_backlog(struct ringbuffer *rb,
+				     ringbuffer_poll_fn_t poll_fn, void *data);
+
 void ringbuffer_consumer_unregister(struct ringbuffer_consumer *rbc);
 
+/* time the consumer's delivery of each batch, while the buffer is tracing */
+void ringbuffer_consumer_set_latency(struct ringbuffer_consumer *rbc,
+				     struct latency_hist *hist);
+
 int ringbuffer_queue(struct ringbuffer *rb, uint8_t *data, size_t len);
 
 size_t ringbuffer_dequeue_peek(struct ringbuffer_consumer *rbc, size_t offset,
@@ -241,25 +402,39 @@ size_t ringbuffer_len(struct ringbuffer_consumer *rbc);
 struct ringbuffer_consumer *
 console_ringbuffer_consumer_register(struct console *console,
 				     ringbuffer_poll_fn_t poll_fn, void *data);
+struct ringbuffer_consumer *
+console_ringbuffer_consumer_register_backlog(struct console *console,
+					     ringbuffer_poll_fn_t poll_fn,
+					     void *data);
 
 /* Console server API */
-void tty_init_termios(struct console_server *server);
+void tty_init_termios(struct upstream_tty *tty);
+double tty_stats_wakeups_per_sec(struct upstream_tty *tty);
 
 /* socket paths */
 ssize_t console_socket_path(socket_path_t path, const char *id);
+ssize_t console_dump_socket_path(socket_path_t path, const char *id);
 ssize_t console_socket_path_readable(const struct sockaddr_un *addr,
 				     size_t addrlen, socket_path_t path);
 
 /* utils */
 int write_buf_to_fd(int fd, const uint8_t *buf, size_t len);
+/* As write_buf_to_fd(), also reporting how much was written before a failure */
+int write_buf_to_fd_partial(int fd, const uint8_t *buf, size_t len,
+			    size_t *written);
 
 /* console_server dbus */
 int dbus_server_init(struct console_server *server);
 void dbus_server_fini(struct console_server *server);
+long dbus_server_timeout(struct console_server *server);
+void dbus_server_process(struct console_server *server);
 
 /* console-dbus API */
 int dbus_init(struct console *console,
 	      struct config *config __attribute__((unused)));
+void dbus_fini(struct console *console);
+int dbus_emit_trigger(struct console *console, const char *pattern,
+		      uint64_t offset, uint64_t suppressed);
 
 /* socket-handler API */
 int dbus_create_socket_consumer(struct console *console);
@@ -285,3 +460,12 @@ ssize_t console_server_request_pollfd(struct console_server *server, int fd,
 
 int console_server_release_pollfd(struct console_server *server,
 				  size_t pollfd_index);
+
+// returns an inherited socket listening on addr, or -1 if there is none
+int console_server_take_listen_fd(struct console_server *server,
+				  const struct sockaddr_un *addr,
+				  size_t addrlen);
+
+// returns true if fd was inherited, and is kept for the next taker rather
+// than closed
+bool console_server_put_listen_fd(struct console_server *server, int fd);
@@ -26,10 +26,11 @@
 #include <sys/types.h>
 #include <unistd.h>
 
-#define CONSOLE_SOCKET_PREFIX "obmc-console"
+#define CONSOLE_SOCKET_PREFIX	   "obmc-console"
+#define CONSOLE_DUMP_SOCKET_PREFIX "obmc-console-dump"
 
-/* Build the socket path. */
-ssize_t console_socket_path(socket_path_t sun_path, const char *id)
+static ssize_t socket_path(socket_path_t sun_path, const char *prefix,
+			   const char *id)
 {
 	ssize_t rc;
 
@@ -39,7 +40,7 @@ ssize_t console_socket_path(socket_path_t sun_path, const char *id)
 	}
 
 	rc = snprintf(sun_path + 1, sizeof(socket_path_t) - 1,
-		      CONSOLE_SOCKET_PREFIX ".%s", id);
+		      "%s.%s", prefix, id);
 	if (rc < 0) {
 		return rc;
 	}
@@ -54,6 +55,20 @@ ssize_t console_socket_path(socket_path_t sun_path, const char *id)
 	return rc + 1 /* Capture NUL prefix */;
 }
 
+/* Build the socket path. */
+ssize_t console_socket_path(socket_path_t sun_path, const char *id)
+{
+	return socket_path(sun_path, CONSOLE_SOCKET_PREFIX, id);
+}
+
+/* Build the path of the socket that hands out the buffered output. The
+ * prefix differs, rather than the suffix, so that it can't collide with the
+ * socket of another console */
+ssize_t console_dump_socket_path(socket_path_t sun_path, const char *id)
+{
+	return socket_path(sun_path, CONSOLE_DUMP_SOCKET_PREFIX, id);
+}
+
 ssize_t console_socket_path_readable(const struct sockaddr_un *addr,
 				     size_t addrlen, socket_path_t path)
 {
@@ -0,0 +1,144 @@
+/**
+ * Copyright © 2016 IBM Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "escape.h"
+
+/*
+ * The data is compacted in place as it's scanned, leaving *len bytes to send.
+ * Only bytes around a '\r' need looking at individually. Returns true when
+ * the escape is complete, and nothing after it is to be sent.
+ */
+bool ssh_esc_scan(struct ssh_esc_state *esc_state, uint8_t *buf, size_t *len)
+{
+	size_t out = 0;
+	size_t i = 0;
+
+	while (i < *len) {
+		uint8_t c;
+
+		if (esc_state->state == '\0') {
+			const uint8_t *cr = memchr(buf + i, '\r', *len - i);
+			size_t n = cr ? (size_t)(cr - (buf + i)) + 1 : *len - i;
+
+			if (out != i) {
+				memmove(buf + out, buf + i, n);
+			}
+			out += n;
+			i += n;
+			if (cr) {
+				esc_state->state = '\r';
+			}
+			continue;
+		}
+
+		c = buf[i++];
+
+		if (esc_state->state == '\r' && c == '~') {
+			esc_state->state = '~';
+			continue;
+		}
+
+		if (esc_state->state == '~' && c == '.') {
+			*len = out;
+			return true;
+		}
+
+		esc_state->state = c == '\r' ? '\r' : '\0';
+		buf[out++] = c;
+	}
+
+	*len = out;
+	return false;
+}
+
+/* Build the prefix function of the escape string, so that a mismatch falls
+ * back to the longest prefix still matched rather than to the start */
+int str_esc_init(struct str_esc_state *esc_state, const uint8_t *str)
+{
+	size_t len = strlen((const char *)str);
+	size_t k = 0;
+
+	esc_state->str = str;
+	esc_state->len = len;
+	esc_state->pos = 0;
+	esc_state->fail = calloc(len, sizeof(*esc_state->fail));
+	if (!esc_state->fail) {
+		return -1;
+	}
+
+	for (size_t i = 1; i < len; i++) {
+		while (k && str[i] != str[k]) {
+			k = esc_state->fail[k - 1];
+		}
+		if (str[i] == str[k]) {
+			k++;
+		}
+		esc_state->fail[i] = k;
+	}
+
+	return 0;
+}
+
+void str_esc_fini(struct str_esc_state *esc_state)
+{
+	free(esc_state->fail);
+	esc_state->fail = NULL;
+}
+
+/* Scan buf for the string, carrying a partial match over from the last
+ * call. Returns the length up to and including the match, or 0 */
+size_t str_esc_scan(struct str_esc_state *esc_state, const uint8_t *buf,
+		    size_t len)
+{
+	const uint8_t *str = esc_state->str;
+	size_t pos = esc_state->pos;
+	size_t i = 0;
+
+	while (i < len) {
+		uint8_t c;
+
+		/* Outside a partial match, skip to the next possible start */
+		if (!pos) {
+			const uint8_t *first = memchr(buf + i, str[0], len - i);
+
+			if (!first) {
+				break;
+			}
+			i = (size_t)(first - buf);
+		}
+
+		c = buf[i++];
+		while (pos && c != str[pos]) {
+			pos = esc_state->fail[pos - 1];
+		}
+		if (c == str[pos]) {
+			pos++;
+		}
+
+		if (pos == esc_state->len) {
+			esc_state->pos = 0;
+			return i;
+		}
+	}
+
+	esc_state->pos = pos;
+	return 0;
+}
@@ -0,0 +1,50 @@
+/**
+ * Copyright © 2016 IBM Corporation
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Scanners for the sequence that ends an interactive session, shared by
+ * obmc-console-client and libobmc-console. Both keep their state between
+ * calls, so input can be fed in arbitrary pieces.
+ */
+
+/* The ssh-style "\r~.": a '~' following '\r' is held back, and "~~" sends
+ * one '~' */
+struct ssh_esc_state {
+	uint8_t state;
+};
+
+/* An arbitrary string, sent along with everything before it */
+struct str_esc_state {
+	const uint8_t *str;
+	size_t len;
+	/* fail[i]: length of the longest proper prefix of str that is also a
+	 * suffix of str[0..i] */
+	size_t *fail;
+	size_t pos;
+};
+
+bool ssh_esc_scan(struct ssh_esc_state *esc_state, uint8_t *buf, size_t *len);
+
+int str_esc_init(struct str_esc_state *esc_state, const uint8_t *str);
+void str_esc_fini(struct str_esc_state *esc_state);
+size_t str_esc_scan(struct str_esc_state *esc_state, const uint8_t *buf,
+		    size_t len);
@@ -0,0 +1,482 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+#define LZ_HASH_BITS	    12
+#define LZ_MIN_MATCH	    4
+#define LZ_LAST_LITERALS    5
+#define LZ_MATCH_FIND_LIMIT 12
+
+struct history_block {
+	size_t offset;
+	uint16_t stored_len;
+	uint16_t raw_len;
+	bool compressed;
+};
+
+struct history {
+	uint8_t *arena;
+	size_t arena_size;
+	size_t write_offset;
+
+	/* ring of block descriptors, oldest first */
+	struct history_block *blocks;
+	size_t blocks_capacity;
+	size_t blocks_head;
+	size_t n_blocks;
+	uint64_t first_seq;
+
+	uint8_t stage[HISTORY_BLOCK_SIZE];
+	size_t stage_len;
+
+	uint8_t *scratch;
+
+	uint64_t raw_bytes;
+	uint64_t stored_bytes;
+};
+
+static uint32_t lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static uint32_t lz_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+
+	return op;
+}
+
+/* Worst-case size of a sequence: token, lengths, literals and offset */
+static size_t lz_sequence_bound(size_t literals, size_t match)
+{
+	return 1 + (literals / 255 + 1) + literals + 2 + (match / 255 + 1);
+}
+
+size_t lz_compress_bound(size_t len)
+{
+	return lz_sequence_bound(len, 0);
+}
+
+/*
+ * Greedy LZ77 over a single block of at most 64kB, emitting LZ4-style
+ * sequences: a token of literal and match length nibbles, the literals, then
+ * a 16-bit match offset. Returns 0 if the output doesn't fit in out_size.
+ */
+size_t lz_compress(const uint8_t *in, size_t in_len, uint8_t *out,
+		   size_t out_size)
+{
+	uint16_t table[1 << LZ_HASH_BITS] = { 0 };
+	const uint8_t *end = in + in_len;
+	const uint8_t *match_limit;
+	const uint8_t *anchor = in;
+	const uint8_t *ip = in;
+	uint8_t *op = out;
+	size_t literals;
+	uint8_t *token;
+
+	assert(in_len <= UINT16_MAX);
+
+	match_limit = in_len > LZ_MATCH_FIND_LIMIT ? end - LZ_MATCH_FIND_LIMIT :
+						     in;
+
+	while (ip < match_limit) {
+		const uint8_t *mp = ip + LZ_MIN_MATCH;
+		const uint32_t seq = lz_read32(ip);
+		const uint32_t h = lz_hash(seq);
+		const uint8_t *ref = in + table[h];
+		size_t match;
+		uint16_t offset;
+
+		table[h] = (uint16_t)(ip - in);
+
+		if (ref >= ip || lz_read32(ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		ref += LZ_MIN_MATCH;
+		while (mp < end - LZ_LAST_LITERALS && *mp == *ref) {
+			mp++;
+			ref++;
+		}
+
+		literals = (size_t)(ip - anchor);
+		match = (size_t)(mp - ip) - LZ_MIN_MATCH;
+		if (lz_sequence_bound(literals, match) > (size_t)(out + out_size - op)) {
+			return 0;
+		}
+
+		token = op++;
+		*token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+		if (literals >= 15) {
+			op = lz_put_length(op, literals - 15);
+		}
+		memcpy(op, anchor, literals);
+		op += literals;
+
+		offset = (uint16_t)(mp - ref);
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+
+		*token |= (uint8_t)(match < 15 ? match : 15);
+		if (match >= 15) {
+			op = lz_put_length(op, match - 15);
+		}
+
+		ip = mp;
+		anchor = ip;
+	}
+
+	/* The block always ends with a literal-only sequence */
+	literals = (size_t)(end - anchor);
+	if (lz_sequence_bound(literals, 0) > (size_t)(out + out_size - op)) {
+		return 0;
+	}
+
+	token = op++;
+	*token = (uint8_t)((literals < 15 ? literals : 15) << 4);
+	if (literals >= 15) {
+		op = lz_put_length(op, literals - 15);
+	}
+	memcpy(op, anchor, literals);
+	op += literals;
+
+	return (size_t)(op - out);
+}
+
+static int lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+	uint8_t b;
+
+	do {
+		if (*ip >= end) {
+			return -1;
+		}
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+
+	return 0;
+}
+
+ssize_t lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out,
+		      size_t out_size)
+{
+	const uint8_t *end = in + in_len;
+	const uint8_t *ip = in;
+	uint8_t *op = out;
+
+	while (ip < end) {
+		const uint8_t token = *ip++;
+		size_t literals = token >> 4;
+		size_t match = token & 0xf;
+		const uint8_t *ref;
+		size_t offset;
+
+		if (literals == 15 && lz_get_length(&ip, end, &literals)) {
+			return -1;
+		}
+
+		if (literals > (size_t)(end - ip) ||
+		    literals > (size_t)(out + out_size - op)) {
+			return -1;
+		}
+
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+
+		if (ip == end) {
+			break;
+		}
+
+		if (end - ip < 2) {
+			return -1;
+		}
+
+		offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+
+		if (!offset || offset > (size_t)(op - out)) {
+			return -1;
+		}
+
+		if (match == 15 && lz_get_length(&ip, end, &match)) {
+			return -1;
+		}
+
+		match += LZ_MIN_MATCH;
+		if (match > (size_t)(out + out_size - op)) {
+			return -1;
+		}
+
+		/* Matches may overlap their output, so copy bytewise */
+		ref = op - offset;
+		while (match--) {
+			*op++ = *ref++;
+		}
+	}
+
+	return (ssize_t)(op - out);
+}
+
+static struct history_block *history_block(struct history *history,
+					   size_t i)
+{
+	assert(i < history->n_blocks);
+	return &history->blocks[(history->blocks_head + i) %
+				history->blocks_capacity];
+}
+
+static void history_drop_oldest(struct history *history)
+{
+	struct history_block *block = history_block(history, 0);
+
+	history->stored_bytes -= block->stored_len;
+	history->raw_bytes -= block->raw_len;
+	history->blocks_head = (history->blocks_head + 1) %
+			       history->blocks_capacity;
+	history->n_blocks--;
+	history->first_seq++;
+}
+
+static int history_grow_blocks(struct history *history)
+{
+	struct history_block *blocks;
+	size_t capacity;
+
+	capacity = history->blocks_capacity ? history->blocks_capacity * 2 : 16;
+	blocks = calloc(capacity, sizeof(*blocks));
+	if (!blocks) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < history->n_blocks; i++) {
+		blocks[i] = *history_block(history, i);
+	}
+
+	free(history->blocks);
+	history->blocks = blocks;
+	history->blocks_capacity = capacity;
+	history->blocks_head = 0;
+
+	return 0;
+}
+
+/*
+ * Reserve len bytes of the arena. Blocks are laid out oldest first from the
+ * write offset, so space is reclaimed by dropping the oldest blocks.
+ */
+static uint8_t *history_reserve(struct history *history, size_t len)
+{
+	size_t start = history->write_offset;
+
+	if (start + len > history->arena_size) {
+		/* Wrap, dropping the blocks beyond the old write offset */
+		while (history->n_blocks &&
+		       history_block(history, 0)->offset >= start) {
+			history_drop_oldest(history);
+		}
+		start = 0;
+	}
+
+	while (history->n_blocks &&
+	       history_block(history, 0)->offset < start + len &&
+	       history_block(history, 0)->offset >= start) {
+		history_drop_oldest(history);
+	}
+
+	history->write_offset = start + len;
+
+	return history->arena + start;
+}
+
+static void history_store_stage(struct history *history)
+{
+	struct history_block *block;
+	const uint8_t *data;
+	size_t stored_len;
+	bool compressed;
+
+	if (!history->stage_len) {
+		return;
+	}
+
+	stored_len = lz_compress(history->stage, history->stage_len,
+				 history->scratch, history->stage_len);
+	compressed = stored_len != 0;
+	if (compressed) {
+		data = history->scratch;
+	} else {
+		data = history->stage;
+		stored_len = history->stage_len;
+	}
+
+	if (stored_len > history->arena_size) {
+		history->stage_len = 0;
+		return;
+	}
+
+	if (history->n_blocks == history->blocks_capacity &&
+	    history_grow_blocks(history)) {
+		history->stage_len = 0;
+		return;
+	}
+
+	memcpy(history_reserve(history, stored_len), data, stored_len);
+
+	block = &history->blocks[(history->blocks_head + history->n_blocks) %
+				 history->blocks_capacity];
+	block->offset = history->write_offset - stored_len;
+	block->stored_len = (uint16_t)stored_len;
+	block->raw_len = (uint16_t)history->stage_len;
+	block->compressed = compressed;
+	history->n_blocks++;
+
+	history->raw_bytes += history->stage_len;
+	history->stored_bytes += stored_len;
+	history->stage_len = 0;
+}
+
+struct history *history_init(size_t arena_size)
+{
+	struct history *history;
+
+	history = calloc(1, sizeof(*history));
+	if (!history) {
+		return NULL;
+	}
+
+	history->arena = malloc(arena_size);
+	history->scratch = malloc(lz_compress_bound(HISTORY_BLOCK_SIZE));
+	if (!history->arena || !history->scratch) {
+		history_fini(history);
+		return NULL;
+	}
+
+	history->arena_size = arena_size;
+
+	return history;
+}
+
+void history_fini(struct history *history)
+{
+	free(history->scratch);
+	free(history->blocks);
+	free(history->arena);
+	free(history);
+}
+
+void history_append(struct history *history, const uint8_t *data,
+		    size_t len)
+{
+	while (len) {
+		size_t n = HISTORY_BLOCK_SIZE - history->stage_len;
+
+		if (n > len) {
+			n = len;
+		}
+
+		memcpy(history->stage + history->stage_len, data, n);
+		history->stage_len += n;
+		data += n;
+		len -= n;
+
+		if (history->stage_len == HISTORY_BLOCK_SIZE) {
+			history_store_stage(history);
+		}
+	}
+}
+
+void history_flush(struct history *history)
+{
+	history_store_stage(history);
+}
+
+size_t history_read_stage(struct history *history, uint8_t *buf)
+{
+	memcpy(buf, history->stage, history->stage_len);
+	return history->stage_len;
+}
+
+uint64_t history_first_seq(struct history *history)
+{
+	return history->first_seq;
+}
+
+uint64_t history_end_seq(struct history *history)
+{
+	return history->first_seq + history->n_blocks;
+}
+
+ssize_t history_read_block(struct history *history, uint64_t *seq,
+			   uint8_t *buf)
+{
+	struct history_block *block;
+	const uint8_t *data;
+	ssize_t len;
+
+	if (*seq < history->first_seq) {
+		*seq = history->first_seq;
+	}
+
+	if (*seq >= history_end_seq(history)) {
+		return 0;
+	}
+
+	block = history_block(history, (size_t)(*seq - history->first_seq));
+	data = history->arena + block->offset;
+	(*seq)++;
+
+	if (!block->compressed) {
+		memcpy(buf, data, block->raw_len);
+		return block->raw_len;
+	}
+
+	len = lz_decompress(data, block->stored_len, buf, HISTORY_BLOCK_SIZE);
+	if (len != block->raw_len) {
+		return -1;
+	}
+
+	return len;
+}
+
+void history_get_stats(struct history *history, struct history_stats *stats)
+{
+	stats->raw_bytes = history->raw_bytes;
+	stats->stored_bytes = history->stored_bytes;
+	stats->n_blocks = history->n_blocks;
+}
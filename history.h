@@ -0,0 +1,76 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Compressed history tier. Data falling out of a console's ringbuffer is
+ * collected into blocks of HISTORY_BLOCK_SIZE bytes, compressed, and kept in a
+ * bounded arena. Once the arena is full, the oldest blocks are dropped.
+ *
+ * Blocks are numbered in sequence, so readers can walk the history while it
+ * is being appended to.
+ */
+#define HISTORY_BLOCK_SIZE 4096
+
+struct history;
+
+struct history_stats {
+	uint64_t raw_bytes;
+	uint64_t stored_bytes;
+	size_t n_blocks;
+};
+
+struct history *history_init(size_t arena_size);
+void history_fini(struct history *history);
+
+void history_append(struct history *history, const uint8_t *data,
+		    size_t len);
+
+/* Close the block being collected, so that its data is readable */
+void history_flush(struct history *history);
+
+/*
+ * Copy the data collected so far for the open block into buf, which must hold
+ * HISTORY_BLOCK_SIZE bytes, leaving the block open. Returns the number of
+ * bytes copied.
+ */
+size_t history_read_stage(struct history *history, uint8_t *buf);
+
+/* The range of block sequence numbers currently held: [first, end) */
+uint64_t history_first_seq(struct history *history);
+uint64_t history_end_seq(struct history *history);
+
+/*
+ * Decompress block *seq into buf, which must hold HISTORY_BLOCK_SIZE bytes,
+ * and advance *seq. Blocks that have been dropped are skipped. Returns the
+ * number of bytes read, 0 at the end of the history, or -1 on error.
+ */
+ssize_t history_read_block(struct history *history, uint64_t *seq,
+			   uint8_t *buf);
+
+void history_get_stats(struct history *history, struct history_stats *stats);
+
+/* LZ77 block codec used for the history, with an LZ4-style sequence format */
+size_t lz_compress_bound(size_t len);
+size_t lz_compress(const uint8_t *in, size_t in_len, uint8_t *out,
+		   size_t out_size);
+ssize_t lz_decompress(const uint8_t *in, size_t in_len, uint8_t *out,
+		      size_t out_size);
@@ -0,0 +1,76 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Log-linear latency histogram, in microseconds. Values below 4us have a
+ * bucket each; above that every power of two is split into four equal
+ * buckets, so a bucket is never more than 25% wide. Values past the last
+ * bucket, about 33 seconds, are counted in it.
+ */
+#define LATENCY_SUB_BITS 2
+#define LATENCY_SUB	 (1u << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS	 96
+
+struct latency_hist {
+	uint64_t count;
+	uint64_t sum_us;
+	uint64_t max_us;
+	uint64_t buckets[LATENCY_BUCKETS];
+};
+
+static inline size_t latency_bucket(uint64_t us)
+{
+	unsigned int msb;
+	size_t i;
+
+	if (us < LATENCY_SUB) {
+		return (size_t)us;
+	}
+
+	msb = 63u - (unsigned int)__builtin_clzll(us);
+	i = (size_t)(msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB +
+	    ((us >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+
+	return i < LATENCY_BUCKETS ? i : LATENCY_BUCKETS - 1;
+}
+
+/* The largest value counted in bucket i */
+static inline uint64_t latency_bucket_max(size_t i)
+{
+	unsigned int shift;
+
+	if (i < LATENCY_SUB) {
+		return i;
+	}
+
+	shift = (unsigned int)(i / LATENCY_SUB) - 1;
+	return (((uint64_t)LATENCY_SUB + i % LATENCY_SUB + 1) << shift) - 1;
+}
+
+static inline void latency_hist_record(struct latency_hist *hist, uint64_t us)
+{
+	hist->buckets[latency_bucket(us)]++;
+	hist->count++;
+	hist->sum_us += us;
+	if (us > hist->max_us) {
+		hist->max_us = us;
+	}
+}
@@ -0,0 +1,477 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "console-server.h"
+#include "escape.h"
+#include "obmc-console.h"
+
+#define OBMC_CONSOLE_EXPORT __attribute__((visibility("default")))
+
+#define OBMC_CONSOLE_RX_SIZE (16 * 1024)
+/* Input queued beyond this is refused, rather than buffered without bound
+ * while the server isn't reading */
+#define OBMC_CONSOLE_TX_MAX (1024 * 1024)
+
+struct obmc_console {
+	int fd;
+	bool connecting;
+	bool closed;
+	const struct obmc_console_ops *ops;
+	void *data;
+
+	/* output received, from rx_start up to rx_end */
+	uint8_t rx_buf[OBMC_CONSOLE_RX_SIZE];
+	size_t rx_start;
+	size_t rx_end;
+
+	/* input the socket hasn't taken yet */
+	uint8_t *tx_buf;
+	size_t tx_len;
+	size_t tx_size;
+
+	enum obmc_console_escape esc_type;
+	uint8_t *esc_str;
+	union {
+		struct ssh_esc_state ssh;
+		struct str_esc_state str;
+	} esc_state;
+};
+
+OBMC_CONSOLE_EXPORT struct obmc_console *
+obmc_console_open(const char *console_id, unsigned int flags,
+		  const struct obmc_console_ops *ops, void *data)
+{
+	struct obmc_console *console;
+	struct sockaddr_un addr;
+	ssize_t len;
+	int rc;
+
+	if (!console_id || (flags & ~OBMC_CONSOLE_DUMP)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (flags & OBMC_CONSOLE_DUMP) {
+		len = console_dump_socket_path(addr.sun_path, console_id);
+	} else {
+		len = console_socket_path(addr.sun_path, console_id);
+	}
+	if (len < 0) {
+		if (!errno) {
+			errno = ENAMETOOLONG;
+		}
+		return NULL;
+	}
+
+	console = calloc(1, sizeof(*console));
+	if (!console) {
+		return NULL;
+	}
+
+	console->ops = ops;
+	console->data = data;
+	console->esc_type = OBMC_CONSOLE_ESCAPE_NONE;
+
+	console->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			     0);
+	if (console->fd < 0) {
+		goto err_free;
+	}
+
+	rc = connect(console->fd, (struct sockaddr *)&addr,
+		     sizeof(addr) - sizeof(addr.sun_path) + len);
+	if (rc) {
+		/* EAGAIN means the server's listen backlog is full: the
+		 * caller may try again, but there's nothing to wait for */
+		if (errno != EINPROGRESS) {
+			goto err_close;
+		}
+		console->connecting = true;
+	}
+
+	return console;
+
+err_close:
+	rc = errno;
+	close(console->fd);
+	errno = rc;
+err_free:
+	free(console);
+	return NULL;
+}
+
+OBMC_CONSOLE_EXPORT void obmc_console_close(struct obmc_console *console)
+{
+	if (!console) {
+		return;
+	}
+
+	if (console->esc_type == OBMC_CONSOLE_ESCAPE_STR) {
+		str_esc_fini(&console->esc_state.str);
+	}
+	free(console->esc_str);
+	free(console->tx_buf);
+	close(console->fd);
+	free(console);
+}
+
+OBMC_CONSOLE_EXPORT int obmc_console_fd(const struct obmc_console *console)
+{
+	return console->fd;
+}
+
+OBMC_CONSOLE_EXPORT short
+obmc_console_events(const struct obmc_console *console)
+{
+	short events = 0;
+
+	if (console->closed) {
+		return 0;
+	}
+
+	if (console->connecting) {
+		return POLLOUT;
+	}
+
+	/* Output waiting to be consumed holds up reading more, once it fills
+	 * the buffer. Consumed output is compacted away by console_recv() */
+	if (console->rx_end - console->rx_start < sizeof(console->rx_buf)) {
+		events |= POLLIN;
+	}
+
+	if (console->tx_len) {
+		events |= POLLOUT;
+	}
+
+	return events;
+}
+
+static int console_set_closed(struct obmc_console *console, int err)
+{
+	console->closed = true;
+	if (console->ops && console->ops->closed) {
+		console->ops->closed(console, err, console->data);
+	}
+
+	return err;
+}
+
+/* Send what the socket will take of buf, returning how much that was */
+static ssize_t console_send(struct obmc_console *console, const uint8_t *buf,
+			    size_t len)
+{
+	ssize_t rc;
+	size_t pos;
+
+	for (pos = 0; pos < len; pos += rc) {
+		rc = send(console->fd, buf + pos, len - pos,
+			  MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (rc < 0) {
+			if (errno == EINTR) {
+				rc = 0;
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			return -errno;
+		}
+	}
+
+	return (ssize_t)pos;
+}
+
+static int console_flush(struct obmc_console *console)
+{
+	ssize_t sent;
+
+	sent = console_send(console, console->tx_buf, console->tx_len);
+	if (sent < 0) {
+		return (int)sent;
+	}
+
+	console->tx_len -= (size_t)sent;
+	memmove(console->tx_buf, console->tx_buf + sent, console->tx_len);
+
+	return 0;
+}
+
+/* The pending error on the socket, as a negative errno value */
+static int console_sock_error(struct obmc_console *console)
+{
+	socklen_t optlen;
+	int err;
+
+	optlen = sizeof(err);
+	if (getsockopt(console->fd, SOL_SOCKET, SO_ERROR, &err, &optlen)) {
+		err = errno;
+	}
+
+	return -err;
+}
+
+static int console_recv(struct obmc_console *console, short revents)
+{
+	ssize_t len;
+
+	/* Make room after what is still to be consumed */
+	if (console->rx_start) {
+		memmove(console->rx_buf, console->rx_buf + console->rx_start,
+			console->rx_end - console->rx_start);
+		console->rx_end -= console->rx_start;
+		console->rx_start = 0;
+	}
+
+	/* poll() reports a hangup or an error whatever events were asked for,
+	 * so one we have no room to read up to ends the connection. What is
+	 * buffered can still be peeked */
+	if (console->rx_end == sizeof(console->rx_buf)) {
+		if (revents & POLLERR) {
+			return console_set_closed(console,
+						  console_sock_error(console));
+		}
+		if (revents & POLLHUP) {
+			return console_set_closed(console, 0);
+		}
+		return 0;
+	}
+
+	len = recv(console->fd, console->rx_buf + console->rx_end,
+		   sizeof(console->rx_buf) - console->rx_end, MSG_DONTWAIT);
+	if (len < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return 0;
+		}
+		return console_set_closed(console, -errno);
+	}
+	if (len == 0) {
+		return console_set_closed(console, 0);
+	}
+
+	console->rx_end += (size_t)len;
+
+	if (console->ops && console->ops->output) {
+		console->ops->output(console, console->rx_buf + console->rx_start,
+				     console->rx_end - console->rx_start,
+				     console->data);
+		console->rx_start = 0;
+		console->rx_end = 0;
+	}
+
+	return 0;
+}
+
+OBMC_CONSOLE_EXPORT int obmc_console_dispatch(struct obmc_console *console,
+					      short revents)
+{
+	int rc;
+
+	if (console->closed) {
+		return -EPIPE;
+	}
+
+	if (console->connecting) {
+		if (!revents) {
+			return 0;
+		}
+
+		rc = console_sock_error(console);
+		if (rc) {
+			return console_set_closed(console, rc);
+		}
+
+		console->connecting = false;
+	}
+
+	if ((revents & POLLOUT) && console->tx_len) {
+		rc = console_flush(console);
+		if (rc) {
+			return console_set_closed(console, rc);
+		}
+	}
+
+	/* A hangup may leave output to read, and reading finds the end */
+	if (revents & (POLLIN | POLLHUP | POLLERR)) {
+		return console_recv(console, revents);
+	}
+
+	return 0;
+}
+
+OBMC_CONSOLE_EXPORT size_t obmc_console_peek(struct obmc_console *console,
+					     const uint8_t **buf)
+{
+	*buf = console->rx_buf + console->rx_start;
+	return console->rx_end - console->rx_start;
+}
+
+OBMC_CONSOLE_EXPORT void obmc_console_consume(struct obmc_console *console,
+					      size_t len)
+{
+	if (len > console->rx_end - console->rx_start) {
+		len = console->rx_end - console->rx_start;
+	}
+
+	console->rx_start += len;
+}
+
+OBMC_CONSOLE_EXPORT int
+obmc_console_set_escape(struct obmc_console *console,
+			enum obmc_console_escape type, const char *str)
+{
+	struct str_esc_state str_state;
+	uint8_t *copy = NULL;
+
+	switch (type) {
+	case OBMC_CONSOLE_ESCAPE_NONE:
+	case OBMC_CONSOLE_ESCAPE_SSH:
+		break;
+	case OBMC_CONSOLE_ESCAPE_STR:
+		if (!str || !*str) {
+			return -EINVAL;
+		}
+		copy = (uint8_t *)strdup(str);
+		if (!copy || str_esc_init(&str_state, copy)) {
+			free(copy);
+			return -ENOMEM;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (console->esc_type == OBMC_CONSOLE_ESCAPE_STR) {
+		str_esc_fini(&console->esc_state.str);
+	}
+	free(console->esc_str);
+
+	memset(&console->esc_state, 0, sizeof(console->esc_state));
+	if (type == OBMC_CONSOLE_ESCAPE_STR) {
+		console->esc_state.str = str_state;
+	}
+	console->esc_type = type;
+	console->esc_str = copy;
+
+	return 0;
+}
+
+/* Make room to queue len more bytes of input */
+static int console_tx_reserve(struct obmc_console *console, size_t len)
+{
+	size_t size = console->tx_size ? console->tx_size : 4096;
+	uint8_t *buf;
+
+	if (len > OBMC_CONSOLE_TX_MAX - console->tx_len) {
+		return -ENOBUFS;
+	}
+
+	while (size < console->tx_len + len) {
+		size *= 2;
+	}
+
+	if (size == console->tx_size) {
+		return 0;
+	}
+
+	buf = realloc(console->tx_buf, size);
+	if (!buf) {
+		return -ENOMEM;
+	}
+
+	console->tx_buf = buf;
+	console->tx_size = size;
+
+	return 0;
+}
+
+OBMC_CONSOLE_EXPORT int obmc_console_write(struct obmc_console *console,
+					   const void *buf, size_t len)
+{
+	const uint8_t *data = buf;
+	bool escaped = false;
+	ssize_t sent;
+	size_t queued;
+	size_t end;
+	int rc;
+
+	if (console->closed) {
+		return -EPIPE;
+	}
+
+	if (console->esc_type == OBMC_CONSOLE_ESCAPE_STR) {
+		end = str_esc_scan(&console->esc_state.str, buf, len);
+		if (end) {
+			len = end;
+			escaped = true;
+		}
+	}
+
+	/* With nothing queued ahead, send straight from buf, and queue only
+	 * what the socket won't take. The ssh-style escape is scanned for in
+	 * place, so that input always goes through the queue */
+	if (console->esc_type != OBMC_CONSOLE_ESCAPE_SSH && !console->tx_len &&
+	    !console->connecting) {
+		sent = console_send(console, data, len);
+		if (sent < 0) {
+			return console_set_closed(console, (int)sent);
+		}
+		data += sent;
+		len -= (size_t)sent;
+	}
+
+	if (!len) {
+		return escaped ? 1 : 0;
+	}
+
+	rc = console_tx_reserve(console, len);
+	if (rc) {
+		return rc;
+	}
+
+	memcpy(console->tx_buf + console->tx_len, data, len);
+	queued = len;
+	if (console->esc_type == OBMC_CONSOLE_ESCAPE_SSH) {
+		escaped = ssh_esc_scan(&console->esc_state.ssh,
+				       console->tx_buf + console->tx_len,
+				       &queued);
+		if (escaped) {
+			console->esc_state.ssh.state = '\0';
+		}
+	}
+	console->tx_len += queued;
+
+	if (!console->connecting) {
+		rc = console_flush(console);
+		if (rc) {
+			return console_set_closed(console, rc);
+		}
+	}
+
+	return escaped ? 1 : 0;
+}
@@ -21,14 +21,54 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 
 #include <linux/types.h>
 
 #include "console-server.h"
 #include "config.h"
+#include "latency.h"
+#include "trace.h"
+
+/* Lines longer than this bypass deduplication */
+#define LOG_LINE_MAX	     1024
+#define LOG_DEDUP_MAX_WINDOW 16
+
+/*
+ * Optional line filter applied to the persisted log only: suppresses lines
+ * matching one of the last few lines logged, and rate-limits lines with a
+ * token bucket. Live consumers of the ringbuffer are unaffected.
+ */
+struct log_filter {
+	/* the line currently being assembled from ringbuffer spans */
+	uint8_t line[LOG_LINE_MAX];
+	size_t line_len;
+	/* set while passing through (or dropping) the rest of a long line */
+	bool overflow;
+	bool overflow_pass;
+
+	/* FNV-1a hashes of the most recently logged lines */
+	uint64_t recent[LOG_DEDUP_MAX_WINDOW];
+	size_t window;
+	size_t n_recent;
+	size_t recent_pos;
+	unsigned long n_suppressed;
+
+	/* lines per second, 0 for unlimited; tokens are in 1/1000 lines */
+	unsigned long rate;
+	uint64_t tokens;
+	struct timespec last_refill;
+	unsigned long n_dropped;
+
+	/* bounds how long a partial line or a notice is held back */
+	int timer_fd;
+	struct poller *poller;
+	bool timer_armed;
+};
 
 struct log_handler {
 	struct handler handler;
@@ -40,21 +80,134 @@ struct log_handler {
 	size_t pagesize;
 	char *log_filename;
 	char *rotate_filename;
+	struct log_filter *filter;
+
+	/* RAM staging area, flushed to fd in large writes. NULL if disabled */
+	uint8_t *staging;
+	size_t staging_size;
+	size_t staged;
+	int staging_fd;
+	int flush_timer_fd;
+	struct poller *flush_poller;
+	struct itimerspec flush_interval;
+
+	/* data counts as delivered once written, or staged */
+	struct latency_hist latency;
 };
 
 static const char *default_filename = LOCALSTATEDIR "/log/obmc-console.log";
 static const size_t default_logsize = 16ul * 1024ul;
+static const unsigned long default_flush_interval = 5;
+static const struct itimerspec log_filter_hold = {
+	.it_value = { .tv_sec = 1 },
+};
 
 static struct log_handler *to_log_handler(struct handler *handler)
 {
 	return container_of(handler, struct log_handler, handler);
 }
 
+/* On failure what wasn't written stays staged, and the timer is rearmed to
+ * retry */
+static int log_flush(struct log_handler *lh)
+{
+	const struct itimerspec disarm = { 0 };
+	size_t written;
+	int rc;
+
+	if (!lh->staged) {
+		return 0;
+	}
+
+	rc = write_buf_to_fd_partial(lh->fd, lh->staging, lh->staged,
+				     &written);
+	if (rc) {
+		memmove(lh->staging, lh->staging + written,
+			lh->staged - written);
+		lh->staged -= written;
+		timerfd_settime(lh->flush_timer_fd, 0, &lh->flush_interval,
+				NULL);
+		return rc;
+	}
+
+	lh->staged = 0;
+	timerfd_settime(lh->flush_timer_fd, 0, &disarm, NULL);
+
+	return 0;
+}
+
+/*
+ * Fill the staging area and write it out whole, carrying the tail of buf over
+ * into the next one, so the log grows in staging_size writes. Data that would
+ * fill the staging area by itself skips it.
+ */
+static int log_stage(struct log_handler *lh, uint8_t *buf, size_t len)
+{
+	size_t n;
+	int rc;
+
+	while (len) {
+		/* Still full from a failed flush */
+		if (lh->staged == lh->staging_size) {
+			rc = log_flush(lh);
+			if (rc) {
+				return rc;
+			}
+		}
+
+		if (!lh->staged && len >= lh->staging_size) {
+			n = len - len % lh->staging_size;
+			rc = write_buf_to_fd(lh->fd, buf, n);
+			if (rc) {
+				return rc;
+			}
+			buf += n;
+			len -= n;
+			continue;
+		}
+
+		/* Bound the time data can sit in RAM from when it's first
+		 * staged */
+		if (!lh->staged) {
+			timerfd_settime(lh->flush_timer_fd, 0,
+					&lh->flush_interval, NULL);
+		}
+
+		n = lh->staging_size - lh->staged;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(lh->staging + lh->staged, buf, n);
+		lh->staged += n;
+		buf += n;
+		len -= n;
+
+		if (lh->staged == lh->staging_size) {
+			rc = log_flush(lh);
+			if (rc) {
+				return rc;
+			}
+		}
+	}
+
+	return 0;
+}
+
 static int log_trim(struct log_handler *lh)
 {
 	int rc;
 
+	/* Complete the current file before it's rotated out */
+	if (lh->staging) {
+		rc = log_flush(lh);
+		if (rc) {
+			warnx("Failed to flush staged log to %s",
+			      lh->log_filename);
+		}
+	}
+
 	/* Move the log buffer file to the rotate file */
+	TRACE2(log_rotate, lh->log_filename, lh->size);
 	close(lh->fd);
 	rc = rename(lh->log_filename, lh->rotate_filename);
 	if (rc) {
@@ -69,7 +222,8 @@ static int log_trim(struct log_handler *lh)
 		return -1;
 	}
 
-	lh->size = 0;
+	/* Data a failed flush left staged is written to the new file */
+	lh->size = lh->staged;
 
 	return 0;
 }
@@ -90,7 +244,11 @@ static int log_data(struct log_handler *lh, uint8_t *buf, size_t len)
 		}
 	}
 
-	rc = write_buf_to_fd(lh->fd, buf, len);
+	if (lh->staging) {
+		rc = log_stage(lh, buf, len);
+	} else {
+		rc = write_buf_to_fd(lh->fd, buf, len);
+	}
 	if (rc) {
 		return rc;
 	}
@@ -100,6 +258,263 @@ static int log_data(struct log_handler *lh, uint8_t *buf, size_t len)
 	return 0;
 }
 
+static uint64_t log_line_hash(const uint8_t *buf, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ull;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= buf[i];
+		hash *= 0x100000001b3ull;
+	}
+
+	return hash;
+}
+
+static bool log_dedup_seen(struct log_filter *lf, uint64_t hash)
+{
+	for (size_t i = 0; i < lf->n_recent; i++) {
+		if (lf->recent[i] == hash) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void log_dedup_remember(struct log_filter *lf, uint64_t hash)
+{
+	if (!lf->window) {
+		return;
+	}
+
+	lf->recent[lf->recent_pos] = hash;
+	lf->recent_pos = (lf->recent_pos + 1) % lf->window;
+	if (lf->n_recent < lf->window) {
+		lf->n_recent++;
+	}
+}
+
+static bool log_rate_admit(struct log_filter *lf)
+{
+	const uint64_t burst = (uint64_t)lf->rate * 1000;
+	struct timespec now;
+	uint64_t elapsed_ms;
+
+	if (!lf->rate) {
+		return true;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ms = (now.tv_sec - lf->last_refill.tv_sec) * 1000 +
+		     (now.tv_nsec - lf->last_refill.tv_nsec) / 1000000;
+	if (elapsed_ms) {
+		lf->tokens += elapsed_ms * lf->rate;
+		if (lf->tokens > burst) {
+			lf->tokens = burst;
+		}
+		lf->last_refill = now;
+	}
+
+	if (lf->tokens < 1000) {
+		return false;
+	}
+
+	lf->tokens -= 1000;
+	return true;
+}
+
+/* fmt takes the count, then the plural suffix for it */
+static int log_filter_notice(struct log_handler *lh, const char *fmt,
+			     unsigned long count)
+{
+	char buf[80];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), fmt, count, count == 1 ? "" : "s");
+	if (len < 0 || (size_t)len >= sizeof(buf)) {
+		return 0;
+	}
+
+	return log_data(lh, (uint8_t *)buf, len);
+}
+
+/* With a wider window, the suppressed lines may repeat any of the recent
+ * ones, not just the last */
+static const char *log_dedup_notice(struct log_filter *lf)
+{
+	if (lf->window == 1) {
+		return "[obmc-console] last message repeated %lu time%s\n";
+	}
+
+	return "[obmc-console] %lu repeated line%s suppressed\n";
+}
+
+/* Report anything we have held back before the next line is logged */
+static int log_filter_flush_notices(struct log_handler *lh)
+{
+	struct log_filter *lf = lh->filter;
+	int rc;
+
+	if (lf->n_suppressed) {
+		rc = log_filter_notice(lh, log_dedup_notice(lf),
+				       lf->n_suppressed);
+		if (rc) {
+			return rc;
+		}
+		lf->n_suppressed = 0;
+	}
+
+	if (lf->n_dropped) {
+		rc = log_filter_notice(
+			lh, "[obmc-console] rate limited, %lu line%s dropped\n",
+			lf->n_dropped);
+		if (rc) {
+			return rc;
+		}
+		lf->n_dropped = 0;
+	}
+
+	return 0;
+}
+
+/* Pass the line through as it's assembled, rather than deduplicating it.
+ * Only the rate limit applies */
+static int log_filter_pass_line(struct log_handler *lh)
+{
+	struct log_filter *lf = lh->filter;
+	int rc;
+
+	lf->overflow = true;
+	lf->overflow_pass = log_rate_admit(lf);
+	if (!lf->overflow_pass) {
+		lf->n_dropped++;
+		lf->line_len = 0;
+		return 0;
+	}
+
+	rc = log_filter_flush_notices(lh);
+	if (!rc) {
+		rc = log_data(lh, lf->line, lf->line_len);
+	}
+	lf->line_len = 0;
+
+	return rc;
+}
+
+static int log_filter_line(struct log_handler *lh)
+{
+	struct log_filter *lf = lh->filter;
+	uint64_t hash;
+	int rc;
+
+	hash = log_line_hash(lf->line, lf->line_len);
+
+	if (log_dedup_seen(lf, hash)) {
+		lf->n_suppressed++;
+		return 0;
+	}
+
+	if (!log_rate_admit(lf)) {
+		lf->n_dropped++;
+		return 0;
+	}
+
+	rc = log_filter_flush_notices(lh);
+	if (rc) {
+		return rc;
+	}
+
+	log_dedup_remember(lf, hash);
+
+	return log_data(lh, lf->line, lf->line_len);
+}
+
+/* Append a fragment of a line; eol is set if buf ends with the newline */
+static int log_filter_append(struct log_handler *lh, uint8_t *buf, size_t len,
+			     bool eol)
+{
+	struct log_filter *lf = lh->filter;
+	int rc = 0;
+
+	if (lf->overflow) {
+		if (lf->overflow_pass) {
+			rc = log_data(lh, buf, len);
+		}
+		lf->overflow = !eol;
+		return rc;
+	}
+
+	if (lf->line_len + len > sizeof(lf->line)) {
+		/* Too long to deduplicate */
+		rc = log_filter_pass_line(lh);
+		if (!rc && lf->overflow_pass) {
+			rc = log_data(lh, buf, len);
+		}
+		lf->overflow = !eol;
+		return rc;
+	}
+
+	memcpy(lf->line + lf->line_len, buf, len);
+	lf->line_len += len;
+
+	if (eol) {
+		rc = log_filter_line(lh);
+		lf->line_len = 0;
+	}
+
+	return rc;
+}
+
+static int log_filter_data(struct log_handler *lh, uint8_t *buf, size_t len)
+{
+	struct log_filter *lf = lh->filter;
+	uint8_t *eol;
+	size_t n;
+	int rc;
+
+	while (len) {
+		eol = memchr(buf, '\n', len);
+		n = eol ? (size_t)(eol - buf) + 1 : len;
+
+		rc = log_filter_append(lh, buf, n, !!eol);
+		if (rc) {
+			return rc;
+		}
+
+		buf += n;
+		len -= n;
+	}
+
+	/* Bound the time anything is held back from when it first is */
+	if (!lf->timer_armed &&
+	    ((lf->line_len && !lf->overflow) || lf->n_suppressed ||
+	     lf->n_dropped)) {
+		timerfd_settime(lf->timer_fd, 0, &log_filter_hold, NULL);
+		lf->timer_armed = true;
+	}
+
+	return 0;
+}
+
+/* Write out what has been held back too long: the notices, and a partial line
+ * such as a login prompt, which is passed through from here */
+static int log_filter_expire(struct log_handler *lh)
+{
+	struct log_filter *lf = lh->filter;
+	int rc = 0;
+
+	lf->timer_armed = false;
+
+	if (lf->line_len && !lf->overflow) {
+		rc = log_filter_pass_line(lh);
+	}
+	if (!rc) {
+		rc = log_filter_flush_notices(lh);
+	}
+
+	return rc;
+}
+
 static enum ringbuffer_poll_ret log_ringbuffer_poll(void *arg, size_t force_len
 						    __attribute__((unused)))
 {
@@ -116,8 +531,13 @@ static enum ringbuffer_poll_ret log_ringbuffer_poll(void *arg, size_t force_len
 			break;
 		}
 
-		rc = log_data(lh, buf, len);
+		if (lh->filter) {
+			rc = log_filter_data(lh, buf, len);
+		} else {
+			rc = log_data(lh, buf, len);
+		}
 		if (rc) {
+			lh->rbc = NULL;
 			return RINGBUFFER_POLL_REMOVE;
 		}
 
@@ -150,6 +570,237 @@ static int log_create(struct log_handler *lh)
 	return 0;
 }
 
+static enum poller_ret log_flush_poll(struct handler *handler, int events,
+				      void *data __attribute__((unused)))
+{
+	struct log_handler *lh = to_log_handler(handler);
+	uint64_t expirations;
+	ssize_t rc;
+
+	if (!(events & POLLIN)) {
+		return POLLER_OK;
+	}
+
+	rc = read(lh->flush_timer_fd, &expirations, sizeof(expirations));
+	if (rc < 0) {
+		return POLLER_OK;
+	}
+
+	if (log_flush(lh)) {
+		warnx("Failed to flush staged log to %s", lh->log_filename);
+	}
+
+	return POLLER_OK;
+}
+
+static enum poller_ret log_filter_poll(struct handler *handler, int events,
+				       void *data __attribute__((unused)))
+{
+	struct log_handler *lh = to_log_handler(handler);
+	uint64_t expirations;
+	ssize_t rc;
+
+	if (!(events & POLLIN)) {
+		return POLLER_OK;
+	}
+
+	rc = read(lh->filter->timer_fd, &expirations, sizeof(expirations));
+	if (rc < 0) {
+		return POLLER_OK;
+	}
+
+	if (log_filter_expire(lh)) {
+		warnx("Failed to write held back log data to %s",
+		      lh->log_filename);
+	}
+
+	return POLLER_OK;
+}
+
+static int log_staging_init(struct log_handler *lh, struct config *config)
+{
+	unsigned long interval = default_flush_interval;
+	const char *console_id = lh->console->console_id;
+	size_t size;
+	const char *val;
+	int rc;
+
+	val = config_get_console_value(config, console_id, "log-staging-size");
+	if (!val) {
+		return 0;
+	}
+
+	rc = config_parse_bytesize(val, &size);
+	if (rc) {
+		warnx("Invalid log-staging-size '%s', writing log directly",
+		      val);
+		return 0;
+	}
+
+	val = config_get_console_value(config, console_id,
+				       "log-flush-interval");
+	if (val && (config_parse_ulong(val, &interval) || !interval)) {
+		warnx("Invalid log-flush-interval '%s', default to %lus", val,
+		      default_flush_interval);
+		interval = default_flush_interval;
+	}
+
+	/* Flush in whole pages */
+	size = (size + lh->pagesize - 1) & ~(lh->pagesize - 1);
+
+	lh->staging_fd = memfd_create("obmc-console-log", MFD_CLOEXEC);
+	if (lh->staging_fd < 0) {
+		warn("Can't create log staging area");
+		return -1;
+	}
+
+	rc = ftruncate(lh->staging_fd, (off_t)size);
+	if (rc) {
+		warn("Can't size log staging area");
+		goto err_close_staging;
+	}
+
+	lh->staging = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			   lh->staging_fd, 0);
+	if (lh->staging == MAP_FAILED) {
+		warn("Can't map log staging area");
+		goto err_close_staging;
+	}
+
+	lh->flush_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					    TFD_NONBLOCK | TFD_CLOEXEC);
+	if (lh->flush_timer_fd < 0) {
+		warn("Can't create log flush timer");
+		goto err_unmap;
+	}
+
+	lh->flush_interval.it_value.tv_sec = (time_t)interval;
+
+	lh->flush_poller = console_poller_register(lh->console, &lh->handler,
+						   log_flush_poll, NULL,
+						   lh->flush_timer_fd, POLLIN,
+						   NULL);
+	if (!lh->flush_poller) {
+		goto err_close_timer;
+	}
+
+	lh->staging_size = size;
+
+	return 0;
+
+err_close_timer:
+	close(lh->flush_timer_fd);
+err_unmap:
+	munmap(lh->staging, size);
+err_close_staging:
+	close(lh->staging_fd);
+	lh->staging = NULL;
+	lh->staging_fd = -1;
+	lh->flush_timer_fd = -1;
+	return -1;
+}
+
+static void log_staging_fini(struct log_handler *lh)
+{
+	if (!lh->staging) {
+		return;
+	}
+
+	if (log_flush(lh)) {
+		warnx("Failed to flush staged log to %s", lh->log_filename);
+	}
+
+	console_poller_unregister(lh->console, lh->flush_poller);
+	close(lh->flush_timer_fd);
+	munmap(lh->staging, lh->staging_size);
+	close(lh->staging_fd);
+	lh->staging = NULL;
+}
+
+static struct log_filter *log_filter_init(struct log_handler *lh,
+					   struct config *config)
+{
+	struct console *console = lh->console;
+	unsigned long window = 0;
+	unsigned long rate = 0;
+	struct log_filter *lf;
+	const char *val;
+
+	val = config_get_console_value(config, console->console_id,
+				       "log-dedup-window");
+	if (val && config_parse_ulong(val, &window)) {
+		warnx("Invalid log-dedup-window '%s', disabling", val);
+		window = 0;
+	}
+	if (window > LOG_DEDUP_MAX_WINDOW) {
+		warnx("log-dedup-window clamped to %d", LOG_DEDUP_MAX_WINDOW);
+		window = LOG_DEDUP_MAX_WINDOW;
+	}
+
+	val = config_get_console_value(config, console->console_id,
+				       "log-rate-limit");
+	if (val && config_parse_ulong(val, &rate)) {
+		warnx("Invalid log-rate-limit '%s', disabling", val);
+		rate = 0;
+	}
+
+	if (!window && !rate) {
+		return NULL;
+	}
+
+	lf = calloc(1, sizeof(*lf));
+	if (!lf) {
+		return NULL;
+	}
+
+	lf->window = window;
+	lf->rate = rate;
+	lf->tokens = (uint64_t)rate * 1000;
+	clock_gettime(CLOCK_MONOTONIC, &lf->last_refill);
+
+	lf->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				      TFD_NONBLOCK | TFD_CLOEXEC);
+	if (lf->timer_fd < 0) {
+		warn("Can't create log filter timer");
+		goto err_free;
+	}
+
+	lf->poller = console_poller_register(console, &lh->handler,
+					     log_filter_poll, NULL,
+					     lf->timer_fd, POLLIN, NULL);
+	if (!lf->poller) {
+		goto err_close_timer;
+	}
+
+	return lf;
+
+err_close_timer:
+	close(lf->timer_fd);
+err_free:
+	free(lf);
+	return NULL;
+}
+
+static void log_filter_fini(struct log_handler *lh)
+{
+	struct log_filter *lf = lh->filter;
+
+	if (!lf) {
+		return;
+	}
+
+	/* Don't lose a trailing partial line or pending notices */
+	if (lf->line_len && !lf->overflow) {
+		log_filter_line(lh);
+	}
+	log_filter_flush_notices(lh);
+
+	console_poller_unregister(lh->console, lf->poller);
+	close(lf->timer_fd);
+	free(lf);
+	lh->filter = NULL;
+}
+
 static struct handler *log_init(const struct handler_type *type
 				__attribute__((unused)),
 				struct console *console, struct config *config)
@@ -166,10 +817,19 @@ static struct handler *log_init(const struct handler_type *type
 	}
 
 	lh->console = console;
+	memset(&lh->latency, 0, sizeof(lh->latency));
 	lh->pagesize = 4096;
 	lh->size = 0;
 	lh->log_filename = NULL;
 	lh->rotate_filename = NULL;
+	lh->filter = NULL;
+	lh->staging = NULL;
+	lh->staging_size = 0;
+	lh->staged = 0;
+	lh->staging_fd = -1;
+	lh->flush_timer_fd = -1;
+	lh->flush_poller = NULL;
+	memset(&lh->flush_interval, 0, sizeof(lh->flush_interval));
 
 	logsize_str = config_get_value(config, "logsize");
 	rc = config_parse_bytesize(logsize_str, &logsize);
@@ -203,8 +863,18 @@ static struct handler *log_init(const struct handler_type *type
 	if (rc < 0) {
 		goto err_free;
 	}
+
+	lh->filter = log_filter_init(lh, config);
+
+	rc = log_staging_init(lh, config);
+	if (rc) {
+		warnx("Writing log directly to %s", lh->log_filename);
+	}
 	lh->rbc = console_ringbuffer_consumer_register(console,
 						       log_ringbuffer_poll, lh);
+	if (lh->rbc) {
+		ringbuffer_consumer_set_latency(lh->rbc, &lh->latency);
+	}
 
 	return &lh->handler;
 
@@ -218,17 +888,27 @@ err_free:
 static void log_fini(struct handler *handler)
 {
 	struct log_handler *lh = to_log_handler(handler);
-	ringbuffer_consumer_unregister(lh->rbc);
+	if (lh->rbc) {
+		ringbuffer_consumer_unregister(lh->rbc);
+	}
+	log_filter_fini(lh);
+	log_staging_fini(lh);
 	close(lh->fd);
 	free(lh->log_filename);
 	free(lh->rotate_filename);
 	free(lh);
 }
 
+static const struct latency_hist *log_latency(struct handler *handler)
+{
+	return &to_log_handler(handler)->latency;
+}
+
 static const struct handler_type log_handler = {
 	.name = "log",
 	.init = log_init,
 	.fini = log_fini,
+	.latency = log_latency,
 };
 
 console_handler_register(&log_handler);
@@ -0,0 +1,221 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matcher.h"
+
+struct matcher {
+	/* next[state * 256 + byte], for every state and byte */
+	uint16_t *next;
+	/* pattern ending at each state, or -1 */
+	int32_t *out;
+	/* nearest state on the failure chain with a pattern ending, or 0 */
+	uint16_t *dict;
+	/* whether any pattern ends at a state or on its chain */
+	bool *hit;
+	size_t n_states;
+
+	char **patterns;
+	size_t *lens;
+	size_t n_patterns;
+
+	uint16_t state;
+	uint64_t offset;
+};
+
+static int matcher_build(struct matcher *m, size_t max_states)
+{
+	uint16_t *queue;
+	uint16_t *fail;
+	size_t head = 0;
+	size_t tail = 0;
+
+	/* Build the trie. Nothing leads back to the root, so 0 marks a missing
+	 * edge until the transitions are filled in below */
+	m->n_states = 1;
+	for (size_t i = 0; i < m->n_patterns; i++) {
+		size_t s = 0;
+
+		for (size_t j = 0; j < m->lens[i]; j++) {
+			uint8_t c = (uint8_t)m->patterns[i][j];
+
+			if (!m->next[s * 256 + c]) {
+				m->next[s * 256 + c] = (uint16_t)m->n_states++;
+			}
+			s = m->next[s * 256 + c];
+		}
+
+		if (m->out[s] < 0) {
+			m->out[s] = (int32_t)i;
+		}
+	}
+
+	queue = calloc(max_states, sizeof(*queue));
+	fail = calloc(max_states, sizeof(*fail));
+	if (!queue || !fail) {
+		free(queue);
+		free(fail);
+		return -1;
+	}
+
+	for (size_t c = 0; c < 256; c++) {
+		uint16_t t = m->next[c];
+
+		if (t) {
+			m->hit[t] = m->out[t] >= 0;
+			queue[tail++] = t;
+		}
+	}
+
+	/* Breadth first, so each state's failure target is already complete */
+	while (head < tail) {
+		uint16_t s = queue[head++];
+
+		for (size_t c = 0; c < 256; c++) {
+			uint16_t t = m->next[s * 256 + c];
+			uint16_t f = m->next[fail[s] * 256 + c];
+
+			if (!t) {
+				m->next[s * 256 + c] = f;
+				continue;
+			}
+
+			fail[t] = f;
+			m->dict[t] = m->out[f] >= 0 ? f : m->dict[f];
+			m->hit[t] = m->out[t] >= 0 || m->dict[t];
+			queue[tail++] = t;
+		}
+	}
+
+	free(queue);
+	free(fail);
+
+	return 0;
+}
+
+struct matcher *matcher_init(const char *const *patterns, size_t n_patterns)
+{
+	struct matcher *m;
+	size_t max_states = 1;
+
+	for (size_t i = 0; i < n_patterns; i++) {
+		size_t len = strlen(patterns[i]);
+
+		if (!len) {
+			warnx("Empty patterns can't be matched");
+			return NULL;
+		}
+		max_states += len;
+	}
+
+	if (!n_patterns || max_states > MATCHER_MAX_LEN + 1) {
+		warnx("Patterns must total 1 to %d bytes", MATCHER_MAX_LEN);
+		return NULL;
+	}
+
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		return NULL;
+	}
+
+	m->next = calloc(max_states * 256, sizeof(*m->next));
+	m->out = malloc(max_states * sizeof(*m->out));
+	m->dict = calloc(max_states, sizeof(*m->dict));
+	m->hit = calloc(max_states, sizeof(*m->hit));
+	m->patterns = calloc(n_patterns, sizeof(*m->patterns));
+	m->lens = calloc(n_patterns, sizeof(*m->lens));
+	if (!m->next || !m->out || !m->dict || !m->hit || !m->patterns ||
+	    !m->lens) {
+		goto err_fini;
+	}
+
+	memset(m->out, -1, max_states * sizeof(*m->out));
+
+	for (size_t i = 0; i < n_patterns; i++) {
+		m->patterns[i] = strdup(patterns[i]);
+		if (!m->patterns[i]) {
+			goto err_fini;
+		}
+		m->lens[i] = strlen(patterns[i]);
+		m->n_patterns++;
+	}
+
+	if (matcher_build(m, max_states)) {
+		goto err_fini;
+	}
+
+	return m;
+
+err_fini:
+	matcher_fini(m);
+	return NULL;
+}
+
+void matcher_fini(struct matcher *m)
+{
+	for (size_t i = 0; i < m->n_patterns; i++) {
+		free(m->patterns[i]);
+	}
+
+	free(m->patterns);
+	free(m->lens);
+	free(m->hit);
+	free(m->dict);
+	free(m->out);
+	free(m->next);
+	free(m);
+}
+
+static void matcher_report(struct matcher *m, uint16_t s, uint64_t end,
+			   matcher_match_fn_t fn, void *data)
+{
+	for (; s; s = m->dict[s]) {
+		if (m->out[s] >= 0) {
+			fn(data, (size_t)m->out[s], end - m->lens[m->out[s]]);
+		}
+	}
+}
+
+void matcher_scan(struct matcher *m, const uint8_t *buf, size_t len,
+		  matcher_match_fn_t fn, void *data)
+{
+	const uint16_t *next = m->next;
+	uint16_t s = m->state;
+
+	for (size_t i = 0; i < len; i++) {
+		s = next[(size_t)s * 256 + buf[i]];
+		if (m->hit[s]) {
+			matcher_report(m, s, m->offset + i + 1, fn, data);
+		}
+	}
+
+	m->state = s;
+	m->offset += len;
+}
+
+const char *matcher_pattern(struct matcher *m, size_t pattern)
+{
+	return m->patterns[pattern];
+}
+
+uint64_t matcher_offset(struct matcher *m)
+{
+	return m->offset;
+}
@@ -0,0 +1,43 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming multi-pattern matcher. A set of literal patterns is compiled into
+ * an Aho-Corasick automaton, with every transition precomputed, so scanning
+ * costs one table lookup per byte however many patterns there are.
+ *
+ * The matcher keeps its position in the stream between calls, so data can be
+ * fed in arbitrary pieces and matches spanning them are still found.
+ */
+#define MATCHER_MAX_LEN 4096
+
+struct matcher;
+
+/* pattern is an index into the set, offset where the match starts */
+typedef void (*matcher_match_fn_t)(void *data, size_t pattern,
+				   uint64_t offset);
+
+struct matcher *matcher_init(const char *const *patterns, size_t n_patterns);
+void matcher_fini(struct matcher *m);
+void matcher_scan(struct matcher *m, const uint8_t *buf, size_t len,
+		  matcher_match_fn_t fn, void *data);
+const char *matcher_pattern(struct matcher *m, size_t pattern);
+uint64_t matcher_offset(struct matcher *m);
@@ -0,0 +1,97 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * libobmc-console: connect to an obmc-console-server console from within a
+ * process, rather than through obmc-console-client.
+ *
+ * A connection is driven by the caller's event loop: poll obmc_console_fd()
+ * for obmc_console_events(), and pass what comes back to
+ * obmc_console_dispatch(). Nothing blocks.
+ *
+ * Console output lands in a buffer owned by the connection, and is handed out
+ * as spans of it: to ops->output as it arrives, or, without that callback,
+ * through obmc_console_peek() and obmc_console_consume().
+ *
+ * Functions returning int give 0 or a positive value on success, and a
+ * negative errno value on failure.
+ */
+struct obmc_console;
+
+enum obmc_console_flags {
+	/* Connect to the console's dump socket: the output the server has
+	 * buffered is sent, then the connection is closed */
+	OBMC_CONSOLE_DUMP = 1 << 0,
+};
+
+enum obmc_console_escape {
+	OBMC_CONSOLE_ESCAPE_NONE,
+	/* "\r~.", as in ssh */
+	OBMC_CONSOLE_ESCAPE_SSH,
+	/* an arbitrary string */
+	OBMC_CONSOLE_ESCAPE_STR,
+};
+
+struct obmc_console_ops {
+	/* Console output. buf is only valid until the callback returns */
+	void (*output)(struct obmc_console *console, const uint8_t *buf,
+		       size_t len, void *data);
+	/* The server closed the connection (err is 0), or it failed (err is
+	 * a negative errno value). Nothing more is dispatched afterwards */
+	void (*closed)(struct obmc_console *console, int err, void *data);
+};
+
+/* Start connecting to the console with the given console-id. Returns NULL,
+ * with errno set, on failure. ops may be NULL */
+struct obmc_console *obmc_console_open(const char *console_id,
+				       unsigned int flags,
+				       const struct obmc_console_ops *ops,
+				       void *data);
+void obmc_console_close(struct obmc_console *console);
+
+int obmc_console_fd(const struct obmc_console *console);
+/* The poll() events to wait for, 0 once the connection has closed */
+short obmc_console_events(const struct obmc_console *console);
+int obmc_console_dispatch(struct obmc_console *console, short revents);
+
+/* The output not yet consumed, when there's no ops->output. It stays
+ * available once the connection has closed */
+size_t obmc_console_peek(struct obmc_console *console, const uint8_t **buf);
+void obmc_console_consume(struct obmc_console *console, size_t len);
+
+/* Watch input passed to obmc_console_write() for an escape sequence */
+int obmc_console_set_escape(struct obmc_console *console,
+			    enum obmc_console_escape type, const char *str);
+
+/* Send input to the console. What the socket won't take now is queued, and
+ * sent as obmc_console_dispatch() finds room. Returns 1 if the escape
+ * sequence was seen: input before it is sent (or all of it up to the end of
+ * a string escape), and the rest is dropped */
+int obmc_console_write(struct obmc_console *console, const void *buf,
+		       size_t len);
+
+#ifdef __cplusplus
+}
+#endif
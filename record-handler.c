@@ -0,0 +1,516 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "asciicast.h"
+#include "console-server.h"
+#include "config.h"
+#include "screen.h"
+
+/* Output arriving within this long of the last is recorded as one event */
+#define RECORD_COALESCE_NS (10 * 1000 * 1000)
+#define RECORD_MAX_MARKS   256
+/* "[seconds, "o", "" and "]\n" around each event */
+#define RECORD_EVENT_MAX   48
+
+/* The span of queued output, up to end, that first arrived at time */
+struct record_mark {
+	size_t end;
+	struct timespec time;
+};
+
+/*
+ * Records console output as asciicast v2, for replay with its timing. On
+ * the output path, the handler only notes when data arrived: the data itself
+ * stays in the ringbuffer until the flush timer fires, or the ringbuffer
+ * needs the space, when it's encoded and written out in one go.
+ */
+struct record_handler {
+	struct handler handler;
+	struct console *console;
+	struct ringbuffer_consumer *rbc;
+	char *filename;
+	char *rotate_filename;
+	int fd;
+	size_t size;
+	size_t maxsize;
+
+	/* when the current file's first event happened */
+	struct timespec start;
+
+	struct record_mark marks[RECORD_MAX_MARKS];
+	size_t n_marks;
+	struct asciicast_enc enc;
+
+	char *staging;
+	size_t staging_size;
+	size_t staged;
+
+	int flush_timer_fd;
+	struct poller *flush_poller;
+	struct itimerspec flush_interval;
+	bool flush_armed;
+};
+
+static const size_t default_record_size = 1024ul * 1024ul;
+static const unsigned long default_record_flush_interval = 1;
+
+static struct record_handler *to_record_handler(struct handler *handler)
+{
+	return container_of(handler, struct record_handler, handler);
+}
+
+static int64_t timespec_diff_ns(const struct timespec *a,
+				const struct timespec *b)
+{
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000 +
+	       (a->tv_nsec - b->tv_nsec);
+}
+
+static int record_reserve(struct record_handler *rh, size_t len)
+{
+	size_t size = rh->staging_size ? rh->staging_size : 4096;
+	char *staging;
+
+	while (size < rh->staged + len) {
+		size *= 2;
+	}
+
+	if (size == rh->staging_size) {
+		return 0;
+	}
+
+	staging = realloc(rh->staging, size);
+	if (!staging) {
+		return -1;
+	}
+
+	rh->staging = staging;
+	rh->staging_size = size;
+
+	return 0;
+}
+
+/* A file starts with a header giving the wall clock time of its first
+ * event, which event times are relative to */
+static int record_stage_header(struct record_handler *rh,
+			       const struct timespec *first)
+{
+	unsigned int cols = 80;
+	unsigned int rows = 24;
+	struct timespec mono;
+	struct timespec real;
+	size_t id_len;
+	int len;
+
+	if (rh->console->screen) {
+		screen_get_size(rh->console->screen, &cols, &rows);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	rh->start = *first;
+
+	id_len = strlen(rh->console->console_id);
+	if (record_reserve(rh, 128 + ASCIICAST_ESCAPED_MAX(id_len))) {
+		return -1;
+	}
+
+	len = snprintf(rh->staging + rh->staged,
+		       rh->staging_size - rh->staged,
+		       "{\"version\": 2, \"width\": %u, \"height\": %u, "
+		       "\"timestamp\": %lld, \"title\": \"",
+		       cols, rows,
+		       (long long)(real.tv_sec -
+				   timespec_diff_ns(&mono, first) /
+					   1000000000));
+	rh->staged += (size_t)len;
+	rh->staged += asciicast_escape(
+		&(struct asciicast_enc){ 0 },
+		(const uint8_t *)rh->console->console_id, id_len,
+		rh->staging + rh->staged);
+	memcpy(rh->staging + rh->staged, "\"}\n", 3);
+	rh->staged += 3;
+
+	return 0;
+}
+
+static int record_stage_event(struct record_handler *rh,
+			      const struct record_mark *mark, size_t *pos,
+			      bool final)
+{
+	int64_t elapsed;
+	uint8_t *buf;
+	size_t len;
+	int n;
+
+	if (record_reserve(rh, RECORD_EVENT_MAX +
+				       ASCIICAST_ESCAPED_MAX(mark->end - *pos))) {
+		return -1;
+	}
+
+	elapsed = timespec_diff_ns(&mark->time, &rh->start);
+	if (elapsed < 0) {
+		elapsed = 0;
+	}
+
+	n = snprintf(rh->staging + rh->staged, rh->staging_size - rh->staged,
+		     "[%lld.%06lld, \"o\", \"", (long long)(elapsed / 1000000000),
+		     (long long)(elapsed % 1000000000 / 1000));
+	rh->staged += (size_t)n;
+
+	while (*pos < mark->end) {
+		len = ringbuffer_dequeue_peek(rh->rbc, *pos, &buf);
+		if (len > mark->end - *pos) {
+			len = mark->end - *pos;
+		}
+		rh->staged += asciicast_escape(&rh->enc, buf, len,
+					       rh->staging + rh->staged);
+		*pos += len;
+	}
+
+	if (final) {
+		rh->staged += asciicast_escape_flush(&rh->enc,
+						     rh->staging + rh->staged);
+	}
+
+	memcpy(rh->staging + rh->staged, "\"]\n", 3);
+	rh->staged += 3;
+
+	return 0;
+}
+
+/* Start a new file once the current one is full, keeping the old one */
+static int record_rotate(struct record_handler *rh)
+{
+	int rc;
+
+	close(rh->fd);
+
+	rc = rename(rh->filename, rh->rotate_filename);
+	if (rc) {
+		warn("Failed to rename %s to %s", rh->filename,
+		     rh->rotate_filename);
+	}
+
+	rh->fd = open(rh->filename,
+		      O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (rh->fd < 0) {
+		warn("Can't open recording %s", rh->filename);
+		return -1;
+	}
+	rh->size = 0;
+
+	return 0;
+}
+
+/* Encode the marked output, and write it out with a single write */
+static int record_flush(struct record_handler *rh, bool final)
+{
+	const struct itimerspec disarm = { 0 };
+	size_t pos = 0;
+	int rc;
+
+	if (rh->flush_armed) {
+		timerfd_settime(rh->flush_timer_fd, 0, &disarm, NULL);
+		rh->flush_armed = false;
+	}
+
+	if (!rh->n_marks) {
+		return 0;
+	}
+
+	if (rh->size >= rh->maxsize) {
+		rc = record_rotate(rh);
+		if (rc) {
+			return rc;
+		}
+	}
+
+	rh->staged = 0;
+	if (!rh->size && record_stage_header(rh, &rh->marks[0].time)) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < rh->n_marks; i++) {
+		rc = record_stage_event(rh, &rh->marks[i], &pos,
+					final && i == rh->n_marks - 1);
+		if (rc) {
+			return rc;
+		}
+	}
+
+	ringbuffer_dequeue_commit(rh->rbc, pos);
+	rh->n_marks = 0;
+
+	rc = write_buf_to_fd(rh->fd, (uint8_t *)rh->staging, rh->staged);
+	rh->size += rh->staged;
+	rh->staged = 0;
+
+	return rc;
+}
+
+/* Note when the newly queued output arrived. Output arriving in quick
+ * succession joins the last event */
+static void record_mark(struct record_handler *rh, size_t end)
+{
+	struct record_mark *mark;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	if (rh->n_marks) {
+		mark = &rh->marks[rh->n_marks - 1];
+		if (timespec_diff_ns(&now, &mark->time) < RECORD_COALESCE_NS) {
+			mark->end = end;
+			return;
+		}
+	}
+
+	mark = &rh->marks[rh->n_marks++];
+	mark->end = end;
+	mark->time = now;
+}
+
+static enum ringbuffer_poll_ret record_ringbuffer_poll(void *arg,
+						       size_t force_len)
+{
+	struct record_handler *rh = arg;
+	size_t marked;
+	size_t len;
+
+	marked = rh->n_marks ? rh->marks[rh->n_marks - 1].end : 0;
+	len = ringbuffer_len(rh->rbc);
+	if (len > marked) {
+		record_mark(rh, len);
+	}
+
+	if (force_len || rh->n_marks == RECORD_MAX_MARKS) {
+		if (record_flush(rh, false)) {
+			warnx("Failed to write recording %s", rh->filename);
+			rh->rbc = NULL;
+			rh->n_marks = 0;
+			return RINGBUFFER_POLL_REMOVE;
+		}
+		return RINGBUFFER_POLL_OK;
+	}
+
+	if (rh->n_marks && !rh->flush_armed) {
+		timerfd_settime(rh->flush_timer_fd, 0, &rh->flush_interval,
+				NULL);
+		rh->flush_armed = true;
+	}
+
+	return RINGBUFFER_POLL_OK;
+}
+
+static enum poller_ret record_flush_poll(struct handler *handler, int events,
+					 void *data __attribute__((unused)))
+{
+	struct record_handler *rh = to_record_handler(handler);
+	uint64_t expirations;
+	ssize_t rc;
+
+	if (!(events & POLLIN)) {
+		return POLLER_OK;
+	}
+
+	rc = read(rh->flush_timer_fd, &expirations, sizeof(expirations));
+	if (rc < 0) {
+		return POLLER_OK;
+	}
+
+	rh->flush_armed = false;
+	if (record_flush(rh, false)) {
+		warnx("Failed to write recording %s", rh->filename);
+	}
+
+	return POLLER_OK;
+}
+
+static int record_open(struct record_handler *rh)
+{
+	struct stat st;
+
+	/* Keep the recording from before a restart */
+	if (!stat(rh->filename, &st) && st.st_size > 0 &&
+	    rename(rh->filename, rh->rotate_filename)) {
+		warn("Failed to rename %s to %s", rh->filename,
+		     rh->rotate_filename);
+	}
+
+	rh->fd = open(rh->filename,
+		      O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+	if (rh->fd < 0) {
+		warn("Can't open recording %s", rh->filename);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void record_config(struct record_handler *rh, struct config *config)
+{
+	unsigned long interval = default_record_flush_interval;
+	const char *id = rh->console->console_id;
+	const char *val;
+
+	rh->maxsize = default_record_size;
+	val = config_get_console_value(config, id, "record-size");
+	if (val && (config_parse_bytesize(val, &rh->maxsize) || !rh->maxsize)) {
+		warnx("Invalid record-size '%s', default to %zukB", val,
+		      default_record_size >> 10);
+		rh->maxsize = default_record_size;
+	}
+
+	val = config_get_console_value(config, id, "record-flush-interval");
+	if (val && (config_parse_ulong(val, &interval) || !interval)) {
+		warnx("Invalid record-flush-interval '%s', default to %lus",
+		      val, default_record_flush_interval);
+		interval = default_record_flush_interval;
+	}
+	rh->flush_interval.it_value.tv_sec = (time_t)interval;
+}
+
+static struct handler *record_init(const struct handler_type *type
+				   __attribute__((unused)),
+				   struct console *console,
+				   struct config *config)
+{
+	struct record_handler *rh;
+	const char *filename;
+
+	filename = config_get_console_value(config, console->console_id,
+					    "record-file");
+	if (!filename) {
+		return NULL;
+	}
+
+	rh = calloc(1, sizeof(*rh));
+	if (!rh) {
+		return NULL;
+	}
+
+	rh->console = console;
+	rh->fd = -1;
+	rh->flush_timer_fd = -1;
+
+	record_config(rh, config);
+
+	rh->filename = strdup(filename);
+	if (!rh->filename || asprintf(&rh->rotate_filename, "%s.1", filename) < 0) {
+		warnx("Failed to construct recording filenames");
+		goto err_free;
+	}
+
+	if (record_open(rh)) {
+		goto err_free;
+	}
+
+	rh->flush_timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					    TFD_NONBLOCK | TFD_CLOEXEC);
+	if (rh->flush_timer_fd < 0) {
+		warn("Can't create recording flush timer");
+		goto err_close;
+	}
+
+	rh->flush_poller = console_poller_register(console, &rh->handler,
+						   record_flush_poll, NULL,
+						   rh->flush_timer_fd, POLLIN,
+						   NULL);
+	if (!rh->flush_poller) {
+		goto err_close_timer;
+	}
+
+	rh->rbc = console_ringbuffer_consumer_register(
+		console, record_ringbuffer_poll, rh);
+
+	return &rh->handler;
+
+err_close_timer:
+	close(rh->flush_timer_fd);
+err_close:
+	close(rh->fd);
+err_free:
+	free(rh->rotate_filename);
+	free(rh->filename);
+	free(rh);
+	return NULL;
+}
+
+static void record_fini(struct handler *handler)
+{
+	struct record_handler *rh = to_record_handler(handler);
+
+	/* The end of a UTF-8 sequence isn't coming, so out with its start */
+	if (rh->rbc && rh->enc.partial_len && !rh->n_marks) {
+		record_mark(rh, 0);
+	}
+
+	if (record_flush(rh, true)) {
+		warnx("Failed to write recording %s", rh->filename);
+	}
+
+	if (rh->rbc) {
+		ringbuffer_consumer_unregister(rh->rbc);
+	}
+	console_poller_unregister(rh->console, rh->flush_poller);
+	close(rh->flush_timer_fd);
+	close(rh->fd);
+	free(rh->staging);
+	free(rh->rotate_filename);
+	free(rh->filename);
+	free(rh);
+}
+
+/* Carry on with the same file, which a restart would rotate */
+static int record_reload(struct handler *handler, struct config *config)
+{
+	struct record_handler *rh = to_record_handler(handler);
+	const char *filename;
+
+	filename = config_get_console_value(config, rh->console->console_id,
+					    "record-file");
+	if (!filename || strcmp(filename, rh->filename)) {
+		return -1;
+	}
+
+	record_config(rh, config);
+
+	return 0;
+}
+
+static const struct handler_type record_handler = {
+	.name = "record",
+	.init = record_init,
+	.fini = record_fini,
+	.reload = record_reload,
+};
+
+console_handler_register(&record_handler);
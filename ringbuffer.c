@@ -15,17 +15,137 @@
  */
 
 #include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "console-server.h"
+#include "latency.h"
+#include "trace.h"
+
+#define RINGBUFFER_FILE_MAGIC	0x6f62636eu /* "obcn" */
+#define RINGBUFFER_FILE_VERSION 1u
+
+/* Granularity of the shared ringbuffer arena, rounded up to the page size */
+#define RINGBUFFER_ARENA_CHUNK (16ul * 1024)
+
+/*
+ * Layout of a file-backed ringbuffer: this header, then the data. The state is
+ * rewritten after every queue, alternating between two slots so that a crash
+ * mid-update leaves the previous state intact. The checksum tells them apart.
+ */
+struct ringbuffer_file_state {
+	uint64_t seq;
+	uint64_t tail;
+	uint64_t len;
+	uint32_t checksum;
+	uint32_t reserved;
+};
+
+struct ringbuffer_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t size;
+	struct ringbuffer_file_state state[2];
+};
+
+/*
+ * While tracing, each queued batch is stamped with the stream offset of its
+ * end and the time it was queued. A consumer committing past that offset has
+ * delivered the batch. Consumers more than RINGBUFFER_STAMPS batches behind
+ * lose the oldest samples.
+ */
+#define RINGBUFFER_STAMPS 64
+
+struct ringbuffer_stamp {
+	uint64_t end;
+	uint64_t ns;
+};
+
+struct ringbuffer_stamps {
+	uint64_t head;
+	struct ringbuffer_stamp ring[RINGBUFFER_STAMPS];
+};
 
 static inline size_t min(size_t a, size_t b)
 {
 	return a < b ? a : b;
 }
 
+static void ringbuffer_evict(struct ringbuffer *rb, size_t len);
+
+/* FNV-1a over the fields preceding the checksum */
+static uint32_t
+ringbuffer_state_checksum(const struct ringbuffer_file_state *state)
+{
+	const size_t len = offsetof(struct ringbuffer_file_state, checksum);
+	const uint8_t *p = (const uint8_t *)state;
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void ringbuffer_header_sync(struct ringbuffer *rb)
+{
+	struct ringbuffer_file_state *state;
+
+	if (!rb->hdr) {
+		return;
+	}
+
+	rb->seq++;
+	state = &rb->hdr->state[rb->seq & 1];
+
+	/* Keep the compiler from moving data stores across the state update */
+	__atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+	state->seq = rb->seq;
+	state->tail = rb->tail;
+	state->len = rb->len;
+	state->checksum = ringbuffer_state_checksum(state);
+}
+
+/* Find the newest intact state, if any */
+static const struct ringbuffer_file_state *
+ringbuffer_header_state(const struct ringbuffer_file_header *hdr, size_t size)
+{
+	const struct ringbuffer_file_state *found = NULL;
+
+	if (hdr->magic != RINGBUFFER_FILE_MAGIC ||
+	    hdr->version != RINGBUFFER_FILE_VERSION || hdr->size != size) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < 2; i++) {
+		const struct ringbuffer_file_state *state = &hdr->state[i];
+
+		if (state->checksum != ringbuffer_state_checksum(state) ||
+		    state->tail >= size || state->len >= size) {
+			continue;
+		}
+
+		if (!found || state->seq > found->seq) {
+			found = state;
+		}
+	}
+
+	return found;
+}
+
 struct ringbuffer *ringbuffer_init(size_t size)
 {
 	struct ringbuffer *rb;
@@ -42,14 +162,520 @@ struct ringbuffer *ringbuffer_init(size_t size)
 	return rb;
 }
 
+/*
+ * Map a ringbuffer from path, creating it if needed. If the file holds a
+ * valid buffer of the same size, its history is reattached as-is.
+ */
+struct ringbuffer *ringbuffer_init_file(const char *path, size_t size)
+{
+	const struct ringbuffer_file_state *state;
+	struct ringbuffer_file_header *hdr;
+	struct ringbuffer *rb;
+	size_t map_len;
+	struct stat st;
+	bool fresh;
+	void *map;
+	int fd;
+
+	if (size < 2) {
+		return NULL;
+	}
+
+	map_len = sizeof(*hdr) + size;
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		warn("Can't open ringbuffer file %s", path);
+		return NULL;
+	}
+
+	if (fstat(fd, &st)) {
+		warn("Can't stat ringbuffer file %s", path);
+		goto err_close;
+	}
+
+	fresh = (size_t)st.st_size != map_len;
+	if (fresh && ftruncate(fd, (off_t)map_len)) {
+		warn("Can't size ringbuffer file %s", path);
+		goto err_close;
+	}
+
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		warn("Can't map ringbuffer file %s", path);
+		goto err_close;
+	}
+
+	close(fd);
+
+	rb = calloc(1, sizeof(*rb));
+	if (!rb) {
+		munmap(map, map_len);
+		return NULL;
+	}
+
+	hdr = map;
+	rb->hdr = hdr;
+	rb->map_len = map_len;
+	rb->size = size;
+	rb->buf = (uint8_t *)(hdr + 1);
+
+	state = fresh ? NULL : ringbuffer_header_state(hdr, size);
+	if (state) {
+		rb->seq = state->seq;
+		rb->tail = state->tail;
+		rb->len = state->len;
+		rb->written = rb->len;
+		return rb;
+	}
+
+	if (!fresh) {
+		warnx("Discarding invalid ringbuffer file %s", path);
+	}
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = RINGBUFFER_FILE_MAGIC;
+	hdr->version = RINGBUFFER_FILE_VERSION;
+	hdr->size = size;
+	ringbuffer_header_sync(rb);
+
+	return rb;
+
+err_close:
+	close(fd);
+	return NULL;
+}
+
+/*
+ * A shared arena of fixed-size chunks, backed by a memfd. Each ringbuffer
+ * reserves address space for its maximum size and maps arena chunks into it,
+ * so its data stays contiguous while its size changes.
+ */
+struct ringbuffer_arena {
+	int fd;
+	size_t chunk_size;
+	size_t n_chunks;
+
+	size_t *free_chunks;
+	size_t n_free;
+
+	struct ringbuffer **rbs;
+	size_t n_rbs;
+};
+
+struct ringbuffer_arena *ringbuffer_arena_init(size_t size)
+{
+	struct ringbuffer_arena *arena;
+	long pagesize;
+
+	arena = calloc(1, sizeof(*arena));
+	if (!arena) {
+		return NULL;
+	}
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	arena->chunk_size = RINGBUFFER_ARENA_CHUNK;
+	if (pagesize > 0 && arena->chunk_size % (size_t)pagesize) {
+		arena->chunk_size += (size_t)pagesize -
+				     arena->chunk_size % (size_t)pagesize;
+	}
+
+	arena->n_chunks = size / arena->chunk_size;
+	if (!arena->n_chunks) {
+		warnx("ringbuffer arena must hold at least %zu bytes",
+		      arena->chunk_size);
+		free(arena);
+		return NULL;
+	}
+
+	arena->fd = memfd_create("obmc-console-ringbuffers", MFD_CLOEXEC);
+	if (arena->fd < 0) {
+		warn("Can't create ringbuffer arena");
+		free(arena);
+		return NULL;
+	}
+
+	if (ftruncate(arena->fd,
+		      (off_t)(arena->n_chunks * arena->chunk_size))) {
+		warn("Can't size ringbuffer arena");
+		goto err_close;
+	}
+
+	arena->free_chunks = calloc(arena->n_chunks,
+				    sizeof(*arena->free_chunks));
+	if (!arena->free_chunks) {
+		goto err_close;
+	}
+
+	/* Hand out low chunks first */
+	for (size_t i = 0; i < arena->n_chunks; i++) {
+		arena->free_chunks[i] = arena->n_chunks - 1 - i;
+	}
+	arena->n_free = arena->n_chunks;
+
+	return arena;
+
+err_close:
+	close(arena->fd);
+	free(arena);
+	return NULL;
+}
+
+void ringbuffer_arena_fini(struct ringbuffer_arena *arena)
+{
+	assert(!arena->n_rbs);
+
+	close(arena->fd);
+	free(arena->free_chunks);
+	free(arena->rbs);
+	free(arena);
+}
+
+size_t ringbuffer_arena_chunk_size(struct ringbuffer_arena *arena)
+{
+	return arena->chunk_size;
+}
+
+/* Release rb's chunks and address space, and drop it from the arena */
+static void ringbuffer_fini_arena(struct ringbuffer_arena *arena,
+				  struct ringbuffer *rb)
+{
+	size_t n = rb->size / arena->chunk_size;
+
+	for (size_t i = 0; i < arena->n_rbs; i++) {
+		if (arena->rbs[i] == rb) {
+			arena->rbs[i] = arena->rbs[--arena->n_rbs];
+			break;
+		}
+	}
+
+	for (size_t slot = 0; slot < n; slot++) {
+		arena->free_chunks[arena->n_free++] = rb->chunks[slot];
+	}
+
+	munmap(rb->buf, rb->map_len);
+	free(rb->chunks);
+	free(rb);
+}
+
+/* Map arena chunk into slot of the buffer, or unmap the slot if chunk is
+ * SIZE_MAX, leaving its address space reserved */
+static int ringbuffer_map_slot(struct ringbuffer *rb, size_t slot,
+			       size_t chunk)
+{
+	const size_t chunk_size = rb->arena->chunk_size;
+	void *addr = rb->buf + slot * chunk_size;
+	void *map;
+
+	if (chunk == SIZE_MAX) {
+		map = mmap(addr, chunk_size, PROT_NONE,
+			   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE |
+				   MAP_FIXED,
+			   -1, 0);
+	} else {
+		map = mmap(addr, chunk_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_FIXED, rb->arena->fd,
+			   (off_t)(chunk * chunk_size));
+	}
+
+	return map == MAP_FAILED ? -1 : 0;
+}
+
+/* Nothing may lie beyond tail: no consumer's unread data wraps around */
+static bool ringbuffer_consumers_linear(struct ringbuffer *rb)
+{
+	for (int i = 0; i < rb->n_consumers; i++) {
+		if (rb->consumers[i]->pos > rb->tail) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Evict the part of the history that wraps around from the end */
+static void ringbuffer_trim_history(struct ringbuffer *rb)
+{
+	if (rb->len > rb->tail) {
+		ringbuffer_evict(rb, rb->len - rb->tail);
+		rb->len = rb->tail;
+	}
+}
+
+/* Return the last chunk of rb to the arena, if none of its data is live */
+static int ringbuffer_shrink(struct ringbuffer *rb)
+{
+	struct ringbuffer_arena *arena = rb->arena;
+	const size_t chunk_size = arena->chunk_size;
+	size_t slot;
+
+	if (rb->size - chunk_size < rb->min_size ||
+	    rb->tail >= rb->size - chunk_size ||
+	    !ringbuffer_consumers_linear(rb)) {
+		return -1;
+	}
+
+	ringbuffer_trim_history(rb);
+
+	slot = rb->size / chunk_size - 1;
+	if (ringbuffer_map_slot(rb, slot, SIZE_MAX)) {
+		return -1;
+	}
+
+	arena->free_chunks[arena->n_free++] = rb->chunks[slot];
+	rb->size -= chunk_size;
+
+	return 0;
+}
+
+/* Take a free chunk, reclaiming one from a buffer above its minimum */
+static int ringbuffer_arena_take(struct ringbuffer_arena *arena,
+				 struct ringbuffer *rb, size_t *chunk)
+{
+	if (!arena->n_free) {
+		for (size_t i = 0; i < arena->n_rbs; i++) {
+			struct ringbuffer *other = arena->rbs[i];
+
+			if (other != rb && other->size > other->min_size &&
+			    !ringbuffer_shrink(other)) {
+				break;
+			}
+		}
+	}
+
+	if (!arena->n_free) {
+		return -1;
+	}
+
+	*chunk = arena->free_chunks[--arena->n_free];
+
+	return 0;
+}
+
+/*
+ * Grow rb so that len bytes fit after tail without wrapping. New space is
+ * added past the end, so only possible while no data lies beyond tail.
+ */
+static void ringbuffer_grow(struct ringbuffer *rb, size_t len)
+{
+	struct ringbuffer_arena *arena = rb->arena;
+	size_t chunk;
+	size_t slot;
+
+	if (!arena || rb->tail + len <= rb->size ||
+	    !ringbuffer_consumers_linear(rb)) {
+		return;
+	}
+
+	while (rb->tail + len > rb->size && rb->size < rb->max_size) {
+		if (ringbuffer_arena_take(arena, rb, &chunk)) {
+			return;
+		}
+
+		slot = rb->size / arena->chunk_size;
+		if (ringbuffer_map_slot(rb, slot, chunk)) {
+			arena->free_chunks[arena->n_free++] = chunk;
+			return;
+		}
+
+		ringbuffer_trim_history(rb);
+		rb->chunks[slot] = chunk;
+		rb->size += arena->chunk_size;
+	}
+}
+
+/*
+ * Build a ringbuffer from arena chunks. It starts at min_size and grows
+ * towards max_size while there are chunks to spare.
+ */
+struct ringbuffer *ringbuffer_init_arena(struct ringbuffer_arena *arena,
+					 size_t min_size, size_t max_size)
+{
+	const size_t chunk_size = arena->chunk_size;
+	struct ringbuffer **rbs;
+	struct ringbuffer *rb;
+	size_t n_min;
+	size_t n_max;
+	void *map;
+
+	n_min = (min_size + chunk_size - 1) / chunk_size;
+	n_max = (max_size + chunk_size - 1) / chunk_size;
+	if (!n_min) {
+		n_min = 1;
+	}
+	if (n_max < n_min) {
+		n_max = n_min;
+	}
+
+	if (n_min > arena->n_free) {
+		warnx("ringbuffer arena has no room for another %zukB",
+		      (n_min * chunk_size) >> 10);
+		return NULL;
+	}
+
+	rbs = reallocarray(arena->rbs, arena->n_rbs + 1, sizeof(*arena->rbs));
+	if (!rbs) {
+		return NULL;
+	}
+	arena->rbs = rbs;
+
+	rb = calloc(1, sizeof(*rb));
+	if (!rb) {
+		return NULL;
+	}
+
+	rb->chunks = calloc(n_max, sizeof(*rb->chunks));
+	map = mmap(NULL, n_max * chunk_size, PROT_NONE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (!rb->chunks || map == MAP_FAILED) {
+		warn("Can't reserve ringbuffer space");
+		free(rb->chunks);
+		free(rb);
+		return NULL;
+	}
+
+	rb->arena = arena;
+	rb->buf = map;
+	rb->map_len = n_max * chunk_size;
+	rb->min_size = n_min * chunk_size;
+	rb->max_size = n_max * chunk_size;
+
+	for (size_t slot = 0; slot < n_min; slot++) {
+		rb->chunks[slot] = arena->free_chunks[--arena->n_free];
+		if (ringbuffer_map_slot(rb, slot, rb->chunks[slot])) {
+			warn("Can't map ringbuffer chunk");
+			arena->n_free++;
+			ringbuffer_fini_arena(arena, rb);
+			return NULL;
+		}
+		rb->size += chunk_size;
+	}
+
+	arena->rbs[arena->n_rbs++] = rb;
+
+	return rb;
+}
+
 void ringbuffer_fini(struct ringbuffer *rb)
 {
 	while (rb->n_consumers) {
 		ringbuffer_consumer_unregister(rb->consumers[0]);
 	}
+
+	free(rb->stamps);
+
+	if (rb->arena) {
+		ringbuffer_fini_arena(rb->arena, rb);
+		return;
+	}
+
+	if (rb->hdr) {
+		munmap(rb->hdr, rb->map_len);
+	} else if (rb->buf != (uint8_t *)(rb + 1)) {
+		/* moved out of line by ringbuffer_resize() */
+		free(rb->buf);
+	}
+
 	free(rb);
 }
 
+void ringbuffer_set_evict(struct ringbuffer *rb, ringbuffer_evict_fn_t fn,
+			  void *data)
+{
+	rb->evict_fn = fn;
+	rb->evict_data = data;
+}
+
+static uint64_t ringbuffer_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int ringbuffer_set_tracing(struct ringbuffer *rb, bool enable)
+{
+	if (!enable) {
+		free(rb->stamps);
+		rb->stamps = NULL;
+		return 0;
+	}
+
+	if (rb->stamps) {
+		return 0;
+	}
+
+	rb->stamps = calloc(1, sizeof(*rb->stamps));
+	if (!rb->stamps) {
+		return -1;
+	}
+
+	/* Only batches queued from here on are timed */
+	for (int i = 0; i < rb->n_consumers; i++) {
+		rb->consumers[i]->stamp = 0;
+	}
+
+	return 0;
+}
+
+static void ringbuffer_stamp(struct ringbuffer *rb)
+{
+	struct ringbuffer_stamp *stamp;
+
+	stamp = &rb->stamps->ring[rb->stamps->head % RINGBUFFER_STAMPS];
+	stamp->end = rb->written;
+	stamp->ns = ringbuffer_now_ns();
+	rb->stamps->head++;
+}
+
+/* Record the batches the consumer has now delivered in full */
+static void ringbuffer_consumer_trace(struct ringbuffer_consumer *rbc)
+{
+	const struct ringbuffer_stamps *stamps = rbc->rb->stamps;
+	uint64_t offset;
+	uint64_t now = 0;
+
+	offset = rbc->rb->written - ringbuffer_len(rbc);
+
+	if (stamps->head - rbc->stamp > RINGBUFFER_STAMPS) {
+		rbc->stamp = stamps->head - RINGBUFFER_STAMPS;
+	}
+
+	for (; rbc->stamp < stamps->head; rbc->stamp++) {
+		const struct ringbuffer_stamp *stamp =
+			&stamps->ring[rbc->stamp % RINGBUFFER_STAMPS];
+
+		if (stamp->end > offset) {
+			break;
+		}
+
+		if (!now) {
+			now = ringbuffer_now_ns();
+		}
+		latency_hist_record(rbc->latency, (now - stamp->ns) / 1000);
+	}
+}
+
+/* Pass the oldest len bytes of history to the evict hook */
+static void ringbuffer_evict(struct ringbuffer *rb, size_t len)
+{
+	size_t start;
+	size_t wlen;
+
+	if (!rb->evict_fn || !len) {
+		return;
+	}
+
+	start = (rb->tail + rb->size - rb->len) % rb->size;
+	wlen = min(len, rb->size - start);
+	rb->evict_fn(rb->evict_data, rb->buf + start, wlen);
+
+	if (len > wlen) {
+		rb->evict_fn(rb->evict_data, rb->buf, len - wlen);
+	}
+}
+
 struct ringbuffer_consumer *
 ringbuffer_consumer_register(struct ringbuffer *rb, ringbuffer_poll_fn_t fn,
 			     void *data)
@@ -62,6 +688,8 @@ ringbuffer_consumer_register(struct ringbuffer *rb, ringbuffer_poll_fn_t fn,
 	rbc->poll_fn = fn;
 	rbc->poll_data = data;
 	rbc->pos = rb->tail;
+	rbc->latency = NULL;
+	rbc->stamp = rb->stamps ? rb->stamps->head : 0;
 
 	n = rb->n_consumers++;
 	/*
@@ -77,6 +705,26 @@ ringbuffer_consumer_register(struct ringbuffer *rb, ringbuffer_poll_fn_t fn,
 	return rbc;
 }
 
+struct ringbuffer_consumer *
+ringbuffer_consumer_register_backlog(struct ringbuffer *rb,
+				     ringbuffer_poll_fn_t fn, void *data)
+{
+	struct ringbuffer_consumer *rbc;
+
+	rbc = ringbuffer_consumer_register(rb, fn, data);
+	if (rbc) {
+		rbc->pos = (rb->tail + rb->size - rb->len) % rb->size;
+	}
+
+	return rbc;
+}
+
+void ringbuffer_consumer_set_latency(struct ringbuffer_consumer *rbc,
+				     struct latency_hist *hist)
+{
+	rbc->latency = hist;
+}
+
 void ringbuffer_consumer_unregister(struct ringbuffer_consumer *rbc)
 {
 	struct ringbuffer *rb = rbc->rb;
@@ -138,7 +786,9 @@ static int ringbuffer_consumer_ensure_space(struct ringbuffer_consumer *rbc,
 
 	force_len = len - ringbuffer_space(rbc);
 
+	TRACE2(ringbuffer_force_drain, rbc, force_len);
 	prc = rbc->poll_fn(rbc->poll_data, force_len);
+	TRACE2(ringbuffer_force_drain_done, rbc, prc);
 	if (prc != RINGBUFFER_POLL_OK) {
 		return -1;
 	}
@@ -146,6 +796,72 @@ static int ringbuffer_consumer_ensure_space(struct ringbuffer_consumer *rbc,
 	return 0;
 }
 
+/*
+ * Move the data of an in-memory ringbuffer to a new buffer of size bytes.
+ * Consumers with more unread data than will fit are polled to make space, as
+ * for a queue, and history that no longer fits is evicted. File and arena
+ * backed buffers are laid out when created, so can't be resized.
+ */
+int ringbuffer_resize(struct ringbuffer *rb, size_t size)
+{
+	struct ringbuffer_consumer *rbc;
+	size_t start;
+	size_t wlen;
+	uint8_t *buf;
+	int i;
+
+	if (rb->hdr || rb->arena || size < 2) {
+		return -1;
+	}
+
+	if (size == rb->size) {
+		return 0;
+	}
+
+	buf = malloc(size);
+	if (!buf) {
+		return -1;
+	}
+
+	for (i = 0; size < rb->size && i < rb->n_consumers; i++) {
+		rbc = rb->consumers[i];
+
+		if (ringbuffer_consumer_ensure_space(rbc, rb->size - size)) {
+			ringbuffer_consumer_unregister(rbc);
+			i--;
+			continue;
+		}
+
+		assert(ringbuffer_len(rbc) < size);
+	}
+
+	if (rb->len > size - 1) {
+		ringbuffer_evict(rb, rb->len - (size - 1));
+		rb->len = size - 1;
+	}
+
+	/* The history ends up at the start of the new buffer, unwrapped */
+	start = (rb->tail + rb->size - rb->len) % rb->size;
+	wlen = min(rb->len, rb->size - start);
+	memcpy(buf, rb->buf + start, wlen);
+	memcpy(buf + wlen, rb->buf, rb->len - wlen);
+
+	for (i = 0; i < rb->n_consumers; i++) {
+		rbc = rb->consumers[i];
+		rbc->pos = rb->len - ringbuffer_len(rbc);
+	}
+
+	if (rb->buf != (uint8_t *)(rb + 1)) {
+		free(rb->buf);
+	}
+
+	rb->buf = buf;
+	rb->size = size;
+	rb->tail = rb->len;
+
+	return 0;
+}
+
 int ringbuffer_queue(struct ringbuffer *rb, uint8_t *data, size_t len)
 {
 	struct ringbuffer_consumer *rbc;
@@ -153,6 +869,10 @@ int ringbuffer_queue(struct ringbuffer *rb, uint8_t *data, size_t len)
 	int i;
 	int rc;
 
+	/* Take more of the arena if this write would otherwise wrap, before
+	 * deciding whether consumers need to make space */
+	ringbuffer_grow(rb, len);
+
 	if (len >= rb->size) {
 		return -1;
 	}
@@ -161,6 +881,8 @@ int ringbuffer_queue(struct ringbuffer *rb, uint8_t *data, size_t len)
 		return 0;
 	}
 
+	TRACE3(ringbuffer_queue, rb, len, rb->n_consumers);
+
 	/* Ensure there is at least len bytes of space available.
 	 *
 	 * If a client doesn't have sufficient space, perform a blocking write
@@ -179,6 +901,14 @@ int ringbuffer_queue(struct ringbuffer *rb, uint8_t *data, size_t len)
 		assert(ringbuffer_space(rbc) >= len);
 	}
 
+	/* Drop the history about to be overwritten before copying, so that a
+	 * crash mid-copy can't leave it looking valid */
+	if (rb->len > rb->size - 1 - len) {
+		ringbuffer_evict(rb, rb->len - (rb->size - 1 - len));
+		rb->len = rb->size - 1 - len;
+	}
+	ringbuffer_header_sync(rb);
+
 	/* Now that we know we have enough space, add new data to tail */
 	wlen = min(len, rb->size - rb->tail);
 	memcpy(rb->buf + rb->tail, data, wlen);
@@ -189,6 +919,14 @@ int ringbuffer_queue(struct ringbuffer *rb, uint8_t *data, size_t len)
 	memcpy(rb->buf, data, len);
 	rb->tail += len;
 
+	rb->len = min(rb->len + wlen + len, rb->size - 1);
+	ringbuffer_header_sync(rb);
+
+	rb->written += wlen + len;
+	if (rb->stamps) {
+		ringbuffer_stamp(rb);
+	}
+
 	/* Inform consumers of new data in non-blocking mode, by calling
 	 * ->poll_fn with 0 force_len */
 	for (i = 0; i < rb->n_consumers; i++) {
@@ -231,5 +969,10 @@ int ringbuffer_dequeue_commit(struct ringbuffer_consumer *rbc, size_t len)
 {
 	assert(len <= ringbuffer_len(rbc));
 	rbc->pos = (rbc->pos + len) % rbc->rb->size;
+
+	if (rbc->rb->stamps && rbc->latency) {
+		ringbuffer_consumer_trace(rbc);
+	}
+
 	return 0;
 }
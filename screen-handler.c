@@ -0,0 +1,149 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "console-server.h"
+#include "config.h"
+#include "screen.h"
+
+/*
+ * Keeps console->screen up to date with the console's output, so that
+ * clients attaching later can be sent the screen as it stands rather than a
+ * replay of the raw output.
+ */
+struct screen_handler {
+	struct handler handler;
+	struct console *console;
+	struct ringbuffer_consumer *rbc;
+	struct screen *screen;
+};
+
+static const unsigned int default_screen_cols = 80;
+static const unsigned int default_screen_rows = 24;
+
+static struct screen_handler *to_screen_handler(struct handler *handler)
+{
+	return container_of(handler, struct screen_handler, handler);
+}
+
+static enum ringbuffer_poll_ret screen_ringbuffer_poll(void *arg,
+						       size_t force_len
+						       __attribute__((unused)))
+{
+	struct screen_handler *sh = arg;
+	uint8_t *buf;
+	size_t len;
+
+	/* Keep the model current with everything queued, so that a client
+	 * registering now sees the screen its live data continues from */
+	for (;;) {
+		len = ringbuffer_dequeue_peek(sh->rbc, 0, &buf);
+		if (!len) {
+			break;
+		}
+
+		screen_update(sh->screen, buf, len);
+		ringbuffer_dequeue_commit(sh->rbc, len);
+	}
+
+	return RINGBUFFER_POLL_OK;
+}
+
+/* 'screen-size' is COLSxROWS, or 'none' to go without the model */
+static int screen_parse_size(const char *val, unsigned int *cols,
+			     unsigned int *rows)
+{
+	char trailing;
+
+	if (sscanf(val, "%ux%u%c", cols, rows, &trailing) != 2) {
+		return -1;
+	}
+
+	if (*cols < 2 || *cols > SCREEN_MAX_COLS || *rows < 2 ||
+	    *rows > SCREEN_MAX_ROWS) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static struct handler *screen_handler_init(const struct handler_type *type
+					   __attribute__((unused)),
+					   struct console *console,
+					   struct config *config)
+{
+	unsigned int cols = default_screen_cols;
+	unsigned int rows = default_screen_rows;
+	struct screen_handler *sh;
+	const char *val;
+
+	val = config_get_console_value(config, console->console_id,
+				       "screen-size");
+	if (val && !strcmp(val, "none")) {
+		return NULL;
+	}
+
+	if (val && screen_parse_size(val, &cols, &rows)) {
+		warnx("Invalid screen-size '%s', must be COLSxROWS up to %ux%u",
+		      val, SCREEN_MAX_COLS, SCREEN_MAX_ROWS);
+		cols = default_screen_cols;
+		rows = default_screen_rows;
+	}
+
+	sh = calloc(1, sizeof(*sh));
+	if (!sh) {
+		return NULL;
+	}
+
+	sh->console = console;
+	sh->screen = screen_init(cols, rows);
+	if (!sh->screen) {
+		free(sh);
+		return NULL;
+	}
+
+	/* Rebuild the screen from whatever the ringbuffer still holds, such
+	 * as output from before a restart */
+	sh->rbc = console_ringbuffer_consumer_register_backlog(
+		console, screen_ringbuffer_poll, sh);
+	screen_ringbuffer_poll(sh, 0);
+	console->screen = sh->screen;
+
+	return &sh->handler;
+}
+
+static void screen_handler_fini(struct handler *handler)
+{
+	struct screen_handler *sh = to_screen_handler(handler);
+
+	sh->console->screen = NULL;
+	ringbuffer_consumer_unregister(sh->rbc);
+	screen_fini(sh->screen);
+	free(sh);
+}
+
+static const struct handler_type screen_handler = {
+	.name = "screen",
+	.init = screen_handler_init,
+	.fini = screen_handler_fini,
+};
+
+console_handler_register(&screen_handler);
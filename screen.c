@@ -0,0 +1,1099 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.h"
+
+#define ATTR_BOLD      0x01
+#define ATTR_DIM       0x02
+#define ATTR_UNDERLINE 0x04
+#define ATTR_BLINK     0x08
+#define ATTR_REVERSE   0x10
+/* fg and bg hold a colour, rather than the terminal's default */
+#define ATTR_FG 0x20
+#define ATTR_BG 0x40
+/* drawn from the DEC special graphics set */
+#define ATTR_ACS 0x80
+
+/* bytes that aren't valid UTF-8 are kept, and redrawn, as they came */
+#define CELL_RAW 0x80000000u
+
+#define SCREEN_MAX_PARAMS 16
+#define SCREEN_TAB_WIDTH  8
+
+struct screen_cell {
+	uint32_t ch;
+	uint8_t attr;
+	uint8_t fg;
+	uint8_t bg;
+};
+
+enum screen_state {
+	STATE_GROUND,
+	STATE_ESC,
+	/* ESC followed by an intermediate, swallow the final byte */
+	STATE_ESC_SKIP,
+	STATE_CHARSET,
+	STATE_CSI,
+	/* OSC, DCS and the like, ignored up to BEL or ST */
+	STATE_STRING,
+	STATE_STRING_ESC,
+};
+
+struct screen_cursor {
+	unsigned int x;
+	unsigned int y;
+	struct screen_cell pen;
+	char charsets[2];
+	unsigned int gl;
+	bool origin;
+};
+
+struct screen {
+	unsigned int cols;
+	unsigned int rows;
+	struct screen_cell *cells;
+	/* where each row is kept in cells, so scrolling moves no cells */
+	uint16_t *lines;
+
+	struct screen_cursor cur;
+	struct screen_cursor saved;
+	/* the last column was written, the next character wraps */
+	bool wrap_pending;
+
+	/* scrolling region, inclusive */
+	unsigned int top;
+	unsigned int bottom;
+	bool autowrap;
+	bool cursor_hidden;
+
+	enum screen_state state;
+	unsigned int params[SCREEN_MAX_PARAMS];
+	unsigned int n_params;
+	char private;
+	bool intermediate;
+	unsigned int charset_slot;
+
+	uint8_t utf8[4];
+	unsigned int utf8_len;
+	unsigned int utf8_need;
+};
+
+/* DEC special graphics, from '_' to '~', as Unicode */
+static const uint16_t acs_unicode[] = {
+	0x0020, 0x25c6, 0x2592, 0x2409, 0x240c, 0x240d, 0x240a, 0x00b0,
+	0x00b1, 0x2424, 0x240b, 0x2518, 0x2510, 0x250c, 0x2514, 0x253c,
+	0x23ba, 0x23bb, 0x2500, 0x23bc, 0x23bd, 0x251c, 0x2524, 0x2534,
+	0x252c, 0x2502, 0x2264, 0x2265, 0x03c0, 0x2260, 0x00a3, 0x00b7,
+};
+
+static inline unsigned int min_u(unsigned int a, unsigned int b)
+{
+	return a < b ? a : b;
+}
+
+static struct screen_cell *screen_cell(struct screen *s, unsigned int x,
+				       unsigned int y)
+{
+	return &s->cells[(size_t)s->lines[y] * s->cols + x];
+}
+
+/* Erased cells take the current background, as xterm does */
+static struct screen_cell screen_blank(struct screen *s)
+{
+	struct screen_cell blank = { .ch = ' ' };
+
+	blank.attr = s->cur.pen.attr & ATTR_BG;
+	blank.bg = s->cur.pen.bg;
+
+	return blank;
+}
+
+/* Erase n cells from x, y onwards, running on to the following rows */
+static void screen_erase(struct screen *s, unsigned int x, unsigned int y,
+			 size_t n)
+{
+	struct screen_cell blank = screen_blank(s);
+
+	while (n) {
+		struct screen_cell *cell = screen_cell(s, x, y);
+		size_t len = n < s->cols - x ? n : s->cols - x;
+
+		for (size_t i = 0; i < len; i++) {
+			cell[i] = blank;
+		}
+
+		n -= len;
+		x = 0;
+		y++;
+	}
+}
+
+/* Scroll rows top to bottom up by n, blanking the rows uncovered */
+static void screen_scroll_up(struct screen *s, unsigned int top,
+			     unsigned int bottom, unsigned int n)
+{
+	unsigned int height = bottom - top + 1;
+
+	uint16_t moved[SCREEN_MAX_ROWS];
+
+	n = min_u(n, height);
+	memcpy(moved, &s->lines[top], n * sizeof(*moved));
+	memmove(&s->lines[top], &s->lines[top + n],
+		(height - n) * sizeof(*s->lines));
+	memcpy(&s->lines[bottom + 1 - n], moved, n * sizeof(*moved));
+	screen_erase(s, 0, bottom + 1 - n, (size_t)n * s->cols);
+}
+
+static void screen_scroll_down(struct screen *s, unsigned int top,
+			       unsigned int bottom, unsigned int n)
+{
+	unsigned int height = bottom - top + 1;
+
+	uint16_t moved[SCREEN_MAX_ROWS];
+
+	n = min_u(n, height);
+	memcpy(moved, &s->lines[bottom + 1 - n], n * sizeof(*moved));
+	memmove(&s->lines[top + n], &s->lines[top],
+		(height - n) * sizeof(*s->lines));
+	memcpy(&s->lines[top], moved, n * sizeof(*moved));
+	screen_erase(s, 0, top, (size_t)n * s->cols);
+}
+
+static void screen_linefeed(struct screen *s)
+{
+	s->wrap_pending = false;
+
+	if (s->cur.y == s->bottom) {
+		screen_scroll_up(s, s->top, s->bottom, 1);
+	} else if (s->cur.y < s->rows - 1) {
+		s->cur.y++;
+	}
+}
+
+static void screen_reverse_index(struct screen *s)
+{
+	s->wrap_pending = false;
+
+	if (s->cur.y == s->top) {
+		screen_scroll_down(s, s->top, s->bottom, 1);
+	} else if (s->cur.y) {
+		s->cur.y--;
+	}
+}
+
+static void screen_move(struct screen *s, unsigned int x, unsigned int y)
+{
+	s->cur.x = min_u(x, s->cols - 1);
+	s->cur.y = min_u(y, s->rows - 1);
+	s->wrap_pending = false;
+}
+
+/* Absolute positioning, relative to the scrolling region in origin mode */
+static void screen_move_origin(struct screen *s, unsigned int x,
+			       unsigned int y)
+{
+	if (s->cur.origin) {
+		y = min_u(y + s->top, s->bottom);
+	}
+
+	screen_move(s, x, y);
+}
+
+static void screen_put(struct screen *s, uint32_t ch)
+{
+	struct screen_cell *cell;
+
+	if (s->wrap_pending && s->autowrap) {
+		s->cur.x = 0;
+		screen_linefeed(s);
+	}
+
+	cell = screen_cell(s, s->cur.x, s->cur.y);
+	*cell = s->cur.pen;
+	cell->ch = ch;
+	if (s->cur.charsets[s->cur.gl] == '0' && ch >= '_' && ch <= '~') {
+		cell->attr |= ATTR_ACS;
+	}
+
+	if (s->cur.x < s->cols - 1) {
+		s->cur.x++;
+		s->wrap_pending = false;
+	} else {
+		s->wrap_pending = true;
+	}
+}
+
+/* Put a run of printable ASCII, a row at a time */
+static void screen_put_ascii(struct screen *s, const uint8_t *buf, size_t len)
+{
+	bool acs = s->cur.charsets[s->cur.gl] == '0';
+
+	while (len) {
+		struct screen_cell *cell;
+		size_t n;
+
+		if (s->wrap_pending || acs) {
+			screen_put(s, *buf++);
+			len--;
+			continue;
+		}
+
+		cell = screen_cell(s, s->cur.x, s->cur.y);
+		n = s->cols - s->cur.x;
+		if (n > len) {
+			n = len;
+		}
+		for (size_t i = 0; i < n; i++) {
+			cell[i] = s->cur.pen;
+			cell[i].ch = buf[i];
+		}
+
+		s->cur.x += n;
+		if (s->cur.x == s->cols) {
+			s->cur.x--;
+			s->wrap_pending = true;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Put the bytes of an incomplete UTF-8 sequence as they came */
+static void screen_flush_utf8(struct screen *s)
+{
+	for (unsigned int i = 0; i < s->utf8_len; i++) {
+		screen_put(s, CELL_RAW | s->utf8[i]);
+	}
+
+	s->utf8_len = 0;
+	s->utf8_need = 0;
+}
+
+static void screen_put_byte(struct screen *s, uint8_t c)
+{
+	uint32_t ch;
+
+	if (s->utf8_need) {
+		if ((c & 0xc0) == 0x80) {
+			s->utf8[s->utf8_len++] = c;
+			if (s->utf8_len < s->utf8_need) {
+				return;
+			}
+
+			ch = s->utf8[0] & (0x7f >> s->utf8_need);
+			for (unsigned int i = 1; i < s->utf8_len; i++) {
+				ch = (ch << 6) | (s->utf8[i] & 0x3f);
+			}
+			s->utf8_len = 0;
+			s->utf8_need = 0;
+			screen_put(s, ch);
+			return;
+		}
+
+		screen_flush_utf8(s);
+	}
+
+	if (c < 0x80) {
+		screen_put(s, c);
+	} else if (c >= 0xc2 && c <= 0xdf) {
+		s->utf8_need = 2;
+	} else if (c >= 0xe0 && c <= 0xef) {
+		s->utf8_need = 3;
+	} else if (c >= 0xf0 && c <= 0xf4) {
+		s->utf8_need = 4;
+	} else {
+		screen_put(s, CELL_RAW | c);
+		return;
+	}
+
+	if (s->utf8_need) {
+		s->utf8[s->utf8_len++] = c;
+	}
+}
+
+static void screen_save_cursor(struct screen *s)
+{
+	s->saved = s->cur;
+}
+
+static void screen_restore_cursor(struct screen *s)
+{
+	s->cur = s->saved;
+	screen_move(s, s->cur.x, s->cur.y);
+}
+
+void screen_reset(struct screen *s)
+{
+	memset(&s->cur, 0, sizeof(s->cur));
+	s->cur.charsets[0] = 'B';
+	s->cur.charsets[1] = 'B';
+	s->saved = s->cur;
+	s->wrap_pending = false;
+
+	s->top = 0;
+	s->bottom = s->rows - 1;
+	s->autowrap = true;
+	s->cursor_hidden = false;
+
+	s->state = STATE_GROUND;
+	s->utf8_len = 0;
+	s->utf8_need = 0;
+
+	screen_erase(s, 0, 0, (size_t)s->cols * s->rows);
+}
+
+/* Returns parameter i, or def if it was missing or zero */
+static unsigned int screen_param(struct screen *s, unsigned int i,
+				 unsigned int def)
+{
+	if (i >= s->n_params || !s->params[i]) {
+		return def;
+	}
+
+	return s->params[i];
+}
+
+static void screen_sgr_colour(struct screen *s, unsigned int *i, uint8_t *colour,
+			      uint8_t flag)
+{
+	if (*i + 2 < s->n_params && s->params[*i + 1] == 5) {
+		*colour = (uint8_t)min_u(s->params[*i + 2], 255);
+		s->cur.pen.attr |= flag;
+		*i += 2;
+	} else if (*i + 1 < s->n_params && s->params[*i + 1] == 2) {
+		/* Direct colour has no palette entry to keep, so drop it */
+		s->cur.pen.attr &= (uint8_t)~flag;
+		*i += 4;
+	}
+}
+
+static void screen_sgr(struct screen *s)
+{
+	struct screen_cell *pen = &s->cur.pen;
+
+	if (!s->n_params) {
+		pen->attr = 0;
+		return;
+	}
+
+	for (unsigned int i = 0; i < s->n_params; i++) {
+		unsigned int p = s->params[i];
+
+		if (p == 0) {
+			pen->attr = 0;
+		} else if (p == 1) {
+			pen->attr |= ATTR_BOLD;
+		} else if (p == 2) {
+			pen->attr |= ATTR_DIM;
+		} else if (p == 4) {
+			pen->attr |= ATTR_UNDERLINE;
+		} else if (p == 5) {
+			pen->attr |= ATTR_BLINK;
+		} else if (p == 7) {
+			pen->attr |= ATTR_REVERSE;
+		} else if (p == 22) {
+			pen->attr &= (uint8_t)~(ATTR_BOLD | ATTR_DIM);
+		} else if (p == 24) {
+			pen->attr &= (uint8_t)~ATTR_UNDERLINE;
+		} else if (p == 25) {
+			pen->attr &= (uint8_t)~ATTR_BLINK;
+		} else if (p == 27) {
+			pen->attr &= (uint8_t)~ATTR_REVERSE;
+		} else if (p >= 30 && p <= 37) {
+			pen->fg = (uint8_t)(p - 30);
+			pen->attr |= ATTR_FG;
+		} else if (p == 38) {
+			screen_sgr_colour(s, &i, &pen->fg, ATTR_FG);
+		} else if (p == 39) {
+			pen->attr &= (uint8_t)~ATTR_FG;
+		} else if (p >= 40 && p <= 47) {
+			pen->bg = (uint8_t)(p - 40);
+			pen->attr |= ATTR_BG;
+		} else if (p == 48) {
+			screen_sgr_colour(s, &i, &pen->bg, ATTR_BG);
+		} else if (p == 49) {
+			pen->attr &= (uint8_t)~ATTR_BG;
+		} else if (p >= 90 && p <= 97) {
+			pen->fg = (uint8_t)(p - 90 + 8);
+			pen->attr |= ATTR_FG;
+		} else if (p >= 100 && p <= 107) {
+			pen->bg = (uint8_t)(p - 100 + 8);
+			pen->attr |= ATTR_BG;
+		}
+	}
+}
+
+static void screen_set_mode(struct screen *s, bool set)
+{
+	for (unsigned int i = 0; i < s->n_params; i++) {
+		switch (s->params[i]) {
+		case 6:
+			s->cur.origin = set;
+			screen_move_origin(s, 0, 0);
+			break;
+		case 7:
+			s->autowrap = set;
+			break;
+		case 25:
+			s->cursor_hidden = !set;
+			break;
+		case 1049:
+			if (set) {
+				screen_save_cursor(s);
+			}
+			/* fall through */
+		case 47:
+		case 1047:
+			/* The alternate screen isn't kept: full screen
+			 * programs redraw it on entry, and the shell below
+			 * reprints its prompt on exit */
+			screen_erase(s, 0, 0, (size_t)s->cols * s->rows);
+			if (s->params[i] == 1049 && !set) {
+				screen_restore_cursor(s);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* Vertical moves stop at the scrolling region's margins, if they start in it */
+static unsigned int screen_up(struct screen *s, unsigned int n)
+{
+	unsigned int limit = s->cur.y >= s->top ? s->top : 0;
+
+	return s->cur.y - min_u(n, s->cur.y - limit);
+}
+
+static unsigned int screen_down(struct screen *s, unsigned int n)
+{
+	unsigned int limit = s->cur.y <= s->bottom ? s->bottom : s->rows - 1;
+
+	return min_u(s->cur.y + n, limit);
+}
+
+static void screen_csi(struct screen *s, uint8_t final)
+{
+	unsigned int n = screen_param(s, 0, 1);
+	unsigned int x = s->cur.x;
+	unsigned int y = s->cur.y;
+	unsigned int bottom;
+	unsigned int top;
+	size_t len;
+
+	if (s->intermediate) {
+		return;
+	}
+
+	if (s->private == '?') {
+		if (final == 'h' || final == 'l') {
+			screen_set_mode(s, final == 'h');
+		}
+		return;
+	}
+
+	if (s->private) {
+		return;
+	}
+
+	switch (final) {
+	case 'A':
+		screen_move(s, x, screen_up(s, n));
+		break;
+	case 'B':
+	case 'e':
+		screen_move(s, x, screen_down(s, n));
+		break;
+	case 'C':
+	case 'a':
+		screen_move(s, x + n, y);
+		break;
+	case 'D':
+		screen_move(s, x - min_u(n, x), y);
+		break;
+	case 'E':
+		screen_move(s, 0, screen_down(s, n));
+		break;
+	case 'F':
+		screen_move(s, 0, screen_up(s, n));
+		break;
+	case 'G':
+	case '`':
+		screen_move(s, n - 1, y);
+		break;
+	case 'd':
+		screen_move_origin(s, x, n - 1);
+		break;
+	case 'H':
+	case 'f':
+		screen_move_origin(s, screen_param(s, 1, 1) - 1, n - 1);
+		break;
+	case 'J':
+		len = (size_t)s->cols * s->rows;
+		if (screen_param(s, 0, 0) == 0) {
+			len -= (size_t)y * s->cols + x;
+			screen_erase(s, x, y, len);
+		} else if (s->params[0] == 1) {
+			screen_erase(s, 0, 0, (size_t)y * s->cols + x + 1);
+		} else {
+			screen_erase(s, 0, 0, len);
+		}
+		break;
+	case 'K':
+		if (screen_param(s, 0, 0) == 0) {
+			screen_erase(s, x, y, s->cols - x);
+		} else if (s->params[0] == 1) {
+			screen_erase(s, 0, y, x + 1);
+		} else {
+			screen_erase(s, 0, y, s->cols);
+		}
+		break;
+	case 'L':
+		if (y >= s->top && y <= s->bottom) {
+			screen_scroll_down(s, y, s->bottom, n);
+			screen_move(s, 0, y);
+		}
+		break;
+	case 'M':
+		if (y >= s->top && y <= s->bottom) {
+			screen_scroll_up(s, y, s->bottom, n);
+			screen_move(s, 0, y);
+		}
+		break;
+	case '@':
+		n = min_u(n, s->cols - x);
+		memmove(screen_cell(s, x + n, y), screen_cell(s, x, y),
+			(s->cols - x - n) * sizeof(*s->cells));
+		screen_erase(s, x, y, n);
+		s->wrap_pending = false;
+		break;
+	case 'P':
+		n = min_u(n, s->cols - x);
+		memmove(screen_cell(s, x, y), screen_cell(s, x + n, y),
+			(s->cols - x - n) * sizeof(*s->cells));
+		screen_erase(s, s->cols - n, y, n);
+		s->wrap_pending = false;
+		break;
+	case 'X':
+		screen_erase(s, x, y, min_u(n, s->cols - x));
+		s->wrap_pending = false;
+		break;
+	case 'S':
+		screen_scroll_up(s, s->top, s->bottom, n);
+		break;
+	case 'T':
+		/* With more parameters, this is xterm's mouse tracking */
+		if (s->n_params <= 1) {
+			screen_scroll_down(s, s->top, s->bottom, n);
+		}
+		break;
+	case 'm':
+		screen_sgr(s);
+		break;
+	case 'r':
+		top = screen_param(s, 0, 1) - 1;
+		bottom = min_u(screen_param(s, 1, s->rows), s->rows) - 1;
+		if (top < bottom) {
+			s->top = top;
+			s->bottom = bottom;
+			screen_move_origin(s, 0, 0);
+		}
+		break;
+	case 's':
+		screen_save_cursor(s);
+		break;
+	case 'u':
+		screen_restore_cursor(s);
+		break;
+	default:
+		break;
+	}
+}
+
+static void screen_esc(struct screen *s, uint8_t c)
+{
+	s->state = STATE_GROUND;
+
+	switch (c) {
+	case '[':
+		memset(s->params, 0, sizeof(s->params));
+		s->n_params = 0;
+		s->private = 0;
+		s->intermediate = false;
+		s->state = STATE_CSI;
+		break;
+	case ']':
+	case 'P':
+	case 'X':
+	case '^':
+	case '_':
+		s->state = STATE_STRING;
+		break;
+	case '(':
+	case ')':
+		s->charset_slot = c == ')';
+		s->state = STATE_CHARSET;
+		break;
+	case '#':
+	case '%':
+	case ' ':
+		s->state = STATE_ESC_SKIP;
+		break;
+	case '7':
+		screen_save_cursor(s);
+		break;
+	case '8':
+		screen_restore_cursor(s);
+		break;
+	case 'D':
+		screen_linefeed(s);
+		break;
+	case 'E':
+		s->cur.x = 0;
+		screen_linefeed(s);
+		break;
+	case 'M':
+		screen_reverse_index(s);
+		break;
+	case 'c':
+		screen_reset(s);
+		break;
+	default:
+		break;
+	}
+}
+
+static void screen_csi_byte(struct screen *s, uint8_t c)
+{
+	if (c >= '0' && c <= '9') {
+		unsigned int *p;
+
+		if (!s->n_params) {
+			s->n_params = 1;
+		}
+		p = &s->params[s->n_params - 1];
+		*p = min_u(*p * 10 + (c - '0'), 65535);
+	} else if (c == ';' || c == ':') {
+		if (!s->n_params) {
+			s->n_params = 1;
+		}
+		if (s->n_params < SCREEN_MAX_PARAMS) {
+			s->n_params++;
+		}
+	} else if (c >= '<' && c <= '?') {
+		s->private = (char)c;
+	} else if (c >= ' ' && c <= '/') {
+		s->intermediate = true;
+	} else if (c >= '@' && c <= '~') {
+		s->state = STATE_GROUND;
+		screen_csi(s, c);
+	}
+}
+
+/* C0 controls act in the middle of sequences too, as on a VT100 */
+static void screen_control(struct screen *s, uint8_t c)
+{
+	switch (c) {
+	case '\b':
+		if (s->cur.x) {
+			s->cur.x--;
+		}
+		s->wrap_pending = false;
+		break;
+	case '\t':
+		screen_move(s, (s->cur.x / SCREEN_TAB_WIDTH + 1) *
+				       SCREEN_TAB_WIDTH,
+			    s->cur.y);
+		break;
+	case '\n':
+	case '\v':
+	case '\f':
+		screen_linefeed(s);
+		break;
+	case '\r':
+		s->cur.x = 0;
+		s->wrap_pending = false;
+		break;
+	case 0x0e:
+		s->cur.gl = 1;
+		break;
+	case 0x0f:
+		s->cur.gl = 0;
+		break;
+	case 0x18:
+	case 0x1a:
+		s->state = STATE_GROUND;
+		break;
+	case 0x1b:
+		s->state = STATE_ESC;
+		break;
+	default:
+		break;
+	}
+}
+
+void screen_update(struct screen *s, const uint8_t *buf, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = buf[i];
+
+		/* Most output is printable text */
+		if (s->state == STATE_GROUND && c >= ' ' && c < 0x7f &&
+		    !s->utf8_need) {
+			size_t n = 1;
+
+			while (i + n < len && buf[i + n] >= ' ' &&
+			       buf[i + n] < 0x7f) {
+				n++;
+			}
+			screen_put_ascii(s, buf + i, n);
+			i += n - 1;
+			continue;
+		}
+
+		if (s->state == STATE_STRING) {
+			if (c == 0x07 || c == 0x18 || c == 0x1a) {
+				s->state = STATE_GROUND;
+			} else if (c == 0x1b) {
+				s->state = STATE_STRING_ESC;
+			}
+			continue;
+		}
+
+		if (c < ' ') {
+			if (s->utf8_need) {
+				screen_flush_utf8(s);
+			}
+			screen_control(s, c);
+			continue;
+		}
+
+		switch (s->state) {
+		case STATE_GROUND:
+			if (c != 0x7f) {
+				screen_put_byte(s, c);
+			}
+			break;
+		case STATE_ESC:
+			screen_esc(s, c);
+			break;
+		case STATE_ESC_SKIP:
+			s->state = STATE_GROUND;
+			break;
+		case STATE_CHARSET:
+			s->cur.charsets[s->charset_slot] = c == '0' ? '0' :
+								      'B';
+			s->state = STATE_GROUND;
+			break;
+		case STATE_CSI:
+			screen_csi_byte(s, c);
+			break;
+		case STATE_STRING_ESC:
+			/* ST, or anything else that follows ESC, ends it */
+			s->state = STATE_GROUND;
+			if (c != '\\') {
+				screen_esc(s, c);
+			}
+			break;
+		case STATE_STRING:
+			break;
+		}
+	}
+}
+
+/* Encode ch as UTF-8, or the raw byte it was, returning the length */
+static size_t encode_utf8(uint32_t ch, uint8_t *buf)
+{
+	if (ch & CELL_RAW) {
+		buf[0] = (uint8_t)ch;
+		return 1;
+	}
+
+	if (ch < 0x80) {
+		buf[0] = (uint8_t)ch;
+		return 1;
+	}
+
+	if (ch < 0x800) {
+		buf[0] = (uint8_t)(0xc0 | (ch >> 6));
+		buf[1] = (uint8_t)(0x80 | (ch & 0x3f));
+		return 2;
+	}
+
+	if (ch < 0x10000) {
+		buf[0] = (uint8_t)(0xe0 | (ch >> 12));
+		buf[1] = (uint8_t)(0x80 | ((ch >> 6) & 0x3f));
+		buf[2] = (uint8_t)(0x80 | (ch & 0x3f));
+		return 3;
+	}
+
+	buf[0] = (uint8_t)(0xf0 | (ch >> 18));
+	buf[1] = (uint8_t)(0x80 | ((ch >> 12) & 0x3f));
+	buf[2] = (uint8_t)(0x80 | ((ch >> 6) & 0x3f));
+	buf[3] = (uint8_t)(0x80 | (ch & 0x3f));
+	return 4;
+}
+
+static void put_colour(FILE *f, uint8_t colour, unsigned int base,
+		       unsigned int bright)
+{
+	if (colour < 8) {
+		fprintf(f, ";%u", base + colour);
+	} else if (colour < 16) {
+		fprintf(f, ";%u", bright + colour - 8);
+	} else {
+		fprintf(f, ";%u;5;%u", base + 8, colour);
+	}
+}
+
+static void put_sgr(FILE *f, const struct screen_cell *cell)
+{
+	static const struct {
+		uint8_t attr;
+		unsigned int sgr;
+	} attrs[] = {
+		{ ATTR_BOLD, 1 },  { ATTR_DIM, 2 },	    { ATTR_UNDERLINE, 4 },
+		{ ATTR_BLINK, 5 }, { ATTR_REVERSE, 7 },
+	};
+
+	fputs("\x1b[0", f);
+	for (size_t i = 0; i < sizeof(attrs) / sizeof(attrs[0]); i++) {
+		if (cell->attr & attrs[i].attr) {
+			fprintf(f, ";%u", attrs[i].sgr);
+		}
+	}
+	if (cell->attr & ATTR_FG) {
+		put_colour(f, cell->fg, 30, 90);
+	}
+	if (cell->attr & ATTR_BG) {
+		put_colour(f, cell->bg, 40, 100);
+	}
+	fputc('m', f);
+}
+
+static bool same_pen(const struct screen_cell *a, const struct screen_cell *b)
+{
+	uint8_t attr = (uint8_t)~ATTR_ACS;
+
+	return (a->attr & attr) == (b->attr & attr) &&
+	       (!(a->attr & ATTR_FG) || a->fg == b->fg) &&
+	       (!(a->attr & ATTR_BG) || a->bg == b->bg);
+}
+
+static bool is_blank(const struct screen_cell *cell)
+{
+	return cell->ch == ' ' && !cell->attr;
+}
+
+/* Draw a cell, switching the pen and character set only as needed */
+static void put_cell(FILE *f, const struct screen_cell *cell,
+		     struct screen_cell *pen)
+{
+	uint8_t buf[4];
+
+	if (!same_pen(cell, pen)) {
+		put_sgr(f, cell);
+		pen->attr = (uint8_t)((cell->attr & ~ATTR_ACS) |
+				      (pen->attr & ATTR_ACS));
+		pen->fg = cell->fg;
+		pen->bg = cell->bg;
+	}
+
+	if ((cell->attr ^ pen->attr) & ATTR_ACS) {
+		fputs(cell->attr & ATTR_ACS ? "\x1b(0" : "\x1b(B", f);
+		pen->attr ^= ATTR_ACS;
+	}
+
+	fwrite(buf, 1, encode_utf8(cell->ch, buf), f);
+}
+
+uint8_t *screen_redraw(struct screen *s, size_t *len)
+{
+	struct screen_cell pen = { 0 };
+	unsigned int row;
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *f;
+
+	f = open_memstream(&buf, &size);
+	if (!f) {
+		return NULL;
+	}
+
+	/* Start from a known state: default modes and pen, blank screen */
+	fputs("\x1b[0m\x1b(B\x1b)B\x0f\x1b[r\x1b[?6l\x1b[?7h\x1b[H\x1b[2J", f);
+
+	for (unsigned int y = 0; y < s->rows; y++) {
+		struct screen_cell *line = screen_cell(s, 0, y);
+		unsigned int first = 0;
+		unsigned int last = s->cols;
+
+		while (last && is_blank(&line[last - 1])) {
+			last--;
+		}
+		while (first < last && is_blank(&line[first])) {
+			first++;
+		}
+		if (first == last) {
+			continue;
+		}
+
+		fprintf(f, "\x1b[%u;%uH", y + 1, first + 1);
+		for (unsigned int x = first; x < last; x++) {
+			put_cell(f, &line[x], &pen);
+		}
+	}
+
+	if (s->top || s->bottom != s->rows - 1) {
+		fprintf(f, "\x1b[%u;%ur", s->top + 1, s->bottom + 1);
+	}
+	if (s->cur.origin) {
+		fputs("\x1b[?6h", f);
+	}
+
+	row = s->cur.y - (s->cur.origin ? s->top : 0) + 1;
+	if (s->wrap_pending && s->autowrap) {
+		/* Rewrite the last column, leaving the terminal about to
+		 * wrap as well */
+		fprintf(f, "\x1b[%u;%uH", row, s->cols);
+		put_cell(f, screen_cell(s, s->cols - 1, s->cur.y), &pen);
+	} else {
+		fprintf(f, "\x1b[%u;%uH", row, s->cur.x + 1);
+	}
+
+	if (!s->autowrap) {
+		fputs("\x1b[?7l", f);
+	}
+	if (s->cursor_hidden) {
+		fputs("\x1b[?25l", f);
+	}
+
+	fprintf(f, "\x1b(%c\x1b)%c", s->cur.charsets[0], s->cur.charsets[1]);
+	if (s->cur.gl) {
+		fputc(0x0e, f);
+	}
+	put_sgr(f, &s->cur.pen);
+
+	if (fclose(f)) {
+		free(buf);
+		return NULL;
+	}
+
+	*len = size;
+	return (uint8_t *)buf;
+}
+
+size_t screen_row_text(struct screen *s, unsigned int row, char *buf,
+		       size_t size)
+{
+	struct screen_cell *line;
+	unsigned int last;
+	uint8_t enc[4];
+	size_t len = 0;
+	size_t n;
+
+	if (row >= s->rows) {
+		if (size) {
+			buf[0] = '\0';
+		}
+		return 0;
+	}
+
+	line = screen_cell(s, 0, row);
+	for (last = s->cols; last && line[last - 1].ch == ' '; last--) {
+		;
+	}
+
+	for (unsigned int x = 0; x < last; x++) {
+		uint32_t ch = line[x].ch;
+
+		if (line[x].attr & ATTR_ACS) {
+			ch = acs_unicode[ch - '_'];
+		} else if (ch & CELL_RAW) {
+			/* Text is UTF-8, so bytes that weren't can't stay */
+			ch = '?';
+		}
+
+		n = encode_utf8(ch, enc);
+		if (len + n < size) {
+			memcpy(buf + len, enc, n);
+		}
+		len += n;
+	}
+
+	if (size) {
+		buf[len < size ? len : size - 1] = '\0';
+	}
+
+	return len;
+}
+
+void screen_get_size(struct screen *s, unsigned int *cols, unsigned int *rows)
+{
+	*cols = s->cols;
+	*rows = s->rows;
+}
+
+void screen_get_cursor(struct screen *s, unsigned int *col, unsigned int *row)
+{
+	*col = s->cur.x;
+	*row = s->cur.y;
+}
+
+struct screen *screen_init(unsigned int cols, unsigned int rows)
+{
+	struct screen *s;
+
+	if (cols < 2 || rows < 2 || cols > SCREEN_MAX_COLS ||
+	    rows > SCREEN_MAX_ROWS) {
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s) {
+		return NULL;
+	}
+
+	s->cols = cols;
+	s->rows = rows;
+	s->cells = calloc((size_t)cols * rows, sizeof(*s->cells));
+	s->lines = calloc(rows, sizeof(*s->lines));
+	if (!s->cells || !s->lines) {
+		screen_fini(s);
+		return NULL;
+	}
+
+	for (unsigned int y = 0; y < rows; y++) {
+		s->lines[y] = (uint16_t)y;
+	}
+
+	screen_reset(s);
+
+	return s;
+}
+
+void screen_fini(struct screen *s)
+{
+	free(s->lines);
+	free(s->cells);
+	free(s);
+}
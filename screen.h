@@ -0,0 +1,54 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A model of the VT100 screen a console's output is drawn on: the grid of
+ * characters and their attributes, the cursor, and the terminal modes that
+ * affect how later output lands. It is fed the console's output as it
+ * arrives, and can produce a compact sequence that redraws the current screen
+ * on a freshly attached terminal.
+ *
+ * The escape sequences understood are the VT100 subset, plus the common xterm
+ * extensions, that firmware setup screens and full screen programs draw with.
+ * Anything else is consumed and ignored.
+ */
+#define SCREEN_MAX_COLS 512
+#define SCREEN_MAX_ROWS 256
+
+struct screen;
+
+struct screen *screen_init(unsigned int cols, unsigned int rows);
+void screen_fini(struct screen *screen);
+void screen_reset(struct screen *screen);
+void screen_update(struct screen *screen, const uint8_t *buf, size_t len);
+
+/* Returns a malloc()ed sequence redrawing the screen, and its length in len */
+uint8_t *screen_redraw(struct screen *screen, size_t *len);
+
+/* Copies row's characters, without attributes, as a string of UTF-8 with the
+ * trailing blanks removed. Returns the string's length, as snprintf() */
+size_t screen_row_text(struct screen *screen, unsigned int row, char *buf,
+		       size_t size);
+
+void screen_get_size(struct screen *screen, unsigned int *cols,
+		     unsigned int *rows);
+void screen_get_cursor(struct screen *screen, unsigned int *col,
+		       unsigned int *row);
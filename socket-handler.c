@@ -28,10 +28,14 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <systemd/sd-daemon.h>
 
 #include "console-mux.h"
 #include "console-server.h"
+#include "config.h"
+#include "history.h"
+#include "latency.h"
+#include "screen.h"
+#include "trace.h"
 
 #define SOCKET_HANDLER_PKT_SIZE 512
 /* Set poll() timeout to 4000 uS, or 4 mS */
@@ -43,6 +47,29 @@ struct client {
 	struct ringbuffer_consumer *rbc;
 	int fd;
 	bool blocked;
+	/* attached to a console the mux has switched away from */
+	bool paused;
+
+	/* history blocks to replay ahead of the ringbuffer backlog */
+	uint64_t history_seq;
+	uint64_t history_end;
+	uint8_t *history_buf;
+	size_t history_len;
+	size_t history_pos;
+	/* the open block as it was on attach, sent after the sealed ones */
+	uint8_t *history_stage;
+	size_t history_stage_len;
+
+	/* redraw of the screen as it was on attach, sent before live data */
+	uint8_t *redraw_buf;
+	size_t redraw_len;
+	size_t redraw_pos;
+
+	/* connected to the dump socket: sent what was buffered when it
+	 * connected, then hung up on. It takes no part in the mux, and
+	 * nothing it sends reaches the console */
+	bool dump;
+	size_t dump_len;
 };
 
 struct socket_handler {
@@ -51,8 +78,24 @@ struct socket_handler {
 	struct poller *poller;
 	int sd;
 
+	/* listens on the dump socket, or -1 */
+	struct poller *dump_poller;
+	int dump_sd;
+
 	struct client **clients;
 	int n_clients;
+
+	/* send new clients the buffered history first */
+	bool replay_backlog;
+
+	/* send new clients a redraw of the screen instead */
+	bool attach_redraw;
+
+	/* keep clients attached when the mux switches away */
+	bool pause_clients;
+
+	/* for interactive clients, dumps aren't timed */
+	struct latency_hist latency;
 };
 
 static struct timeval const socket_handler_timeout = {
@@ -71,6 +114,9 @@ static void client_close(struct client *client)
 	int idx;
 
 	close(client->fd);
+	if (!client->dump) {
+		sh->console->n_sessions--;
+	}
 	if (client->poller) {
 		console_poller_unregister(sh->console, client->poller);
 	}
@@ -79,6 +125,10 @@ static void client_close(struct client *client)
 		ringbuffer_consumer_unregister(client->rbc);
 	}
 
+	free(client->history_buf);
+	free(client->history_stage);
+	free(client->redraw_buf);
+
 	for (idx = 0; idx < sh->n_clients; idx++) {
 		if (sh->clients[idx] == client) {
 			break;
@@ -108,22 +158,42 @@ static void client_close(struct client *client)
 	/* NOLINTEND(bugprone-sizeof-expression) */
 }
 
-static void client_set_blocked(struct client *client, bool blocked)
+static void client_update_events(struct client *client)
 {
-	int events;
+	int events = 0;
+
+	/* Input from paused clients is left in the socket until the console
+	 * is selected again */
+	if (!client->paused && !client->dump) {
+		events |= POLLIN;
+	}
+
+	if (client->blocked) {
+		events |= POLLOUT;
+	}
 
+	console_poller_set_events(client->sh->console, client->poller, events);
+}
+
+static void client_set_blocked(struct client *client, bool blocked)
+{
 	if (client->blocked == blocked) {
 		return;
 	}
 
 	client->blocked = blocked;
+	TRACE2(client_blocked, client->fd, blocked);
+	client_update_events(client);
+}
 
-	events = POLLIN;
-	if (client->blocked) {
-		events |= POLLOUT;
+static void client_set_paused(struct client *client, bool paused)
+{
+	if (client->paused == paused) {
+		return;
 	}
 
-	console_poller_set_events(client->sh->console, client->poller, events);
+	client->paused = paused;
+	client_update_events(client);
 }
 
 static ssize_t send_all(struct client *client, void *buf, size_t len,
@@ -168,8 +238,91 @@ static ssize_t send_all(struct client *client, void *buf, size_t len,
 	return (ssize_t)pos;
 }
 
+/* Give up on replaying the rest of the history */
+static void client_drop_history(struct client *client)
+{
+	free(client->history_buf);
+	client->history_buf = NULL;
+	free(client->history_stage);
+	client->history_stage = NULL;
+}
+
+/* Send any history being replayed, without blocking: it can run to megabytes.
+ * Returns 1 while some remains unsent */
+static int client_drain_history(struct client *client)
+{
+	struct history *history = client->sh->console->history;
+	ssize_t wlen;
+	ssize_t len;
+
+	while (client->history_buf) {
+		if (client->history_pos == client->history_len) {
+			len = 0;
+			if (client->history_seq < client->history_end) {
+				len = history_read_block(history,
+							 &client->history_seq,
+							 client->history_buf);
+			} else if (client->history_stage) {
+				free(client->history_buf);
+				client->history_buf = client->history_stage;
+				len = (ssize_t)client->history_stage_len;
+				client->history_stage = NULL;
+			}
+
+			if (len <= 0) {
+				client_drop_history(client);
+				return len < 0 ? -1 : 0;
+			}
+
+			client->history_len = (size_t)len;
+			client->history_pos = 0;
+		}
+
+		wlen = send_all(client,
+				client->history_buf + client->history_pos,
+				client->history_len - client->history_pos,
+				false);
+		if (wlen < 0) {
+			return -1;
+		}
+
+		client->history_pos += (size_t)wlen;
+		if (client->history_pos < client->history_len) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Send the rest of the redraw. Returns 1 while some remains unsent */
+static int client_drain_redraw(struct client *client, bool block)
+{
+	ssize_t wlen;
+
+	if (!client->redraw_buf) {
+		return 0;
+	}
+
+	wlen = send_all(client, client->redraw_buf + client->redraw_pos,
+			client->redraw_len - client->redraw_pos, block);
+	if (wlen < 0) {
+		return -1;
+	}
+
+	client->redraw_pos += (size_t)wlen;
+	if (client->redraw_pos < client->redraw_len) {
+		return 1;
+	}
+
+	free(client->redraw_buf);
+	client->redraw_buf = NULL;
+	return 0;
+}
+
 /* Drain the queue to the socket and update the queue buffer. If force_len is
- * set, send at least that many bytes from the queue, possibly while blocking
+ * set, send at least that many bytes from the queue, possibly while blocking.
+ * Returns 1 once a dump client has been sent all it's owed
  */
 static int client_drain_queue(struct client *client, size_t force_len)
 {
@@ -178,6 +331,7 @@ static int client_drain_queue(struct client *client, size_t force_len)
 	size_t len;
 	size_t total_len;
 	bool block;
+	int rc;
 
 	total_len = 0;
 	wlen = 0;
@@ -188,8 +342,24 @@ static int client_drain_queue(struct client *client, size_t force_len)
 		return 0;
 	}
 
+	/* Older data from the history goes out first. A forced drain can't
+	 * wait for the replay, so the rest of it is dropped */
+	if (block) {
+		client_drop_history(client);
+	}
+	rc = client_drain_history(client);
+	if (!rc) {
+		rc = client_drain_redraw(client, block);
+	}
+	if (rc) {
+		return rc < 0 ? -1 : 0;
+	}
+
 	for (;;) {
 		len = ringbuffer_dequeue_peek(client->rbc, total_len, &buf);
+		if (client->dump && len > client->dump_len - total_len) {
+			len = client->dump_len - total_len;
+		}
 		if (!len) {
 			break;
 		}
@@ -210,6 +380,13 @@ static int client_drain_queue(struct client *client, size_t force_len)
 		return -1;
 	}
 
+	if (client->dump) {
+		client->dump_len -= total_len;
+		if (!client->dump_len) {
+			return 1;
+		}
+	}
+
 	if (force_len && total_len < force_len) {
 		return -1;
 	}
@@ -298,6 +475,12 @@ static enum poller_ret client_poll(struct handler *handler, int events,
 		}
 	}
 
+	/* Not reading, so a paused client's hangup shows up only here */
+	if ((client->paused || client->dump) &&
+	    (events & (POLLHUP | POLLERR))) {
+		goto err_close;
+	}
+
 	return POLLER_OK;
 
 err_close:
@@ -306,35 +489,103 @@ err_close:
 	return POLLER_REMOVE;
 }
 
-static enum poller_ret socket_poll(struct handler *handler, int events,
-				   void __attribute__((unused)) * data)
+static struct ringbuffer_consumer *
+client_consumer_register(struct client *client)
+{
+	struct socket_handler *sh = client->sh;
+	struct ringbuffer_consumer *rbc;
+
+	/* The redraw stands in for the backlog, and live data follows on */
+	if (sh->attach_redraw && sh->console->screen) {
+		client->redraw_buf = screen_redraw(sh->console->screen,
+						   &client->redraw_len);
+		console_poller_set_timeout(sh->console, client->poller,
+					   &socket_handler_timeout);
+		return console_ringbuffer_consumer_register(
+			sh->console, client_ringbuffer_poll, client);
+	}
+
+	if (!sh->replay_backlog && !client->dump) {
+		return console_ringbuffer_consumer_register(
+			sh->console, client_ringbuffer_poll, client);
+	}
+
+	/* Replay the history as it is right now. The open block is copied
+	 * rather than sealed, which would leave a small block for every
+	 * attach */
+	if (sh->console->history) {
+		struct history *history = sh->console->history;
+
+		client->history_seq = history_first_seq(history);
+		client->history_end = history_end_seq(history);
+		client->history_buf = malloc(HISTORY_BLOCK_SIZE);
+		client->history_stage = malloc(HISTORY_BLOCK_SIZE);
+		if (client->history_buf && client->history_stage) {
+			client->history_stage_len =
+				history_read_stage(history,
+						   client->history_stage);
+		} else {
+			client_drop_history(client);
+		}
+	}
+
+	/* Drain the backlog from client_timeout() */
+	console_poller_set_timeout(sh->console, client->poller,
+				   &socket_handler_timeout);
+
+	rbc = console_ringbuffer_consumer_register_backlog(
+		sh->console, client_ringbuffer_poll, client);
+
+	/* A dump stops at what's buffered now */
+	if (rbc && client->dump) {
+		client->dump_len = ringbuffer_len(rbc);
+	}
+
+	return rbc;
+}
+
+/* A client whose switch request is queued waits, paused, for its turn */
+static void client_start(struct client *client)
+{
+	struct console *console = client->sh->console;
+
+	if (console->tty->active != console) {
+		client_set_paused(client, true);
+	}
+}
+
+static void socket_accept(struct socket_handler *sh, int sd, bool dump)
 {
-	struct socket_handler *sh = to_socket_handler(handler);
 	struct client *client;
 	int fd;
 	int n;
 
-	if (!(events & POLLIN)) {
-		return POLLER_OK;
-	}
-
-	fd = accept(sh->sd, NULL, NULL);
+	fd = accept(sd, NULL, NULL);
 	if (fd < 0) {
-		return POLLER_OK;
+		return;
 	}
 
-	console_mux_activate(sh->console);
+	if (!dump) {
+		console_mux_activate(sh->console);
+	}
 
 	client = malloc(sizeof(*client));
 	memset(client, 0, sizeof(*client));
 
 	client->sh = sh;
 	client->fd = fd;
-	client->poller = console_poller_register(sh->console, handler,
-						 client_poll, client_timeout,
-						 client->fd, POLLIN, client);
-	client->rbc = console_ringbuffer_consumer_register(
-		sh->console, client_ringbuffer_poll, client);
+	client->dump = dump;
+	client->poller = console_poller_register(
+		sh->console, &sh->handler, client_poll, client_timeout,
+		client->fd, dump ? 0 : POLLIN, client);
+	client->rbc = client_consumer_register(client);
+	if (client->rbc && !dump) {
+		ringbuffer_consumer_set_latency(client->rbc, &sh->latency);
+	}
+	if (!dump) {
+		sh->console->n_sessions++;
+		client_start(client);
+	}
 
 	n = sh->n_clients++;
 	/*
@@ -346,6 +597,28 @@ static enum poller_ret socket_poll(struct handler *handler, int events,
 		reallocarray(sh->clients, sh->n_clients, sizeof(*sh->clients));
 	/* NOLINTEND(bugprone-sizeof-expression) */
 	sh->clients[n] = client;
+}
+
+static enum poller_ret socket_poll(struct handler *handler, int events,
+				   void __attribute__((unused)) * data)
+{
+	struct socket_handler *sh = to_socket_handler(handler);
+
+	if (events & POLLIN) {
+		socket_accept(sh, sh->sd, false);
+	}
+
+	return POLLER_OK;
+}
+
+static enum poller_ret socket_dump_poll(struct handler *handler, int events,
+					void __attribute__((unused)) * data)
+{
+	struct socket_handler *sh = to_socket_handler(handler);
+
+	if (events & POLLIN) {
+		socket_accept(sh, sh->dump_sd, true);
+	}
 
 	return POLLER_OK;
 }
@@ -394,14 +667,16 @@ int dbus_create_socket_consumer(struct console *console)
 	client->poller = console_poller_register(sh->console, &sh->handler,
 						 client_poll, client_timeout,
 						 client->fd, POLLIN, client);
-	client->rbc = console_ringbuffer_consumer_register(
-		sh->console, client_ringbuffer_poll, client);
+	client->rbc = client_consumer_register(client);
 	if (client->rbc == NULL) {
 		warnx("Failed to register a consumer.\n");
 		rc = -ENOMEM;
 		goto free_client;
 	}
+	ringbuffer_consumer_set_latency(client->rbc, &sh->latency);
+	client_start(client);
 
+	sh->console->n_sessions++;
 	n = sh->n_clients++;
 
 	/*
@@ -425,17 +700,97 @@ close_fds:
 	return rc;
 }
 
+/* Bind and listen on an abstract socket, returning it or -1 */
+static int socket_listen(struct sockaddr_un *addr, ssize_t len)
+{
+	size_t addrlen;
+	int sd;
+	int rc;
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd < 0) {
+		warn("Can't create socket");
+		return -1;
+	}
+
+	addrlen = sizeof(*addr) - sizeof(addr->sun_path) + len;
+
+	rc = bind(sd, (struct sockaddr *)addr, addrlen);
+	if (rc) {
+		socket_path_t name;
+		console_socket_path_readable(addr, addrlen, name);
+		warn("Can't bind to socket path %s (terminated at first null)",
+		     name);
+		goto err_close;
+	}
+
+	rc = listen(sd, 1);
+	if (rc) {
+		warn("Can't listen for incoming connections");
+		goto err_close;
+	}
+
+	return sd;
+
+err_close:
+	close(sd);
+	return -1;
+}
+
+static int socket_take_or_listen(struct socket_handler *sh,
+				 struct sockaddr_un *addr, ssize_t len)
+{
+	size_t addrlen = sizeof(*addr) - sizeof(addr->sun_path) + len;
+	int sd;
+
+	sd = console_server_take_listen_fd(sh->console->server, addr, addrlen);
+	if (sd >= 0) {
+		return sd;
+	}
+
+	return socket_listen(addr, len);
+}
+
+/* Sockets from systemd go back to the server, for a console added on reload */
+static void socket_close(struct socket_handler *sh, int sd)
+{
+	if (!console_server_put_listen_fd(sh->console->server, sd)) {
+		close(sd);
+	}
+}
+
+static void socket_config(struct socket_handler *sh, struct config *config)
+{
+	const char *id = sh->console->console_id;
+	const char *val;
+
+	sh->replay_backlog = false;
+	val = config_get_console_value(config, id, "replay-backlog");
+	if (val && config_parse_bool(val, &sh->replay_backlog)) {
+		warnx("Invalid replay-backlog '%s'", val);
+	}
+
+	sh->attach_redraw = false;
+	val = config_get_console_value(config, id, "attach-redraw");
+	if (val && config_parse_bool(val, &sh->attach_redraw)) {
+		warnx("Invalid attach-redraw '%s'", val);
+	}
+
+	sh->pause_clients = false;
+	val = config_get_console_value(config, id, "mux-pause-clients");
+	if (val && config_parse_bool(val, &sh->pause_clients)) {
+		warnx("Invalid mux-pause-clients '%s'", val);
+	}
+}
+
 static struct handler *socket_init(const struct handler_type *type
 				   __attribute__((unused)),
 				   struct console *console,
-				   struct config *config
-				   __attribute__((unused)))
+				   struct config *config)
 {
 	struct socket_handler *sh;
 	struct sockaddr_un addr;
-	size_t addrlen;
 	ssize_t len;
-	int rc;
 
 	sh = malloc(sizeof(*sh));
 	if (!sh) {
@@ -445,6 +800,11 @@ static struct handler *socket_init(const struct handler_type *type
 	sh->console = console;
 	sh->clients = NULL;
 	sh->n_clients = 0;
+	sh->dump_poller = NULL;
+	sh->dump_sd = -1;
+	memset(&sh->latency, 0, sizeof(sh->latency));
+
+	socket_config(sh, config);
 
 	memset(&addr, 0, sizeof(addr));
 	addr.sun_family = AF_UNIX;
@@ -459,42 +819,30 @@ static struct handler *socket_init(const struct handler_type *type
 	}
 
 	/* Try to take a socket from systemd first */
-	if (sd_listen_fds(0) == 1 &&
-	    sd_is_socket_unix(SD_LISTEN_FDS_START, SOCK_STREAM, 1,
-			      addr.sun_path, len) > 0) {
-		sh->sd = SD_LISTEN_FDS_START;
-	} else {
-		sh->sd = socket(AF_UNIX, SOCK_STREAM, 0);
-		if (sh->sd < 0) {
-			warn("Can't create socket");
-			goto err_free;
-		}
-
-		addrlen = sizeof(addr) - sizeof(addr.sun_path) + len;
-
-		rc = bind(sh->sd, (struct sockaddr *)&addr, addrlen);
-		if (rc) {
-			socket_path_t name;
-			console_socket_path_readable(&addr, addrlen, name);
-			warn("Can't bind to socket path %s (terminated at first null)",
-			     name);
-			goto err_close;
-		}
-
-		rc = listen(sh->sd, 1);
-		if (rc) {
-			warn("Can't listen for incoming connections");
-			goto err_close;
-		}
+	sh->sd = socket_take_or_listen(sh, &addr, len);
+	if (sh->sd < 0) {
+		goto err_free;
 	}
 
 	sh->poller = console_poller_register(console, &sh->handler, socket_poll,
 					     NULL, sh->sd, POLLIN, NULL);
 
+	/* The console is usable without the dump socket */
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	len = console_dump_socket_path(addr.sun_path, console->console_id);
+	if (len >= 0) {
+		sh->dump_sd = socket_take_or_listen(sh, &addr, len);
+	}
+	if (sh->dump_sd >= 0) {
+		sh->dump_poller = console_poller_register(console, &sh->handler,
+							  socket_dump_poll, NULL,
+							  sh->dump_sd, POLLIN,
+							  NULL);
+	}
+
 	return &sh->handler;
 
-err_close:
-	close(sh->sd);
 err_free:
 	free(sh);
 	return NULL;
@@ -504,13 +852,51 @@ static void socket_deselect(struct handler *handler)
 {
 	struct socket_handler *sh = to_socket_handler(handler);
 
-	while (sh->n_clients) {
-		struct client *c = sh->clients[0];
+	if (sh->pause_clients) {
+		for (int i = 0; i < sh->n_clients; i++) {
+			if (sh->clients[i]->dump) {
+				continue;
+			}
+			client_set_paused(sh->clients[i], true);
+		}
+		return;
+	}
+
+	/* Dumps carry on regardless of the mux */
+	for (int i = 0; i < sh->n_clients;) {
+		struct client *c = sh->clients[i];
+		if (c->dump) {
+			i++;
+			continue;
+		}
 		client_drain_queue(c, 0);
 		client_close(c);
 	}
 }
 
+static void socket_select(struct handler *handler)
+{
+	struct socket_handler *sh = to_socket_handler(handler);
+
+	for (int i = 0; i < sh->n_clients; i++) {
+		client_set_paused(sh->clients[i], false);
+	}
+}
+
+/* Clients stay connected, and the settings apply from the next attach or
+ * mux switch */
+static int socket_reload(struct handler *handler, struct config *config)
+{
+	socket_config(to_socket_handler(handler), config);
+
+	return 0;
+}
+
+static const struct latency_hist *socket_latency(struct handler *handler)
+{
+	return &to_socket_handler(handler)->latency;
+}
+
 static void socket_fini(struct handler *handler)
 {
 	struct socket_handler *sh = to_socket_handler(handler);
@@ -523,14 +909,25 @@ static void socket_fini(struct handler *handler)
 		console_poller_unregister(sh->console, sh->poller);
 	}
 
-	close(sh->sd);
+	if (sh->dump_poller) {
+		console_poller_unregister(sh->console, sh->dump_poller);
+	}
+
+	if (sh->dump_sd >= 0) {
+		socket_close(sh, sh->dump_sd);
+	}
+
+	socket_close(sh, sh->sd);
 	free(sh);
 }
 
 static const struct handler_type socket_handler = {
 	.name = "socket",
 	.init = socket_init,
+	.select = socket_select,
 	.deselect = socket_deselect,
+	.reload = socket_reload,
+	.latency = socket_latency,
 	.fini = socket_fini,
 };
 
@@ -0,0 +1,109 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "asciicast.c"
+#include "util.h"
+
+#define BENCH_INPUT_SIZE (64ul * 1024ul * 1024ul)
+#define BENCH_CHUNK_SIZE 4096ul
+
+static const char *const messages[] = {
+	"systemd[1]: Started \x1b[0;1;39mJournal Service\x1b[0m.",
+	"kernel: EXT4-fs (mmcblk0p2): mounted filesystem with ordered data mode",
+	"[\x1b[0;32m  OK  \x1b[0m] Reached target \x1b[0;1;39mNetwork\x1b[0m.",
+	"kernel: aspeed-i2c-bus 1e78a080.i2c-bus: i2c bus 1 timed out",
+	"Loading, please wait...",
+	"login: ",
+};
+
+/* Boot-log style lines, with a firmware setup style screen now and then */
+static size_t make_console_text(uint8_t *buf, size_t size)
+{
+	uint32_t state = 1;
+	size_t len = 0;
+	unsigned long us = 0;
+
+	while (len + 1024 < size) {
+		const char *msg;
+
+		state = state * 1103515245u + 12345u;
+		if ((state >> 16) % 64 == 0) {
+			len += (size_t)snprintf(
+				(char *)buf + len, size - len,
+				"\x1b[2J\x1b[1;1H\x1b[44;37m\x1b(0lqqqqqqqqk\x1b(B"
+				"\x1b[5;10H\x1b[1mMain\x1b[0;44;37m  Advanced"
+				"\x1b[7;3H\x1b[7m Boot Order \x1b[0m\x1b[24;1H");
+			continue;
+		}
+
+		msg = messages[(state >> 16) % ARRAY_SIZE(messages)];
+		us += (state >> 8) % 50000;
+
+		len += (size_t)snprintf((char *)buf + len, size - len,
+					"[%5lu.%06lu] %s\r\n", us / 1000000,
+					us % 1000000, msg);
+	}
+
+	return len;
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	struct asciicast_enc enc = { 0 };
+	double start, escape, parse;
+	size_t out_len = 0;
+	size_t len, n;
+	uint8_t *buf;
+	char *line;
+	double time;
+
+	buf = malloc(BENCH_INPUT_SIZE);
+	assert(buf);
+	len = make_console_text(buf, BENCH_INPUT_SIZE);
+
+	line = malloc(ASCIICAST_ESCAPED_MAX(BENCH_CHUNK_SIZE) + 32);
+	assert(line);
+
+	/* Encoding is what the record handler does at each flush */
+	start = cpu_seconds();
+	for (size_t i = 0; i < len; i += BENCH_CHUNK_SIZE) {
+		n = len - i < BENCH_CHUNK_SIZE ? len - i : BENCH_CHUNK_SIZE;
+		out_len += asciicast_escape(&enc, buf + i, n, line);
+	}
+	escape = cpu_seconds() - start;
+
+	/* Decoding, as for a replay */
+	n = (size_t)sprintf(line, "[1.000000, \"o\", \"");
+	n += asciicast_escape(&enc, buf, BENCH_CHUNK_SIZE, line + n);
+	strcpy(line + n, "\"]\n");
+
+	start = cpu_seconds();
+	for (size_t i = 0; i < len; i += BENCH_CHUNK_SIZE) {
+		int rc = asciicast_parse_event(line, &time, buf, &n);
+
+		assert(!rc);
+	}
+	parse = cpu_seconds() - start;
+
+	printf("input: %zu bytes, %zu encoded\n", len, out_len);
+	printf("escape: %.0f MB/s\n",
+	       (double)len / (1024.0 * 1024.0) / escape);
+	printf("parse: %.0f MB/s\n", (double)len / (1024.0 * 1024.0) / parse);
+
+	free(line);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,125 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+#include "asciicast.c"
+#include "config.c"
+#include "console-socket.c"
+#include "escape.c"
+#define main __main
+#include "console-client.c"
+#undef main
+
+#define BENCH_INPUT_SIZE (64ul * 1024ul * 1024ul)
+#define BENCH_READ_SIZE	 4096ul
+
+static size_t n_writes;
+static size_t n_written;
+
+int write_buf_to_fd(int fd __attribute__((unused)),
+		    const uint8_t *buf __attribute__((unused)), size_t len)
+{
+	n_writes++;
+	n_written += len;
+	return 0;
+}
+
+/* A large paste: shell script text, one line at a time */
+static size_t make_paste(uint8_t *buf, size_t size)
+{
+	uint32_t state = 1;
+	size_t len = 0;
+
+	while (len + 128 < size) {
+		state = state * 1103515245u + 12345u;
+		len += (size_t)snprintf((char *)buf + len, size - len,
+					"echo %08x > /sys/class/gpio/gpio%u/value\r",
+					state, (state >> 16) % 512);
+	}
+
+	return len;
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void run(const char *name, struct console_client *client,
+		const uint8_t *paste, size_t len)
+{
+	uint8_t buf[BENCH_READ_SIZE];
+	enum process_rc prc;
+	double start;
+	size_t n;
+
+	n_writes = 0;
+	n_written = 0;
+
+	start = cpu_seconds();
+	for (size_t i = 0; i < len; i += n) {
+		n = len - i < sizeof(buf) ? len - i : sizeof(buf);
+		/* stands in for the read() from the tty */
+		memcpy(buf, paste + i, n);
+
+		if (client->esc_type == ESC_TYPE_SSH) {
+			prc = process_ssh_tty(client, buf, n);
+		} else {
+			prc = process_str_tty(client, buf, n);
+		}
+		assert(prc == PROCESS_OK);
+	}
+	start = cpu_seconds() - start;
+
+	assert(n_written == len);
+	printf("%s: %.0f MB/s, %zu writes for %zu reads\n", name,
+	       (double)len / (1024.0 * 1024.0) / start, n_writes,
+	       (len + BENCH_READ_SIZE - 1) / BENCH_READ_SIZE);
+}
+
+static const struct {
+	const char *name;
+	const char *str;
+} escapes[] = {
+	{ "string escape '~.'", "~." },
+	{ "string escape 'echo!'", "echo!" },
+};
+
+int main(void)
+{
+	struct console_client client;
+	uint8_t *paste;
+	size_t len;
+	int rc;
+
+	paste = malloc(BENCH_INPUT_SIZE);
+	assert(paste);
+	len = make_paste(paste, BENCH_INPUT_SIZE);
+
+	memset(&client, 0, sizeof(client));
+	client.esc_type = ESC_TYPE_SSH;
+	run("ssh escape", &client, paste, len);
+
+	/* Escapes whose first byte is rare, and common, in the paste */
+	for (size_t i = 0; i < ARRAY_SIZE(escapes); i++) {
+		memset(&client, 0, sizeof(client));
+		client.esc_type = ESC_TYPE_STR;
+		rc = str_esc_init(&client.esc_state.str,
+				  (const uint8_t *)escapes[i].str);
+		assert(!rc);
+		run(escapes[i].name, &client, paste, len);
+		str_esc_fini(&client.esc_state.str);
+	}
+
+	free(paste);
+
+	return EXIT_SUCCESS;
+}
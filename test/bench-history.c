@@ -0,0 +1,106 @@
+#include <assert.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "history.c"
+#include "util.h"
+
+#define BENCH_INPUT_SIZE (16ul * 1024ul * 1024ul)
+
+static const char *const messages[] = {
+	"systemd[1]: Started Journal Service.",
+	"kernel: EXT4-fs (mmcblk0p2): mounted filesystem with ordered data mode",
+	"phosphor-hwmon: Failed to read sensor temp1: Device or resource busy",
+	"bmcweb: Session created for user root from 10.0.0.5",
+	"ipmid: Set sensor reading: sensor 0x23, value 0x4f",
+	"kernel: aspeed-i2c-bus 1e78a080.i2c-bus: i2c bus 1 timed out",
+	"Loading, please wait...",
+	"login: ",
+};
+
+/* Boot-log style text: timestamps and a small vocabulary of messages */
+static size_t make_console_text(uint8_t *buf, size_t size)
+{
+	uint32_t state = 1;
+	size_t len = 0;
+	unsigned long us = 0;
+
+	while (len + 160 < size) {
+		const char *msg;
+
+		state = state * 1103515245u + 12345u;
+		msg = messages[(state >> 16) % ARRAY_SIZE(messages)];
+		us += (state >> 8) % 50000;
+
+		len += (size_t)snprintf((char *)buf + len, size - len,
+					"[%5lu.%06lu] %s\r\n", us / 1000000,
+					us % 1000000, msg);
+	}
+
+	return len;
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	uint8_t block[HISTORY_BLOCK_SIZE];
+	struct history_stats stats;
+	struct history *history;
+	double start, compress, decompress;
+	size_t len, read;
+	uint8_t *buf;
+	uint64_t seq;
+	ssize_t rc;
+
+	buf = malloc(BENCH_INPUT_SIZE);
+	assert(buf);
+	len = make_console_text(buf, BENCH_INPUT_SIZE);
+
+	/* Large enough to keep everything, so the ratio covers all input */
+	history = history_init(BENCH_INPUT_SIZE);
+	assert(history);
+
+	start = cpu_seconds();
+	history_append(history, buf, len);
+	history_flush(history);
+	compress = cpu_seconds() - start;
+
+	history_get_stats(history, &stats);
+	assert(stats.raw_bytes == len);
+
+	read = 0;
+	seq = history_first_seq(history);
+	start = cpu_seconds();
+	while ((rc = history_read_block(history, &seq, block)) > 0) {
+		assert(!memcmp(block, buf + read, (size_t)rc));
+		read += (size_t)rc;
+	}
+	decompress = cpu_seconds() - start;
+	assert(rc == 0 && read == len);
+
+	printf("input: %zu bytes in %zu blocks of %d\n", len, stats.n_blocks,
+	       HISTORY_BLOCK_SIZE);
+	printf("compression ratio: %.2f (%" PRIu64 " bytes stored)\n",
+	       (double)stats.raw_bytes / (double)stats.stored_bytes,
+	       stats.stored_bytes);
+	printf("compress: %.2f ms CPU per MB\n",
+	       compress * 1e3 / ((double)len / (1024.0 * 1024.0)));
+	printf("read back: %.2f ms CPU per MB\n",
+	       decompress * 1e3 / ((double)len / (1024.0 * 1024.0)));
+
+	history_fini(history);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,102 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "screen.c"
+#include "util.h"
+
+#define BENCH_INPUT_SIZE (64ul * 1024ul * 1024ul)
+#define BENCH_CHUNK_SIZE 4096ul
+
+static const char *const messages[] = {
+	"systemd[1]: Started \x1b[0;1;39mJournal Service\x1b[0m.",
+	"kernel: EXT4-fs (mmcblk0p2): mounted filesystem with ordered data mode",
+	"[\x1b[0;32m  OK  \x1b[0m] Reached target \x1b[0;1;39mNetwork\x1b[0m.",
+	"kernel: aspeed-i2c-bus 1e78a080.i2c-bus: i2c bus 1 timed out",
+	"Loading, please wait...",
+	"login: ",
+};
+
+/* Boot-log style lines, with a firmware setup style screen now and then */
+static size_t make_console_text(uint8_t *buf, size_t size)
+{
+	uint32_t state = 1;
+	size_t len = 0;
+	unsigned long us = 0;
+
+	while (len + 1024 < size) {
+		const char *msg;
+
+		state = state * 1103515245u + 12345u;
+		if ((state >> 16) % 64 == 0) {
+			len += (size_t)snprintf(
+				(char *)buf + len, size - len,
+				"\x1b[2J\x1b[1;1H\x1b[44;37m\x1b(0lqqqqqqqqk\x1b(B"
+				"\x1b[5;10H\x1b[1mMain\x1b[0;44;37m  Advanced"
+				"\x1b[7;3H\x1b[7m Boot Order \x1b[0m\x1b[24;1H");
+			continue;
+		}
+
+		msg = messages[(state >> 16) % ARRAY_SIZE(messages)];
+		us += (state >> 8) % 50000;
+
+		len += (size_t)snprintf((char *)buf + len, size - len,
+					"[%5lu.%06lu] %s\r\n", us / 1000000,
+					us % 1000000, msg);
+	}
+
+	return len;
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	double start, update, redraw;
+	struct screen *screen;
+	uint8_t *out;
+	uint8_t *buf;
+	size_t len;
+	size_t n;
+
+	buf = malloc(BENCH_INPUT_SIZE);
+	assert(buf);
+	len = make_console_text(buf, BENCH_INPUT_SIZE);
+
+	screen = screen_init(80, 24);
+	assert(screen);
+
+	start = cpu_seconds();
+	for (size_t i = 0; i < len; i += BENCH_CHUNK_SIZE) {
+		n = len - i < BENCH_CHUNK_SIZE ? len - i : BENCH_CHUNK_SIZE;
+		screen_update(screen, buf + i, n);
+	}
+	update = cpu_seconds() - start;
+
+	start = cpu_seconds();
+	for (int i = 0; i < 1000; i++) {
+		out = screen_redraw(screen, &n);
+		assert(out);
+		free(out);
+	}
+	redraw = (cpu_seconds() - start) / 1000;
+
+	printf("input: %zu bytes\n", len);
+	printf("update: %.0f MB/s\n",
+	       (double)len / (1024.0 * 1024.0) / update);
+	printf("redraw: %zu bytes in %.1f us\n", n, redraw * 1e6);
+
+	screen_fini(screen);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "matcher.c"
+#include "ringbuffer.c"
+#include "util.h"
+
+#define BENCH_INPUT_SIZE (64ul * 1024ul * 1024ul)
+#define BENCH_CHUNK_SIZE 4096ul
+#define BENCH_RB_SIZE	 (128ul * 1024ul)
+
+static const char *const messages[] = {
+	"systemd[1]: Started Journal Service.",
+	"kernel: EXT4-fs (mmcblk0p2): mounted filesystem with ordered data mode",
+	"phosphor-hwmon: Failed to read sensor temp1: Device or resource busy",
+	"bmcweb: Session created for user root from 10.0.0.5",
+	"kernel: aspeed-i2c-bus 1e78a080.i2c-bus: i2c bus 1 timed out",
+	"Loading, please wait...",
+	"login: ",
+};
+
+static const char *const patterns[] = {
+	"Kernel panic", "Oops", "BUG:", "Call Trace:", "watchdog: ",
+	"login: ",	"MCE",	"segfault", "Out of memory",
+};
+
+static size_t make_console_text(uint8_t *buf, size_t size)
+{
+	uint32_t state = 1;
+	size_t len = 0;
+	unsigned long us = 0;
+
+	while (len + 160 < size) {
+		const char *msg;
+
+		state = state * 1103515245u + 12345u;
+		msg = messages[(state >> 16) % ARRAY_SIZE(messages)];
+		us += (state >> 8) % 50000;
+
+		len += (size_t)snprintf((char *)buf + len, size - len,
+					"[%5lu.%06lu] %s\r\n", us / 1000000,
+					us % 1000000, msg);
+	}
+
+	return len;
+}
+
+static double cpu_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void count_match(void *data, size_t pattern __attribute__((unused)),
+			uint64_t offset __attribute__((unused)))
+{
+	(*(size_t *)data)++;
+}
+
+static enum ringbuffer_poll_ret noop_poll(void *data __attribute__((unused)),
+					  size_t force_len
+					  __attribute__((unused)))
+{
+	return RINGBUFFER_POLL_OK;
+}
+
+/* Queue the input through a ringbuffer, optionally matching each span */
+static double run(const uint8_t *buf, size_t len, struct matcher *m,
+		  size_t *n_matches)
+{
+	struct ringbuffer_consumer *rbc;
+	struct ringbuffer *rb;
+	double start;
+	uint8_t *span;
+	size_t n;
+
+	rb = ringbuffer_init(BENCH_RB_SIZE);
+	assert(rb);
+	rbc = ringbuffer_consumer_register(rb, noop_poll, NULL);
+	assert(rbc);
+
+	start = cpu_seconds();
+	for (size_t i = 0; i < len; i += BENCH_CHUNK_SIZE) {
+		n = len - i < BENCH_CHUNK_SIZE ? len - i : BENCH_CHUNK_SIZE;
+		ringbuffer_queue(rb, (uint8_t *)buf + i, n);
+
+		while ((n = ringbuffer_dequeue_peek(rbc, 0, &span))) {
+			if (m) {
+				matcher_scan(m, span, n, count_match,
+					     n_matches);
+			}
+			ringbuffer_dequeue_commit(rbc, n);
+		}
+	}
+	start = cpu_seconds() - start;
+
+	ringbuffer_fini(rb);
+
+	return start;
+}
+
+int main(void)
+{
+	double base, matched;
+	size_t n_matches = 0;
+	struct matcher *m;
+	uint8_t *buf;
+	size_t len;
+	double mb;
+
+	buf = malloc(BENCH_INPUT_SIZE);
+	assert(buf);
+	len = make_console_text(buf, BENCH_INPUT_SIZE);
+	mb = (double)len / (1024.0 * 1024.0);
+
+	m = matcher_init(patterns, ARRAY_SIZE(patterns));
+	assert(m);
+
+	base = run(buf, len, NULL, NULL);
+	matched = run(buf, len, m, &n_matches);
+
+	printf("input: %zu bytes, %zu patterns, %zu matches\n", len,
+	       ARRAY_SIZE(patterns), n_matches);
+	printf("ringbuffer only: %.0f MB/s\n", mb / base);
+	printf("ringbuffer and matcher: %.0f MB/s\n", mb / matched);
+
+	matcher_fini(m);
+	free(buf);
+
+	return EXIT_SUCCESS;
+}
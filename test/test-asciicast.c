@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "asciicast.c"
+
+/* Escape buf in pieces of the given size, as one event */
+static char *escape_event(const uint8_t *buf, size_t len, size_t piece)
+{
+	struct asciicast_enc enc = { 0 };
+	char *line;
+	size_t o;
+
+	line = malloc(ASCIICAST_ESCAPED_MAX(len) + 32);
+	assert(line);
+
+	o = (size_t)sprintf(line, "[1.500000, \"o\", \"");
+	for (size_t i = 0; i < len; i += piece) {
+		size_t n = len - i < piece ? len - i : piece;
+
+		o += asciicast_escape(&enc, buf + i, n, line + o);
+	}
+	o += asciicast_escape_flush(&enc, line + o);
+	strcpy(line + o, "\"]\n");
+
+	return line;
+}
+
+static void assert_round_trip(const uint8_t *buf, size_t len)
+{
+	for (size_t piece = 1; piece <= len + 1; piece++) {
+		uint8_t out[1024];
+		size_t out_len;
+		double time;
+		char *line;
+
+		line = escape_event(buf, len, piece);
+		assert(asciicast_parse_event(line, &time, out, &out_len) == 0);
+		assert(time == 1.5);
+		assert(out_len == len && !memcmp(out, buf, len));
+		free(line);
+	}
+}
+
+static void test_escape(void)
+{
+	struct asciicast_enc enc = { 0 };
+	char out[128];
+	size_t n;
+
+	n = asciicast_escape(&enc, (const uint8_t *)"a\"\\\r\n\t\x1b[0m\x7f", 11,
+			     out);
+	out[n] = '\0';
+	assert(!strcmp(out, "a\\\"\\\\\\r\\n\\t\\u001b[0m\\u007f"));
+
+	/* UTF-8 passes through, other bytes are written as U+0080-U+00FF */
+	n = asciicast_escape(&enc, (const uint8_t *)"\xc3\xa9\xb0\xc3x", 5,
+			     out);
+	out[n] = '\0';
+	assert(!strcmp(out, "\xc3\xa9\\u00b0\\u00c3x"));
+
+	/* A sequence cut short is held back for the next call */
+	n = asciicast_escape(&enc, (const uint8_t *)"\xe2\x82", 2, out);
+	assert(n == 0 && enc.partial_len == 2);
+	n = asciicast_escape(&enc, (const uint8_t *)"\xac", 1, out);
+	assert(n == 3 && !memcmp(out, "\xe2\x82\xac", 3));
+}
+
+static void test_round_trip(void)
+{
+#define CASE(s) { (const uint8_t *)(s), sizeof(s) - 1 }
+	static const struct {
+		const uint8_t *buf;
+		size_t len;
+	} cases[] = {
+		CASE("plain text\r\n"),
+		CASE("caf\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80"),
+		/* overlong, surrogate, out of range, stray continuation */
+		CASE("\xc0\xaf\xed\xa0\x80\xf4\x90\x80\x80\x80"),
+		/* sequences broken off by the next byte */
+		CASE("\xe2\x82x\xf0\x9f\x98\xc3\xa9\xe2"),
+		CASE("\x1b[1;31m\"quoted\"\\\x1b[0m\x00\x7f"),
+	};
+#undef CASE
+	uint8_t all[256];
+
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		assert_round_trip(cases[i].buf, cases[i].len);
+	}
+
+	for (size_t i = 0; i < sizeof(all); i++) {
+		all[i] = (uint8_t)i;
+	}
+	assert_round_trip(all, sizeof(all));
+}
+
+static void test_parse(void)
+{
+	uint8_t out[64];
+	size_t len;
+	double time;
+
+	assert(asciicast_parse_event("{\"version\": 2, \"width\": 80}\n",
+				     &time, out, &len) == 1);
+	assert(asciicast_parse_event("\n", &time, out, &len) == 1);
+	assert(asciicast_parse_event("[0.5, \"i\", \"typed\"]\n", &time, out,
+				     &len) == 1);
+	assert(asciicast_parse_event("[0.5, \"r\", \"80x24\"]\n", &time, out,
+				     &len) == 1);
+
+	/* Written by other tools: \/, \b, \f, surrogate pairs */
+	assert(asciicast_parse_event(
+		       " [ 2 , \"o\" , \"\\/\\b\\f\\ud83d\\ude00\\u00E9\" ] ",
+		       &time, out, &len) == 0);
+	assert(time == 2);
+	assert(len == 8 && !memcmp(out, "/\b\f\xf0\x9f\x98\x80\xe9", 8));
+
+	/* Truncated, or otherwise broken */
+	assert(asciicast_parse_event("[1.0, \"o\", \"cut sho", &time, out,
+				     &len) == -1);
+	assert(asciicast_parse_event("[1.0, \"o\", \"\\x\"]", &time, out,
+				     &len) == -1);
+	assert(asciicast_parse_event("[1.0, \"o\", \"\\u12\"]", &time, out,
+				     &len) == -1);
+	assert(asciicast_parse_event("[-1, \"o\", \"\"]", &time, out, &len) ==
+	       -1);
+	assert(asciicast_parse_event("[\"o\", \"\"]", &time, out, &len) == -1);
+	assert(asciicast_parse_event("[1.0, \"o\", \"x\"", &time, out, &len) ==
+	       -1);
+	assert(asciicast_parse_event("text", &time, out, &len) == -1);
+}
+
+int main(void)
+{
+	test_escape();
+	test_round_trip();
+	test_parse();
+
+	return EXIT_SUCCESS;
+}
@@ -25,8 +25,10 @@
 
 static ssize_t __read(int fd, void *buf, size_t len);
 #define read __read
+#include "asciicast.c"
 #include "config.c"
 #include "console-socket.c"
+#include "escape.c"
 #define main __main
 #include "console-client.c"
 #undef read
@@ -50,6 +52,7 @@ struct test_ctx {
 	uint8_t out[4096];
 	size_t cur_in;
 	size_t cur_out;
+	size_t n_writes;
 };
 
 struct test tests[] = {
@@ -154,6 +157,58 @@ struct test tests[] = {
 		.exp_out = "acb",
 		.exp_rc = PROCESS_EXIT,
 	},
+	{
+		/* str escape, overlapping a longer partial match */
+		.esc_type = ESC_TYPE_STR,
+		.esc_state = { .str = { .str = (const uint8_t *)"aab" } },
+		.in = { "xaaabc" },
+		.n_in = 1,
+		.exp_out = "xaaab",
+		.exp_rc = PROCESS_ESC,
+	},
+	{
+		/* str escape, overlapping partial match split over reads */
+		.esc_type = ESC_TYPE_STR,
+		.esc_state = { .str = { .str = (const uint8_t *)"abac" } },
+		.in = { "ab", "aba", "cd" },
+		.n_in = 3,
+		.exp_out = "ababac",
+		.exp_rc = PROCESS_ESC,
+	},
+	{
+		/* str escape, mismatch falls back to a shorter prefix */
+		.esc_type = ESC_TYPE_STR,
+		.esc_state = { .str = { .str = (const uint8_t *)"~~~." } },
+		.in = { "~~~~~.x" },
+		.n_in = 1,
+		.exp_out = "~~~~~.",
+		.exp_rc = PROCESS_ESC,
+	},
+	{
+		/* str escape, partial matches that never complete */
+		.esc_type = ESC_TYPE_STR,
+		.esc_state = { .str = { .str = (const uint8_t *)"aab" } },
+		.in = { "aaca", "ba" },
+		.n_in = 2,
+		.exp_out = "aacaba",
+		.exp_rc = PROCESS_EXIT,
+	},
+	{
+		/* ssh escape, repeated carriage returns */
+		.esc_type = ESC_TYPE_SSH,
+		.in = { "a\r\r\r~." },
+		.n_in = 1,
+		.exp_out = "a\r\r\r",
+		.exp_rc = PROCESS_ESC,
+	},
+	{
+		/* ssh escape, held tildes dropped from the middle of a read */
+		.esc_type = ESC_TYPE_SSH,
+		.in = { "a\r~b\r~c\r~~d" },
+		.n_in = 1,
+		.exp_out = "a\rb\rc\r~d",
+		.exp_rc = PROCESS_EXIT,
+	},
 };
 
 struct test_ctx ctxs[ARRAY_SIZE(tests)];
@@ -165,6 +220,7 @@ int write_buf_to_fd(int fd, const uint8_t *buf, size_t len)
 	assert(ctx->cur_out + len <= sizeof(ctx->out));
 	memcpy(ctx->out + ctx->cur_out, buf, len);
 	ctx->cur_out += len;
+	ctx->n_writes++;
 
 	return 0;
 }
@@ -206,6 +262,11 @@ void run_one_test(size_t idx, struct test *test, struct test_ctx *ctx)
 	ctx->client.esc_type = test->esc_type;
 	memcpy(&ctx->client.esc_state, &test->esc_state,
 	       sizeof(test->esc_state));
+	if (test->esc_type == ESC_TYPE_STR) {
+		rc = str_esc_init(&ctx->client.esc_state.str,
+				  test->esc_state.str.str);
+		assert(!rc);
+	}
 	ctx->test = test;
 
 	for (;;) {
@@ -225,6 +286,12 @@ void run_one_test(size_t idx, struct test *test, struct test_ctx *ctx)
 	assert(rc == test->exp_rc);
 	assert(exp_out_len == ctx->cur_out);
 	assert(!memcmp(ctx->out, test->exp_out, exp_out_len));
+	/* at most one write for each read */
+	assert(ctx->n_writes <= ctx->cur_in);
+
+	if (test->esc_type == ESC_TYPE_STR) {
+		str_esc_fini(&ctx->client.esc_state.str);
+	}
 }
 
 int main(void)
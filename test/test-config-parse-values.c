@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifndef SYSCONFDIR
+// Bypass compilation error due to -DSYSCONFDIR not provided
+#define SYSCONFDIR
+#endif
+
+#include "config.c"
+
+static void test_config_parse_ulong(void)
+{
+	const struct {
+		const char *str;
+		unsigned long expected;
+		int expected_rc;
+	} test_data[] = {
+		{ NULL, 0, -1 },   { "", 0, -1 },	 { "0", 0, 0 },
+		{ "42", 42, 0 },   { "0x10", 16, 0 }, { " 7 ", 7, 0 },
+		{ "-1", 0, -1 },   { "5ms", 0, -1 },  { "abc", 0, -1 },
+		{ "99999999999999999999999", 0, -1 },
+	};
+	unsigned long val;
+	int rc;
+
+	for (size_t i = 0; i < ARRAY_SIZE(test_data); i++) {
+		rc = config_parse_ulong(test_data[i].str, &val);
+		assert(rc == test_data[i].expected_rc);
+		if (!rc) {
+			assert(val == test_data[i].expected);
+		}
+	}
+}
+
+static void test_config_parse_bool(void)
+{
+	const struct {
+		const char *str;
+		bool expected;
+		int expected_rc;
+	} test_data[] = {
+		{ NULL, false, -1 }, { "", false, -1 },	   { "1", true, 0 },
+		{ "true", true, 0 }, { "Yes", true, 0 },   { "on", true, 0 },
+		{ "0", false, 0 },   { "FALSE", false, 0 }, { "no", false, 0 },
+		{ "off", false, 0 }, { "2", false, -1 },   { "maybe", false, -1 },
+	};
+	bool val;
+	int rc;
+
+	for (size_t i = 0; i < ARRAY_SIZE(test_data); i++) {
+		rc = config_parse_bool(test_data[i].str, &val);
+		assert(rc == test_data[i].expected_rc);
+		if (!rc) {
+			assert(val == test_data[i].expected);
+		}
+	}
+}
+
+int main(void)
+{
+	test_config_parse_ulong();
+	test_config_parse_bool();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,324 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef SYSCONFDIR
+// Bypass compilation error due to -DSYSCONFDIR not provided
+#define SYSCONFDIR
+#endif
+
+#include "config.c"
+#include "ringbuffer.c"
+#include "console-mux.c"
+
+/* A single fake select line, standing in for libgpiod */
+struct gpiod_chip {
+	const char *name;
+};
+
+struct gpiod_line {
+	struct gpiod_chip *chip;
+	int value;
+};
+
+static struct gpiod_chip fake_chip = { .name = "gpiochip0" };
+static struct gpiod_line fake_line = { .chip = &fake_chip };
+
+struct gpiod_line *gpiod_line_find(const char *name)
+{
+	return strcmp(name, "SEL") ? NULL : &fake_line;
+}
+
+struct gpiod_line *gpiod_chip_find_line(struct gpiod_chip *chip
+					__attribute__((unused)),
+					const char *name)
+{
+	return gpiod_line_find(name);
+}
+
+struct gpiod_chip *gpiod_line_get_chip(struct gpiod_line *line)
+{
+	return line->chip;
+}
+
+const char *gpiod_chip_name(struct gpiod_chip *chip)
+{
+	return chip->name;
+}
+
+void gpiod_line_close_chip(struct gpiod_line *line __attribute__((unused)))
+{
+}
+
+void gpiod_chip_close(struct gpiod_chip *chip __attribute__((unused)))
+{
+}
+
+int gpiod_line_request_bulk_output(struct gpiod_line_bulk *bulk,
+				   const char *consumer
+				   __attribute__((unused)),
+				   const int *values)
+{
+	for (unsigned int i = 0; i < bulk->num_lines; i++) {
+		bulk->lines[i]->value = values[i];
+	}
+
+	return 0;
+}
+
+int gpiod_line_set_value_bulk(struct gpiod_line_bulk *bulk, const int *values)
+{
+	for (unsigned int i = 0; i < bulk->num_lines; i++) {
+		bulk->lines[i]->value = values[i];
+	}
+
+	return 0;
+}
+
+void gpiod_line_release_bulk(struct gpiod_line_bulk *bulk
+			     __attribute__((unused)))
+{
+}
+
+/* Counts the pauses and resumptions of a console's sessions */
+struct test_handler {
+	struct handler handler;
+	int selects;
+	int deselects;
+};
+
+static void test_handler_select(struct handler *handler)
+{
+	container_of(handler, struct test_handler, handler)->selects++;
+}
+
+static void test_handler_deselect(struct handler *handler)
+{
+	container_of(handler, struct test_handler, handler)->deselects++;
+}
+
+static const struct handler_type test_handler_type = {
+	.name = "test",
+	.select = test_handler_select,
+	.deselect = test_handler_deselect,
+};
+
+struct test_ctx {
+	struct console_server server;
+	struct upstream_tty tty;
+	struct console consoles[3];
+	struct console *console_ptrs[3];
+	struct test_handler handlers[3];
+	struct handler *handler_ptrs[3];
+};
+
+static char *const console_ids[] = { "a", "b", "c" };
+static struct console *a;
+static struct console *b;
+static struct console *c;
+
+static void setup(struct test_ctx *ctx, const struct console_mux_policy *policy)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->tty.server = &ctx->server;
+	ctx->server.consoles = ctx->console_ptrs;
+	ctx->server.n_consoles = 3;
+
+	for (size_t i = 0; i < 3; i++) {
+		struct console *console = &ctx->consoles[i];
+
+		console->server = &ctx->server;
+		console->tty = &ctx->tty;
+		console->console_id = console_ids[i];
+		console->mux_index = i;
+		console->rb = ringbuffer_init(4096);
+		assert(console->rb);
+		ctx->handlers[i].handler.type = &test_handler_type;
+		ctx->handler_ptrs[i] = &ctx->handlers[i].handler;
+		console->handlers = &ctx->handler_ptrs[i];
+		console->n_handlers = 1;
+		ctx->console_ptrs[i] = console;
+	}
+	a = &ctx->consoles[0];
+	b = &ctx->consoles[1];
+	c = &ctx->consoles[2];
+
+	assert(!console_tty_mux_init(&ctx->tty, "SEL"));
+	console_mux_set_policy(&ctx->tty, policy);
+
+	/* The initial selection is never held back */
+	assert(console_mux_activate(a) == 0);
+	assert(ctx->tty.active == a && fake_line.value == 0);
+}
+
+static void teardown(struct test_ctx *ctx)
+{
+	console_tty_mux_fini(&ctx->tty);
+	ringbuffer_fini(a->rb);
+	ringbuffer_fini(b->rb);
+	ringbuffer_fini(c->rb);
+}
+
+static void sleep_ms(long ms)
+{
+	struct timespec ts = { .tv_sec = 0, .tv_nsec = ms * 1000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static uint64_t switches(struct test_ctx *ctx)
+{
+	struct console_mux_stats stats;
+
+	console_mux_get_stats(&ctx->tty, &stats);
+	return stats.switches;
+}
+
+/* A request within the dwell time is queued, and granted once it is over */
+static void test_dwell_queues_request(void)
+{
+	struct console_mux_policy policy = { .min_dwell_ms = 100 };
+	struct console *const *pending;
+	struct test_ctx ctx;
+	size_t n_pending;
+	long timeout;
+
+	setup(&ctx, &policy);
+
+	b->n_sessions = 1;
+	assert(console_mux_activate(b) == 0);
+	assert(ctx.tty.active == b && fake_line.value == 1);
+
+	a->n_sessions = 1;
+	assert(console_mux_activate(a) == 1);
+	pending = console_mux_pending(&ctx.tty, &n_pending);
+	assert(n_pending == 1 && pending[0] == a);
+
+	timeout = console_mux_timeout(&ctx.tty);
+	assert(timeout > 0 && timeout <= 100);
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == b && fake_line.value == 1);
+
+	sleep_ms(timeout + 10);
+	assert(console_mux_timeout(&ctx.tty) == 0);
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == a && fake_line.value == 0);
+	console_mux_pending(&ctx.tty, &n_pending);
+	assert(n_pending == 0);
+
+	/* b's session was paused by the switch, and a's resumed */
+	assert(ctx.handlers[1].deselects == 1);
+	assert(ctx.handlers[0].selects == 2);
+
+	teardown(&ctx);
+}
+
+/* A console with sessions holds the mux until they have all gone */
+static void test_lease_blocks_switch(void)
+{
+	struct console_mux_policy policy = { .lease = true };
+	struct test_ctx ctx;
+	size_t n_pending;
+
+	setup(&ctx, &policy);
+
+	a->n_sessions = 1;
+	assert(console_mux_owner(&ctx.tty) == a);
+
+	b->n_sessions = 1;
+	assert(console_mux_activate(b) == 1);
+	console_mux_pending(&ctx.tty, &n_pending);
+	assert(n_pending == 1);
+
+	/* Nothing to wait for but the lease, so no timeout */
+	assert(console_mux_timeout(&ctx.tty) == -1);
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == a && fake_line.value == 0);
+
+	a->n_sessions = 0;
+	assert(!console_mux_owner(&ctx.tty));
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == b && fake_line.value == 1);
+	assert(console_mux_owner(&ctx.tty) == b);
+
+	teardown(&ctx);
+}
+
+/* Requests are dropped once the sessions that made them have gone */
+static void test_pending_dropped(void)
+{
+	struct console_mux_policy policy = { .lease = true };
+	struct test_ctx ctx;
+	size_t n_pending;
+	uint64_t before;
+
+	setup(&ctx, &policy);
+	before = switches(&ctx);
+
+	a->n_sessions = 1;
+	b->n_sessions = 1;
+	assert(console_mux_activate(b) == 1);
+
+	b->n_sessions = 0;
+	a->n_sessions = 0;
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == a && fake_line.value == 0);
+	console_mux_pending(&ctx.tty, &n_pending);
+	assert(n_pending == 0);
+	assert(switches(&ctx) == before);
+
+	/* As is the request of a console going away */
+	a->n_sessions = 1;
+	b->n_sessions = 1;
+	assert(console_mux_activate(b) == 1);
+	console_mux_remove(b);
+	console_mux_pending(&ctx.tty, &n_pending);
+	assert(n_pending == 0);
+
+	teardown(&ctx);
+}
+
+/* Granting one request leaves the sessions still queued for the mux alone */
+static void test_pending_kept_on_switch(void)
+{
+	struct console_mux_policy policy = { .lease = true };
+	struct console *const *pending;
+	struct test_ctx ctx;
+	size_t n_pending;
+
+	setup(&ctx, &policy);
+
+	a->n_sessions = 1;
+	b->n_sessions = 1;
+	c->n_sessions = 1;
+	assert(console_mux_activate(b) == 1);
+	assert(console_mux_activate(c) == 1);
+
+	a->n_sessions = 0;
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == b && fake_line.value == 1);
+	assert(ctx.handlers[2].deselects == 0);
+	pending = console_mux_pending(&ctx.tty, &n_pending);
+	assert(n_pending == 1 && pending[0] == c);
+
+	/* c gets its turn once b's lease ends */
+	b->n_sessions = 0;
+	console_mux_service(&ctx.tty);
+	assert(ctx.tty.active == c);
+	assert(ctx.handlers[2].selects == 1);
+
+	teardown(&ctx);
+}
+
+int main(void)
+{
+	test_dwell_queues_request();
+	test_lease_blocks_switch();
+	test_pending_dropped();
+	test_pending_kept_on_switch();
+
+	return EXIT_SUCCESS;
+}
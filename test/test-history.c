@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.c"
+
+static void roundtrip(const uint8_t *in, size_t len)
+{
+	uint8_t out[HISTORY_BLOCK_SIZE * 2];
+	uint8_t *comp;
+	size_t bound;
+	size_t clen;
+	ssize_t dlen;
+
+	bound = lz_compress_bound(len);
+	comp = malloc(bound);
+	assert(comp);
+
+	clen = lz_compress(in, len, comp, bound);
+	assert(clen > 0);
+
+	dlen = lz_decompress(comp, clen, out, sizeof(out));
+	assert(dlen == (ssize_t)len);
+	assert(!memcmp(in, out, len));
+
+	free(comp);
+}
+
+static void test_lz_roundtrip(void)
+{
+	uint8_t buf[HISTORY_BLOCK_SIZE];
+	size_t len = 0;
+
+	roundtrip((const uint8_t *)"", 0);
+	roundtrip((const uint8_t *)"abc", 3);
+
+	memset(buf, 'z', sizeof(buf));
+	roundtrip(buf, sizeof(buf));
+
+	while (len < sizeof(buf) - 64) {
+		len += (size_t)sprintf((char *)buf + len,
+				       "[%8zu.000000] systemd[1]: Started unit %zu\r\n",
+				       len, len % 7);
+	}
+	roundtrip(buf, len);
+
+	srand(1);
+	for (size_t i = 0; i < sizeof(buf); i++) {
+		buf[i] = (uint8_t)rand();
+	}
+	roundtrip(buf, sizeof(buf));
+}
+
+static void test_lz_incompressible_overflow(void)
+{
+	uint8_t in[256];
+	uint8_t out[256];
+
+	srand(2);
+	for (size_t i = 0; i < sizeof(in); i++) {
+		in[i] = (uint8_t)rand();
+	}
+
+	/* Random data can't shrink, so it doesn't fit in its own size */
+	assert(lz_compress(in, sizeof(in), out, sizeof(in)) == 0);
+}
+
+static void test_lz_decompress_rejects_bad_offset(void)
+{
+	/* One literal, then a match reaching before the start of output */
+	const uint8_t bad[] = { 0x10, 'a', 0x05, 0x00 };
+	uint8_t out[64];
+
+	assert(lz_decompress(bad, sizeof(bad), out, sizeof(out)) == -1);
+}
+
+static void test_lz_decompress_rejects_overrun(void)
+{
+	uint8_t in[64];
+	uint8_t comp[128];
+	uint8_t out[32];
+	size_t clen;
+
+	memset(in, 'q', sizeof(in));
+	clen = lz_compress(in, sizeof(in), comp, sizeof(comp));
+	assert(clen);
+	assert(lz_decompress(comp, clen, out, sizeof(out)) == -1);
+}
+
+/* An incompressible stream, where each byte is derived from its position */
+static uint8_t pattern(size_t pos)
+{
+	uint32_t x = (uint32_t)pos * 2654435761u;
+
+	x ^= x >> 15;
+	x *= 2246822519u;
+	x ^= x >> 13;
+
+	return (uint8_t)x;
+}
+
+static void append_pattern(struct history *history, size_t *next, size_t len)
+{
+	uint8_t buf[1000];
+
+	while (len) {
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+
+		for (size_t i = 0; i < n; i++) {
+			buf[i] = pattern((*next)++);
+		}
+		history_append(history, buf, n);
+		len -= n;
+	}
+}
+
+static void test_history_read_in_order(void)
+{
+	uint8_t buf[HISTORY_BLOCK_SIZE];
+	struct history *history;
+	size_t next = 0;
+	uint64_t seq;
+	ssize_t len;
+	size_t total = 0;
+
+	history = history_init(64 * 1024);
+	assert(history);
+
+	append_pattern(history, &next, 3 * HISTORY_BLOCK_SIZE + 100);
+	assert(history_end_seq(history) == 3);
+	history_flush(history);
+	assert(history_end_seq(history) == 4);
+
+	seq = history_first_seq(history);
+	while ((len = history_read_block(history, &seq, buf)) > 0) {
+		for (ssize_t i = 0; i < len; i++) {
+			assert(buf[i] == pattern(total + (size_t)i));
+		}
+		total += (size_t)len;
+	}
+	assert(len == 0);
+	assert(total == next);
+
+	history_fini(history);
+}
+
+/* The open block can be read without closing it */
+static void test_history_read_stage(void)
+{
+	uint8_t buf[HISTORY_BLOCK_SIZE];
+	struct history *history;
+	size_t next = 0;
+	size_t len;
+
+	history = history_init(64 * 1024);
+	assert(history);
+
+	append_pattern(history, &next, HISTORY_BLOCK_SIZE + 100);
+	len = history_read_stage(history, buf);
+	assert(len == 100);
+	for (size_t i = 0; i < len; i++) {
+		assert(buf[i] == pattern(HISTORY_BLOCK_SIZE + i));
+	}
+	assert(history_end_seq(history) == 1);
+
+	/* And goes on collecting data */
+	append_pattern(history, &next, 50);
+	assert(history_read_stage(history, buf) == 150);
+	assert(history_end_seq(history) == 1);
+
+	history_fini(history);
+}
+
+static void test_history_drops_oldest(void)
+{
+	struct history_stats stats;
+	uint8_t buf[HISTORY_BLOCK_SIZE];
+	struct history *history;
+	size_t next = 0;
+	uint64_t seq;
+	ssize_t len;
+
+	/* The pattern doesn't compress, so blocks are stored raw */
+	history = history_init(3 * HISTORY_BLOCK_SIZE + 10);
+	assert(history);
+
+	append_pattern(history, &next, 10 * HISTORY_BLOCK_SIZE);
+	history_get_stats(history, &stats);
+	assert(stats.n_blocks == 3);
+	assert(stats.stored_bytes <= 3 * HISTORY_BLOCK_SIZE + 10);
+	assert(history_first_seq(history) == 7);
+
+	/* A reader positioned on a dropped block skips ahead */
+	seq = 0;
+	len = history_read_block(history, &seq, buf);
+	assert(len == HISTORY_BLOCK_SIZE);
+	assert(seq == 8);
+
+	for (size_t i = 0; i < HISTORY_BLOCK_SIZE; i++) {
+		assert(buf[i] == pattern(7 * HISTORY_BLOCK_SIZE + i));
+	}
+
+	history_fini(history);
+}
+
+static void make_block(size_t i, uint8_t *block)
+{
+	memset(block, 'a' + (int)(i % 26), HISTORY_BLOCK_SIZE);
+	for (size_t j = 0; j < i % 50; j++) {
+		block[j * 37 % HISTORY_BLOCK_SIZE] = (uint8_t)j;
+	}
+}
+
+static void test_history_wraps_arena(void)
+{
+	uint8_t expect[HISTORY_BLOCK_SIZE];
+	uint8_t buf[HISTORY_BLOCK_SIZE];
+	struct history *history;
+	uint64_t seq;
+	ssize_t len;
+
+	history = history_init(2 * 1024);
+	assert(history);
+
+	/* Compressible blocks of varying stored size */
+	for (size_t i = 0; i < 200; i++) {
+		make_block(i, buf);
+		history_append(history, buf, sizeof(buf));
+	}
+
+	assert(history_end_seq(history) == 200);
+	assert(history_first_seq(history) > 0);
+
+	/* Every retained block still decompresses to its own content */
+	seq = history_first_seq(history);
+	while ((len = history_read_block(history, &seq, buf)) > 0) {
+		make_block((size_t)(seq - 1), expect);
+		assert(len == HISTORY_BLOCK_SIZE);
+		assert(!memcmp(buf, expect, sizeof(buf)));
+	}
+	assert(len == 0);
+
+	history_fini(history);
+}
+
+int main(void)
+{
+	test_lz_roundtrip();
+	test_lz_incompressible_overflow();
+	test_lz_decompress_rejects_bad_offset();
+	test_lz_decompress_rejects_overrun();
+	test_history_read_in_order();
+	test_history_read_stage();
+	test_history_drops_oldest();
+	test_history_wraps_arena();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,359 @@
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "console-socket.c"
+#include "escape.c"
+#include "libobmc-console.c"
+
+struct ctx {
+	uint8_t out[256];
+	size_t out_len;
+	int n_closed;
+	int closed_err;
+};
+
+static void ctx_output(struct obmc_console *console __attribute__((unused)),
+		       const uint8_t *buf, size_t len, void *data)
+{
+	struct ctx *ctx = data;
+
+	assert(ctx->out_len + len <= sizeof(ctx->out));
+	memcpy(ctx->out + ctx->out_len, buf, len);
+	ctx->out_len += len;
+}
+
+static void ctx_closed(struct obmc_console *console __attribute__((unused)),
+		       int err, void *data)
+{
+	struct ctx *ctx = data;
+
+	ctx->n_closed++;
+	ctx->closed_err = err;
+}
+
+static const struct obmc_console_ops ctx_ops = {
+	.output = ctx_output,
+	.closed = ctx_closed,
+};
+
+/* Stand in for the server's listening socket */
+static int listen_on(const char *id, bool dump)
+{
+	struct sockaddr_un addr;
+	ssize_t len;
+	int sd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	len = dump ? console_dump_socket_path(addr.sun_path, id) :
+		     console_socket_path(addr.sun_path, id);
+	assert(len > 0);
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(sd >= 0);
+	assert(!bind(sd, (struct sockaddr *)&addr,
+		     sizeof(addr) - sizeof(addr.sun_path) + len));
+	assert(!listen(sd, 1));
+
+	return sd;
+}
+
+/* Poll and dispatch once */
+static int run_once(struct obmc_console *console)
+{
+	struct pollfd pfd;
+
+	pfd.fd = obmc_console_fd(console);
+	pfd.events = obmc_console_events(console);
+	pfd.revents = 0;
+	assert(poll(&pfd, 1, 1000) == 1);
+
+	return obmc_console_dispatch(console, pfd.revents);
+}
+
+static void expect_recv(int fd, const char *exp)
+{
+	char buf[256];
+	size_t len = 0;
+	ssize_t rc;
+
+	while (len < strlen(exp)) {
+		rc = recv(fd, buf + len, sizeof(buf) - len, 0);
+		assert(rc > 0);
+		len += (size_t)rc;
+	}
+
+	assert(len == strlen(exp));
+	assert(!memcmp(buf, exp, len));
+}
+
+static void test_no_server(const char *id)
+{
+	assert(!obmc_console_open(id, 0, NULL, NULL));
+	assert(errno == ECONNREFUSED);
+
+	assert(!obmc_console_open(NULL, 0, NULL, NULL));
+	assert(errno == EINVAL);
+}
+
+static void test_output(int sd, const char *id)
+{
+	struct obmc_console *console;
+	struct ctx ctx = { 0 };
+	int fd;
+
+	console = obmc_console_open(id, 0, &ctx_ops, &ctx);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	assert(write(fd, "hello", 5) == 5);
+	while (ctx.out_len < 5) {
+		assert(!run_once(console));
+	}
+	assert(!memcmp(ctx.out, "hello", 5));
+
+	/* The server going away is reported once, with no error */
+	close(fd);
+	assert(run_once(console) == 0);
+	assert(ctx.n_closed == 1 && ctx.closed_err == 0);
+	assert(obmc_console_events(console) == 0);
+	assert(obmc_console_dispatch(console, POLLIN) == -EPIPE);
+	assert(ctx.n_closed == 1);
+
+	obmc_console_close(console);
+}
+
+static void test_peek(int sd, const char *id)
+{
+	struct obmc_console *console;
+	const uint8_t *buf;
+	size_t len;
+	int fd;
+
+	console = obmc_console_open(id, 0, NULL, NULL);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	assert(write(fd, "abcdef", 6) == 6);
+	assert(!run_once(console));
+	assert(obmc_console_peek(console, &buf) == 6);
+	assert(!memcmp(buf, "abcdef", 6));
+
+	/* Spans stay put until consumed */
+	obmc_console_consume(console, 4);
+	assert(write(fd, "gh", 2) == 2);
+	assert(!run_once(console));
+	len = obmc_console_peek(console, &buf);
+	assert(len == 4 && !memcmp(buf, "efgh", 4));
+	obmc_console_consume(console, len);
+	assert(obmc_console_peek(console, &buf) == 0);
+
+	close(fd);
+	obmc_console_close(console);
+}
+
+/* Consuming part of a full buffer makes room to read more */
+static void test_peek_full(int sd, const char *id)
+{
+	static uint8_t data[OBMC_CONSOLE_RX_SIZE + 100];
+	struct obmc_console *console;
+	const uint8_t *buf;
+	size_t len;
+	int fd;
+
+	for (size_t i = 0; i < sizeof(data); i++) {
+		data[i] = (uint8_t)(i % 251);
+	}
+
+	console = obmc_console_open(id, 0, NULL, NULL);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	assert(write(fd, data, sizeof(data)) == sizeof(data));
+	while (obmc_console_peek(console, &buf) < OBMC_CONSOLE_RX_SIZE) {
+		assert(!run_once(console));
+	}
+	assert(!(obmc_console_events(console) & POLLIN));
+
+	obmc_console_consume(console, OBMC_CONSOLE_RX_SIZE / 2);
+	assert(obmc_console_events(console) & POLLIN);
+	assert(!run_once(console));
+	len = obmc_console_peek(console, &buf);
+	assert(len == OBMC_CONSOLE_RX_SIZE / 2 + 100);
+	assert(!memcmp(buf, data + OBMC_CONSOLE_RX_SIZE / 2, len));
+
+	close(fd);
+	obmc_console_close(console);
+}
+
+/* A hangup with the buffer full ends the connection, rather than having poll()
+ * report it again and again */
+static void test_hangup_full(int sd, const char *id)
+{
+	static uint8_t data[OBMC_CONSOLE_RX_SIZE + 100];
+	struct obmc_console *console;
+	const uint8_t *buf;
+	struct pollfd pfd;
+	int fd;
+
+	memset(data, 'h', sizeof(data));
+
+	console = obmc_console_open(id, 0, NULL, NULL);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	assert(write(fd, data, sizeof(data)) == sizeof(data));
+	while (obmc_console_peek(console, &buf) < OBMC_CONSOLE_RX_SIZE) {
+		assert(!run_once(console));
+	}
+	close(fd);
+
+	pfd.fd = obmc_console_fd(console);
+	pfd.events = obmc_console_events(console);
+	pfd.revents = 0;
+	assert(poll(&pfd, 1, 1000) == 1 && (pfd.revents & POLLHUP));
+	assert(!obmc_console_dispatch(console, pfd.revents));
+	assert(obmc_console_dispatch(console, pfd.revents) == -EPIPE);
+	assert(obmc_console_peek(console, &buf) == OBMC_CONSOLE_RX_SIZE);
+
+	obmc_console_close(console);
+}
+
+static void test_escape(int sd, const char *id)
+{
+	struct obmc_console *console;
+	int fd;
+
+	console = obmc_console_open(id, 0, NULL, NULL);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	/* ssh-style, split across writes */
+	assert(!obmc_console_set_escape(console, OBMC_CONSOLE_ESCAPE_SSH, NULL));
+	assert(obmc_console_write(console, "a\r~~b\r", 6) == 0);
+	assert(obmc_console_write(console, "~", 1) == 0);
+	assert(obmc_console_write(console, ".c", 2) == 1);
+	expect_recv(fd, "a\r~b\r");
+
+	/* A string, sent along with what precedes it */
+	assert(obmc_console_set_escape(console, OBMC_CONSOLE_ESCAPE_STR, "") ==
+	       -EINVAL);
+	assert(!obmc_console_set_escape(console, OBMC_CONSOLE_ESCAPE_STR,
+					"ab!"));
+	assert(obmc_console_write(console, "xa", 2) == 0);
+	assert(obmc_console_write(console, "bab!yz", 6) == 1);
+	expect_recv(fd, "xabab!");
+
+	assert(!obmc_console_set_escape(console, OBMC_CONSOLE_ESCAPE_NONE,
+					NULL));
+	assert(obmc_console_write(console, "\r~.", 3) == 0);
+	expect_recv(fd, "\r~.");
+
+	close(fd);
+	obmc_console_close(console);
+}
+
+static void test_queue(int sd, const char *id)
+{
+	struct obmc_console *console;
+	static uint8_t buf[64 * 1024];
+	size_t total = 0;
+	size_t n = 0;
+	ssize_t rc;
+	int fd;
+
+	console = obmc_console_open(id, 0, NULL, NULL);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	/* Fill the socket while the server isn't reading */
+	memset(buf, 'x', sizeof(buf));
+	while (!(obmc_console_events(console) & POLLOUT)) {
+		assert(obmc_console_write(console, buf, sizeof(buf)) == 0);
+		total += sizeof(buf);
+	}
+
+	/* The queue is bounded */
+	while ((rc = obmc_console_write(console, buf, sizeof(buf))) == 0) {
+		total += sizeof(buf);
+	}
+	assert(rc == -ENOBUFS);
+
+	while (n < total) {
+		rc = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		if (rc > 0) {
+			n += (size_t)rc;
+			continue;
+		}
+		assert(obmc_console_events(console) & POLLOUT);
+		assert(!run_once(console));
+	}
+	assert(n == total);
+	assert(!(obmc_console_events(console) & POLLOUT));
+
+	close(fd);
+	obmc_console_close(console);
+}
+
+static void test_dump(const char *id)
+{
+	struct obmc_console *console;
+	struct ctx ctx = { 0 };
+	int sd;
+	int fd;
+
+	sd = listen_on(id, true);
+
+	console = obmc_console_open(id, OBMC_CONSOLE_DUMP, &ctx_ops, &ctx);
+	assert(console);
+	fd = accept(sd, NULL, NULL);
+	assert(fd >= 0);
+
+	assert(write(fd, "dumped", 6) == 6);
+	close(fd);
+	while (!ctx.n_closed) {
+		run_once(console);
+	}
+	assert(ctx.out_len == 6 && !memcmp(ctx.out, "dumped", 6));
+
+	obmc_console_close(console);
+	close(sd);
+}
+
+int main(void)
+{
+	char id[64];
+	int sd;
+
+	snprintf(id, sizeof(id), "test-libobmc-console-%d", getpid());
+
+	test_no_server(id);
+
+	sd = listen_on(id, false);
+	test_output(sd, id);
+	test_peek(sd, id);
+	test_peek_full(sd, id);
+	test_hangup_full(sd, id);
+	test_escape(sd, id);
+	test_queue(sd, id);
+	close(sd);
+
+	test_dump(id);
+
+	return EXIT_SUCCESS;
+}
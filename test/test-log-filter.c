@@ -0,0 +1,234 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SYSCONFDIR
+// Bypass compilation error due to -DSYSCONFDIR not provided
+#define SYSCONFDIR
+#endif
+
+#ifndef LOCALSTATEDIR
+#define LOCALSTATEDIR
+#endif
+
+#include "config.c"
+#include "ringbuffer.c"
+#include "log-handler.c"
+
+static uint8_t out[8192];
+static size_t out_len;
+
+int write_buf_to_fd(int fd __attribute__((unused)), const uint8_t *buf,
+		    size_t len)
+{
+	assert(out_len + len <= sizeof(out));
+	memcpy(out + out_len, buf, len);
+	out_len += len;
+	return 0;
+}
+
+int write_buf_to_fd_partial(int fd, const uint8_t *buf, size_t len,
+			    size_t *written)
+{
+	*written = len;
+	return write_buf_to_fd(fd, buf, len);
+}
+
+struct ringbuffer_consumer *
+console_ringbuffer_consumer_register(struct console *console,
+				     ringbuffer_poll_fn_t poll_fn, void *data)
+{
+	return ringbuffer_consumer_register(console->rb, poll_fn, data);
+}
+
+struct poller *console_poller_register(
+	struct console *console __attribute__((unused)),
+	struct handler *handler __attribute__((unused)),
+	poller_event_fn_t poller_fn __attribute__((unused)),
+	poller_timeout_fn_t timeout_fn __attribute__((unused)),
+	int fd __attribute__((unused)), int events __attribute__((unused)),
+	void *data __attribute__((unused)))
+{
+	return NULL;
+}
+
+void console_poller_unregister(struct console *console
+			       __attribute__((unused)),
+			       struct poller *poller __attribute__((unused)))
+{
+}
+
+static void setup(struct log_handler *lh, size_t window, unsigned long rate)
+{
+	memset(lh, 0, sizeof(*lh));
+	lh->maxsize = sizeof(out);
+	lh->filter = calloc(1, sizeof(*lh->filter));
+	assert(lh->filter);
+	lh->filter->window = window;
+	lh->filter->rate = rate;
+	lh->filter->tokens = (uint64_t)rate * 1000;
+	clock_gettime(CLOCK_MONOTONIC, &lh->filter->last_refill);
+	lh->filter->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	assert(lh->filter->timer_fd >= 0);
+	out_len = 0;
+}
+
+static void teardown(struct log_handler *lh)
+{
+	close(lh->filter->timer_fd);
+	free(lh->filter);
+}
+
+static bool timer_armed(struct log_handler *lh)
+{
+	struct itimerspec timer;
+
+	assert(!timerfd_gettime(lh->filter->timer_fd, &timer));
+	return timer.it_value.tv_sec || timer.it_value.tv_nsec;
+}
+
+static void feed(struct log_handler *lh, const char *str)
+{
+	int rc;
+
+	rc = log_filter_data(lh, (uint8_t *)str, strlen(str));
+	assert(!rc);
+}
+
+static void expect(const char *str)
+{
+	assert(out_len == strlen(str));
+	assert(!memcmp(out, str, out_len));
+}
+
+static void test_dedup_repeated(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 1, 0);
+	feed(&lh, "a\nb\nb\nb\nc\n");
+	expect("a\nb\n[obmc-console] last message repeated 2 times\nc\n");
+	teardown(&lh);
+}
+
+static void test_dedup_split_spans(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 1, 0);
+	feed(&lh, "hel");
+	feed(&lh, "lo\nhe");
+	feed(&lh, "llo\nbye\n");
+	expect("hello\n[obmc-console] last message repeated 1 time\nbye\n");
+	teardown(&lh);
+}
+
+static void test_dedup_window(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 2, 0);
+	feed(&lh, "a\nb\na\nb\na\nc\n");
+	expect("a\nb\n[obmc-console] 3 repeated lines suppressed\nc\n");
+
+	/* b is still within the window, behind c */
+	feed(&lh, "b\nd\n");
+	expect("a\nb\n[obmc-console] 3 repeated lines suppressed\nc\n"
+	       "[obmc-console] 1 repeated line suppressed\nd\n");
+	teardown(&lh);
+}
+
+static void test_partial_line_flushed_at_fini(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 1, 0);
+	feed(&lh, "x\nx\nlogin: ");
+	log_filter_fini(&lh);
+	expect("x\n[obmc-console] last message repeated 1 time\nlogin: ");
+}
+
+/* A prompt isn't held back for long, and the rest of its line follows it */
+static void test_partial_line_expires(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 1, 0);
+	feed(&lh, "login: ");
+	expect("");
+	assert(timer_armed(&lh));
+
+	assert(!log_filter_expire(&lh));
+	expect("login: ");
+	feed(&lh, "root\nlogin: ");
+	expect("login: root\n");
+	assert(!log_filter_expire(&lh));
+	expect("login: root\nlogin: ");
+	teardown(&lh);
+}
+
+/* Nor are the notices, when no line follows */
+static void test_notices_expire(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 1, 1);
+	feed(&lh, "a\na\nb\n");
+	expect("a\n");
+	assert(timer_armed(&lh));
+
+	assert(!log_filter_expire(&lh));
+	expect("a\n[obmc-console] last message repeated 1 time\n"
+	       "[obmc-console] rate limited, 1 line dropped\n");
+	assert(!log_filter_expire(&lh));
+	expect("a\n[obmc-console] last message repeated 1 time\n"
+	       "[obmc-console] rate limited, 1 line dropped\n");
+	teardown(&lh);
+}
+
+static void test_long_line_bypasses_dedup(void)
+{
+	char line[LOG_LINE_MAX + 16];
+	struct log_handler lh;
+
+	memset(line, 'z', sizeof(line) - 2);
+	line[sizeof(line) - 2] = '\n';
+	line[sizeof(line) - 1] = '\0';
+
+	setup(&lh, 1, 0);
+	feed(&lh, line);
+	feed(&lh, line);
+	assert(out_len == 2 * strlen(line));
+	teardown(&lh);
+}
+
+static void test_rate_limit(void)
+{
+	struct log_handler lh;
+
+	setup(&lh, 0, 2);
+	feed(&lh, "1\n2\n3\n4\n");
+	expect("1\n2\n");
+
+	/* Refill the bucket without waiting */
+	lh.filter->tokens = 1000;
+	feed(&lh, "5\n");
+	expect("1\n2\n[obmc-console] rate limited, 2 lines dropped\n5\n");
+	teardown(&lh);
+}
+
+int main(void)
+{
+	test_dedup_repeated();
+	test_dedup_split_spans();
+	test_dedup_window();
+	test_partial_line_flushed_at_fini();
+	test_partial_line_expires();
+	test_notices_expire();
+	test_long_line_bypasses_dedup();
+	test_rate_limit();
+
+	return EXIT_SUCCESS;
+}
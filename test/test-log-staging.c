@@ -0,0 +1,316 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef SYSCONFDIR
+// Bypass compilation error due to -DSYSCONFDIR not provided
+#define SYSCONFDIR
+#endif
+
+#ifndef LOCALSTATEDIR
+#define LOCALSTATEDIR
+#endif
+
+#include "config.c"
+#include "ringbuffer.c"
+#include "log-handler.c"
+
+#define STAGING_SIZE 4096
+
+/* What reached the log file, and in which writes */
+static uint8_t out[8 * STAGING_SIZE];
+static size_t out_len;
+static size_t writes[16];
+static size_t n_writes;
+/* Writes fail once this much more has been written */
+static size_t fail_after;
+
+int write_buf_to_fd_partial(int fd __attribute__((unused)), const uint8_t *buf,
+			    size_t len, size_t *written)
+{
+	*written = len < fail_after ? len : fail_after;
+	fail_after -= *written;
+
+	assert(out_len + *written <= sizeof(out));
+	assert(n_writes < sizeof(writes) / sizeof(writes[0]));
+	memcpy(out + out_len, buf, *written);
+	out_len += *written;
+	if (*written) {
+		writes[n_writes++] = *written;
+	}
+
+	return *written < len ? -1 : 0;
+}
+
+int write_buf_to_fd(int fd, const uint8_t *buf, size_t len)
+{
+	size_t written;
+
+	return write_buf_to_fd_partial(fd, buf, len, &written);
+}
+
+struct ringbuffer_consumer *
+console_ringbuffer_consumer_register(struct console *console,
+				     ringbuffer_poll_fn_t poll_fn, void *data)
+{
+	return ringbuffer_consumer_register(console->rb, poll_fn, data);
+}
+
+static struct poller *dummy_poller = (struct poller *)&dummy_poller;
+
+struct poller *console_poller_register(
+	struct console *console __attribute__((unused)),
+	struct handler *handler __attribute__((unused)),
+	poller_event_fn_t poller_fn __attribute__((unused)),
+	poller_timeout_fn_t timeout_fn __attribute__((unused)),
+	int fd __attribute__((unused)), int events __attribute__((unused)),
+	void *data __attribute__((unused)))
+{
+	return dummy_poller;
+}
+
+void console_poller_unregister(struct console *console
+			       __attribute__((unused)),
+			       struct poller *poller __attribute__((unused)))
+{
+}
+
+static struct config *mock_config_from_buffer(const char *input)
+{
+	struct config *ctx;
+	dictionary *dict;
+	ssize_t rc;
+	FILE *f;
+	int fd;
+
+	fd = memfd_create("test-log-staging", 0);
+	assert(fd != -1);
+
+	rc = write(fd, input, strlen(input));
+	assert(rc >= 0 && (size_t)rc == strlen(input));
+	assert(lseek(fd, 0, SEEK_SET) == 0);
+
+	f = fdopen(fd, "r");
+	assert(f != NULL);
+	dict = iniparser_load_file(f, "");
+	fclose(f);
+	assert(dict);
+
+	ctx = calloc(1, sizeof(*ctx));
+	assert(ctx);
+	ctx->dict = dict;
+
+	return ctx;
+}
+
+static void setup(struct log_handler *lh, struct console *console)
+{
+	struct config *config;
+
+	memset(console, 0, sizeof(*console));
+	console->console_id = "test";
+
+	memset(lh, 0, sizeof(*lh));
+	lh->console = console;
+	lh->pagesize = 4096;
+	lh->maxsize = sizeof(out);
+	lh->fd = -1;
+
+	config = mock_config_from_buffer("log-staging-size = 4k\n"
+					 "log-flush-interval = 1\n");
+	assert(!log_staging_init(lh, config));
+	assert(lh->staging_size == STAGING_SIZE);
+	config_fini(config);
+
+	out_len = 0;
+	n_writes = 0;
+	fail_after = SIZE_MAX;
+}
+
+static void fill(uint8_t *buf, size_t len, size_t start)
+{
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = (uint8_t)((start + i) % 251);
+	}
+}
+
+/* Nothing but whole staging areas is written until it overflows */
+static void test_overflow_flush(void)
+{
+	static uint8_t buf[STAGING_SIZE];
+	struct console console;
+	struct log_handler lh;
+	uint8_t expect[STAGING_SIZE + 100];
+
+	setup(&lh, &console);
+	fill(buf, 3000, 0);
+	assert(!log_data(&lh, buf, 3000));
+	assert(n_writes == 0 && lh.staged == 3000);
+
+	/* The tail of the overflowing data is carried over */
+	fill(buf, 1196, 3000);
+	assert(!log_data(&lh, buf, 1196));
+	assert(n_writes == 1 && writes[0] == STAGING_SIZE);
+	assert(lh.staged == 100);
+
+	log_staging_fini(&lh);
+	assert(n_writes == 2 && writes[1] == 100);
+	fill(expect, sizeof(expect), 0);
+	assert(out_len == sizeof(expect) && !memcmp(out, expect, out_len));
+}
+
+/* Data filling whole staging areas by itself is written straight out */
+static void test_oversized_direct(void)
+{
+	static uint8_t buf[2 * STAGING_SIZE + 10];
+	static uint8_t expect[2 * STAGING_SIZE + 20];
+	struct console console;
+	struct log_handler lh;
+
+	setup(&lh, &console);
+	fill(buf, sizeof(buf), 0);
+	assert(!log_data(&lh, buf, sizeof(buf)));
+	assert(n_writes == 1 && writes[0] == 2 * STAGING_SIZE);
+	assert(lh.staged == 10);
+
+	fill(buf, 10, sizeof(buf));
+	assert(!log_data(&lh, buf, 10));
+	assert(n_writes == 1 && lh.staged == 20);
+
+	log_staging_fini(&lh);
+	fill(expect, sizeof(expect), 0);
+	assert(out_len == sizeof(expect) && !memcmp(out, expect, out_len));
+}
+
+/* The flush interval bounds how long data stays staged */
+static void test_timer_flush(void)
+{
+	struct itimerspec timer;
+	struct console console;
+	struct log_handler lh;
+	struct pollfd pfd;
+
+	setup(&lh, &console);
+	lh.flush_interval.it_value.tv_sec = 0;
+	lh.flush_interval.it_value.tv_nsec = 10 * 1000 * 1000;
+
+	assert(!log_data(&lh, (uint8_t *)"abc", 3));
+	assert(!timerfd_gettime(lh.flush_timer_fd, &timer));
+	assert(timer.it_value.tv_sec || timer.it_value.tv_nsec);
+
+	pfd.fd = lh.flush_timer_fd;
+	pfd.events = POLLIN;
+	assert(poll(&pfd, 1, 1000) == 1);
+	assert(log_flush_poll(&lh.handler, POLLIN, NULL) == POLLER_OK);
+	assert(n_writes == 1 && out_len == 3 && !memcmp(out, "abc", 3));
+
+	/* Disarmed until data is staged again */
+	assert(!timerfd_gettime(lh.flush_timer_fd, &timer));
+	assert(!timer.it_value.tv_sec && !timer.it_value.tv_nsec);
+
+	log_staging_fini(&lh);
+	assert(n_writes == 1);
+}
+
+/* What is staged at shutdown is written out */
+static void test_fini_flush(void)
+{
+	struct console console;
+	struct log_handler lh;
+
+	setup(&lh, &console);
+	assert(!log_data(&lh, (uint8_t *)"login: ", 7));
+	assert(n_writes == 0);
+
+	log_staging_fini(&lh);
+	assert(n_writes == 1 && out_len == 7 && !memcmp(out, "login: ", 7));
+	assert(!lh.staging);
+}
+
+/* A failed flush keeps the data staged for the next attempt */
+static void test_failed_flush(void)
+{
+	struct itimerspec timer;
+	struct console console;
+	struct log_handler lh;
+
+	setup(&lh, &console);
+	assert(!log_data(&lh, (uint8_t *)"kept", 4));
+
+	fail_after = 0;
+	assert(log_flush(&lh));
+	assert(lh.staged == 4);
+	assert(!timerfd_gettime(lh.flush_timer_fd, &timer));
+	assert(timer.it_value.tv_sec || timer.it_value.tv_nsec);
+
+	fail_after = SIZE_MAX;
+	assert(!log_flush(&lh));
+	assert(lh.staged == 0 && out_len == 4 && !memcmp(out, "kept", 4));
+
+	log_staging_fini(&lh);
+}
+
+/* Only what a failed flush didn't write is retried */
+static void test_partial_flush(void)
+{
+	struct console console;
+	struct log_handler lh;
+
+	setup(&lh, &console);
+	assert(!log_data(&lh, (uint8_t *)"written", 7));
+
+	fail_after = 3;
+	assert(log_flush(&lh));
+	assert(lh.staged == 4 && out_len == 3);
+
+	fail_after = SIZE_MAX;
+	assert(!log_flush(&lh));
+	assert(lh.staged == 0 && out_len == 7 && !memcmp(out, "written", 7));
+
+	log_staging_fini(&lh);
+}
+
+/* Staged data a rotation fails to flush counts against the new file */
+static void test_trim_failed_flush(void)
+{
+	char dir[] = "/tmp/test-log-staging.XXXXXX";
+	struct console console;
+	struct log_handler lh;
+
+	assert(mkdtemp(dir));
+	setup(&lh, &console);
+	assert(asprintf(&lh.log_filename, "%s/log", dir) > 0);
+	assert(asprintf(&lh.rotate_filename, "%s/log.1", dir) > 0);
+	assert(!log_create(&lh));
+	assert(!log_data(&lh, (uint8_t *)"staged", 6));
+
+	fail_after = 0;
+	assert(!log_trim(&lh));
+	assert(lh.size == 6 && lh.staged == 6);
+
+	fail_after = SIZE_MAX;
+	log_staging_fini(&lh);
+	assert(out_len == 6);
+
+	close(lh.fd);
+	unlink(lh.rotate_filename);
+	unlink(lh.log_filename);
+	rmdir(dir);
+	free(lh.rotate_filename);
+	free(lh.log_filename);
+}
+
+int main(void)
+{
+	test_overflow_flush();
+	test_oversized_direct();
+	test_timer_flush();
+	test_fini_flush();
+	test_failed_flush();
+	test_partial_flush();
+	test_trim_failed_flush();
+
+	return EXIT_SUCCESS;
+}
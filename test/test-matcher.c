@@ -0,0 +1,151 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "matcher.c"
+#include "util.h"
+
+struct match {
+	size_t pattern;
+	uint64_t offset;
+};
+
+struct matches {
+	struct match m[16];
+	size_t n;
+};
+
+static void record(void *data, size_t pattern, uint64_t offset)
+{
+	struct matches *ms = data;
+
+	assert(ms->n < ARRAY_SIZE(ms->m));
+	ms->m[ms->n].pattern = pattern;
+	ms->m[ms->n].offset = offset;
+	ms->n++;
+}
+
+static void scan_str(struct matcher *m, const char *str, struct matches *ms)
+{
+	matcher_scan(m, (const uint8_t *)str, strlen(str), record, ms);
+}
+
+static int has_match(struct matches *ms, size_t pattern, uint64_t offset)
+{
+	for (size_t i = 0; i < ms->n; i++) {
+		if (ms->m[i].pattern == pattern && ms->m[i].offset == offset) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void test_overlapping(void)
+{
+	const char *patterns[] = { "he", "she", "his", "hers" };
+	struct matches ms = { 0 };
+	struct matcher *m;
+
+	m = matcher_init(patterns, ARRAY_SIZE(patterns));
+	assert(m);
+
+	scan_str(m, "ushers", &ms);
+	assert(ms.n == 3);
+	assert(has_match(&ms, 1, 1));
+	assert(has_match(&ms, 0, 2));
+	assert(has_match(&ms, 3, 2));
+	assert(!strcmp(matcher_pattern(m, 3), "hers"));
+
+	matcher_fini(m);
+}
+
+static void test_split(void)
+{
+	const char *patterns[] = { "Kernel panic", "Oops" };
+	struct matches ms = { 0 };
+	struct matcher *m;
+
+	m = matcher_init(patterns, ARRAY_SIZE(patterns));
+	assert(m);
+
+	scan_str(m, "[   1.0] Kernel pa", &ms);
+	assert(ms.n == 0);
+	scan_str(m, "nic - not syncing\r\nOo", &ms);
+	assert(ms.n == 1);
+	assert(has_match(&ms, 0, 9));
+	scan_str(m, "ps", &ms);
+	assert(ms.n == 2);
+	assert(has_match(&ms, 1, 37));
+	assert(matcher_offset(m) == 41);
+
+	matcher_fini(m);
+}
+
+static void test_bytewise(void)
+{
+	const char *patterns[] = { "aab", "ab", "b" };
+	const char *input = "aaab";
+	struct matches ms = { 0 };
+	struct matcher *m;
+
+	m = matcher_init(patterns, ARRAY_SIZE(patterns));
+	assert(m);
+
+	for (const char *c = input; *c; c++) {
+		matcher_scan(m, (const uint8_t *)c, 1, record, &ms);
+	}
+
+	assert(ms.n == 3);
+	assert(has_match(&ms, 0, 1));
+	assert(has_match(&ms, 1, 2));
+	assert(has_match(&ms, 2, 3));
+
+	matcher_fini(m);
+}
+
+static void test_binary(void)
+{
+	const char *patterns[] = { "\xff\x01" };
+	const uint8_t buf[] = { 0xff, 0xff, 0x01, 0x00, 0xff, 0x01 };
+	struct matches ms = { 0 };
+	struct matcher *m;
+
+	m = matcher_init(patterns, ARRAY_SIZE(patterns));
+	assert(m);
+
+	matcher_scan(m, buf, sizeof(buf), record, &ms);
+	assert(ms.n == 2);
+	assert(has_match(&ms, 0, 1));
+	assert(has_match(&ms, 0, 4));
+
+	matcher_fini(m);
+}
+
+static void test_invalid(void)
+{
+	const char *empty[] = { "ok", "" };
+	char *big;
+
+	assert(!matcher_init(empty, 0));
+	assert(!matcher_init(empty, ARRAY_SIZE(empty)));
+
+	big = malloc(MATCHER_MAX_LEN + 2);
+	assert(big);
+	memset(big, 'x', MATCHER_MAX_LEN + 1);
+	big[MATCHER_MAX_LEN + 1] = '\0';
+	assert(!matcher_init((const char *const *)&big, 1));
+	free(big);
+}
+
+int main(void)
+{
+	test_overlapping();
+	test_split();
+	test_bytewise();
+	test_binary();
+	test_invalid();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,162 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuffer.c"
+#include "ringbuffer-test-utils.c"
+
+static void fill(uint8_t *buf, size_t len, size_t offset)
+{
+	for (size_t i = 0; i < len; i++) {
+		buf[i] = (uint8_t)((offset + i) * 7 + ((offset + i) >> 8));
+	}
+}
+
+static void queue_pattern(struct ringbuffer *rb, size_t offset, size_t len)
+{
+	uint8_t buf[1000];
+
+	while (len) {
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+
+		fill(buf, n, offset);
+		assert(!ringbuffer_queue(rb, buf, n));
+		offset += n;
+		len -= n;
+	}
+}
+
+/* A buffer grows into free chunks instead of wrapping, keeping unread data */
+static void test_arena_grow(void)
+{
+	struct ringbuffer_arena *arena;
+	struct rb_test_ctx _ctx, *ctx = &_ctx;
+	struct ringbuffer *rb;
+	size_t chunk;
+	uint8_t *expect;
+	size_t len;
+
+	arena = ringbuffer_arena_init(4 * RINGBUFFER_ARENA_CHUNK);
+	assert(arena);
+	chunk = ringbuffer_arena_chunk_size(arena);
+
+	rb = ringbuffer_init_arena(arena, chunk, 4 * chunk);
+	assert(rb);
+	assert(rb->size == chunk);
+
+	ringbuffer_test_context_init(ctx);
+	ctx->rbc = ringbuffer_consumer_register(rb, ringbuffer_poll_append_all,
+					       ctx);
+	ctx->ignore_poll = true;
+
+	len = 3 * chunk - 1;
+	queue_pattern(rb, 0, len);
+	assert(rb->size == 3 * chunk);
+	assert(ringbuffer_len(ctx->rbc) == len);
+
+	ctx->ignore_poll = false;
+	ringbuffer_poll_append_all(ctx, 0);
+	expect = malloc(len);
+	fill(expect, len, 0);
+	assert(ctx->len == len);
+	assert(!memcmp(ctx->data, expect, len));
+
+	free(expect);
+	ringbuffer_fini(rb);
+	ringbuffer_test_context_fini(ctx);
+	ringbuffer_arena_fini(arena);
+}
+
+/* A busy buffer takes the chunks an idle one holds above its minimum */
+static void test_arena_steal(void)
+{
+	struct ringbuffer_arena *arena;
+	struct ringbuffer *idle;
+	struct ringbuffer *busy;
+	size_t chunk;
+
+	arena = ringbuffer_arena_init(3 * RINGBUFFER_ARENA_CHUNK);
+	assert(arena);
+	chunk = ringbuffer_arena_chunk_size(arena);
+
+	idle = ringbuffer_init_arena(arena, chunk, 2 * chunk);
+	busy = ringbuffer_init_arena(arena, chunk, 2 * chunk);
+	assert(idle && busy);
+
+	/* Grow, then wrap back into the first chunk */
+	queue_pattern(idle, 0, 2 * chunk + 100);
+	assert(idle->size == 2 * chunk);
+	assert(idle->tail < chunk);
+
+	queue_pattern(busy, 0, chunk + 100);
+	assert(busy->size == 2 * chunk);
+	assert(idle->size == chunk);
+
+	/* The history that wrapped is kept, and still reads in order */
+	assert(idle->len == idle->tail);
+	assert(idle->buf[0] == (uint8_t)(2 * chunk * 7 + ((2 * chunk) >> 8)));
+
+	ringbuffer_fini(idle);
+	ringbuffer_fini(busy);
+	ringbuffer_arena_fini(arena);
+}
+
+/* Chunks below a buffer's minimum are never taken, nor overcommitted */
+static void test_arena_min_quota(void)
+{
+	struct ringbuffer_arena *arena;
+	struct ringbuffer *reserved;
+	struct ringbuffer *busy;
+	size_t chunk;
+
+	arena = ringbuffer_arena_init(3 * RINGBUFFER_ARENA_CHUNK);
+	assert(arena);
+	chunk = ringbuffer_arena_chunk_size(arena);
+
+	reserved = ringbuffer_init_arena(arena, 2 * chunk, 2 * chunk);
+	busy = ringbuffer_init_arena(arena, chunk, 3 * chunk);
+	assert(reserved && busy);
+	assert(!ringbuffer_init_arena(arena, chunk, chunk));
+
+	queue_pattern(busy, 0, 5 * chunk);
+	assert(busy->size == chunk);
+	assert(reserved->size == 2 * chunk);
+
+	ringbuffer_fini(busy);
+	ringbuffer_fini(reserved);
+	ringbuffer_arena_fini(arena);
+}
+
+/* Chunks return to the arena when a buffer is released */
+static void test_arena_release(void)
+{
+	struct ringbuffer_arena *arena;
+	struct ringbuffer *rb;
+	size_t chunk;
+
+	arena = ringbuffer_arena_init(2 * RINGBUFFER_ARENA_CHUNK);
+	assert(arena);
+	chunk = ringbuffer_arena_chunk_size(arena);
+
+	rb = ringbuffer_init_arena(arena, chunk, 2 * chunk);
+	assert(rb);
+	queue_pattern(rb, 0, chunk + 1);
+	assert(rb->size == 2 * chunk);
+	ringbuffer_fini(rb);
+
+	rb = ringbuffer_init_arena(arena, 2 * chunk, 2 * chunk);
+	assert(rb);
+	ringbuffer_fini(rb);
+	ringbuffer_arena_fini(arena);
+}
+
+int main(void)
+{
+	test_arena_grow();
+	test_arena_steal();
+	test_arena_min_quota();
+	test_arena_release();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,49 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuffer.c"
+#include "ringbuffer-test-utils.c"
+
+static uint8_t evicted[64];
+static size_t evicted_len;
+
+static void evict_append(void *data __attribute__((unused)),
+			 const uint8_t *buf, size_t len)
+{
+	assert(evicted_len + len <= sizeof(evicted));
+	memcpy(evicted + evicted_len, buf, len);
+	evicted_len += len;
+}
+
+/* History is handed to the hook oldest first, exactly once, across wraps */
+static void test_evict_in_order(void)
+{
+	uint8_t in_buf[] = { '0', '1', '2', '3', '4', '5', '6' };
+	struct ringbuffer *rb;
+
+	evicted_len = 0;
+	rb = ringbuffer_init(10);
+	ringbuffer_set_evict(rb, evict_append, NULL);
+
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(evicted_len == 0);
+
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(evicted_len == 5);
+	assert(!memcmp(evicted, "01234", 5));
+
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(evicted_len == 12);
+	assert(!memcmp(evicted, "012345601234", 12));
+
+	ringbuffer_fini(rb);
+}
+
+int main(void)
+{
+	test_evict_in_order();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,199 @@
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/wait.h>
+
+#include "ringbuffer.c"
+#include "ringbuffer-test-utils.c"
+
+static char path[] = "/tmp/test-ringbuffer-file.XXXXXX";
+
+/* Copy out the history a backlog consumer sees */
+static size_t read_backlog(struct ringbuffer *rb, uint8_t *out, size_t size)
+{
+	struct ringbuffer_consumer *rbc;
+	size_t total = 0;
+	uint8_t *buf;
+	size_t len;
+
+	rbc = ringbuffer_consumer_register_backlog(rb, ringbuffer_poll_nop,
+						   NULL);
+	assert(rbc);
+
+	while ((len = ringbuffer_dequeue_peek(rbc, total, &buf))) {
+		assert(total + len <= size);
+		memcpy(out + total, buf, len);
+		total += len;
+	}
+
+	ringbuffer_consumer_unregister(rbc);
+
+	return total;
+}
+
+static void test_reattach(void)
+{
+	uint8_t in_buf[] = { 'a', 'b', 'c' };
+	struct ringbuffer *rb;
+	uint8_t out[16];
+
+	unlink(path);
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_fini(rb);
+
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(rb->len == sizeof(in_buf));
+	assert(read_backlog(rb, out, sizeof(out)) == sizeof(in_buf));
+	assert(!memcmp(out, in_buf, sizeof(in_buf)));
+	ringbuffer_fini(rb);
+}
+
+static void test_reattach_wrapped(void)
+{
+	uint8_t in_buf[] = { '0', '1', '2', '3', '4', '5', '6', '7' };
+	struct ringbuffer *rb;
+	uint8_t out[16];
+
+	unlink(path);
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_fini(rb);
+
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(rb->len == 9);
+	assert(read_backlog(rb, out, sizeof(out)) == 9);
+	assert(!memcmp(out, "701234567", 9));
+	ringbuffer_fini(rb);
+}
+
+static void test_discard_resized(void)
+{
+	uint8_t in_buf[] = { 'a', 'b', 'c' };
+	struct ringbuffer *rb;
+
+	unlink(path);
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_fini(rb);
+
+	rb = ringbuffer_init_file(path, 20);
+	assert(rb);
+	assert(rb->len == 0);
+	assert(rb->tail == 0);
+	ringbuffer_fini(rb);
+}
+
+static void test_discard_corrupt(void)
+{
+	uint8_t in_buf[] = { 'a', 'b', 'c' };
+	struct ringbuffer *rb;
+	uint8_t garbage[sizeof(struct ringbuffer_file_state)];
+	int fd;
+
+	unlink(path);
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_fini(rb);
+
+	fd = open(path, O_WRONLY);
+	assert(fd >= 0);
+	memset(garbage, 0x5a, sizeof(garbage));
+	for (size_t i = 0; i < 2; i++) {
+		off_t off = (off_t)(offsetof(struct ringbuffer_file_header,
+					     state) +
+				    i * sizeof(garbage));
+		assert(pwrite(fd, garbage, sizeof(garbage), off) ==
+		       (ssize_t)sizeof(garbage));
+	}
+	close(fd);
+
+	rb = ringbuffer_init_file(path, 10);
+	assert(rb);
+	assert(rb->len == 0);
+	ringbuffer_fini(rb);
+}
+
+/*
+ * Kill a writer mid-stream, then check that the reattached history is an
+ * unbroken run of the counter it was queueing.
+ */
+static void test_reattach_after_sigkill(useconds_t delay)
+{
+	const size_t size = 4096;
+	struct ringbuffer *rb;
+	uint8_t out[4096];
+	size_t len;
+	int status;
+	pid_t pid;
+
+	unlink(path);
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		uint8_t chunk[37];
+		uint8_t next = 0;
+
+		rb = ringbuffer_init_file(path, size);
+		assert(rb);
+		for (;;) {
+			for (size_t i = 0; i < sizeof(chunk); i++) {
+				chunk[i] = next;
+				next = (uint8_t)((next + 1) % 251);
+			}
+			ringbuffer_queue(rb, chunk, sizeof(chunk));
+		}
+	}
+
+	usleep(delay);
+	kill(pid, SIGKILL);
+	assert(waitpid(pid, &status, 0) == pid);
+	assert(WIFSIGNALED(status));
+
+	/* At most the chunk being queued at the time is lost */
+	rb = ringbuffer_init_file(path, size);
+	assert(rb);
+	assert(rb->len >= size - 1 - 37);
+
+	len = read_backlog(rb, out, sizeof(out));
+	assert(len == rb->len);
+	for (size_t i = 1; i < len; i++) {
+		assert(out[i] == (out[i - 1] + 1) % 251);
+	}
+
+	ringbuffer_fini(rb);
+}
+
+int main(void)
+{
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	test_reattach();
+	test_reattach_wrapped();
+	test_discard_resized();
+	test_discard_corrupt();
+	for (useconds_t delay = 10000; delay <= 100000; delay += 10000) {
+		test_reattach_after_sigkill(delay);
+	}
+
+	unlink(path);
+
+	return EXIT_SUCCESS;
+}
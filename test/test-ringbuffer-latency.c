@@ -0,0 +1,120 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuffer.c"
+#include "ringbuffer-test-utils.c"
+
+static uint64_t hist_total(const struct latency_hist *hist)
+{
+	uint64_t total = 0;
+
+	for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+		total += hist->buckets[i];
+	}
+
+	return total;
+}
+
+/* Every value lands in the bucket whose bounds hold it */
+static void test_buckets(void)
+{
+	assert(latency_bucket(0) == 0);
+	assert(latency_bucket(3) == 3);
+	assert(latency_bucket(4) == 4);
+	assert(latency_bucket(9) == 8 && latency_bucket(10) == 9);
+	assert(latency_bucket_max(8) == 9 && latency_bucket_max(11) == 15);
+
+	for (uint64_t us = 0; us < (1u << 20); us += 1 + us / 64) {
+		size_t i = latency_bucket(us);
+
+		assert(us <= latency_bucket_max(i));
+		assert(i == 0 || us > latency_bucket_max(i - 1));
+	}
+
+	/* Beyond the last bucket, values are clamped to it */
+	assert(latency_bucket(UINT64_MAX) == LATENCY_BUCKETS - 1);
+	for (size_t i = 1; i < LATENCY_BUCKETS; i++) {
+		assert(latency_bucket_max(i) > latency_bucket_max(i - 1));
+	}
+}
+
+/* A batch is timed once the consumer has committed all of it */
+static void test_delivery(void)
+{
+	uint8_t in_buf[] = { 'a', 'b', 'c', 'd' };
+	struct latency_hist hist = { 0 };
+	struct rb_test_ctx ctx;
+	struct ringbuffer *rb;
+
+	ringbuffer_test_context_init(&ctx);
+	rb = ringbuffer_init(64);
+	assert(!ringbuffer_set_tracing(rb, true));
+	ctx.rbc = ringbuffer_consumer_register(rb, ringbuffer_poll_nop, &ctx);
+	ringbuffer_consumer_set_latency(ctx.rbc, &hist);
+
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+
+	ringbuffer_dequeue_commit(ctx.rbc, 3);
+	assert(hist.count == 0);
+	ringbuffer_dequeue_commit(ctx.rbc, 1);
+	assert(hist.count == 1);
+	ringbuffer_dequeue_commit(ctx.rbc, 4);
+	assert(hist.count == 2 && hist_total(&hist) == 2);
+	assert(hist.max_us < 1000000);
+
+	/* Not tracing: no stamps, nothing recorded */
+	assert(!ringbuffer_set_tracing(rb, false));
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_dequeue_commit(ctx.rbc, 4);
+	assert(hist.count == 2);
+
+	ringbuffer_fini(rb);
+	ringbuffer_test_context_fini(&ctx);
+}
+
+/* A consumer far behind only times the batches still stamped */
+static void test_lagging(void)
+{
+	uint8_t in_buf[] = { 'x' };
+	struct latency_hist hist = { 0 };
+	struct rb_test_ctx ctx;
+	struct ringbuffer *rb;
+
+	ringbuffer_test_context_init(&ctx);
+	rb = ringbuffer_init(1024);
+	ringbuffer_set_tracing(rb, true);
+	ctx.rbc = ringbuffer_consumer_register(rb, ringbuffer_poll_nop, &ctx);
+	ringbuffer_consumer_set_latency(ctx.rbc, &hist);
+
+	for (int i = 0; i < RINGBUFFER_STAMPS * 2; i++) {
+		assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	}
+
+	ringbuffer_dequeue_commit(ctx.rbc, RINGBUFFER_STAMPS * 2);
+	assert(hist.count == RINGBUFFER_STAMPS);
+
+	/* A consumer registered late starts with the next batch */
+	ringbuffer_consumer_unregister(ctx.rbc);
+	memset(&hist, 0, sizeof(hist));
+	ctx.rbc = ringbuffer_consumer_register(rb, ringbuffer_poll_nop, &ctx);
+	ringbuffer_consumer_set_latency(ctx.rbc, &hist);
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_dequeue_commit(ctx.rbc, 1);
+	assert(hist.count == 1);
+
+	ringbuffer_fini(rb);
+	ringbuffer_test_context_fini(&ctx);
+}
+
+int main(void)
+{
+	test_buckets();
+	test_delivery();
+	test_lagging();
+
+	return EXIT_SUCCESS;
+}
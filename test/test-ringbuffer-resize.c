@@ -0,0 +1,114 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ringbuffer.c"
+#include "ringbuffer-test-utils.c"
+
+static uint8_t evicted[64];
+static size_t evicted_len;
+
+static void evict_append(void *data __attribute__((unused)),
+			 const uint8_t *buf, size_t len)
+{
+	assert(evicted_len + len <= sizeof(evicted));
+	memcpy(evicted + evicted_len, buf, len);
+	evicted_len += len;
+}
+
+/* A wrapped buffer grows, and its history and unread data come along */
+static void test_resize_grow(void)
+{
+	uint8_t in_buf[] = { '0', '1', '2', '3', '4', '5', '6' };
+	struct rb_test_ctx ctx;
+	struct ringbuffer *rb;
+	uint8_t *out;
+	size_t len;
+
+	ringbuffer_test_context_init(&ctx);
+	rb = ringbuffer_init(10);
+	ctx.rbc = ringbuffer_consumer_register(rb, ringbuffer_poll_nop, &ctx);
+
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	ringbuffer_dequeue_commit(ctx.rbc, 4);
+	assert(!ringbuffer_queue(rb, in_buf, 5));
+	assert(rb->tail < 7);
+
+	assert(!ringbuffer_resize(rb, 32));
+	assert(rb->size == 32);
+	assert(rb->len == 9 && rb->tail == 9);
+	assert(!memcmp(rb->buf, "345601234", 9));
+
+	assert(ringbuffer_len(ctx.rbc) == 8);
+	len = ringbuffer_dequeue_peek(ctx.rbc, 0, &out);
+	assert(len == 8 && !memcmp(out, "45601234", 8));
+
+	/* and carries on from there */
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(ringbuffer_len(ctx.rbc) == 15);
+
+	ringbuffer_fini(rb);
+	ringbuffer_test_context_fini(&ctx);
+}
+
+/* Shrinking drains consumers that are behind, and evicts the oldest history */
+static void test_resize_shrink(void)
+{
+	uint8_t in_buf[] = { 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j' };
+	struct rb_test_ctx ctx;
+	struct ringbuffer *rb;
+
+	evicted_len = 0;
+	ringbuffer_test_context_init(&ctx);
+	ctx.force_only = true;
+	rb = ringbuffer_init(16);
+	ringbuffer_set_evict(rb, evict_append, NULL);
+	ctx.rbc = ringbuffer_consumer_register(rb, ringbuffer_poll_append_all,
+					       &ctx);
+
+	assert(!ringbuffer_queue(rb, in_buf, sizeof(in_buf)));
+	assert(ctx.count == 0);
+
+	assert(!ringbuffer_resize(rb, 8));
+	assert(ctx.count == 1);
+	assert(ctx.len == 3 && !memcmp(ctx.data, "abc", 3));
+	assert(evicted_len == 3 && !memcmp(evicted, "abc", 3));
+
+	assert(rb->size == 8 && rb->len == 7);
+	assert(!memcmp(rb->buf, "defghij", 7));
+	assert(ringbuffer_len(ctx.rbc) == 7);
+
+	ringbuffer_fini(rb);
+	ringbuffer_test_context_fini(&ctx);
+}
+
+/* A file-backed buffer keeps its size */
+static void test_resize_file(void)
+{
+	char path[] = "/tmp/test-ringbuffer-resize.XXXXXX";
+	struct ringbuffer *rb;
+	int fd;
+
+	fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	rb = ringbuffer_init_file(path, 64);
+	assert(rb);
+	assert(ringbuffer_resize(rb, 128));
+	assert(rb->size == 64);
+
+	ringbuffer_fini(rb);
+	unlink(path);
+}
+
+int main(void)
+{
+	test_resize_grow();
+	test_resize_shrink();
+	test_resize_file();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,302 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "screen.c"
+
+static void feed(struct screen *s, const char *str)
+{
+	screen_update(s, (const uint8_t *)str, strlen(str));
+}
+
+static void assert_row(struct screen *s, unsigned int row, const char *text)
+{
+	char buf[SCREEN_MAX_COLS * 4 + 1];
+
+	screen_row_text(s, row, buf, sizeof(buf));
+	if (strcmp(buf, text)) {
+		fprintf(stderr, "row %u: '%s', expected '%s'\n", row, buf, text);
+		assert(0);
+	}
+}
+
+static void assert_cursor(struct screen *s, unsigned int x, unsigned int y)
+{
+	unsigned int col;
+	unsigned int row;
+
+	screen_get_cursor(s, &col, &row);
+	assert(col == x && row == y);
+}
+
+static void assert_same_cell(const struct screen_cell *a,
+			     const struct screen_cell *b)
+{
+	assert(a->ch == b->ch && a->attr == b->attr);
+	assert(!(a->attr & ATTR_FG) || a->fg == b->fg);
+	assert(!(a->attr & ATTR_BG) || a->bg == b->bg);
+}
+
+/* Drawing the redraw on a fresh screen must give the same screen */
+static void assert_redraw(struct screen *s)
+{
+	struct screen *copy;
+	uint8_t *buf;
+	size_t len;
+
+	buf = screen_redraw(s, &len);
+	assert(buf);
+
+	copy = screen_init(s->cols, s->rows);
+	assert(copy);
+	screen_update(copy, buf, len);
+
+	for (unsigned int y = 0; y < s->rows; y++) {
+		for (unsigned int x = 0; x < s->cols; x++) {
+			assert_same_cell(screen_cell(copy, x, y),
+					 screen_cell(s, x, y));
+		}
+	}
+	assert(copy->cur.x == s->cur.x && copy->cur.y == s->cur.y);
+	assert(copy->wrap_pending == s->wrap_pending);
+	assert(copy->top == s->top && copy->bottom == s->bottom);
+	assert(copy->autowrap == s->autowrap);
+	assert(copy->cursor_hidden == s->cursor_hidden);
+	assert_same_cell(&copy->cur.pen, &s->cur.pen);
+	assert(!memcmp(copy->cur.charsets, s->cur.charsets, 2));
+	assert(copy->cur.gl == s->cur.gl);
+
+	screen_fini(copy);
+	free(buf);
+}
+
+static void test_text(void)
+{
+	struct screen *s = screen_init(10, 3);
+
+	assert(s);
+	feed(s, "hello\r\nworld");
+	assert_row(s, 0, "hello");
+	assert_row(s, 1, "world");
+	assert_row(s, 2, "");
+	assert_cursor(s, 5, 1);
+
+	/* Wrap at the last column, scroll at the bottom */
+	feed(s, "\r\n0123456789ab\r\nc");
+	assert_row(s, 0, "0123456789");
+	assert_row(s, 1, "ab");
+	assert_row(s, 2, "c");
+	assert_cursor(s, 1, 2);
+
+	assert_redraw(s);
+	screen_fini(s);
+}
+
+static void test_cursor(void)
+{
+	struct screen *s = screen_init(20, 5);
+
+	assert(s);
+	feed(s, "\x1b[3;5Hx\x1b[Ay\x1b[2Dz\x1b[10Cw\x1b[Hh");
+	assert_row(s, 0, "h");
+	assert_row(s, 1, "    zy         w");
+	assert_row(s, 2, "    x");
+	assert_cursor(s, 1, 0);
+
+	/* Tabs, backspace, and clamping at the edges */
+	feed(s, "\x1b[5;1H\tt\b\bu\x1b[99;99Hq");
+	assert_row(s, 4, "       ut          q");
+	assert_cursor(s, 19, 4);
+	assert(s->wrap_pending);
+
+	assert_redraw(s);
+	screen_fini(s);
+}
+
+static void test_erase(void)
+{
+	struct screen *s = screen_init(10, 3);
+
+	assert(s);
+	feed(s, "aaaaaaaaaa\r\nbbbbbbbbbb\r\ncccccccccc");
+	feed(s, "\x1b[2;5H\x1b[K");
+	assert_row(s, 1, "bbbb");
+	feed(s, "\x1b[1K");
+	assert_row(s, 1, "");
+	feed(s, "\x1b[1;3H\x1b[2P\x1b[2@");
+	assert_row(s, 0, "aa  aaaaaa");
+	feed(s, "\x1b[3;8H\x1b[J");
+	assert_row(s, 2, "ccccccc");
+	feed(s, "\x1b[2J");
+	for (unsigned int y = 0; y < 3; y++) {
+		assert_row(s, y, "");
+	}
+
+	screen_fini(s);
+}
+
+static void test_scroll_region(void)
+{
+	struct screen *s = screen_init(10, 5);
+
+	assert(s);
+	feed(s, "top\r\n1\r\n2\r\n3\r\nbottom");
+	feed(s, "\x1b[2;4r\x1b[4;1H\nnew");
+	assert_row(s, 0, "top");
+	assert_row(s, 1, "2");
+	assert_row(s, 2, "3");
+	assert_row(s, 3, "new");
+	assert_row(s, 4, "bottom");
+
+	/* Reverse index at the top margin scrolls the region down */
+	feed(s, "\x1b[2;1H\x1bMrev");
+	assert_row(s, 1, "rev");
+	assert_row(s, 2, "2");
+	assert_row(s, 4, "bottom");
+
+	/* Insert and delete lines within the region */
+	feed(s, "\x1b[3;1H\x1b[L");
+	assert_row(s, 2, "");
+	assert_row(s, 3, "2");
+	feed(s, "\x1b[M");
+	assert_row(s, 2, "2");
+
+	assert_redraw(s);
+	screen_fini(s);
+}
+
+static void test_attributes(void)
+{
+	struct screen *s = screen_init(20, 3);
+
+	assert(s);
+	feed(s, "\x1b[1;31mred\x1b[0m plain \x1b[7;44mrev\x1b[38;5;200m256");
+	assert(s->cells[0].attr == (ATTR_BOLD | ATTR_FG));
+	assert(s->cells[0].fg == 1);
+	assert(s->cells[3].attr == 0);
+	assert(s->cells[10].attr == (ATTR_REVERSE | ATTR_BG));
+	assert(s->cells[13].fg == 200);
+
+	/* Erasing takes the background colour */
+	feed(s, "\x1b[2;1H\x1b[K");
+	assert(s->cells[20].attr == ATTR_BG && s->cells[20].bg == 4);
+
+	assert_redraw(s);
+	screen_fini(s);
+}
+
+static void test_charsets(void)
+{
+	struct screen *s = screen_init(10, 3);
+
+	assert(s);
+	feed(s, "\x1b(0lqk\x1b(B\r\n");
+	feed(s, "\x1b)0x\x0ex\x0fx");
+	assert_row(s, 0, "┌─┐");
+	assert_row(s, 1, "x│x");
+
+	/* Leave the G1 set selected for the redraw */
+	feed(s, "\x0e");
+	assert_redraw(s);
+	screen_fini(s);
+}
+
+static void test_utf8(void)
+{
+	struct screen *s = screen_init(10, 3);
+
+	assert(s);
+	feed(s, "caf\xc3\xa9 \xe2\x82\xac");
+	assert_row(s, 0, "café €");
+	assert_cursor(s, 6, 0);
+
+	/* A sequence split across updates */
+	feed(s, "\xe2\x82");
+	feed(s, "\xac");
+	assert_row(s, 0, "café €€");
+
+	/* Bytes that aren't UTF-8 are kept, and shown as '?' in text */
+	feed(s, "\r\n\xb0\xc3x");
+	assert_row(s, 1, "??x");
+	assert(s->cells[10].ch == (CELL_RAW | 0xb0));
+
+	assert_redraw(s);
+	screen_fini(s);
+}
+
+static void test_ignored(void)
+{
+	struct screen *s = screen_init(20, 3);
+
+	assert(s);
+	feed(s, "\x1b]0;title\x07""a\x1b]2;x\x1b\\b\x1bPdcs\x1b\\c\x1b[>1;2cd");
+	feed(s, "\x1b[?1;1000he\x1b#8f\x1b=g\x1b[1\x18h");
+	assert_row(s, 0, "abcdefgh");
+
+	screen_fini(s);
+}
+
+static void test_modes(void)
+{
+	struct screen *s = screen_init(10, 4);
+
+	assert(s);
+	feed(s, "\x1b[?7l0123456789abc");
+	assert_row(s, 0, "012345678c");
+	assert_cursor(s, 9, 0);
+
+	feed(s, "\x1b[?25l\x1b[2;3r\x1b[?6h\x1b[2;1Ho");
+	assert_row(s, 2, "o");
+	assert_redraw(s);
+
+	feed(s, "\x1b[?6l\x1b[r\x1b[?7h\x1b[?25h\x1b[4;10Hz");
+	assert(s->wrap_pending);
+	assert_redraw(s);
+
+	/* The alternate screen is cleared on the way in and out */
+	feed(s, "\x1b[?1049hfull\x1b[?1049l");
+	assert_row(s, 0, "");
+	assert_cursor(s, 9, 3);
+
+	feed(s, "x\x1b""c");
+	assert_row(s, 0, "");
+	assert_cursor(s, 0, 0);
+
+	screen_fini(s);
+}
+
+static void test_invalid(void)
+{
+	char buf[4];
+	struct screen *s;
+
+	assert(!screen_init(1, 24));
+	assert(!screen_init(80, SCREEN_MAX_ROWS + 1));
+
+	s = screen_init(10, 2);
+	assert(s);
+	feed(s, "abcdef");
+	assert(screen_row_text(s, 0, buf, sizeof(buf)) == 6);
+	assert(!strcmp(buf, "abc"));
+	assert(screen_row_text(s, 2, buf, sizeof(buf)) == 0);
+
+	screen_fini(s);
+}
+
+int main(void)
+{
+	test_text();
+	test_cursor();
+	test_erase();
+	test_scroll_region();
+	test_attributes();
+	test_charsets();
+	test_utf8();
+	test_ignored();
+	test_modes();
+	test_invalid();
+
+	return EXIT_SUCCESS;
+}
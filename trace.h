@@ -0,0 +1,53 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Static tracepoints on the server's hot paths, for perf and bpftrace on a
+ * running server. With the 'usdt' meson feature they are SystemTap SDT probes
+ * under the obmc_console provider: a nop each until a tracer attaches.
+ * Otherwise they compile to nothing. Strings are passed as pointers, and
+ * contrib/bpftrace has scripts that use them.
+ *
+ *   tty_read(kname, bytes)
+ *   ringbuffer_queue(rb, len, n_consumers)
+ *   ringbuffer_force_drain(rbc, force_len)
+ *   ringbuffer_force_drain_done(rbc, ret)
+ *   client_blocked(fd, blocked)
+ *   poller_dispatch(handler, fd, revents)    revents is 0 for a timeout
+ *   poller_dispatch_done(handler, ret)
+ *   log_rotate(filename, size)
+ *   mux_switch(from, to)                     from is "" on first activation
+ */
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define TRACE2(name, a, b)    DTRACE_PROBE2(obmc_console, name, a, b)
+#define TRACE3(name, a, b, c) DTRACE_PROBE3(obmc_console, name, a, b, c)
+#else
+#define TRACE2(name, a, b)                                                     \
+	do {                                                                   \
+		(void)(a);                                                     \
+		(void)(b);                                                     \
+	} while (0)
+#define TRACE3(name, a, b, c)                                                  \
+	do {                                                                   \
+		(void)(a);                                                     \
+		(void)(b);                                                     \
+		(void)(c);                                                     \
+	} while (0)
+#endif
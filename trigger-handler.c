@@ -0,0 +1,212 @@
+/**
+ * Copyright © 2026 obmc-console authors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <err.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "console-server.h"
+#include "config.h"
+#include "matcher.h"
+
+/*
+ * Watches the console output for the patterns in 'trigger-patterns', and
+ * emits a D-Bus signal for each match, at most 'trigger-rate-limit' per
+ * second. Matches over the limit are counted, and reported with the next
+ * signal that gets through.
+ */
+struct trigger_handler {
+	struct handler handler;
+	struct console *console;
+	struct ringbuffer_consumer *rbc;
+	struct matcher *matcher;
+
+	/* signals per second; tokens are in 1/1000 signals */
+	unsigned long rate;
+	uint64_t tokens;
+	struct timespec last_refill;
+	uint64_t n_suppressed;
+};
+
+static const unsigned long default_trigger_rate = 10;
+
+static struct trigger_handler *to_trigger_handler(struct handler *handler)
+{
+	return container_of(handler, struct trigger_handler, handler);
+}
+
+static bool trigger_rate_admit(struct trigger_handler *th)
+{
+	const uint64_t burst = (uint64_t)th->rate * 1000;
+	struct timespec now;
+	uint64_t elapsed_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed_ms = (uint64_t)(now.tv_sec - th->last_refill.tv_sec) * 1000 +
+		     (uint64_t)((now.tv_nsec - th->last_refill.tv_nsec) /
+				1000000);
+	if (elapsed_ms) {
+		th->tokens += elapsed_ms * th->rate;
+		if (th->tokens > burst) {
+			th->tokens = burst;
+		}
+		th->last_refill = now;
+	}
+
+	if (th->tokens < 1000) {
+		return false;
+	}
+
+	th->tokens -= 1000;
+	return true;
+}
+
+static void trigger_match(void *data, size_t pattern, uint64_t offset)
+{
+	struct trigger_handler *th = data;
+	const char *str = matcher_pattern(th->matcher, pattern);
+
+	if (!trigger_rate_admit(th)) {
+		th->n_suppressed++;
+		return;
+	}
+
+	dbus_emit_trigger(th->console, str, offset, th->n_suppressed);
+	th->n_suppressed = 0;
+}
+
+static enum ringbuffer_poll_ret trigger_ringbuffer_poll(void *arg,
+							size_t force_len
+							__attribute__((unused)))
+{
+	struct trigger_handler *th = arg;
+	uint8_t *buf;
+	size_t len;
+
+	/* Matching is cheap, so consume everything straight away. The matcher
+	 * carries its state over from one span to the next */
+	for (;;) {
+		len = ringbuffer_dequeue_peek(th->rbc, 0, &buf);
+		if (!len) {
+			break;
+		}
+
+		matcher_scan(th->matcher, buf, len, trigger_match, th);
+		ringbuffer_dequeue_commit(th->rbc, len);
+	}
+
+	return RINGBUFFER_POLL_OK;
+}
+
+/* Split the comma-separated list of patterns */
+static struct matcher *trigger_matcher_init(const char *list)
+{
+	struct matcher *matcher = NULL;
+	const char **patterns;
+	size_t n = 1;
+	char *copy;
+	char *p;
+
+	for (const char *c = list; *c; c++) {
+		n += *c == ',';
+	}
+
+	copy = strdup(list);
+	patterns = calloc(n, sizeof(*patterns));
+	if (!copy || !patterns) {
+		goto out;
+	}
+
+	n = 0;
+	for (p = copy;; p++) {
+		patterns[n++] = p;
+		p = strchrnul(p, ',');
+		if (!*p) {
+			break;
+		}
+		*p = '\0';
+	}
+
+	matcher = matcher_init(patterns, n);
+
+out:
+	free(patterns);
+	free(copy);
+	return matcher;
+}
+
+static struct handler *trigger_init(const struct handler_type *type
+				    __attribute__((unused)),
+				    struct console *console,
+				    struct config *config)
+{
+	struct trigger_handler *th;
+	const char *val;
+
+	val = config_get_console_value(config, console->console_id,
+				       "trigger-patterns");
+	if (!val) {
+		return NULL;
+	}
+
+	th = calloc(1, sizeof(*th));
+	if (!th) {
+		return NULL;
+	}
+
+	th->console = console;
+	th->matcher = trigger_matcher_init(val);
+	if (!th->matcher) {
+		warnx("Invalid trigger-patterns '%s'", val);
+		free(th);
+		return NULL;
+	}
+
+	th->rate = default_trigger_rate;
+	val = config_get_console_value(config, console->console_id,
+				       "trigger-rate-limit");
+	if (val && (config_parse_ulong(val, &th->rate) || !th->rate)) {
+		warnx("Invalid trigger-rate-limit '%s'", val);
+		th->rate = default_trigger_rate;
+	}
+	th->tokens = (uint64_t)th->rate * 1000;
+	clock_gettime(CLOCK_MONOTONIC, &th->last_refill);
+
+	th->rbc = console_ringbuffer_consumer_register(
+		console, trigger_ringbuffer_poll, th);
+
+	return &th->handler;
+}
+
+static void trigger_fini(struct handler *handler)
+{
+	struct trigger_handler *th = to_trigger_handler(handler);
+
+	ringbuffer_consumer_unregister(th->rbc);
+	matcher_fini(th->matcher);
+	free(th);
+}
+
+static const struct handler_type trigger_handler = {
+	.name = "trigger",
+	.init = trigger_init,
+	.fini = trigger_fini,
+};
+
+console_handler_register(&trigger_handler);
@@ -26,6 +26,7 @@
 
 #include "console-server.h"
 #include "config.h"
+#include "latency.h"
 
 struct tty_handler {
 	struct handler handler;
@@ -35,6 +36,7 @@ struct tty_handler {
 	int fd;
 	int fd_flags;
 	bool blocked;
+	struct latency_hist latency;
 };
 
 static struct tty_handler *to_tty_handler(struct handler *handler)
@@ -151,6 +153,8 @@ static enum ringbuffer_poll_ret tty_ringbuffer_poll(void *arg, size_t force_len)
 	rc = tty_drain_queue(th, force_len);
 	if (rc) {
 		console_poller_unregister(th->console, th->poller);
+		th->poller = NULL;
+		th->rbc = NULL;
 		return RINGBUFFER_POLL_REMOVE;
 	}
 
@@ -187,7 +191,9 @@ static enum poller_ret tty_poll(struct handler *handler, int events,
 err:
 	th->poller = NULL;
 	close(th->fd);
+	th->fd = -1;
 	ringbuffer_consumer_unregister(th->rbc);
+	th->rbc = NULL;
 	return POLLER_REMOVE;
 }
 
@@ -263,6 +269,7 @@ static struct handler *tty_init(const struct handler_type *type
 	if (!th) {
 		return NULL;
 	}
+	memset(&th->latency, 0, sizeof(th->latency));
 
 	th->fd = open(tty_path, O_RDWR | O_NONBLOCK);
 	if (th->fd < 0) {
@@ -300,6 +307,9 @@ static struct handler *tty_init(const struct handler_type *type
 	th->console = console;
 	th->rbc = console_ringbuffer_consumer_register(console,
 						       tty_ringbuffer_poll, th);
+	if (th->rbc) {
+		ringbuffer_consumer_set_latency(th->rbc, &th->latency);
+	}
 
 	return &th->handler;
 }
@@ -310,7 +320,13 @@ static void tty_fini(struct handler *handler)
 	if (th->poller) {
 		console_poller_unregister(th->console, th->poller);
 	}
-	close(th->fd);
+	/* Restarted on a reload, so leave the ringbuffer as we found it */
+	if (th->rbc) {
+		ringbuffer_consumer_unregister(th->rbc);
+	}
+	if (th->fd >= 0) {
+		close(th->fd);
+	}
 	free(th);
 }
 
@@ -331,11 +347,17 @@ static int tty_baudrate(struct handler *handler, speed_t baudrate)
 	return 0;
 }
 
+static const struct latency_hist *tty_latency(struct handler *handler)
+{
+	return &to_tty_handler(handler)->latency;
+}
+
 static const struct handler_type tty_handler = {
 	.name = "tty",
 	.init = tty_init,
 	.fini = tty_fini,
 	.baudrate = tty_baudrate,
+	.latency = tty_latency,
 };
 
 console_handler_register(&tty_handler);
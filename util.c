@@ -19,13 +19,13 @@
 
 #include "console-server.h"
 
-int write_buf_to_fd(int fd, const uint8_t *buf, size_t len)
+int write_buf_to_fd_partial(int fd, const uint8_t *buf, size_t len,
+			    size_t *written)
 {
-	size_t pos;
 	ssize_t rc;
 
-	for (pos = 0; pos < len; pos += rc) {
-		rc = write(fd, buf + pos, len - pos);
+	for (*written = 0; *written < len; *written += rc) {
+		rc = write(fd, buf + *written, len - *written);
 		if (rc <= 0) {
 			warn("Write error");
 			return -1;
@@ -34,3 +34,10 @@ int write_buf_to_fd(int fd, const uint8_t *buf, size_t len)
 
 	return 0;
 }
+
+int write_buf_to_fd(int fd, const uint8_t *buf, size_t len)
+{
+	size_t written;
+
+	return write_buf_to_fd_partial(fd, buf, len, &written);
+}